@@ -0,0 +1,621 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl.c
+ *
+ * Description:
+ *
+ * Ingress ACL, compiled into a bit-vector classifier. See sr_acl.h.
+ *
+ * A compiled rule set is never changed once built, except for its hit
+ * counters, which are bumped atomically. Packets look at it under the
+ * read side of acl->lock; a reload builds the new set first and only
+ * takes the write side to swap it in.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_acl.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_log.h"
+
+#define SR_ACL_LINE    256
+#define SR_ACL_NOPORT  0x10000    /* port value of a packet without one */
+
+enum sr_acl_field_id
+{
+    sr_acl_f_iface = 0,
+    sr_acl_f_src,
+    sr_acl_f_dst,
+    sr_acl_f_proto,
+    sr_acl_f_sport,
+    sr_acl_f_dport,
+    sr_acl_fields
+};
+
+struct sr_acl_rule
+{
+    enum sr_acl_action action;
+    uint32_t lo[sr_acl_fields];   /* host order, inclusive */
+    uint32_t hi[sr_acl_fields];
+    unsigned long hits;
+    char text[SR_ACL_LINE];
+};
+
+/* one field cut into intervals; interval i starts at start[i] and holds
+   the rules in bits[i * words ..], with bit w of agg[i] set if word w
+   has any */
+struct sr_acl_field
+{
+    unsigned int n;
+    uint32_t* start;
+    uint64_t* bits;
+    uint64_t* agg;
+};
+
+struct sr_acl_set
+{
+    unsigned int n_rules;
+    unsigned int words;
+    struct sr_acl_rule* rules;
+    struct sr_acl_field f[sr_acl_fields];
+    int n_ifaces;
+    char ifaces[SR_ACL_MAX_IFACES][sr_IFACE_NAMELEN];
+    enum sr_acl_action def;
+    unsigned long def_hits;
+};
+
+struct sr_acl
+{
+    struct sr_instance* sr;
+    pthread_rwlock_t lock;
+    struct sr_acl_set* set;
+};
+
+static const char* sr_acl_action_name[] = { "allow", "deny", "reject" };
+
+static void sr_acl_set_free(struct sr_acl_set* set)
+{
+    int f;
+
+    if (!set)
+    { return; }
+    for (f = 0; f < sr_acl_fields; f++)
+    {
+        free(set->f[f].start);
+        free(set->f[f].bits);
+        free(set->f[f].agg);
+    }
+    free(set->rules);
+    free(set);
+}
+
+/* the interval of field f that holds v */
+static unsigned int sr_acl_find(const struct sr_acl_field* f, uint32_t v)
+{
+    unsigned int lo = 0, hi = f->n - 1, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if (f->start[mid] <= v)
+        { lo = mid; }
+        else
+        { hi = mid - 1; }
+    }
+    return lo;
+}
+
+static int sr_acl_cmp32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_build_field(..)
+ * Scope: Local
+ *
+ * Cut field id at every rule's range ends and give each interval the
+ * set of rules that cover it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_acl_build_field(struct sr_acl_set* set, int id)
+{
+    struct sr_acl_field* f = &set->f[id];
+    const struct sr_acl_rule* r;
+    unsigned int i, j, k, n = 0;
+
+    if (!(f->start = (uint32_t*)malloc((2 * set->n_rules + 1) * sizeof(uint32_t))))
+    { return -1; }
+    f->start[n++] = 0;
+    for (i = 0; i < set->n_rules; i++)
+    {
+        r = &set->rules[i];
+        if (r->lo[id] != 0)
+        { f->start[n++] = r->lo[id]; }
+        if (r->hi[id] != 0xffffffff)
+        { f->start[n++] = r->hi[id] + 1; }
+    }
+    qsort(f->start, n, sizeof(uint32_t), sr_acl_cmp32);
+    for (i = 1, j = 1; i < n; i++)
+    {
+        if (f->start[i] != f->start[j - 1])
+        { f->start[j++] = f->start[i]; }
+    }
+    f->n = j;
+
+    f->bits = (uint64_t*)calloc(f->n * set->words, sizeof(uint64_t));
+    f->agg = (uint64_t*)calloc(f->n, sizeof(uint64_t));
+    if (!f->bits || !f->agg)
+    { return -1; }
+
+    for (i = 0; i < set->n_rules; i++)
+    {
+        r = &set->rules[i];
+        k = sr_acl_find(f, r->hi[id]);
+        for (j = sr_acl_find(f, r->lo[id]); j <= k; j++)
+        {
+            f->bits[j * set->words + i / 64] |= 1ULL << (i % 64);
+            f->agg[j] |= 1ULL << (i / 64);
+        }
+    }
+    return 0;
+}
+
+static int sr_acl_prefix(const char* arg, uint32_t* lo, uint32_t* hi)
+{
+    char addr[32];
+    const char* slash = strchr(arg, '/');
+    struct in_addr in;
+    uint32_t mask;
+    char* end;
+    long len = 32;
+
+    if (slash)
+    {
+        len = strtol(slash + 1, &end, 10);
+        if (*end != 0 || len < 0 || len > 32 || slash - arg >= (long)sizeof(addr))
+        { return -1; }
+    }
+    memset(addr, 0, sizeof(addr));
+    strncpy(addr, arg, slash ? (size_t)(slash - arg) : sizeof(addr) - 1);
+    if (inet_aton(addr, &in) == 0)
+    { return -1; }
+
+    mask = len ? 0xffffffff << (32 - len) : 0;
+    *lo = ntohl(in.s_addr) & mask;
+    *hi = *lo | ~mask;
+    return 0;
+}
+
+static int sr_acl_ports(const char* arg, uint32_t* lo, uint32_t* hi)
+{
+    char* end;
+    long a, b;
+
+    a = strtol(arg, &end, 10);
+    b = a;
+    if (*end == '-')
+    { b = strtol(end + 1, &end, 10); }
+    if (*end != 0 || a < 0 || b > 65535 || a > b)
+    { return -1; }
+    *lo = (uint32_t)a;
+    *hi = (uint32_t)b;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_parse(..)
+ * Scope: Local
+ *
+ * One rule from a line, tokens of which are in tok (strtok'd).
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_acl_parse(struct sr_acl_set* set, struct sr_acl_rule* r, char* tok)
+{
+    char* arg;
+    char* end;
+    long proto;
+    int f, i;
+
+    for (f = 0; f < sr_acl_fields; f++)
+    {
+        r->lo[f] = 0;
+        r->hi[f] = 0xffffffff;
+    }
+
+    for (r->action = sr_acl_allow; r->action <= sr_acl_reject; r->action++)
+    {
+        if (strcmp(tok, sr_acl_action_name[r->action]) == 0)
+        { break; }
+    }
+    if (r->action > sr_acl_reject)
+    { return -1; }
+
+    for (tok = strtok(0, " \t\r\n"); tok; tok = strtok(0, " \t\r\n"))
+    {
+        if (strcmp(tok, "tcp") == 0)
+        { r->lo[sr_acl_f_proto] = r->hi[sr_acl_f_proto] = ip_protocol_tcp; continue; }
+        if (strcmp(tok, "udp") == 0)
+        { r->lo[sr_acl_f_proto] = r->hi[sr_acl_f_proto] = ip_protocol_udp; continue; }
+        if (strcmp(tok, "icmp") == 0)
+        { r->lo[sr_acl_f_proto] = r->hi[sr_acl_f_proto] = ip_protocol_icmp; continue; }
+
+        if (!(arg = strtok(0, " \t\r\n")))
+        { return -1; }
+        if (strcmp(tok, "in") == 0)
+        {
+            for (i = 0; i < set->n_ifaces; i++)
+            {
+                if (strncmp(set->ifaces[i], arg, sr_IFACE_NAMELEN) == 0)
+                { break; }
+            }
+            if (i == set->n_ifaces)
+            {
+                if (i == SR_ACL_MAX_IFACES || strlen(arg) >= sr_IFACE_NAMELEN)
+                { return -1; }
+                strcpy(set->ifaces[set->n_ifaces++], arg);
+            }
+            r->lo[sr_acl_f_iface] = r->hi[sr_acl_f_iface] = i + 1;
+        }
+        else if (strcmp(tok, "proto") == 0)
+        {
+            proto = strtol(arg, &end, 0);
+            if (*end != 0 || proto < 0 || proto > 255)
+            { return -1; }
+            r->lo[sr_acl_f_proto] = r->hi[sr_acl_f_proto] = (uint32_t)proto;
+        }
+        else if (strcmp(tok, "src") == 0)
+        {
+            if (sr_acl_prefix(arg, &r->lo[sr_acl_f_src], &r->hi[sr_acl_f_src]) != 0)
+            { return -1; }
+        }
+        else if (strcmp(tok, "dst") == 0)
+        {
+            if (sr_acl_prefix(arg, &r->lo[sr_acl_f_dst], &r->hi[sr_acl_f_dst]) != 0)
+            { return -1; }
+        }
+        else if (strcmp(tok, "sport") == 0)
+        {
+            if (sr_acl_ports(arg, &r->lo[sr_acl_f_sport], &r->hi[sr_acl_f_sport]) != 0)
+            { return -1; }
+        }
+        else if (strcmp(tok, "dport") == 0)
+        {
+            if (sr_acl_ports(arg, &r->lo[sr_acl_f_dport], &r->hi[sr_acl_f_dport]) != 0)
+            { return -1; }
+        }
+        else
+        { return -1; }
+    }
+
+    /* ports only mean something for tcp and udp */
+    if ((r->hi[sr_acl_f_sport] != 0xffffffff || r->hi[sr_acl_f_dport] != 0xffffffff) &&
+        r->lo[sr_acl_f_proto] != ip_protocol_tcp && r->lo[sr_acl_f_proto] != ip_protocol_udp)
+    { return -1; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_compile(..)
+ * Scope: Local
+ *
+ * Read and compile the rules in fname; 0 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_acl_set* sr_acl_compile(const char* fname)
+{
+    struct sr_acl_set* set;
+    struct sr_acl_rule* r;
+    char line[SR_ACL_LINE];
+    char copy[SR_ACL_LINE];
+    char* tok;
+    FILE* fp;
+    int lineno = 0, f;
+    size_t len;
+
+    if (!(fp = fopen(fname, "r")))
+    {
+        perror(fname);
+        return 0;
+    }
+    set = (struct sr_acl_set*)calloc(1, sizeof(struct sr_acl_set));
+    if (!set || !(set->rules = (struct sr_acl_rule*)
+                  calloc(SR_ACL_MAX_RULES, sizeof(struct sr_acl_rule))))
+    {
+        fprintf(stderr, "acl: out of memory\n");
+        fclose(fp);
+        sr_acl_set_free(set);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if ((tok = strchr(line, '#')))
+        { *tok = 0; }
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' ||
+                           line[len - 1] == ' ' || line[len - 1] == '\t'))
+        { line[--len] = 0; }
+        strcpy(copy, line);
+        if (!(tok = strtok(copy, " \t\r\n")))
+        { continue; }
+
+        if (strcmp(tok, "default") == 0)
+        {
+            tok = strtok(0, " \t\r\n");
+            if (tok && strcmp(tok, "allow") == 0 && !strtok(0, " \t\r\n"))
+            { set->def = sr_acl_allow; }
+            else if (tok && strcmp(tok, "deny") == 0 && !strtok(0, " \t\r\n"))
+            { set->def = sr_acl_deny; }
+            else
+            {
+                fprintf(stderr, "%s:%d: default must be allow or deny\n", fname, lineno);
+                break;
+            }
+            continue;
+        }
+
+        if (set->n_rules == SR_ACL_MAX_RULES)
+        {
+            fprintf(stderr, "%s:%d: more than %d rules\n", fname, lineno, SR_ACL_MAX_RULES);
+            break;
+        }
+        r = &set->rules[set->n_rules];
+        if (sr_acl_parse(set, r, tok) != 0)
+        {
+            fprintf(stderr, "%s:%d: bad rule '%s'\n", fname, lineno, line);
+            break;
+        }
+        while (*line == ' ' || *line == '\t')
+        { memmove(line, line + 1, strlen(line)); }
+        strcpy(r->text, line);
+        set->n_rules++;
+    }
+    if (!feof(fp))
+    {
+        fclose(fp);
+        sr_acl_set_free(set);
+        return 0;
+    }
+    fclose(fp);
+    if (set->n_rules > 0)
+    {
+        r = (struct sr_acl_rule*)realloc(set->rules, set->n_rules * sizeof(struct sr_acl_rule));
+        set->rules = r ? r : set->rules;
+    }
+
+    set->words = (set->n_rules + 63) / 64;
+    if (set->words == 0)
+    { set->words = 1; }
+    for (f = 0; f < sr_acl_fields; f++)
+    {
+        if (sr_acl_build_field(set, f) != 0)
+        {
+            fprintf(stderr, "acl: out of memory\n");
+            sr_acl_set_free(set);
+            return 0;
+        }
+    }
+    return set;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_check(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+enum sr_acl_action sr_acl_check(struct sr_acl* acl, const uint8_t* packet,
+                                unsigned int len, const char* iface)
+{
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    const struct sr_acl_set* set;
+    const uint8_t* l4;
+    uint32_t v[sr_acl_fields];
+    unsigned int at[sr_acl_fields];
+    uint64_t agg, word;
+    enum sr_acl_action action;
+    int f, w, i;
+
+    v[sr_acl_f_src] = ntohl(ip->ip_src);
+    v[sr_acl_f_dst] = ntohl(ip->ip_dst);
+    v[sr_acl_f_proto] = ip->ip_p;
+    v[sr_acl_f_sport] = v[sr_acl_f_dport] = SR_ACL_NOPORT;
+    l4 = (const uint8_t*)ip + ip->ip_hl * 4;
+    if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+        (ntohs(ip->ip_off) & IP_OFFMASK) == 0 && l4 + 4 <= packet + len)
+    {
+        v[sr_acl_f_sport] = (l4[0] << 8) | l4[1];
+        v[sr_acl_f_dport] = (l4[2] << 8) | l4[3];
+    }
+
+    pthread_rwlock_rdlock(&acl->lock);
+    set = acl->set;
+
+    v[sr_acl_f_iface] = 0;
+    for (i = 0; i < set->n_ifaces; i++)
+    {
+        if (strncmp(set->ifaces[i], iface, sr_IFACE_NAMELEN) == 0)
+        {
+            v[sr_acl_f_iface] = i + 1;
+            break;
+        }
+    }
+
+    agg = ~0ULL;
+    for (f = 0; f < sr_acl_fields; f++)
+    {
+        at[f] = sr_acl_find(&set->f[f], v[f]);
+        agg &= set->f[f].agg[at[f]];
+    }
+
+    /* the aggregate can promise a word the rules' own bits don't keep */
+    for (i = -1; agg; agg &= agg - 1)
+    {
+        w = __builtin_ctzll(agg);
+        word = ~0ULL;
+        for (f = 0; f < sr_acl_fields && word; f++)
+        { word &= set->f[f].bits[at[f] * set->words + w]; }
+        if (word)
+        {
+            i = w * 64 + __builtin_ctzll(word);
+            break;
+        }
+    }
+
+    if (i >= 0)
+    {
+        __atomic_fetch_add(&acl->set->rules[i].hits, 1, __ATOMIC_RELAXED);
+        action = set->rules[i].action;
+    }
+    else
+    {
+        __atomic_fetch_add(&acl->set->def_hits, 1, __ATOMIC_RELAXED);
+        action = set->def;
+    }
+    pthread_rwlock_unlock(&acl->lock);
+
+    return action;
+} /* -- sr_acl_check -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_load(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_load(struct sr_acl* acl, const char* fname)
+{
+    struct sr_acl_set* set;
+    struct sr_acl_set* old;
+
+    if (!(set = sr_acl_compile(fname)))
+    { return -1; }
+
+    pthread_rwlock_wrlock(&acl->lock);
+    old = acl->set;
+    acl->set = set;
+    pthread_rwlock_unlock(&acl->lock);
+    sr_acl_set_free(old);
+
+    SR_LOG(SR_LOG_INFO, "acl: %u rules compiled", set->n_rules);
+    return 0;
+} /* -- sr_acl_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_open(struct sr_instance* sr, const char* fname)
+{
+    struct sr_acl* acl;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(fname);
+
+    if (!(acl = (struct sr_acl*)calloc(1, sizeof(struct sr_acl))))
+    {
+        fprintf(stderr, "acl: out of memory\n");
+        return -1;
+    }
+    acl->sr = sr;
+    pthread_rwlock_init(&acl->lock, 0);
+    if (sr_acl_load(acl, fname) != 0)
+    {
+        pthread_rwlock_destroy(&acl->lock);
+        free(acl);
+        return -1;
+    }
+    sr->acl = acl;
+    return 0;
+} /* -- sr_acl_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_acl_close(struct sr_instance* sr)
+{
+    struct sr_acl* acl = sr->acl;
+
+    if (!acl)
+    { return; }
+    sr->acl = 0;
+    sr_acl_set_free(acl->set);
+    pthread_rwlock_destroy(&acl->lock);
+    free(acl);
+} /* -- sr_acl_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_acl_ctl(..)
+ * Scope: Global
+ *
+ * "acl" lists the rules with their hits, "acl load FILE" replaces them.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_acl_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    const struct sr_acl_set* set;
+    unsigned int i, n = 0;
+
+    if (argc == 3 && strcmp(argv[1], "load") == 0)
+    {
+        if (!sr->acl)
+        {
+            fprintf(out, "no ACL; start with -A to have one\n");
+            return 0;
+        }
+        if (sr_acl_load(sr->acl, argv[2]) != 0)
+        {
+            fprintf(out, "%s not loaded, see the router's stderr\n", argv[2]);
+            return 0;
+        }
+        fprintf(out, "loaded %s\n", argv[2]);
+        return 0;
+    }
+    if (argc != 1)
+    { return -1; }
+    if (!sr->acl)
+    {
+        fprintf(out, "no ACL\n");
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&sr->acl->lock);
+    set = sr->acl->set;
+    for (i = 0; i < sr_acl_fields; i++)
+    { n += set->f[i].n; }
+    fprintf(out, "%u rules, %u intervals\n", set->n_rules, n);
+    for (i = 0; i < set->n_rules; i++)
+    {
+        fprintf(out, "%4u %12lu  %s\n", i + 1,
+                __atomic_load_n(&set->rules[i].hits, __ATOMIC_RELAXED),
+                set->rules[i].text);
+    }
+    fprintf(out, "     %12lu  default %s\n",
+            __atomic_load_n(&set->def_hits, __ATOMIC_RELAXED),
+            sr_acl_action_name[set->def]);
+    pthread_rwlock_unlock(&sr->acl->lock);
+
+    return 0;
+} /* -- sr_acl_ctl -- */
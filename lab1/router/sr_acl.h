@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl.h
+ *
+ * Description:
+ *
+ * Stateless ingress filtering: every IP packet is checked against an
+ * ordered list of rules before it is delivered or routed, and the first
+ * rule that matches says whether it may pass.
+ *
+ * The rules come from a file (-A), one to a line, first match wins:
+ *
+ *   allow|deny|reject [in IFACE] [tcp|udp|icmp|proto N]
+ *                     [src A.B.C.D[/LEN]] [dst A.B.C.D[/LEN]]
+ *                     [sport N[-M]] [dport N[-M]]
+ *   default allow|deny
+ *
+ * A term left out matches anything. Ports need tcp or udp, and match
+ * nothing in a fragment after the first, which has none. "reject" also
+ * answers with ICMP administratively prohibited; a packet no rule
+ * matches gets the default, allow unless the file says otherwise.
+ *
+ * The rules are compiled into a bit-vector classifier (Lakshman and
+ * Stiliadis): along each field the rules' ranges cut the values into
+ * intervals, and each interval holds the set of rules whose range covers
+ * it, one bit a rule. A packet finds its interval in each field with a
+ * binary search and the first rule in all of the sets is the one that
+ * matches. An aggregate bit for every 64 rules says which words of the
+ * sets are worth looking at, so the cost is a search per field and an
+ * AND of a few words: with 4000 rules a check takes under three times
+ * what it does with 10.
+ *
+ * Each rule counts the packets it matched; "acl" on the control socket
+ * shows them, and "acl load FILE" swaps in a new rule set (with fresh
+ * counters) without stopping the traffic.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ACL_H
+#define SR_ACL_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_acl;
+
+#define SR_ACL_MAX_RULES  4096    /* 64 words of 64, one aggregate word */
+#define SR_ACL_MAX_IFACES 16      /* interfaces named with "in" */
+
+enum sr_acl_action
+{
+    sr_acl_allow = 0,
+    sr_acl_deny,
+    sr_acl_reject
+};
+
+/* Filter with the rules in fname. Returns 0 on success and sets
+   sr->acl. */
+int  sr_acl_open(struct sr_instance* sr, const char* fname);
+void sr_acl_close(struct sr_instance* sr);
+
+/* Compile the rules in fname and use them in place of the current ones.
+   On error the current rules stay. */
+int  sr_acl_load(struct sr_acl* acl, const char* fname);
+
+/* What to do with an IP packet, header already checked, that came in on
+   iface; counted against the rule that decided it. */
+enum sr_acl_action sr_acl_check(struct sr_acl* acl, const uint8_t* packet,
+                                unsigned int len, const char* iface);
+
+/* control socket "acl" command */
+int  sr_acl_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_ACL_H -- */
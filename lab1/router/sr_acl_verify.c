@@ -0,0 +1,265 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_acl_verify.c
+ *
+ * Description:
+ *
+ * Offline check of the ingress ACL's bit-vector classifier (sr_acl.c).
+ * For each rule count given, compiles that many random rules and checks
+ * random packets with sr_acl_check() against a plain first-match scan
+ * of the same rules. Half the packets are aimed inside a random rule so
+ * that rules match often; the rest are anywhere in 10.0.0.0/8. Some are
+ * ICMP or another protocol without ports, non-first fragments, or too
+ * short to hold the ports, which no port rule may match.
+ *
+ * Prints the packets on which the two disagree, and exits 1 if any do.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_acl.h"
+#include "sr_bench_util.h"
+
+extern char* optarg;
+extern int optind;
+
+#define DEFAULT_PACKETS 100000
+#define DEFAULT_SEED    1
+#define VERIFY_NET      0x0a000000    /* 10.0.0.0/8 */
+#define VERIFY_LEN      8
+#define VERIFY_IFACES   3
+#define VERIFY_FRAME    (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 4)
+#define VERIFY_SHOW     10            /* mismatches printed per rule count */
+#define NOPORT          0x10000
+
+static const unsigned int default_counts[] = { 10, 100, 1000, SR_ACL_MAX_RULES };
+
+static void usage(char* );
+static unsigned long verify(struct sr_instance* , unsigned int , unsigned long );
+static int linear(const struct sr_bench_acl_rule* , unsigned int , int , int ,
+                  uint32_t , uint32_t , int , uint32_t , uint32_t );
+static uint32_t in_range(uint32_t , uint32_t );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    struct sr_instance sr;
+    char name[sr_IFACE_NAMELEN];
+    unsigned long packets = DEFAULT_PACKETS;
+    unsigned long bad = 0;
+    unsigned int seed = DEFAULT_SEED;
+    unsigned int count;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "hn:s:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'n':
+                packets = strtoul(optarg, 0, 10);
+                break;
+            case 's':
+                seed = (unsigned int)strtoul(optarg, 0, 10);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    sr_bench_init_instance(&sr);
+    for (i = 0; i < VERIFY_IFACES; i++)
+    {
+        sprintf(name, "eth%d", i + 1);
+        sr_add_interface(&sr, name);
+    }
+    srand(seed);
+
+    if (optind == argc)
+    {
+        for (i = 0; i < (int)(sizeof(default_counts) / sizeof(default_counts[0])); i++)
+        { bad += verify(&sr, default_counts[i], packets); }
+    }
+    for (i = optind; i < argc; i++)
+    {
+        count = (unsigned int)strtoul(argv[i], 0, 10);
+        if (count == 0 || count > SR_ACL_MAX_RULES)
+        {
+            fprintf(stderr, "%s: rule count must be 1 to %d\n", argv[i], SR_ACL_MAX_RULES);
+            exit(1);
+        }
+        bad += verify(&sr, count, packets);
+    }
+
+    if (bad)
+    {
+        printf("FAILED: %lu mismatches\n", bad);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router ACL classifier check\n");
+    printf("Format: %s [-n packets] [-s seed] [rules ...]\n", argv0);
+    printf("   rules  rule counts to check, default 10 100 1000 %d\n", SR_ACL_MAX_RULES);
+    printf("   defaults packets=%d seed=%d\n", DEFAULT_PACKETS, DEFAULT_SEED);
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: verify(..)
+ * Scope: local
+ *
+ * Check that many random packets against n random rules. Returns the number
+ * of mismatches.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned long verify(struct sr_instance* sr, unsigned int n,
+                            unsigned long packets)
+{
+    static const char* action[] = { "allow", "deny", "reject" };
+    static const int protos[] = { ip_protocol_tcp, ip_protocol_tcp, ip_protocol_udp,
+                                  ip_protocol_udp, ip_protocol_icmp, 47 };
+    struct sr_bench_acl_rule* rules;
+    const struct sr_bench_acl_rule* r;
+    uint8_t frame[VERIFY_FRAME];
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    uint8_t* l4 = (uint8_t*)(ip + 1);
+    char name[sr_IFACE_NAMELEN];
+    struct in_addr src, dst;
+    uint32_t s, d, sport, dport;
+    unsigned long k, bad = 0;
+    unsigned int len;
+    int def, iface, want, got;
+
+    rules = (struct sr_bench_acl_rule*)malloc(n * sizeof(struct sr_bench_acl_rule));
+    assert(rules);
+    def = rand() % 2 ? sr_acl_allow : sr_acl_deny;
+    if (sr_bench_acl_random(sr, n, def, VERIFY_NET, VERIFY_LEN, rules) != 0)
+    { exit(1); }
+
+    for (k = 0; k < packets; k++)
+    {
+        memset(frame, 0, sizeof(frame));
+        ip->ip_v = 4;
+        ip->ip_hl = 5;
+        ip->ip_p = protos[rand() % (sizeof(protos) / sizeof(protos[0]))];
+        if (rand() % 8 == 0)
+        { ip->ip_off = htons(1 + rand() % IP_OFFMASK); }
+        len = rand() % 16 ? VERIFY_FRAME : VERIFY_FRAME - 4;
+
+        /* eth1..eth3, or one no rule names */
+        iface = rand() % (VERIFY_IFACES + 1);
+        sprintf(name, "eth%d", iface + 1);
+
+        r = &rules[rand() % n];
+        if (rand() % 2)
+        {
+            s = in_range(r->src_lo, r->src_hi);
+            d = in_range(r->dst_lo, r->dst_hi);
+            sport = in_range(r->sport_lo, r->sport_hi < 65535 ? r->sport_hi : 65535);
+            dport = in_range(r->dport_lo, r->dport_hi < 65535 ? r->dport_hi : 65535);
+        }
+        else
+        {
+            s = in_range(VERIFY_NET, VERIFY_NET | 0x00ffffff);
+            d = in_range(VERIFY_NET, VERIFY_NET | 0x00ffffff);
+            sport = in_range(0, 65535);
+            dport = in_range(0, 1200);
+        }
+        ip->ip_src = htonl(s);
+        ip->ip_dst = htonl(d);
+        l4[0] = sport >> 8;
+        l4[1] = sport & 0xff;
+        l4[2] = dport >> 8;
+        l4[3] = dport & 0xff;
+
+        if ((ip->ip_p != ip_protocol_tcp && ip->ip_p != ip_protocol_udp) ||
+            ip->ip_off != 0 || len < VERIFY_FRAME)
+        { sport = dport = NOPORT; }
+
+        want = linear(rules, n, def, iface, s, d, ip->ip_p, sport, dport);
+        got = sr_acl_check(sr->acl, frame, len, name);
+        if (want == got)
+        { continue; }
+
+        if (bad++ < VERIFY_SHOW)
+        {
+            src.s_addr = ip->ip_src;
+            printf("%4u rules: in %s proto %d src %s", n, name, ip->ip_p, inet_ntoa(src));
+            dst.s_addr = ip->ip_dst;
+            printf(" dst %s sport %u dport %u len %u: linear %s, classifier %s\n",
+                   inet_ntoa(dst), sport, dport, len, action[want], action[got]);
+        }
+    }
+
+    printf("%4u rules: %lu packets, %lu mismatches\n", n, packets, bad);
+    sr_acl_close(sr);
+    free(rules);
+    return bad;
+} /* -- verify -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: linear(..)
+ * Scope: local
+ *
+ * The action of the first rule matching, the way the rules read.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int linear(const struct sr_bench_acl_rule* rules, unsigned int n, int def,
+                  int iface, uint32_t src, uint32_t dst, int proto,
+                  uint32_t sport, uint32_t dport)
+{
+    const struct sr_bench_acl_rule* r;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    {
+        r = &rules[i];
+        if ((r->iface < 0 || r->iface == iface) &&
+            (r->proto < 0 || r->proto == proto) &&
+            src >= r->src_lo && src <= r->src_hi &&
+            dst >= r->dst_lo && dst <= r->dst_hi &&
+            sport >= r->sport_lo && sport <= r->sport_hi &&
+            dport >= r->dport_lo && dport <= r->dport_hi)
+        { return r->action; }
+    }
+    return def;
+} /* -- linear -- */
+
+static uint32_t in_range(uint32_t lo, uint32_t hi)
+{
+    uint32_t r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+    if (hi - lo == 0xffffffff)
+    { return r; }
+    return lo + r % (hi - lo + 1);
+} /* -- in_range -- */
@@ -10,6 +10,7 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_log.h"
 
 /* 
   This function gets called every second. For each request sent out, we keep
@@ -32,10 +33,10 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr)
         time_t now = time(NULL);
         if (difftime(now, req->sent) > 1.0)
         {
-            Debug("\t\tARP req still pending, finding out whether to drop or send again\n");
             if (req->times_sent >= 5)
             {
-                Debug("Dropping ARP request and sending ICMP host unreachable to all waiting hosts\n");
+                SR_LOG(SR_LOG_DEBUG, "ARP for %u.%u.%u.%u timed out, sending host unreachable",
+                       SR_LOG_IP(req->ip));
                 struct sr_packet *packet = req->packets;
                 while (packet)
                 {
@@ -51,17 +52,23 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr)
                             memcpy(interface, if_walker->name, sr_IFACE_NAMELEN);
                             break;
                         }
+                        if_walker = if_walker->next;
                     }
                     
-                    /* send icmp host unreachable (type 3, code 1) */
-                    sr_send_icmp_t3(sr, packet->buf, 3, 1, interface);
+                    /* send icmp host unreachable (type 3, code 1), about
+                       the packet as it arrived if NAT has rewritten it */
+                    if (packet->quote)
+                        memcpy(packet->buf + sizeof(sr_ethernet_hdr_t), packet->quote,
+                               packet->quote_len);
+                    if (if_walker)
+                        sr_send_icmp_t3(sr, packet->buf, 3, 1, (char *)interface);
+                    SR_DROP(sr, sr_drop_arp_timeout);
                     packet = packet->next;
                 }
                 sr_arpreq_destroy(cache, req);
             }
             else
             {
-                Debug("Send the arp request\n");
                 /* send arp request */
                 sr_send_arp_req(sr, req);
 
@@ -117,7 +124,9 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet, /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       char *iface,
+                                       const uint8_t *quote, /* borrowed */
+                                       unsigned int quote_len)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -135,6 +144,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     {
         req = (struct sr_arpreq *)calloc(1, sizeof(struct sr_arpreq));
         req->ip = ip;
+        req->queued_ns = sr_stats_now_ns();
         req->next = cache->requests;
         cache->requests = req;
     }
@@ -149,6 +159,14 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
         new_pkt->len = packet_len;
         new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
         strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
+        new_pkt->quote = NULL;
+        new_pkt->quote_len = 0;
+        if (quote && quote_len)
+        {
+            new_pkt->quote = (uint8_t *)malloc(quote_len);
+            memcpy(new_pkt->quote, quote, quote_len);
+            new_pkt->quote_len = quote_len;
+        }
         new_pkt->next = req->packets;
         req->packets = new_pkt;
     }
@@ -164,7 +182,8 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
    2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip)
+                                     uint32_t ip,
+                                     const char *iface)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -189,12 +208,16 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         prev = req;
     }
 
-    int i;
+    int i, free_slot = SR_ARPCACHE_SZ;
     for (i = 0; i < SR_ARPCACHE_SZ; i++)
     {
-        if (!(cache->entries[i].valid))
+        if (cache->entries[i].valid && cache->entries[i].ip == ip)
             break;
+        if (!(cache->entries[i].valid) && free_slot == SR_ARPCACHE_SZ)
+            free_slot = i;
     }
+    if (i == SR_ARPCACHE_SZ)
+        i = free_slot;
 
     if (i != SR_ARPCACHE_SZ)
     {
@@ -202,6 +225,15 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         cache->entries[i].ip = ip;
         cache->entries[i].added = time(NULL);
         cache->entries[i].valid = 1;
+        cache->entries[i].tentative = 0;
+        cache->entries[i].probes = 0;
+        if (iface)
+        {
+            strncpy(cache->entries[i].iface, iface, sr_IFACE_NAMELEN - 1);
+            cache->entries[i].iface[sr_IFACE_NAMELEN - 1] = 0;
+        }
+        else
+            cache->entries[i].iface[0] = 0;
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -209,6 +241,44 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
     return req;
 }
 
+/* Puts back a mapping saved before a restart, tentative until the cleanup
+   thread hears it confirmed. */
+int sr_arpcache_restore(struct sr_arpcache *cache,
+                        unsigned char *mac,
+                        uint32_t ip,
+                        const char *iface)
+{
+    pthread_mutex_lock(&(cache->lock));
+
+    int i, free_slot = SR_ARPCACHE_SZ;
+    for (i = 0; i < SR_ARPCACHE_SZ; i++)
+    {
+        if (cache->entries[i].valid && cache->entries[i].ip == ip)
+            break;
+        if (!(cache->entries[i].valid) && free_slot == SR_ARPCACHE_SZ)
+            free_slot = i;
+    }
+
+    if (i != SR_ARPCACHE_SZ || free_slot == SR_ARPCACHE_SZ)
+    {
+        pthread_mutex_unlock(&(cache->lock));
+        return -1;
+    }
+
+    memcpy(cache->entries[free_slot].mac, mac, 6);
+    cache->entries[free_slot].ip = ip;
+    cache->entries[free_slot].added = time(NULL);
+    cache->entries[free_slot].valid = 1;
+    cache->entries[free_slot].tentative = 1;
+    cache->entries[free_slot].probes = 0;
+    strncpy(cache->entries[free_slot].iface, iface, sr_IFACE_NAMELEN - 1);
+    cache->entries[free_slot].iface[sr_IFACE_NAMELEN - 1] = 0;
+
+    pthread_mutex_unlock(&(cache->lock));
+
+    return 0;
+}
+
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry)
@@ -247,6 +317,7 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry)
                 free(pkt->buf);
             if (pkt->iface)
                 free(pkt->iface);
+            free(pkt->quote);
             free(pkt);
         }
 
@@ -259,15 +330,15 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry)
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache)
 {
-    fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
-    fprintf(stderr, "-----------------------------------------------------------\n");
+    fprintf(stderr, "\nMAC            IP         ADDED                      VALID TENTATIVE\n");
+    fprintf(stderr, "---------------------------------------------------------------------\n");
 
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++)
     {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
-        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
+        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d     %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid, cur->tentative);
     }
 
     fprintf(stderr, "\n");
@@ -298,7 +369,8 @@ int sr_arpcache_destroy(struct sr_arpcache *cache)
 }
 
 /* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+   more than SR_ARPCACHE_TO seconds ago, and asks tentative entries' IPs for
+   their MACs again, invalidating those that don't answer. */
 void *sr_arpcache_timeout(void *sr_ptr)
 {
     struct sr_instance *sr = sr_ptr;
@@ -315,9 +387,24 @@ void *sr_arpcache_timeout(void *sr_ptr)
         int i;
         for (i = 0; i < SR_ARPCACHE_SZ; i++)
         {
-            if ((cache->entries[i].valid) && (difftime(curtime, cache->entries[i].added) > SR_ARPCACHE_TO))
+            struct sr_arpentry *entry = &(cache->entries[i]);
+            if ((entry->valid) && (difftime(curtime, entry->added) > SR_ARPCACHE_TO))
             {
-                cache->entries[i].valid = 0;
+                entry->valid = 0;
+            }
+            else if ((entry->valid) && (entry->tentative))
+            {
+                if (entry->probes >= SR_ARPCACHE_PROBES || !entry->iface[0])
+                {
+                    SR_LOG(SR_LOG_DEBUG, "restored ARP entry for %u.%u.%u.%u not confirmed, dropping it",
+                           SR_LOG_IP(entry->ip));
+                    entry->valid = 0;
+                }
+                else
+                {
+                    sr_send_arp_probe(sr, entry->ip, entry->iface);
+                    entry->probes++;
+                }
             }
         }
 
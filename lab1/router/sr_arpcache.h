@@ -73,11 +73,17 @@
 
 #define SR_ARPCACHE_SZ    100  
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_PROBES 3    /* requests a tentative entry gets, one a
+                                   second, before it is dropped */
 
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
     char *iface;                /* The outgoing interface */
+    uint8_t *quote;             /* Its IP header and 8 bytes of data as they
+                                   arrived, if NAT has rewritten them since;
+                                   NULL otherwise */
+    unsigned int quote_len;
     struct sr_packet *next;
 };
 
@@ -86,6 +92,12 @@ struct sr_arpentry {
     uint32_t ip;                /* IP addr in network byte order */
     time_t added;         
     int valid;
+    int tentative;              /* restored from a snapshot (sr_snap.h) and
+                                   used, but not yet confirmed by a reply */
+    unsigned int probes;        /* requests sent to confirm it */
+    char iface[sr_IFACE_NAMELEN]; /* where the reply came in, "" if not
+                                     known; tentative entries are asked
+                                     for again there */
 };
 
 struct sr_arpreq {
@@ -95,6 +107,8 @@ struct sr_arpreq {
                                    never sent, will be 0. */
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
+    uint64_t queued_ns;         /* when the first packet was queued, for the
+                                   ARP latency histogram */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
     struct sr_arpreq *next;
 };
@@ -113,7 +127,9 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
+   freed by the caller. quote_len bytes of quote (may be NULL) are the
+   packet's IP header as it arrived, for the host unreachable message if
+   the request times out; see struct sr_packet.
 
    A pointer to the ARP request is returned; it should not be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
@@ -121,15 +137,30 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         char *iface,
+                         const uint8_t *quote,          /* borrowed */
+                         unsigned int quote_len);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping in the cache, learned on iface (may be
+      NULL), and marks it valid. An entry the IP has already is refreshed,
+      and stops being tentative. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip);
+                                     uint32_t ip,
+                                     const char *iface);
+
+/* Puts back an IP to MAC mapping saved before a restart, learned on
+   iface. It is used straight away, and the cleanup thread asks the IP
+   for its MAC again out of iface until a reply confirms it, dropping it
+   after SR_ARPCACHE_PROBES tries. Returns 0, or -1 if the IP is cached
+   already or the cache is full. */
+int sr_arpcache_restore(struct sr_arpcache *cache,
+                        unsigned char *mac,
+                        uint32_t ip,
+                        const char *iface);
 
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
@@ -138,6 +169,12 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
+/* Resends the ARP requests that have waited a second, and gives up on those
+   sent 5 times, answering their packets with host unreachable. The cleanup
+   thread calls it every second. */
+struct sr_instance;
+void sr_arpcache_sweepreqs(struct sr_instance *sr);
+
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
    a destructor, and a cleanup thread times out cache entries every 15
@@ -0,0 +1,412 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * Offline replay driver for the forwarding path. Loads one or more pcap
+ * files (such as the logfile.pcap written by sr -l), a routing table and
+ * an interface description, then feeds the captured frames straight into
+ * sr_handlepacket() with a stubbed sr_send_packet(). Reports packets per
+ * second, ns per packet and why frames were dropped. No VNS server, POX
+ * or mininet is needed.
+ *
+ * Frames sent by the router itself (source MAC is one of ours) are
+ * skipped. Every other frame is handed in on the interface whose MAC it
+ * is addressed to, or, for broadcasts, on the interface the routing table
+ * would use to reach its sender.
+ *
+ * -R times the ingress ACL against its size: the frames are filtered by
+ * that many random rules over 198.18.0.0/15 (RFC 2544's benchmarking
+ * block) that captured traffic does not match, so every frame searches
+ * all of them and is let through by the default.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _SOLARIS_
+#define __EXTENSIONS__
+#endif /* _SOLARIS_ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_pbuf.h"
+#include "sr_bench_util.h"
+#include "sr_acl.h"
+
+extern char* optarg;
+extern int optind;
+
+#define DEFAULT_RTABLE "rtable"
+#define DEFAULT_PASSES 1
+#define ACL_RANDOM_NET 0xc6120000   /* 198.18.0.0/15 */
+#define ACL_RANDOM_LEN 15
+
+/* A captured frame and the interface it will be received on */
+struct sr_bench_frame
+{
+    uint8_t* buf;
+    unsigned int len;
+    char* iface;
+};
+
+static struct sr_bench_frame* frames = 0;
+static unsigned int nframes = 0;
+static unsigned int maxframes = 0;
+static unsigned long skipped_own = 0;
+
+static void usage(char* );
+static int  sr_bench_load_pcap(struct sr_instance* , const char* );
+static char* sr_bench_ingress(struct sr_instance* , uint8_t* , unsigned int );
+static uint32_t swap32(uint32_t );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    int c, i;
+    char *rtable = DEFAULT_RTABLE;
+    char *ifaces = 0;
+    char *acl_file = 0;
+    unsigned int acl_random = 0;
+    unsigned int passes = DEFAULT_PASSES;
+    unsigned int burst = 1;
+    int arp_autoreply = 0;
+    int verbose = 0;
+    struct sr_instance sr;
+    FILE* report;
+    unsigned long drops[sr_drop_max], drops_end[sr_drop_max];
+    uint8_t **work, **pkts;
+    unsigned int *lens;
+    char **ifs;
+    unsigned int p, f, n;
+    uint64_t start, elapsed = 0;
+    unsigned long total;
+
+    while ((c = getopt(argc, argv, "hi:r:n:b:A:R:av")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'i':
+                ifaces = optarg;
+                break;
+            case 'r':
+                rtable = optarg;
+                break;
+            case 'n':
+                passes = atoi((char *) optarg);
+                break;
+            case 'b':
+                burst = atoi((char *) optarg);
+                break;
+            case 'A':
+                acl_file = optarg;
+                break;
+            case 'R':
+                acl_random = atoi((char *) optarg);
+                break;
+            case 'a':
+                arp_autoreply = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    if (ifaces == 0 || optind >= argc || (acl_file && acl_random) ||
+        acl_random > SR_ACL_MAX_RULES)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (passes < 1)
+    { passes = 1; }
+    if (burst < 1)
+    { burst = 1; }
+
+    sr_bench_init_instance(&sr);
+    if (sr_bench_load_ifaces(&sr, ifaces) != 0)
+    { exit(1); }
+    if (sr_load_rt(&sr, rtable) != 0)
+    {
+        fprintf(stderr, "Error setting up routing table from file %s\n",
+                rtable);
+        exit(1);
+    }
+    if (acl_file && sr_acl_open(&sr, acl_file) != 0)
+    { exit(1); }
+    if (acl_random &&
+        sr_bench_acl_random(&sr, acl_random, sr_acl_allow,
+                            ACL_RANDOM_NET, ACL_RANDOM_LEN, 0) != 0)
+    { exit(1); }
+
+    for (i = optind; i < argc; i++)
+    {
+        if (sr_bench_load_pcap(&sr, argv[i]) != 0)
+        { exit(1); }
+    }
+    if (nframes == 0)
+    {
+        fprintf(stderr, "No frames to replay\n");
+        exit(1);
+    }
+
+    /* the router rewrites frames in place, so each pass works on a
+       fresh copy of the capture */
+    work = (uint8_t**)malloc(nframes * sizeof(uint8_t*));
+    pkts = (uint8_t**)malloc(burst * sizeof(uint8_t*));
+    lens = (unsigned int*)malloc(burst * sizeof(unsigned int));
+    ifs  = (char**)malloc(burst * sizeof(char*));
+    assert(work && pkts && lens && ifs);
+    for (f = 0; f < nframes; f++)
+    {
+        work[f] = (uint8_t*)malloc(frames[f].len);
+        assert(work[f]);
+    }
+
+    sr_bench_arp_autoreply(arp_autoreply);
+    sr_init(&sr);
+
+    report = sr_bench_report_stream(verbose);
+    memset(&sr_bench_tx, 0, sizeof(sr_bench_tx));
+    sr_stats_drops(drops);
+
+    for (p = 0; p < passes; p++)
+    {
+        for (f = 0; f < nframes; f++)
+        { memcpy(work[f], frames[f].buf, frames[f].len); }
+
+        start = sr_bench_now_ns();
+        for (f = 0; f < nframes; f += n)
+        {
+            if (burst == 1)
+            {
+                sr_handlepacket(&sr, work[f], frames[f].len, frames[f].iface);
+                n = 1;
+            }
+            else
+            {
+                for (n = 0; n < burst && f + n < nframes; n++)
+                {
+                    pkts[n] = work[f + n];
+                    lens[n] = frames[f + n].len;
+                    ifs[n]  = frames[f + n].iface;
+                }
+                sr_handlepacket_burst(&sr, pkts, lens, ifs, n);
+            }
+            sr_bench_answer_arps(&sr);
+        }
+        elapsed += sr_bench_now_ns() - start;
+    }
+
+    total = (unsigned long)nframes * passes;
+
+    fprintf(report, "frames:       %u per pass, %u pass(es), %lu skipped (sent by router)\n",
+            nframes, passes, skipped_own);
+    fprintf(report, "mode:         %s (burst %u)\n",
+            burst == 1 ? "sr_handlepacket" : "sr_handlepacket_burst", burst);
+    if (acl_random)
+    { fprintf(report, "acl:          %u random rules, none matching\n", acl_random); }
+    fprintf(report, "elapsed:      %.3f ms\n", elapsed / 1e6);
+    fprintf(report, "throughput:   %.0f pps\n",
+            elapsed ? total * 1e9 / elapsed : 0.0);
+    fprintf(report, "latency:      %.1f ns/pkt\n", (double)elapsed / total);
+    fprintf(report, "transmitted:  %lu frames, %lu bytes (%lu ARP requests, %lu answered)\n",
+            sr_bench_tx.packets, sr_bench_tx.bytes,
+            sr_bench_tx.arp_reqs, sr_bench_tx.arp_answers);
+    fprintf(report, "icmp errors:  %lu sent, %lu rate limited (%lu global, %lu per destination)\n",
+            sr.icmp_limit.sent,
+            sr.icmp_limit.suppressed_global + sr.icmp_limit.suppressed_peer,
+            sr.icmp_limit.suppressed_global, sr.icmp_limit.suppressed_peer);
+    fprintf(report, "pbufs:        %lu in use, %lu allocations refused\n",
+            sr_pbuf_in_use(), sr_pbuf_exhausted());
+    sr_stats_drops(drops_end);
+    fprintf(report, "drops:\n");
+    for (i = 0; i < sr_drop_max; i++)
+    {
+        fprintf(report, "  %-14s %lu\n", sr_drop_name((enum sr_drop_reason)i),
+                drops_end[i] - drops[i]);
+    }
+    fflush(report);
+
+    return 0;
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router offline benchmark\n");
+    printf("Format: %s -i interfaces [-r routing table] [-n passes]\n", argv0);
+    printf("           [-b burst] [-A acl | -R rules] [-a] [-v] file.pcap [file.pcap ...]\n");
+    printf("   -a  answer the router's ARP requests\n");
+    printf("   -A  filter with the rules in this ACL file, as sr -A\n");
+    printf("   -R  filter with this many random rules (up to %d) that no frame matches\n",
+           SR_ACL_MAX_RULES);
+    printf("   -b  frames per sr_handlepacket_burst() call, 1 for sr_handlepacket()\n");
+    printf("   -v  keep the router's own output\n");
+    printf("   defaults rtable=%s passes=%d burst=1\n",
+            DEFAULT_RTABLE, DEFAULT_PASSES);
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_load_pcap(..)
+ * Scope: local
+ *
+ * Append the frames of a pcap file to the replay list.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_bench_load_pcap(struct sr_instance* sr, const char* filename)
+{
+    FILE* fp;
+    struct pcap_file_header fhdr;
+    struct pcap_sf_pkthdr   phdr;
+    int swapped;
+    uint32_t caplen;
+    uint8_t* buf;
+    char* iface;
+
+    if ( (fp = fopen(filename, "r")) == 0 )
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    if ( fread(&fhdr, sizeof(fhdr), 1, fp) != 1 ||
+         (fhdr.magic != TCPDUMP_MAGIC && swap32(fhdr.magic) != TCPDUMP_MAGIC) )
+    {
+        fprintf(stderr, "%s: not a pcap file\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    swapped = (fhdr.magic != TCPDUMP_MAGIC);
+    if ( (swapped ? swap32(fhdr.linktype) : fhdr.linktype) != LINKTYPE_ETHERNET )
+    {
+        fprintf(stderr, "%s: not an ethernet capture\n", filename);
+        fclose(fp);
+        return -1;
+    }
+
+    while ( fread(&phdr, sizeof(phdr), 1, fp) == 1 )
+    {
+        caplen = swapped ? swap32(phdr.caplen) : phdr.caplen;
+        if ( caplen > IP_MAXPACKET )
+        {
+            fprintf(stderr, "%s: corrupt record\n", filename);
+            fclose(fp);
+            return -1;
+        }
+
+        buf = (uint8_t*)malloc(caplen ? caplen : 1);
+        assert(buf);
+        if ( fread(buf, 1, caplen, fp) != caplen )
+        {
+            fprintf(stderr, "%s: truncated record, ignored\n", filename);
+            free(buf);
+            break;
+        }
+
+        if ( (iface = sr_bench_ingress(sr, buf, caplen)) == 0 )
+        {
+            skipped_own++;
+            free(buf);
+            continue;
+        }
+
+        if ( nframes == maxframes )
+        {
+            maxframes = maxframes ? 2 * maxframes : 1024;
+            frames = (struct sr_bench_frame*)realloc(frames,
+                    maxframes * sizeof(struct sr_bench_frame));
+            assert(frames);
+        }
+        frames[nframes].buf = buf;
+        frames[nframes].len = caplen;
+        frames[nframes].iface = iface;
+        nframes++;
+    }
+
+    fclose(fp);
+    return 0;
+} /* -- sr_bench_load_pcap -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_ingress(..)
+ * Scope: local
+ *
+ * Pick the interface a captured frame arrived on, or return 0 if the frame
+ * was sent by the router.
+ *
+ *---------------------------------------------------------------------------*/
+
+static char* sr_bench_ingress(struct sr_instance* sr, uint8_t* buf,
+                              unsigned int len)
+{
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)buf;
+    struct sr_if* if_walker;
+    struct sr_rt rt;
+    uint32_t src = 0;
+
+    if ( len < sizeof(sr_ethernet_hdr_t) )
+    { return sr->if_list->name; }
+
+    for ( if_walker = sr->if_list; if_walker; if_walker = if_walker->next )
+    {
+        if ( memcmp(e_hdr->ether_shost, if_walker->addr, ETHER_ADDR_LEN) == 0 )
+        { return 0; }
+    }
+    for ( if_walker = sr->if_list; if_walker; if_walker = if_walker->next )
+    {
+        if ( memcmp(e_hdr->ether_dhost, if_walker->addr, ETHER_ADDR_LEN) == 0 )
+        { return if_walker->name; }
+    }
+
+    /* broadcast or someone else's: go by the sender's address */
+    if ( ethertype(buf) == ethertype_arp &&
+         len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) )
+    {
+        src = ((sr_arp_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t)))->ar_sip;
+    }
+    else if ( ethertype(buf) == ethertype_ip &&
+              len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) )
+    {
+        src = ((sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t)))->ip_src;
+    }
+
+    if ( sr_rt_for_dst(sr, src, &rt) == 0 &&
+         (if_walker = sr_get_interface(sr, rt.interface)) != 0 )
+    { return if_walker->name; }
+
+    return sr->if_list->name;
+} /* -- sr_bench_ingress -- */
+
+static uint32_t swap32(uint32_t x)
+{
+    return ((x & 0xff) << 24) | ((x & 0xff00) << 8) |
+           ((x >> 8) & 0xff00) | (x >> 24);
+}
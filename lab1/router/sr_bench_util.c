@@ -0,0 +1,498 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench_util.c
+ *
+ * Description:
+ *
+ * Stubbed transmit path and set-up helpers for the offline benchmark
+ * drivers. See sr_bench_util.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_bench_util.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_pbuf.h"
+#include "sr_acl.h"
+
+#define SR_BENCH_MAX_PENDING_ARP 256
+
+struct sr_bench_tx sr_bench_tx;
+
+/* ARP requests waiting for a synthetic answer */
+struct sr_bench_arp
+{
+    uint32_t ip;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+static int autoreply = 0;
+static void (*tap)(const uint8_t* , unsigned int , const char* ) = 0;
+static struct sr_bench_arp pending[SR_BENCH_MAX_PENDING_ARP];
+static int npending = 0;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope: Global
+ *
+ * Stand-in for the VNS transmit path. Counts the frame and, if ARP
+ * auto-reply is on, remembers ARP requests so they can be answered.
+ * Called from both the packet path and the ARP cache thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                   uint8_t* buf /* borrowed */,
+                   unsigned int len,
+                   const char* iface /* borrowed */)
+{
+    sr_arp_hdr_t* arp_hdr;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+
+    if ( len < sizeof(sr_ethernet_hdr_t) )
+    {
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        return -1;
+    }
+
+    __sync_fetch_and_add(&sr_bench_tx.packets, 1);
+    __sync_fetch_and_add(&sr_bench_tx.bytes, len);
+    if ( tap )
+    { tap(buf, len, iface); }
+
+    if ( ethertype(buf) != ethertype_arp ||
+         len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) )
+    { return 0; }
+
+    arp_hdr = (sr_arp_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    if ( ntohs(arp_hdr->ar_op) != arp_op_request )
+    { return 0; }
+
+    __sync_fetch_and_add(&sr_bench_tx.arp_reqs, 1);
+
+    if ( autoreply )
+    {
+        pthread_mutex_lock(&pending_lock);
+        if ( npending < SR_BENCH_MAX_PENDING_ARP )
+        {
+            pending[npending].ip = arp_hdr->ar_tip;
+            strncpy(pending[npending].iface, iface, sr_IFACE_NAMELEN);
+            npending++;
+        }
+        pthread_mutex_unlock(&pending_lock);
+    }
+
+    return 0;
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_pbuf(..)
+ * Scope: Global
+ *
+ * Stand-in for the VNS pool buffer transmit path. Takes ownership of the
+ * buffer, as the real one does.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_pbuf(struct sr_instance* sr /* borrowed */,
+                 struct sr_pbuf* pbuf /* given */,
+                 const char* iface /* borrowed */)
+{
+    int ret;
+
+    /* REQUIRES */
+    assert(pbuf);
+
+    ret = sr_send_packet(sr, pbuf->data, pbuf->len, iface);
+    sr_pbuf_free(pbuf);
+    return ret;
+} /* -- sr_send_pbuf -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_pbuf_now(..)
+ * Scope: Global
+ *
+ * There are no egress queues to bypass here.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_pbuf_now(struct sr_instance* sr /* borrowed */,
+                     struct sr_pbuf* pbuf /* given */,
+                     const char* iface /* borrowed */)
+{
+    return sr_send_pbuf(sr, pbuf, iface);
+} /* -- sr_send_pbuf_now -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_init_instance(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_bench_init_instance(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    memset(sr, 0, sizeof(*sr));
+    sr_rt_init(sr);
+    sr->sockfd = -1;
+    strncpy(sr->user, "bench", 32);
+    strncpy(sr->host, "bench", 32);
+} /* -- sr_bench_init_instance -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_load_ifaces(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_bench_load_ifaces(struct sr_instance* sr, const char* filename)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  name[sr_IFACE_NAMELEN];
+    char  ip[32];
+    char  mac[32];
+    struct in_addr ip_addr;
+    unsigned char addr[ETHER_ADDR_LEN];
+    unsigned int  m[ETHER_ADDR_LEN];
+    int n, i, count = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    if ( (fp = fopen(filename, "r")) == 0 )
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    while ( fgets(line, BUFSIZ, fp) != 0 )
+    {
+        n = sscanf(line, "%31s %31s %31s", name, ip, mac);
+        if ( n <= 0 || name[0] == '#' )
+        { continue; }
+
+        if ( n < 2 || inet_aton(ip, &ip_addr) == 0 )
+        {
+            fprintf(stderr, "Error loading interfaces, bad line: %s", line);
+            fclose(fp);
+            return -1;
+        }
+
+        memset(addr, 0, sizeof(addr));
+        if ( n == 3 )
+        {
+            if ( sscanf(mac, "%x:%x:%x:%x:%x:%x",
+                        &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6 )
+            {
+                fprintf(stderr, "Error loading interfaces, bad MAC %s\n", mac);
+                fclose(fp);
+                return -1;
+            }
+            for ( i = 0; i < ETHER_ADDR_LEN; i++ )
+            { addr[i] = (unsigned char)m[i]; }
+        }
+        else
+        {
+            /* locally administered, one per interface */
+            addr[0] = 0x02;
+            addr[5] = (unsigned char)(count + 1);
+        }
+
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, addr);
+        sr_set_ether_ip(sr, ip_addr.s_addr);
+        count++;
+    }
+
+    fclose(fp);
+
+    if ( count == 0 )
+    {
+        fprintf(stderr, "Error loading interfaces, none found in %s\n",
+                filename);
+        return -1;
+    }
+    return 0;
+} /* -- sr_bench_load_ifaces -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_arp_autoreply(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_bench_arp_autoreply(int on)
+{
+    autoreply = on;
+} /* -- sr_bench_arp_autoreply -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_set_tap(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_bench_set_tap(void (*fn)(const uint8_t* , unsigned int , const char* ))
+{
+    tap = fn;
+} /* -- sr_bench_set_tap -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_answer_arps(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_bench_answer_arps(struct sr_instance* sr)
+{
+    struct sr_bench_arp todo[SR_BENCH_MAX_PENDING_ARP];
+    uint8_t frame[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)frame;
+    sr_arp_hdr_t* a_hdr = (sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    struct sr_if* iface;
+    struct sr_arpreq* req;
+    int n, i;
+
+    if ( !autoreply )
+    { return 0; }
+
+    /* take the list so the router can add to it while we answer */
+    pthread_mutex_lock(&pending_lock);
+    n = npending;
+    memcpy(todo, pending, n * sizeof(struct sr_bench_arp));
+    npending = 0;
+    pthread_mutex_unlock(&pending_lock);
+
+    /* the router only sends its first request from the once a second
+       sweep; a neighbour on a real wire would have answered by then */
+    pthread_mutex_lock(&(sr->cache.lock));
+    for ( req = sr->cache.requests;
+          req && n < SR_BENCH_MAX_PENDING_ARP; req = req->next )
+    {
+        if ( req->packets == 0 )
+        { continue; }
+        todo[n].ip = req->ip;
+        strncpy(todo[n].iface, req->packets->iface, sr_IFACE_NAMELEN);
+        n++;
+    }
+    pthread_mutex_unlock(&(sr->cache.lock));
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( (iface = sr_get_interface(sr, todo[i].iface)) == 0 )
+        { continue; }
+
+        memcpy(e_hdr->ether_dhost, iface->addr, ETHER_ADDR_LEN);
+        e_hdr->ether_shost[0] = 0x02;
+        e_hdr->ether_shost[1] = 0x00;
+        memcpy(e_hdr->ether_shost + 2, &todo[i].ip, 4);
+        e_hdr->ether_type = htons(ethertype_arp);
+
+        a_hdr->ar_hrd = htons(arp_hrd_ethernet);
+        a_hdr->ar_pro = htons(ethertype_ip);
+        a_hdr->ar_hln = ETHER_ADDR_LEN;
+        a_hdr->ar_pln = 4;
+        a_hdr->ar_op  = htons(arp_op_reply);
+        memcpy(a_hdr->ar_sha, e_hdr->ether_shost, ETHER_ADDR_LEN);
+        a_hdr->ar_sip = todo[i].ip;
+        memcpy(a_hdr->ar_tha, iface->addr, ETHER_ADDR_LEN);
+        a_hdr->ar_tip = iface->ip;
+
+        sr_handlepacket(sr, frame, sizeof(frame), iface->name);
+        sr_bench_tx.arp_answers++;
+    }
+
+    return n;
+} /* -- sr_bench_answer_arps -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_acl_prefix(..)
+ * Scope: local
+ *
+ * Write " tok a.b.c.d/l", a random prefix inside net/len, and its range.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_bench_acl_prefix(FILE* fp, const char* tok, uint32_t net, int len,
+                                uint32_t* lo, uint32_t* hi)
+{
+    struct in_addr addr;
+    uint32_t netmask, mask, r;
+    int l;
+
+    l = len + rand() % (33 - len);
+    netmask = len ? 0xffffffff << (32 - len) : 0;
+    mask = l ? 0xffffffff << (32 - l) : 0;
+    r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+
+    *lo = ((net & netmask) | (r & ~netmask)) & mask;
+    *hi = *lo | ~mask;
+    addr.s_addr = htonl(*lo);
+    fprintf(fp, " %s %s/%d", tok, inet_ntoa(addr), l);
+} /* -- sr_bench_acl_prefix -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_acl_random(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_bench_acl_random(struct sr_instance* sr, unsigned int n, int def,
+                        uint32_t net, int len, struct sr_bench_acl_rule* rules)
+{
+    static const char* action[] = { "allow", "deny", "reject" };
+    char fname[] = "/tmp/sr_bench_aclXXXXXX";
+    const char* ifname[SR_ACL_MAX_IFACES];
+    struct sr_bench_acl_rule r;
+    struct sr_if* if_walker;
+    unsigned int i;
+    int fd, n_ifs = 0, rc, p;
+    FILE* fp;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(n <= SR_ACL_MAX_RULES);
+    assert(def == sr_acl_allow || def == sr_acl_deny);
+    assert(len >= 0 && len <= 32);
+
+    for (if_walker = sr->if_list; if_walker && n_ifs < SR_ACL_MAX_IFACES;
+         if_walker = if_walker->next)
+    { ifname[n_ifs++] = if_walker->name; }
+
+    if ((fd = mkstemp(fname)) < 0 || !(fp = fdopen(fd, "w")))
+    {
+        perror(fname);
+        return -1;
+    }
+    fprintf(fp, "default %s\n", action[def]);
+
+    for (i = 0; i < n; i++)
+    {
+        memset(&r, 0, sizeof(r));
+        r.src_hi = r.dst_hi = r.sport_hi = r.dport_hi = 0xffffffff;
+
+        r.action = rand() % 3;
+        fprintf(fp, "%s", action[r.action]);
+
+        r.iface = -1;
+        if (n_ifs > 0 && rand() % 4 == 0)
+        {
+            r.iface = rand() % n_ifs;
+            fprintf(fp, " in %s", ifname[r.iface]);
+        }
+
+        p = rand() % 8;
+        r.proto = p < 3 ? -1 : p < 5 ? ip_protocol_tcp : p == 5 ? ip_protocol_udp :
+                  p == 6 ? ip_protocol_icmp : 47;
+        if (r.proto == ip_protocol_tcp || r.proto == ip_protocol_udp)
+        { fprintf(fp, r.proto == ip_protocol_tcp ? " tcp" : " udp"); }
+        else if (r.proto == ip_protocol_icmp)
+        { fprintf(fp, " icmp"); }
+        else if (r.proto >= 0)
+        { fprintf(fp, " proto %d", r.proto); }
+
+        /* at least one of the two, so that no rule reaches outside net */
+        p = 1 + rand() % 3;
+        if (p & 1)
+        { sr_bench_acl_prefix(fp, "src", net, len, &r.src_lo, &r.src_hi); }
+        if (p & 2)
+        { sr_bench_acl_prefix(fp, "dst", net, len, &r.dst_lo, &r.dst_hi); }
+
+        if (r.proto == ip_protocol_tcp || r.proto == ip_protocol_udp)
+        {
+            if (rand() % 4 == 0)
+            {
+                r.sport_lo = r.sport_hi = rand() % 65536;
+                fprintf(fp, " sport %u", r.sport_lo);
+            }
+            if (rand() % 2)
+            {
+                r.dport_lo = rand() % 1024;
+                r.dport_hi = r.dport_lo + rand() % 100;
+                fprintf(fp, " dport %u-%u", r.dport_lo, r.dport_hi);
+            }
+        }
+        fprintf(fp, "\n");
+
+        if (rules)
+        { rules[i] = r; }
+    }
+
+    if (fclose(fp) != 0)
+    {
+        perror(fname);
+        unlink(fname);
+        return -1;
+    }
+    rc = sr_acl_open(sr, fname);
+    unlink(fname);
+    return rc;
+} /* -- sr_bench_acl_random -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_now_ns(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+uint64_t sr_bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- sr_bench_now_ns -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_bench_report_stream(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+FILE* sr_bench_report_stream(int verbose)
+{
+    FILE* report;
+    int fd;
+
+    if ( verbose )
+    { return stdout; }
+
+    fflush(stdout);
+    fflush(stderr);
+    if ( (fd = dup(fileno(stdout))) < 0 || (report = fdopen(fd, "w")) == 0 )
+    {
+        perror("dup");
+        return stdout;
+    }
+
+    if ( freopen("/dev/null", "w", stdout) == 0 ||
+         freopen("/dev/null", "w", stderr) == 0 )
+    {
+        fprintf(report, "Warning: could not silence router output\n");
+    }
+
+    return report;
+} /* -- sr_bench_report_stream -- */
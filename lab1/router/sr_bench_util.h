@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench_util.h
+ *
+ * Description:
+ *
+ * Support code shared by the offline benchmark drivers. The drivers link
+ * the router core without sr_main.c and sr_vns_comm.c, so this file
+ * provides the sr_send_packet() they run against: it counts what the
+ * router transmits instead of handing it to the VNS server, and can play
+ * the part of the neighbours by answering the router's ARP requests.
+ *
+ * Interface description files have one interface per line:
+ *
+ *   name  ip  [mac]
+ *
+ * e.g. "eth1 192.168.2.1 86:e2:01:a1:ac:7e". Blank lines and lines
+ * starting with '#' are ignored. If the MAC is left out one is made up
+ * from the interface number.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BENCH_UTIL_H
+#define SR_BENCH_UTIL_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+struct sr_instance;
+
+/* What the router handed to sr_send_packet() */
+struct sr_bench_tx
+{
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long arp_reqs;    /* ARP requests among the above */
+    unsigned long arp_answers; /* synthetic replies fed back to the router */
+};
+
+extern struct sr_bench_tx sr_bench_tx;
+
+/* Zero out an instance the way sr_main.c does for the real client. */
+void sr_bench_init_instance(struct sr_instance* sr);
+
+/* Populate sr->if_list from an interface description file. Returns 0 on
+   success. */
+int sr_bench_load_ifaces(struct sr_instance* sr, const char* filename);
+
+/* When on, ARP requests sent by the router are remembered so that
+   sr_bench_answer_arps() can answer them. */
+void sr_bench_arp_autoreply(int on);
+
+/* When set, tap is shown every frame the router transmits, from whichever
+   thread sends it. 0 turns it off. */
+void sr_bench_set_tap(void (*tap)(const uint8_t* buf, unsigned int len,
+                                  const char* iface));
+
+/* Feed a reply to every ARP request seen since the last call, and to every
+   request still waiting in the router's ARP queue, back into the router.
+   The neighbour's MAC is made up from its IP address. Returns the number
+   of replies injected. */
+int sr_bench_answer_arps(struct sr_instance* sr);
+
+/* Monotonic clock in nanoseconds. */
+uint64_t sr_bench_now_ns(void);
+
+/* A rule sr_bench_acl_random() wrote, for checking the compiled ACL
+   against a plain first-match scan. Ranges are host order and inclusive,
+   the whole range when the rule leaves the field out. */
+struct sr_bench_acl_rule
+{
+    int action;                /* enum sr_acl_action */
+    int iface;                 /* position in sr->if_list, -1 for any */
+    int proto;                 /* -1 for any */
+    uint32_t src_lo, src_hi;
+    uint32_t dst_lo, dst_hi;
+    uint32_t sport_lo, sport_hi;
+    uint32_t dport_lo, dport_hi;
+};
+
+/* Give sr an ACL of n random rules (at most SR_ACL_MAX_RULES) and the
+   default def. Every rule names a source or destination inside net/len
+   (host order), so traffic from outside it only ever gets the default.
+   The rules are stored in rules, if not 0, which has room for n. Uses
+   rand(). Returns 0 on success. */
+int sr_bench_acl_random(struct sr_instance* sr, unsigned int n, int def,
+                        uint32_t net, int len, struct sr_bench_acl_rule* rules);
+
+/* Returns a stream for the benchmark report. Unless verbose is set, the
+   router's own stdout/stderr chatter is sent to /dev/null so it does not
+   end up in the report. */
+FILE* sr_bench_report_stream(int verbose);
+
+#endif /* -- SR_BENCH_UTIL_H -- */
@@ -0,0 +1,534 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bfd.c
+ *
+ * Description:
+ *
+ * Next hop failure detection. See sr_bfd.h.
+ *
+ * Sessions are guarded by bfd->lock. Packets are handled on the thread
+ * that reads them; sending and the detection timers run on a thread of
+ * their own. Times are in microseconds, as on the wire.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_bfd.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_arpcache.h"
+#include "sr_utils.h"
+#include "sr_log.h"
+
+#define SR_BFD_TTL 255
+
+struct sr_bfd_session
+{
+    int used;
+    uint32_t gw;                    /* network order */
+    char iface[sr_IFACE_NAMELEN];
+    uint16_t sport;
+    int state;
+    int diag;
+    uint32_t my_disc;
+    uint32_t remote_disc;
+    int remote_state;
+    unsigned int remote_mult;
+    uint32_t remote_min_tx;
+    uint32_t remote_min_rx;
+    int send_final;                 /* answer a poll */
+    uint64_t next_tx;
+    uint64_t detect;                /* down if nothing heard by then */
+    uint64_t changed;               /* last time the state moved */
+    unsigned long tx;
+    unsigned long rx;
+    unsigned long ups;
+    unsigned long downs;
+};
+
+struct sr_bfd
+{
+    struct sr_instance* sr;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int stop;
+    uint32_t interval;
+    struct sr_bfd_session s[SR_BFD_MAX_SESSIONS];
+    unsigned long rx_bad;
+    unsigned int seed;
+};
+
+static const char* sr_bfd_state_name[] = { "admin_down", "down", "init", "up" };
+
+static uint64_t sr_bfd_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t sr_bfd_max(uint32_t a, uint32_t b)
+{
+    return a > b ? a : b;
+}
+
+/* what we tell the neighbour we would like to send at */
+static uint32_t sr_bfd_desired_tx(struct sr_bfd* bfd, const struct sr_bfd_session* s)
+{
+    return s->state == sr_bfd_up ? bfd->interval : SR_BFD_SLOW_MS * 1000;
+}
+
+static struct sr_bfd_session* sr_bfd_add(struct sr_bfd* bfd, uint32_t gw,
+                                         const char* iface)
+{
+    struct sr_bfd_session* s;
+    int i;
+
+    for (i = 0; i < SR_BFD_MAX_SESSIONS && bfd->s[i].used; i++);
+    if (i == SR_BFD_MAX_SESSIONS)
+    { return 0; }
+
+    s = &bfd->s[i];
+    memset(s, 0, sizeof(*s));
+    s->used = 1;
+    s->gw = gw;
+    strncpy(s->iface, iface, sr_IFACE_NAMELEN - 1);
+    s->sport = SR_BFD_SRC_PORT + i;
+    s->state = sr_bfd_down;
+    s->my_disc = i + 1;
+    s->remote_mult = SR_BFD_MULT;
+    s->next_tx = sr_bfd_now();
+    s->changed = s->next_tx;
+    return s;
+}
+
+static struct sr_bfd_session* sr_bfd_find(struct sr_bfd* bfd, uint32_t gw,
+                                          const char* iface)
+{
+    int i;
+
+    for (i = 0; i < SR_BFD_MAX_SESSIONS; i++)
+    {
+        if (bfd->s[i].used && bfd->s[i].gw == gw &&
+            strncmp(bfd->s[i].iface, iface, sr_IFACE_NAMELEN) == 0)
+        { return &bfd->s[i]; }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_set_state(..)
+ * Scope: Local
+ *
+ * Move a session to state, telling the routing table when the next hop
+ * dies or comes back, and send at once so the neighbour hears of it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_bfd_set_state(struct sr_bfd* bfd, struct sr_bfd_session* s,
+                             int state, int diag)
+{
+    struct in_addr gw;
+    int was = s->state;
+
+    if (state == was)
+    { return; }
+    s->state = state;
+    s->diag = diag;
+    s->changed = s->next_tx = sr_bfd_now();
+    gw.s_addr = s->gw;
+
+    if (state == sr_bfd_up)
+    {
+        s->ups++;
+        s->diag = sr_bfd_diag_none;
+        sr_rt_nh_state(bfd->sr, gw, 1);
+        SR_LOG_S(SR_LOG_INFO, s->iface, "%s: next hop %u.%u.%u.%u up",
+                 SR_LOG_IP(s->gw));
+    }
+    else if (was == sr_bfd_up)
+    {
+        s->downs++;
+        if (sr_rt_nh_state(bfd->sr, gw, 0) != 0)
+        {
+            SR_LOG_S(SR_LOG_ERR, s->iface, "%s: too many dead next hops to route round %u.%u.%u.%u",
+                     SR_LOG_IP(s->gw));
+        }
+        SR_LOG_S(SR_LOG_WARN, s->iface, "%s: next hop %u.%u.%u.%u down (diag %u)",
+                 SR_LOG_IP(s->gw), diag);
+    }
+    if (state == sr_bfd_down)
+    { s->remote_disc = 0; }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_send(..)
+ * Scope: Local
+ *
+ * One control packet, by way of the ARP cache like any packet we route.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_bfd_send(struct sr_bfd* bfd, struct sr_bfd_session* s)
+{
+    uint8_t frame[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                  sizeof(sr_udp_hdr_t) + sizeof(struct sr_bfd_hdr)];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    sr_udp_hdr_t* udp = (sr_udp_hdr_t*)(ip + 1);
+    struct sr_bfd_hdr* h = (struct sr_bfd_hdr*)(udp + 1);
+    struct sr_if* ifp = sr_get_interface(bfd->sr, s->iface);
+    struct sr_arpentry* entry;
+
+    if (!ifp)
+    { return; }
+
+    memset(frame, 0, sizeof(frame));
+    memcpy(eth->ether_shost, ifp->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_hl = 5;
+    ip->ip_v = 4;
+    ip->ip_tos = 0xc0;            /* network control */
+    ip->ip_len = htons(sizeof(frame) - sizeof(sr_ethernet_hdr_t));
+    ip->ip_ttl = SR_BFD_TTL;
+    ip->ip_p = ip_protocol_udp;
+    ip->ip_src = ifp->ip;
+    ip->ip_dst = s->gw;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    udp->udp_sport = htons(s->sport);
+    udp->udp_dport = htons(SR_BFD_PORT);
+    udp->udp_len = htons(sizeof(sr_udp_hdr_t) + sizeof(struct sr_bfd_hdr));
+
+    h->vers_diag = (SR_BFD_VERSION << 5) | s->diag;
+    h->state_flags = (s->state << 6) | (s->send_final ? SR_BFD_F_FINAL : 0);
+    h->mult = SR_BFD_MULT;
+    h->len = sizeof(struct sr_bfd_hdr);
+    h->my_disc = htonl(s->my_disc);
+    h->your_disc = htonl(s->remote_disc);
+    h->min_tx = htonl(sr_bfd_desired_tx(bfd, s));
+    h->min_rx = htonl(bfd->interval);
+    h->min_echo_rx = 0;
+    s->send_final = 0;
+    s->tx++;
+
+    if ((entry = sr_arpcache_lookup(&bfd->sr->cache, s->gw)))
+    {
+        memcpy(eth->ether_dhost, entry->mac, ETHER_ADDR_LEN);
+        free(entry);
+        sr_send_packet(bfd->sr, frame, sizeof(frame), s->iface);
+    }
+    else
+    { sr_arpcache_queuereq(&bfd->sr->cache, s->gw, frame, sizeof(frame), s->iface, 0, 0); }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_input(..)
+ * Scope: Global
+ *
+ * Reception of a control packet, RFC 5880 6.8.6.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_bfd_input(struct sr_bfd* bfd, uint8_t* packet, unsigned int len,
+                  const char* iface)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    unsigned int hl = ip->ip_hl * 4;
+    sr_udp_hdr_t* udp = (sr_udp_hdr_t*)((uint8_t*)ip + hl);
+    struct sr_bfd_hdr* h = (struct sr_bfd_hdr*)(udp + 1);
+    struct sr_bfd_session* s = 0;
+    uint32_t your_disc;
+    int state, was, i;
+
+    pthread_mutex_lock(&bfd->lock);
+
+    if (hl < sizeof(sr_ip_hdr_t) ||
+        len < sizeof(sr_ethernet_hdr_t) + hl + sizeof(sr_udp_hdr_t) + sizeof(*h) ||
+        ip->ip_ttl != SR_BFD_TTL || (h->vers_diag >> 5) != SR_BFD_VERSION ||
+        h->len < sizeof(*h) || h->mult == 0 || h->my_disc == 0)
+    { goto bad; }
+    state = h->state_flags >> 6;
+    your_disc = ntohl(h->your_disc);
+
+    if (your_disc)
+    {
+        for (i = 0; i < SR_BFD_MAX_SESSIONS; i++)
+        {
+            if (bfd->s[i].used && bfd->s[i].my_disc == your_disc)
+            {
+                s = &bfd->s[i];
+                break;
+            }
+        }
+    }
+    else if (state == sr_bfd_down || state == sr_bfd_admin_down)
+    {
+        /* a neighbour starting a session we may not know about */
+        if (!(s = sr_bfd_find(bfd, ip->ip_src, iface)) &&
+            (s = sr_bfd_add(bfd, ip->ip_src, iface)))
+        {
+            SR_LOG_S(SR_LOG_INFO, iface, "%s: session asked for by %u.%u.%u.%u",
+                     SR_LOG_IP(ip->ip_src));
+        }
+    }
+    if (!s)
+    { goto bad; }
+
+    was = s->state;
+    s->rx++;
+    s->remote_disc = ntohl(h->my_disc);
+    s->remote_state = state;
+    s->remote_mult = h->mult;
+    s->remote_min_tx = ntohl(h->min_tx);
+    s->remote_min_rx = ntohl(h->min_rx);
+    if (h->state_flags & SR_BFD_F_POLL)
+    {
+        s->send_final = 1;
+        s->next_tx = 0;
+    }
+
+    if (state == sr_bfd_admin_down)
+    {
+        if (s->state != sr_bfd_down)
+        { sr_bfd_set_state(bfd, s, sr_bfd_down, sr_bfd_diag_neighbor_down); }
+    }
+    else if (s->state == sr_bfd_down)
+    {
+        if (state == sr_bfd_down)
+        { sr_bfd_set_state(bfd, s, sr_bfd_init, sr_bfd_diag_none); }
+        else if (state == sr_bfd_init)
+        { sr_bfd_set_state(bfd, s, sr_bfd_up, sr_bfd_diag_none); }
+    }
+    else if (s->state == sr_bfd_init)
+    {
+        if (state == sr_bfd_init || state == sr_bfd_up)
+        { sr_bfd_set_state(bfd, s, sr_bfd_up, sr_bfd_diag_none); }
+    }
+    else if (s->state == sr_bfd_up && state == sr_bfd_down)
+    { sr_bfd_set_state(bfd, s, sr_bfd_down, sr_bfd_diag_neighbor_down); }
+
+    s->detect = sr_bfd_now() +
+                (uint64_t)s->remote_mult * sr_bfd_max(bfd->interval, s->remote_min_tx);
+    if (s->state != was || s->send_final)
+    { pthread_cond_signal(&bfd->wake); }
+    pthread_mutex_unlock(&bfd->lock);
+    return;
+
+bad:
+    bfd->rx_bad++;
+    pthread_mutex_unlock(&bfd->lock);
+} /* -- sr_bfd_input -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_timer(..)
+ * Scope: Local
+ *
+ * Sends each session's packets, jittered to 75-100% of the interval
+ * (RFC 5880 6.8.7), and takes down sessions not heard from in time.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_bfd_timer(void* arg)
+{
+    struct sr_bfd* bfd = (struct sr_bfd*)arg;
+    struct sr_bfd_session* s;
+    struct timespec ts;
+    uint64_t now, wake, period;
+    int i;
+
+    pthread_mutex_lock(&bfd->lock);
+    while (!bfd->stop)
+    {
+        now = sr_bfd_now();
+        wake = now + SR_BFD_SLOW_MS * 1000;
+
+        for (i = 0; i < SR_BFD_MAX_SESSIONS; i++)
+        {
+            s = &bfd->s[i];
+            if (!s->used)
+            { continue; }
+            if ((s->state == sr_bfd_init || s->state == sr_bfd_up) && now >= s->detect)
+            { sr_bfd_set_state(bfd, s, sr_bfd_down, sr_bfd_diag_expired); }
+            if (now >= s->next_tx)
+            {
+                sr_bfd_send(bfd, s);
+                period = sr_bfd_max(sr_bfd_desired_tx(bfd, s), s->remote_min_rx);
+                s->next_tx = now + period - period * (rand_r(&bfd->seed) % 26) / 100;
+            }
+            if (s->next_tx < wake)
+            { wake = s->next_tx; }
+            if ((s->state == sr_bfd_init || s->state == sr_bfd_up) && s->detect < wake)
+            { wake = s->detect; }
+        }
+
+        if (wake > now)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += (wake - now) / 1000000;
+            ts.tv_nsec += ((wake - now) % 1000000) * 1000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&bfd->wake, &bfd->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&bfd->lock);
+    return 0;
+} /* -- sr_bfd_timer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_bfd_open(struct sr_instance* sr, unsigned int interval_ms)
+{
+    struct sr_bfd* bfd;
+    struct sr_rt* rt;
+    pthread_condattr_t attr;
+    int i;
+
+    if (interval_ms == 0)
+    {
+        fprintf(stderr, "bfd: interval must be at least 1 ms\n");
+        return -1;
+    }
+    if (!(bfd = (struct sr_bfd*)calloc(1, sizeof(struct sr_bfd))))
+    {
+        fprintf(stderr, "bfd: out of memory\n");
+        return -1;
+    }
+    bfd->sr = sr;
+    bfd->interval = interval_ms * 1000;
+    bfd->seed = (unsigned int)sr_bfd_now();
+
+    /* -- a session with every gateway the rtable uses -- */
+    pthread_rwlock_rdlock(&sr->rt_lock);
+    for (rt = sr->routing_table; rt; rt = rt->next)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            uint32_t gw = i ? rt->backup_gw.s_addr : rt->gw.s_addr;
+            const char* iface = i ? rt->backup_interface : rt->interface;
+
+            if (gw == 0 || !iface[0] || !sr_get_interface(sr, iface) ||
+                sr_bfd_find(bfd, gw, iface))
+            { continue; }
+            if (!sr_bfd_add(bfd, gw, iface))
+            {
+                fprintf(stderr, "bfd: more than %d next hops, the rest go unwatched\n",
+                        SR_BFD_MAX_SESSIONS);
+                break;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+
+    pthread_mutex_init(&bfd->lock, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bfd->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&bfd->thread, 0, sr_bfd_timer, bfd) != 0)
+    {
+        perror("pthread_create");
+        free(bfd);
+        return -1;
+    }
+    sr->bfd = bfd;
+    return 0;
+} /* -- sr_bfd_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_close(..)
+ * Scope: Global
+ *
+ * Dead next hops are left marked dead.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_bfd_close(struct sr_instance* sr)
+{
+    struct sr_bfd* bfd = sr->bfd;
+
+    if (!bfd)
+    { return; }
+
+    pthread_mutex_lock(&bfd->lock);
+    bfd->stop = 1;
+    pthread_cond_signal(&bfd->wake);
+    pthread_mutex_unlock(&bfd->lock);
+    pthread_join(bfd->thread, 0);
+    sr->bfd = 0;
+
+    pthread_mutex_destroy(&bfd->lock);
+    pthread_cond_destroy(&bfd->wake);
+    free(bfd);
+} /* -- sr_bfd_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bfd_ctl(..)
+ * Scope: Global
+ *
+ * "bfd" lists the sessions.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_bfd_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_bfd* bfd = sr->bfd;
+    const struct sr_bfd_session* s;
+    struct in_addr a;
+    uint64_t now = sr_bfd_now();
+    int i;
+
+    if (argc != 1)
+    { return -1; }
+    if (!bfd)
+    {
+        fprintf(out, "failure detection is off\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&bfd->lock);
+    fprintf(out, "interval %u ms detect x%d bad packets %lu\n",
+            bfd->interval / 1000, SR_BFD_MULT, bfd->rx_bad);
+    for (i = 0; i < SR_BFD_MAX_SESSIONS; i++)
+    {
+        s = &bfd->s[i];
+        if (!s->used)
+        { continue; }
+        a.s_addr = s->gw;
+        fprintf(out, "%s %s %s for %.1f s disc %u/%u tx %lu rx %lu up %lu down %lu",
+                inet_ntoa(a), s->iface, sr_bfd_state_name[s->state],
+                (now - s->changed) / 1e6, s->my_disc, s->remote_disc,
+                s->tx, s->rx, s->ups, s->downs);
+        if (s->state == sr_bfd_up)
+        {
+            fprintf(out, " detect %.1f ms",
+                    s->remote_mult * sr_bfd_max(bfd->interval, s->remote_min_tx) / 1e3);
+        }
+        else if (s->diag)
+        { fprintf(out, " diag %d", s->diag); }
+        fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(&bfd->lock);
+
+    return 0;
+} /* -- sr_bfd_ctl -- */
@@ -0,0 +1,103 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bfd.h
+ *
+ * Description:
+ *
+ * Next hop failure detection after BFD (RFC 5880, single hop as in RFC
+ * 5881), so that a dead neighbour is noticed in a few tens of
+ * milliseconds rather than after the five one-second ARP retries that
+ * were the only sign of it before.
+ *
+ * A session runs with each gateway of the rtable (primary or backup) and
+ * with any neighbour that opens one with us. Each side sends a control
+ * packet every interval over UDP 3784 with a TTL of 255, which is also
+ * what a packet must arrive with to be believed. A session comes up by
+ * the three-way handshake of RFC 5880 6.2, and goes down when nothing is
+ * heard from the neighbour for SR_BFD_MULT of its intervals or it says
+ * it is going down.
+ *
+ * When a session that was up goes down, its gateway is marked dead with
+ * sr_rt_nh_state(), and lookups move to each route's backup, or to the
+ * next less specific route, at once and whatever the number of routes
+ * involved (sr_rt.h). It is marked alive again when the session is back
+ * up. A session that never came up, e.g. with a host that does not speak
+ * BFD, changes nothing.
+ *
+ * Not done: echo mode, demand mode, authentication, and the poll
+ * sequence for changing intervals (a poll from the neighbour is answered
+ * with the final bit, but the rates here are fixed).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BFD_H
+#define SR_BFD_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_bfd;
+
+#define SR_BFD_PORT          3784
+#define SR_BFD_SRC_PORT      49152   /* first source port, RFC 5881 4 */
+#define SR_BFD_VERSION       1
+#define SR_BFD_MULT          3       /* intervals missed before a session is down */
+#define SR_BFD_SLOW_MS       1000    /* interval while a session is not up */
+#define SR_BFD_DEFAULT_MS    50
+#define SR_BFD_MAX_SESSIONS  64
+
+enum sr_bfd_state
+{
+    sr_bfd_admin_down = 0,
+    sr_bfd_down       = 1,
+    sr_bfd_init       = 2,
+    sr_bfd_up         = 3
+};
+
+enum sr_bfd_diag
+{
+    sr_bfd_diag_none          = 0,
+    sr_bfd_diag_expired       = 1,   /* control detection time expired */
+    sr_bfd_diag_neighbor_down = 3    /* neighbour signaled session down */
+};
+
+/* flags, below the state in the second byte */
+#define SR_BFD_F_POLL   0x20
+#define SR_BFD_F_FINAL  0x10
+
+/* the mandatory section of a control packet; all fields network order,
+   intervals in microseconds */
+struct sr_bfd_hdr
+{
+    uint8_t  vers_diag;            /* version << 5 | diagnostic */
+    uint8_t  state_flags;          /* state << 6 | flags */
+    uint8_t  mult;
+    uint8_t  len;
+    uint32_t my_disc;
+    uint32_t your_disc;
+    uint32_t min_tx;               /* desired min TX interval */
+    uint32_t min_rx;               /* required min RX interval */
+    uint32_t min_echo_rx;          /* 0: no echo */
+} __attribute__ ((packed)) ;
+
+/* Start sessions with the gateways of sr's routing table, sending every
+   interval_ms once up. Call once the interfaces and the rtable are
+   loaded. Returns 0 on success and sets sr->bfd. */
+int  sr_bfd_open(struct sr_instance* sr, unsigned int interval_ms);
+void sr_bfd_close(struct sr_instance* sr);
+
+/* A UDP frame to port SR_BFD_PORT received on iface. */
+void sr_bfd_input(struct sr_bfd* bfd, uint8_t* packet, unsigned int len,
+                  const char* iface);
+
+/* control socket "bfd" command */
+int sr_bfd_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_BFD_H -- */
@@ -0,0 +1,488 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Asynchronous pcap writer. See sr_capture.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_router.h"
+
+/* A snapshot as it sits in the ring */
+struct sr_capture_rec
+{
+    struct pcap_sf_pkthdr hdr;
+    uint8_t data[PACKET_DUMP_SIZE];
+};
+
+static void* sr_capture_writer(void* );
+static int   sr_capture_next_file(struct sr_capture* );
+static void  sr_capture_flush(struct sr_capture* );
+static int   sr_capture_match(const struct sr_capture_filter* ,
+                              const uint8_t* , unsigned int );
+static int   sr_capture_prefix(const char* , uint32_t* , uint32_t* );
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_policy_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_policy_init(struct sr_capture_policy* policy)
+{
+    /* -- REQUIRES -- */
+    assert(policy);
+
+    memset(policy, 0, sizeof(*policy));
+    policy->sample = 1;
+    policy->snaplen = PACKET_DUMP_SIZE;
+    policy->filter.proto = -1;
+} /* -- sr_capture_policy_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_compile(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_compile(struct sr_capture_filter* filter, const char* expr)
+{
+    char* copy;
+    char* tok;
+    char* arg;
+    char* end;
+    uint16_t ethertype = 0;
+    long proto;
+    int rc = 0;
+
+    /* -- REQUIRES -- */
+    assert(filter);
+    assert(expr);
+
+    memset(filter, 0, sizeof(*filter));
+    filter->proto = -1;
+
+    if ((copy = strdup(expr)) == 0)
+    { return -1; }
+
+    for (tok = strtok(copy, " \t"); tok && rc == 0; tok = strtok(0, " \t"))
+    {
+        if (strcmp(tok, "and") == 0)
+        { continue; }
+        else if (strcmp(tok, "arp") == 0)
+        { ethertype = ethertype_arp; }
+        else if (strcmp(tok, "ip") == 0)
+        { ethertype = ethertype_ip; }
+        else if (strcmp(tok, "icmp") == 0)
+        { filter->proto = ip_protocol_icmp; }
+        else if (strcmp(tok, "tcp") == 0)
+        { filter->proto = ip_protocol_tcp; }
+        else if (strcmp(tok, "udp") == 0)
+        { filter->proto = ip_protocol_udp; }
+        else if (strcmp(tok, "proto") == 0 ||
+                 strcmp(tok, "src") == 0 ||
+                 strcmp(tok, "dst") == 0 ||
+                 strcmp(tok, "net") == 0)
+        {
+            if ((arg = strtok(0, " \t")) == 0)
+            {
+                fprintf(stderr, "Capture filter: '%s' needs an argument\n", tok);
+                rc = -1;
+            }
+            else if (tok[0] == 'p')
+            {
+                proto = strtol(arg, &end, 0);
+                if (*end != 0 || proto < 0 || proto > 255)
+                {
+                    fprintf(stderr, "Capture filter: bad protocol '%s'\n", arg);
+                    rc = -1;
+                }
+                filter->proto = (int)proto;
+            }
+            else if (tok[0] == 's')
+            { rc = sr_capture_prefix(arg, &filter->src, &filter->src_mask); }
+            else if (tok[0] == 'd')
+            { rc = sr_capture_prefix(arg, &filter->dst, &filter->dst_mask); }
+            else
+            { rc = sr_capture_prefix(arg, &filter->net, &filter->net_mask); }
+        }
+        else
+        {
+            fprintf(stderr, "Capture filter: unknown term '%s'\n", tok);
+            rc = -1;
+        }
+    }
+    free(copy);
+
+    if (rc != 0)
+    { return -1; }
+
+    filter->ip_terms = filter->proto >= 0 || filter->src_mask ||
+                       filter->dst_mask || filter->net_mask;
+    if (filter->ip_terms)
+    {
+        if (ethertype == ethertype_arp)
+        {
+            fprintf(stderr, "Capture filter: arp can't match IP terms\n");
+            return -1;
+        }
+        ethertype = ethertype_ip;
+    }
+    filter->ethertype = htons(ethertype);
+
+    return 0;
+} /* -- sr_capture_compile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_capture* sr_capture_open(const char* fname,
+                                   unsigned long rotate_bytes,
+                                   unsigned int rotate_secs,
+                                   const struct sr_capture_policy* policy)
+{
+    struct sr_capture* cap;
+
+    /* -- REQUIRES -- */
+    assert(fname);
+
+    cap = (struct sr_capture*)calloc(1, sizeof(struct sr_capture));
+    if (cap == 0)
+    { return 0; }
+
+    if (policy)
+    { cap->policy = *policy; }
+    else
+    { sr_capture_policy_init(&cap->policy); }
+    if (cap->policy.snaplen == 0 || cap->policy.snaplen > PACKET_DUMP_SIZE)
+    { cap->policy.snaplen = PACKET_DUMP_SIZE; }
+
+    cap->fname = strdup(fname);
+    cap->batch = (unsigned char*)malloc(SR_CAPTURE_BATCH_BYTES);
+    if (cap->fname == 0 || cap->batch == 0 ||
+        sr_ring_init(&cap->ring, SR_CAPTURE_SLOTS,
+                     sizeof(struct sr_capture_rec)) != 0)
+    {
+        fprintf(stderr, "sr_capture_open: out of memory\n");
+        free(cap->fname);
+        free(cap->batch);
+        free(cap);
+        return 0;
+    }
+
+    /* rotating stdout makes no sense */
+    if (strcmp(fname, "-") != 0)
+    {
+        cap->rotate_bytes = rotate_bytes;
+        cap->rotate_secs = rotate_secs;
+    }
+
+    if (sr_capture_next_file(cap) != 0)
+    {
+        sr_ring_destroy(&cap->ring);
+        free(cap->fname);
+        free(cap->batch);
+        free(cap);
+        return 0;
+    }
+
+    if (pthread_create(&cap->thread, 0, sr_capture_writer, cap) != 0)
+    {
+        perror("pthread_create");
+        sr_dump_close(cap->fp);
+        sr_ring_destroy(&cap->ring);
+        free(cap->fname);
+        free(cap->batch);
+        free(cap);
+        return 0;
+    }
+
+    return cap;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, const char* iface)
+{
+    const struct sr_capture_policy* policy = &cap->policy;
+    struct sr_capture_rec* rec;
+    struct timeval tv;
+    unsigned int size, i;
+
+    /* -- cheap rejections first, before we touch the clock or the ring -- */
+    if (policy->n_ifaces)
+    {
+        for (i = 0; i < policy->n_ifaces; i++)
+        {
+            if (strncmp(policy->ifaces[i], iface, sr_IFACE_NAMELEN) == 0)
+            { break; }
+        }
+        if (i == policy->n_ifaces)
+        { return; }
+    }
+
+    if (policy->filter.ethertype &&
+        !sr_capture_match(&policy->filter, buf, len))
+    { return; }
+
+    if (policy->sample > 1 &&
+        __atomic_fetch_add(&cap->matched, 1, __ATOMIC_RELAXED) % policy->sample)
+    { return; }
+
+    rec = (struct sr_capture_rec*)sr_ring_claim(&cap->ring);
+    if (rec == 0)
+    {
+        __atomic_fetch_add(&cap->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size = min(policy->snaplen, len);
+
+    gettimeofday(&tv, 0);
+    rec->hdr.ts.tv_sec  = tv.tv_sec;
+    rec->hdr.ts.tv_usec = tv.tv_usec;
+    rec->hdr.caplen = size;
+    rec->hdr.len = len;
+    memcpy(rec->data, buf, size);
+
+    sr_ring_publish(&cap->ring, rec);
+} /* -- sr_capture_packet -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_capture* cap)
+{
+    if (cap == 0)
+    { return; }
+
+    __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(cap->thread, 0);
+
+    if (cap->dropped)
+    {
+        fprintf(stderr, "Capture: %lu packets written, %lu dropped (ring full)\n",
+                cap->written, cap->dropped);
+    }
+
+    if (cap->fp)
+    { sr_dump_close(cap->fp); }
+    sr_ring_destroy(&cap->ring);
+    free(cap->fname);
+    free(cap->batch);
+    free(cap);
+} /* -- sr_capture_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_writer(..)
+ * Scope: Local
+ *
+ * Writer thread: drain the ring into the batch buffer, write the batch
+ * out whenever it fills or the ring runs dry, and rotate files as
+ * configured. Exits once asked to stop and the ring is empty.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_capture_writer(void* arg)
+{
+    struct sr_capture* cap = (struct sr_capture*)arg;
+    struct sr_capture_rec* rec;
+    struct timespec idle;
+    size_t size;
+    int stop;
+
+    idle.tv_sec = 0;
+    idle.tv_nsec = SR_CAPTURE_IDLE_US * 1000;
+
+    for (;;)
+    {
+        /* read the flag first so nothing published before it is missed */
+        stop = __atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE);
+
+        while ((rec = (struct sr_capture_rec*)sr_ring_peek(&cap->ring)) != 0)
+        {
+            size = sizeof(rec->hdr) + rec->hdr.caplen;
+
+            if (cap->rotate_bytes &&
+                cap->file_bytes + cap->batch_len + size > cap->rotate_bytes &&
+                cap->file_bytes + cap->batch_len > sizeof(struct pcap_file_header))
+            {
+                sr_capture_flush(cap);
+                sr_capture_next_file(cap);
+            }
+            if (cap->batch_len + size > SR_CAPTURE_BATCH_BYTES)
+            { sr_capture_flush(cap); }
+
+            memcpy(cap->batch + cap->batch_len, rec, size);
+            cap->batch_len += size;
+            cap->written++;
+
+            sr_ring_release(&cap->ring);
+        }
+
+        sr_capture_flush(cap);
+
+        if (cap->rotate_secs &&
+            difftime(time(0), cap->file_opened) >= cap->rotate_secs)
+        { sr_capture_next_file(cap); }
+
+        if (stop)
+        { break; }
+
+        nanosleep(&idle, 0);
+    }
+
+    return 0;
+} /* -- sr_capture_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_flush(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_capture_flush(struct sr_capture* cap)
+{
+    if (cap->batch_len == 0 || cap->fp == 0)
+    { return; }
+
+    if (fwrite(cap->batch, cap->batch_len, 1, cap->fp) != 1)
+    { fprintf(stderr, "Capture: error writing %s\n", cap->fname); }
+    fflush(cap->fp);
+
+    cap->file_bytes += cap->batch_len;
+    cap->batch_len = 0;
+} /* -- sr_capture_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_next_file(..)
+ * Scope: Local
+ *
+ * Open the first capture file, or close the current one and move on to
+ * the next in the rotation.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_next_file(struct sr_capture* cap)
+{
+    char name[BUFSIZ];
+
+    if (cap->fp)
+    {
+        sr_dump_close(cap->fp);
+        cap->fp = 0;
+    }
+    if (cap->file_opened)
+    { cap->file_no++; }
+
+    if (cap->file_no == 0)
+    { snprintf(name, sizeof(name), "%s", cap->fname); }
+    else
+    { snprintf(name, sizeof(name), "%s.%u", cap->fname, cap->file_no); }
+
+    cap->file_opened = time(0);
+    if ((cap->fp = sr_dump_open(name, 0, cap->policy.snaplen)) == 0)
+    { return -1; }
+
+    cap->file_bytes = sizeof(struct pcap_file_header);
+    return 0;
+} /* -- sr_capture_next_file -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_match(..)
+ * Scope: Local
+ *
+ * Run the compiled filter over a frame. Only called when the filter has
+ * at least an ethertype.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_match(const struct sr_capture_filter* f,
+                            const uint8_t* buf, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)buf;
+    const sr_ip_hdr_t* ip;
+
+    if (len < sizeof(sr_ethernet_hdr_t) || eth->ether_type != f->ethertype)
+    { return 0; }
+    if (!f->ip_terms)
+    { return 1; }
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+    { return 0; }
+    ip = (const sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+
+    if (f->proto >= 0 && ip->ip_p != f->proto)
+    { return 0; }
+    if ((ip->ip_src & f->src_mask) != f->src ||
+        (ip->ip_dst & f->dst_mask) != f->dst)
+    { return 0; }
+    if ((ip->ip_src & f->net_mask) != f->net &&
+        (ip->ip_dst & f->net_mask) != f->net)
+    { return 0; }
+
+    return 1;
+} /* -- sr_capture_match -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_prefix(..)
+ * Scope: Local
+ *
+ * Parse a.b.c.d[/len] into a network order address and mask.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_capture_prefix(const char* str, uint32_t* addr, uint32_t* mask)
+{
+    char buf[32];
+    char* slash;
+    char* end;
+    struct in_addr in;
+    long plen = 32;
+
+    strncpy(buf, str, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    if ((slash = strchr(buf, '/')) != 0)
+    {
+        *slash++ = 0;
+        plen = strtol(slash, &end, 10);
+        if (*slash == 0 || *end != 0 || plen < 0 || plen > 32)
+        {
+            fprintf(stderr, "Capture filter: bad prefix length in '%s'\n", str);
+            return -1;
+        }
+    }
+    if (inet_aton(buf, &in) == 0)
+    {
+        fprintf(stderr, "Capture filter: bad address '%s'\n", str);
+        return -1;
+    }
+
+    *mask = plen ? htonl(0xffffffffUL << (32 - plen)) : 0;
+    *addr = in.s_addr & *mask;
+    return 0;
+} /* -- sr_capture_prefix -- */
@@ -0,0 +1,119 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Packet capture off the packet path. sr_capture_packet() takes a
+ * timestamped snapshot of the frame into a lock-free ring and returns;
+ * a background writer thread drains the ring into the pcap file in large
+ * batched writes. If the ring is full the snapshot is dropped and
+ * counted, so a slow disk costs us capture fidelity rather than
+ * forwarding throughput.
+ *
+ * The file can optionally be rotated once it reaches a size or age, as
+ * tcpdump -C/-G does. Rotated files are named <file>.1, <file>.2, ...
+ *
+ * A capture policy narrows what is captured: only some interfaces, 1 in
+ * N packets, the first snaplen bytes, and a compiled filter on ethertype,
+ * IP protocol and addresses. Policy checks run before anything is
+ * timestamped or copied, so rejected packets cost a few compares.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+#include "sr_ring.h"
+
+#define SR_CAPTURE_SLOTS       4096       /* snapshots the ring can hold */
+#define SR_CAPTURE_BATCH_BYTES (1 << 20)  /* bytes per write to the file */
+#define SR_CAPTURE_IDLE_US     1000       /* writer poll interval when idle */
+#define SR_CAPTURE_MAX_IFACES  8          /* interfaces a policy can name */
+
+/* Compiled capture filter; every term has to match. Addresses, masks and
+   the ethertype are kept in network byte order so they compare directly
+   against the headers. */
+struct sr_capture_filter
+{
+    uint16_t ethertype;          /* 0: any */
+    int proto;                   /* IP protocol, -1: any */
+    int ip_terms;                /* any of proto/src/dst/net set */
+    uint32_t src, src_mask;
+    uint32_t dst, dst_mask;
+    uint32_t net, net_mask;      /* either source or destination */
+};
+
+struct sr_capture_policy
+{
+    unsigned int sample;         /* keep 1 in N matching packets, 0/1: all */
+    unsigned int snaplen;        /* bytes kept per packet */
+    unsigned int n_ifaces;       /* 0: every interface */
+    char ifaces[SR_CAPTURE_MAX_IFACES][sr_IFACE_NAMELEN];
+    struct sr_capture_filter filter;
+};
+
+struct sr_capture
+{
+    struct sr_capture_policy policy;
+    unsigned long matched;       /* packets that passed the policy */
+    struct sr_ring ring;         /* snapshots on their way to the writer */
+    unsigned long dropped;       /* snapshots lost to a full ring */
+
+    /* -- writer thread only -- */
+    char* fname;
+    FILE* fp;
+    unsigned int file_no;        /* rotation count, 0 for the first file */
+    unsigned long file_bytes;    /* bytes in the current file */
+    time_t file_opened;
+    unsigned long rotate_bytes;  /* 0: don't rotate on size */
+    unsigned int rotate_secs;    /* 0: don't rotate on age */
+    unsigned long written;       /* snapshots written */
+    unsigned char* batch;
+    size_t batch_len;
+
+    int stop;
+    pthread_t thread;
+};
+
+/* Capture everything, full PACKET_DUMP_SIZE snapshots. */
+void sr_capture_policy_init(struct sr_capture_policy* policy);
+
+/* Compile a filter expression: space separated terms, all of which must
+   match (an "and" between them is allowed and ignored).
+
+     arp | ip | icmp | tcp | udp | proto <n>
+     src <prefix> | dst <prefix> | net <prefix>
+
+   where prefix is a.b.c.d[/len]. Returns 0 on success, -1 with a message
+   on stderr otherwise. */
+int sr_capture_compile(struct sr_capture_filter* filter, const char* expr);
+
+/* Open fname ("-" for stdout) and start the writer. policy may be NULL
+   to capture everything. Returns NULL on error. */
+struct sr_capture* sr_capture_open(const char* fname,
+                                   unsigned long rotate_bytes,
+                                   unsigned int rotate_secs,
+                                   const struct sr_capture_policy* policy);
+
+/* Snapshot a frame seen on iface, if the policy wants it. Never blocks;
+   safe from any thread. */
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, const char* iface);
+
+/* Write out what is queued, stop the writer and close the file. */
+void sr_capture_close(struct sr_capture* cap);
+
+#endif /* -- SR_CAPTURE_H -- */
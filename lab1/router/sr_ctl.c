@@ -0,0 +1,279 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.c
+ *
+ * Description:
+ *
+ * UNIX domain control socket. See sr_ctl.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "sr_ctl.h"
+
+#define SR_CTL_CLIENT_TIMEOUT 10  /* seconds a client may sit idle */
+
+struct sr_ctl_cmd
+{
+    const char* name;
+    const char* usage;
+    sr_ctl_handler fn;
+    void* arg;
+};
+
+static struct sr_ctl_cmd sr_ctl_cmds[SR_CTL_MAX_CMDS];
+static int sr_ctl_n_cmds;
+static sr_ctl_hangup sr_ctl_hangups[SR_CTL_MAX_CMDS];
+static void* sr_ctl_hangup_args[SR_CTL_MAX_CMDS];
+static int sr_ctl_n_hangups;
+static pthread_mutex_t sr_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sr_ctl_fd = -1;
+static int sr_ctl_stop;
+static char sr_ctl_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static pthread_t sr_ctl_thread;
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_register(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ctl_register(const char* name, const char* usage,
+                    sr_ctl_handler fn, void* arg)
+{
+    pthread_mutex_lock(&sr_ctl_lock);
+    if (sr_ctl_n_cmds == SR_CTL_MAX_CMDS)
+    {
+        pthread_mutex_unlock(&sr_ctl_lock);
+        fprintf(stderr, "sr_ctl_register: too many commands for %s\n", name);
+        return -1;
+    }
+    sr_ctl_cmds[sr_ctl_n_cmds].name = name;
+    sr_ctl_cmds[sr_ctl_n_cmds].usage = usage;
+    sr_ctl_cmds[sr_ctl_n_cmds].fn = fn;
+    sr_ctl_cmds[sr_ctl_n_cmds].arg = arg;
+    sr_ctl_n_cmds++;
+    pthread_mutex_unlock(&sr_ctl_lock);
+
+    return 0;
+} /* -- sr_ctl_register -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_on_hangup(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ctl_on_hangup(sr_ctl_hangup fn, void* arg)
+{
+    pthread_mutex_lock(&sr_ctl_lock);
+    if (sr_ctl_n_hangups == SR_CTL_MAX_CMDS)
+    {
+        pthread_mutex_unlock(&sr_ctl_lock);
+        fprintf(stderr, "sr_ctl_on_hangup: too many hooks\n");
+        return -1;
+    }
+    sr_ctl_hangups[sr_ctl_n_hangups] = fn;
+    sr_ctl_hangup_args[sr_ctl_n_hangups] = arg;
+    sr_ctl_n_hangups++;
+    pthread_mutex_unlock(&sr_ctl_lock);
+
+    return 0;
+} /* -- sr_ctl_on_hangup -- */
+
+/* run one command line */
+static void sr_ctl_dispatch(char* line, FILE* out)
+{
+    char* argv[SR_CTL_MAX_ARGS];
+    char* save = 0;
+    char* tok;
+    int argc = 0, i;
+    struct sr_ctl_cmd cmd;
+
+    for (tok = strtok_r(line, " \t\r\n", &save);
+         tok && argc < SR_CTL_MAX_ARGS;
+         tok = strtok_r(0, " \t\r\n", &save))
+    { argv[argc++] = tok; }
+    if (argc == 0)
+    { return; }
+
+    pthread_mutex_lock(&sr_ctl_lock);
+    if (strcmp(argv[0], "help") == 0)
+    {
+        for (i = 0; i < sr_ctl_n_cmds; i++)
+        { fprintf(out, "%s\n", sr_ctl_cmds[i].usage); }
+        pthread_mutex_unlock(&sr_ctl_lock);
+        return;
+    }
+    for (i = 0; i < sr_ctl_n_cmds; i++)
+    {
+        if (strcmp(argv[0], sr_ctl_cmds[i].name) == 0)
+        { break; }
+    }
+    if (i == sr_ctl_n_cmds)
+    {
+        pthread_mutex_unlock(&sr_ctl_lock);
+        fprintf(out, "error: unknown command %s, try help\n", argv[0]);
+        return;
+    }
+    cmd = sr_ctl_cmds[i];
+    pthread_mutex_unlock(&sr_ctl_lock);
+
+    if (cmd.fn(cmd.arg, argc, argv, out) != 0)
+    { fprintf(out, "error: %s\n", cmd.usage); }
+}
+
+/* talk to one client until it hangs up or goes quiet */
+static void sr_ctl_serve(int fd)
+{
+    struct timeval tv;
+    char line[SR_CTL_LINE];
+    FILE* in;
+    FILE* out;
+    int dupfd, i;
+
+    tv.tv_sec = SR_CTL_CLIENT_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if ((dupfd = dup(fd)) < 0)
+    {
+        close(fd);
+        return;
+    }
+    in = fdopen(fd, "r");
+    out = fdopen(dupfd, "w");
+    if (!in || !out)
+    {
+        if (in) { fclose(in); } else { close(fd); }
+        if (out) { fclose(out); } else { close(dupfd); }
+        return;
+    }
+
+    while (!__atomic_load_n(&sr_ctl_stop, __ATOMIC_ACQUIRE) &&
+           fgets(line, sizeof(line), in))
+    {
+        if (!strchr(line, '\n') && !feof(in))
+        {
+            /* throw the rest of the line away */
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n');
+            fprintf(out, "error: line longer than %d bytes\n", SR_CTL_LINE - 1);
+        }
+        else
+        { sr_ctl_dispatch(line, out); }
+        if (fflush(out) != 0)
+        { break; }
+    }
+
+    fclose(in);
+    fclose(out);
+
+    pthread_mutex_lock(&sr_ctl_lock);
+    for (i = 0; i < sr_ctl_n_hangups; i++)
+    { sr_ctl_hangups[i](sr_ctl_hangup_args[i]); }
+    pthread_mutex_unlock(&sr_ctl_lock);
+}
+
+static void* sr_ctl_listener(void* arg)
+{
+    int fd;
+
+    while (!__atomic_load_n(&sr_ctl_stop, __ATOMIC_ACQUIRE))
+    {
+        fd = accept(sr_ctl_fd, 0, 0);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            { continue; }
+            break;
+        }
+        sr_ctl_serve(fd);
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ctl_open(const char* path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "sr_ctl_open: path too long: %s\n", path);
+        return -1;
+    }
+
+    /* a client that hangs up mid-answer must not kill the router */
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((sr_ctl_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(sr_ctl_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(sr_ctl_fd, 8) != 0)
+    {
+        perror(path);
+        close(sr_ctl_fd);
+        sr_ctl_fd = -1;
+        return -1;
+    }
+    strncpy(sr_ctl_path, path, sizeof(sr_ctl_path) - 1);
+
+    sr_ctl_stop = 0;
+    if (pthread_create(&sr_ctl_thread, 0, sr_ctl_listener, 0) != 0)
+    {
+        perror("pthread_create");
+        close(sr_ctl_fd);
+        sr_ctl_fd = -1;
+        unlink(sr_ctl_path);
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_ctl_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_close(..)
+ * Scope: Global
+ *
+ * A client in the middle of a session is cut off at its next command,
+ * or after SR_CTL_CLIENT_TIMEOUT at worst.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ctl_close(void)
+{
+    if (sr_ctl_fd < 0)
+    { return; }
+
+    __atomic_store_n(&sr_ctl_stop, 1, __ATOMIC_RELEASE);
+    shutdown(sr_ctl_fd, SHUT_RDWR);   /* wakes accept() */
+    pthread_join(sr_ctl_thread, 0);
+    close(sr_ctl_fd);
+    sr_ctl_fd = -1;
+    unlink(sr_ctl_path);
+} /* -- sr_ctl_close -- */
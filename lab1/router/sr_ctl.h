@@ -0,0 +1,45 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.h
+ *
+ * Description:
+ *
+ * UNIX domain control socket. A client connects and sends commands, one
+ * per line; each is answered in turn and the connection is closed when
+ * the client shuts down its side. A scraper can simply do
+ *
+ *   echo stats | nc -U /tmp/sr.ctl
+ *
+ * Commands are registered by name before or after the socket is opened.
+ * A handler writes its answer to out and returns 0, or writes nothing
+ * and returns -1 to have "error: <usage>" sent back. Handlers run on the
+ * control thread, one at a time.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CTL_H
+#define SR_CTL_H
+
+#include <stdio.h>
+
+#define SR_CTL_MAX_CMDS 32
+#define SR_CTL_MAX_ARGS 16
+#define SR_CTL_LINE     512   /* longest command line */
+
+typedef int (*sr_ctl_handler)(void* arg, int argc, char** argv, FILE* out);
+typedef void (*sr_ctl_hangup)(void* arg);
+
+/* usage is shown by "help" and after a failed command, e.g.
+   "route add <prefix>/<len> <gw> <iface>" */
+int sr_ctl_register(const char* name, const char* usage,
+                    sr_ctl_handler fn, void* arg);
+
+/* Have fn called on the control thread whenever a client goes away, to
+   drop whatever state its commands built up. */
+int sr_ctl_on_hangup(sr_ctl_hangup fn, void* arg);
+
+/* Listen on path, replacing any stale socket there. Returns 0 on
+   success. */
+int sr_ctl_open(const char* path);
+void sr_ctl_close(void);
+
+#endif /* -- SR_CTL_H -- */
@@ -0,0 +1,261 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * Path compressed binary trie for longest prefix match. See sr_fib.h.
+ *
+ * Every node carries the full prefix it stands for. A node's children
+ * extend its prefix and are told apart by the first bit past it, bit
+ * len of the key counting from the most significant. Nodes without a
+ * route exist only where two subtrees branch, so they always have both
+ * children.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "sr_fib.h"
+
+#define SR_FIB_BIT(key, i) (((key) >> (31 - (i))) & 1)
+
+static struct sr_fib_node* sr_fib_node_new(struct sr_fib* fib, uint32_t key,
+                                           int len, struct sr_rt* rt)
+{
+    struct sr_fib_node* n = (struct sr_fib_node*)malloc(sizeof(struct sr_fib_node));
+
+    if (!n)
+    { return 0; }
+    n->key = key;
+    n->len = len;
+    n->rt = rt;
+    n->child[0] = n->child[1] = 0;
+    fib->nodes++;
+    return n;
+}
+
+void sr_fib_init(struct sr_fib* fib)
+{
+    fib->root = 0;
+    fib->prefixes = 0;
+    fib->nodes = 0;
+}
+
+static void sr_fib_free_nodes(struct sr_fib_node* n)
+{
+    if (!n)
+    { return; }
+    sr_fib_free_nodes(n->child[0]);
+    sr_fib_free_nodes(n->child[1]);
+    free(n);
+}
+
+void sr_fib_clear(struct sr_fib* fib)
+{
+    sr_fib_free_nodes(fib->root);
+    sr_fib_init(fib);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t dst)
+{
+    const struct sr_fib_node* n = fib->root;
+    struct sr_rt* best = 0;
+    uint32_t key = ntohl(dst);
+
+    while (n && ((key ^ n->key) & SR_FIB_MASK(n->len)) == 0)
+    {
+        if (n->rt)
+        { best = n->rt; }
+        if (n->len == 32)
+        { break; }
+        n = n->child[SR_FIB_BIT(key, n->len)];
+    }
+    return best;
+} /* -- sr_fib_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_matches(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_fib_matches(const struct sr_fib* fib, uint32_t dst,
+                            struct sr_rt* out[33])
+{
+    const struct sr_fib_node* n = fib->root;
+    uint32_t key = ntohl(dst);
+    unsigned int count = 0;
+
+    while (n && ((key ^ n->key) & SR_FIB_MASK(n->len)) == 0)
+    {
+        if (n->rt)
+        { out[count++] = n->rt; }
+        if (n->len == 32)
+        { break; }
+        n = n->child[SR_FIB_BIT(key, n->len)];
+    }
+    return count;
+} /* -- sr_fib_matches -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_find(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_find(const struct sr_fib* fib, uint32_t prefix, int len)
+{
+    const struct sr_fib_node* n = fib->root;
+    uint32_t key = ntohl(prefix) & SR_FIB_MASK(len);
+
+    while (n && n->len <= len && ((key ^ n->key) & SR_FIB_MASK(n->len)) == 0)
+    {
+        if (n->len == len)
+        { return n->rt; }
+        n = n->child[SR_FIB_BIT(key, n->len)];
+    }
+    return 0;
+} /* -- sr_fib_find -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_insert(..)
+ * Scope: Global
+ *
+ * Walk down while the node's prefix covers the new one. Where it stops
+ * covering, the new prefix either covers the node and goes in above it,
+ * or the two part ways and a branching node goes in at the bit where
+ * they differ.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, int len, struct sr_rt* rt)
+{
+    struct sr_fib_node** pp = &fib->root;
+    struct sr_fib_node *n, *leaf, *branch;
+    uint32_t key = ntohl(prefix) & SR_FIB_MASK(len);
+    uint32_t diff;
+    int common;
+
+    while ((n = *pp))
+    {
+        diff = key ^ n->key;
+        common = diff ? __builtin_clz(diff) : 32;
+        if (common > len)
+        { common = len; }
+        if (common > n->len)
+        { common = n->len; }
+
+        if (common == n->len)
+        {
+            if (n->len == len)
+            {
+                if (!n->rt)
+                { fib->prefixes++; }
+                n->rt = rt;
+                return 0;
+            }
+            pp = &n->child[SR_FIB_BIT(key, n->len)];
+            continue;
+        }
+
+        if (!(leaf = sr_fib_node_new(fib, key, len, rt)))
+        { return -1; }
+        if (common == len)
+        {
+            /* the new prefix covers n */
+            leaf->child[SR_FIB_BIT(n->key, len)] = n;
+            *pp = leaf;
+        }
+        else
+        {
+            if (!(branch = sr_fib_node_new(fib, key & SR_FIB_MASK(common), common, 0)))
+            {
+                free(leaf);
+                fib->nodes--;
+                return -1;
+            }
+            branch->child[SR_FIB_BIT(key, common)] = leaf;
+            branch->child[SR_FIB_BIT(n->key, common)] = n;
+            *pp = branch;
+        }
+        fib->prefixes++;
+        return 0;
+    }
+
+    if (!(*pp = sr_fib_node_new(fib, key, len, rt)))
+    { return -1; }
+    fib->prefixes++;
+    return 0;
+} /* -- sr_fib_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_remove(..)
+ * Scope: Global
+ *
+ * A node left without a route and with fewer than two children has no
+ * reason to exist: it is replaced by its child, if any. Losing a child
+ * can do the same to a branching parent, so the check repeats upwards.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_remove(struct sr_fib* fib, uint32_t prefix, int len)
+{
+    struct sr_fib_node** path[33];
+    struct sr_fib_node** pp = &fib->root;
+    struct sr_fib_node *n, *c;
+    struct sr_rt* rt;
+    uint32_t key = ntohl(prefix) & SR_FIB_MASK(len);
+    int depth = 0;
+
+    while ((n = *pp) && n->len < len &&
+           ((key ^ n->key) & SR_FIB_MASK(n->len)) == 0)
+    {
+        path[depth++] = pp;
+        pp = &n->child[SR_FIB_BIT(key, n->len)];
+    }
+    if (!n || n->len != len || n->key != key || !n->rt)
+    { return 0; }
+
+    rt = n->rt;
+    n->rt = 0;
+    fib->prefixes--;
+
+    while (!n->rt && !(n->child[0] && n->child[1]))
+    {
+        c = n->child[0] ? n->child[0] : n->child[1];
+        *pp = c;
+        free(n);
+        fib->nodes--;
+        /* the parent only lost a child if n had none to hand it */
+        if (c || depth == 0)
+        { break; }
+        pp = path[--depth];
+        n = *pp;
+    }
+
+    return rt;
+} /* -- sr_fib_remove -- */
+
+static void sr_fib_walk_node(const struct sr_fib_node* n,
+                             void (*fn)(struct sr_rt* , void* ), void* arg)
+{
+    if (!n)
+    { return; }
+    if (n->rt)
+    { fn(n->rt, arg); }
+    sr_fib_walk_node(n->child[0], fn, arg);
+    sr_fib_walk_node(n->child[1], fn, arg);
+}
+
+void sr_fib_walk(const struct sr_fib* fib,
+                 void (*fn)(struct sr_rt* rt, void* arg), void* arg)
+{
+    sr_fib_walk_node(fib->root, fn, arg);
+} /* -- sr_fib_walk -- */
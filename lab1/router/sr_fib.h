@@ -0,0 +1,77 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ *
+ * Description:
+ *
+ * Longest prefix match over the routing table: a path compressed binary
+ * trie with one node per prefix plus at most one branching node for each,
+ * so a table of n routes has fewer than 2n nodes and a lookup visits at
+ * most 33. Routes are added and removed one at a time without rebuilding
+ * anything, which lets the table change under traffic.
+ *
+ * The trie only points at struct sr_rt entries owned by sr_rt.c and does
+ * no locking of its own; sr_rt.c serializes access with the routing table
+ * lock. Prefixes and addresses are in network byte order.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FIB_H
+#define SR_FIB_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_rt;
+
+/* host order netmask of a prefix length */
+#define SR_FIB_MASK(len) ((len) ? 0xffffffffU << (32 - (len)) : 0)
+
+struct sr_fib_node
+{
+    uint32_t key;                   /* host order, bits past len are 0 */
+    int len;
+    struct sr_rt* rt;               /* 0 for a branching node */
+    struct sr_fib_node* child[2];
+};
+
+struct sr_fib
+{
+    struct sr_fib_node* root;
+    unsigned long prefixes;
+    unsigned long nodes;
+};
+
+void sr_fib_init(struct sr_fib* fib);
+
+/* Free every node; the routes are left alone. */
+void sr_fib_clear(struct sr_fib* fib);
+
+/* Most specific route covering dst, or 0. */
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t dst);
+
+/* Every route covering dst, least specific first, into out. Returns how
+   many there are. */
+unsigned int sr_fib_matches(const struct sr_fib* fib, uint32_t dst,
+                            struct sr_rt* out[33]);
+
+/* The route for exactly prefix/len, or 0. */
+struct sr_rt* sr_fib_find(const struct sr_fib* fib, uint32_t prefix, int len);
+
+/* Point prefix/len at rt, replacing whatever it pointed at. Returns 0, or
+   -1 if a node could not be allocated. */
+int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, int len, struct sr_rt* rt);
+
+/* Take prefix/len out, returning the route it pointed at or 0. */
+struct sr_rt* sr_fib_remove(struct sr_fib* fib, uint32_t prefix, int len);
+
+/* Call fn on every route in address order, each prefix ahead of the more
+   specific ones inside it. */
+void sr_fib_walk(const struct sr_fib* fib,
+                 void (*fn)(struct sr_rt* rt, void* arg), void* arg);
+
+#endif /* -- SR_FIB_H -- */
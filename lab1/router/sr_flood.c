@@ -0,0 +1,442 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flood.c
+ *
+ * Description:
+ *
+ * Count-min sketches over a sliding window, top-K heaps and the drop
+ * set. See sr_flood.h.
+ *
+ * Everything is under flood->lock, taken once per packet; the window
+ * moves on lazily, from whichever packet first finds a slot over.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_flood.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+
+enum sr_flood_kind
+{
+    sr_flood_src = 0,
+    sr_flood_dst,
+    sr_flood_kinds
+};
+
+struct sr_flood_top
+{
+    uint32_t key;               /* network order */
+    uint32_t count;
+};
+
+struct sr_flood_sketch
+{
+    uint32_t slot[SR_FLOOD_SLOTS][SR_FLOOD_DEPTH][SR_FLOOD_WIDTH];
+    uint32_t total[SR_FLOOD_DEPTH][SR_FLOOD_WIDTH];   /* sum of the slots */
+    struct sr_flood_top top[SR_FLOOD_TOPK];           /* min-heap on count */
+    unsigned int n_top;
+    unsigned int threshold;     /* packets a second, 0 none */
+    unsigned long dropped;
+};
+
+struct sr_flood_drop
+{
+    uint32_t key;
+    uint8_t  kind;
+    uint8_t  used;
+    uint32_t count;             /* when it was last over */
+    uint64_t until_ns;
+};
+
+struct sr_flood
+{
+    struct sr_instance* sr;
+    pthread_mutex_t lock;
+    int cur;                    /* slot being counted into */
+    uint64_t next_ns;           /* when it ends */
+    struct sr_flood_sketch k[sr_flood_kinds];
+    struct sr_flood_drop drop[SR_FLOOD_DROP_MAX];
+    unsigned long offenders;    /* keys put in the drop set */
+};
+
+static const uint32_t sr_flood_seed[SR_FLOOD_DEPTH] =
+    { 0x9e3779b1, 0x85ebca6b, 0xc2b2ae35, 0x27d4eb2f };
+static const char* sr_flood_kind_name[sr_flood_kinds] = { "source", "destination" };
+
+static uint32_t sr_flood_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t sr_flood_count(const struct sr_flood_sketch* sk, uint32_t key)
+{
+    uint32_t c, min = 0xffffffff;
+    int r;
+
+    for (r = 0; r < SR_FLOOD_DEPTH; r++)
+    {
+        c = sk->total[r][sr_flood_hash(key ^ sr_flood_seed[r]) & (SR_FLOOD_WIDTH - 1)];
+        if (c < min)
+        { min = c; }
+    }
+    return min;
+}
+
+/* count one for key, returning its count over the window */
+static uint32_t sr_flood_add(struct sr_flood_sketch* sk, int cur, uint32_t key)
+{
+    uint32_t c, min = 0xffffffff;
+    unsigned int i;
+    int r;
+
+    for (r = 0; r < SR_FLOOD_DEPTH; r++)
+    {
+        i = sr_flood_hash(key ^ sr_flood_seed[r]) & (SR_FLOOD_WIDTH - 1);
+        sk->slot[cur][r][i]++;
+        if ((c = ++sk->total[r][i]) < min)
+        { min = c; }
+    }
+    return min;
+}
+
+static void sr_flood_sift_down(struct sr_flood_sketch* sk, unsigned int i)
+{
+    struct sr_flood_top t;
+    unsigned int c;
+
+    for (;;)
+    {
+        c = 2 * i + 1;
+        if (c >= sk->n_top)
+        { return; }
+        if (c + 1 < sk->n_top && sk->top[c + 1].count < sk->top[c].count)
+        { c++; }
+        if (sk->top[i].count <= sk->top[c].count)
+        { return; }
+        t = sk->top[i];
+        sk->top[i] = sk->top[c];
+        sk->top[c] = t;
+        i = c;
+    }
+}
+
+static void sr_flood_sift_up(struct sr_flood_sketch* sk, unsigned int i)
+{
+    struct sr_flood_top t;
+
+    while (i > 0 && sk->top[(i - 1) / 2].count > sk->top[i].count)
+    {
+        t = sk->top[i];
+        sk->top[i] = sk->top[(i - 1) / 2];
+        sk->top[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+/* key now counts count; a count only grows within a slot */
+static void sr_flood_top_update(struct sr_flood_sketch* sk, uint32_t key, uint32_t count)
+{
+    unsigned int i;
+
+    /* at or under the smallest of a full heap, it can't move anything:
+       if key is in there already, it is with this count */
+    if (sk->n_top == SR_FLOOD_TOPK && count <= sk->top[0].count)
+    { return; }
+
+    for (i = 0; i < sk->n_top; i++)
+    {
+        if (sk->top[i].key == key)
+        {
+            sk->top[i].count = count;
+            sr_flood_sift_down(sk, i);
+            return;
+        }
+    }
+    if (sk->n_top < SR_FLOOD_TOPK)
+    {
+        sk->top[sk->n_top].key = key;
+        sk->top[sk->n_top].count = count;
+        sr_flood_sift_up(sk, sk->n_top++);
+    }
+    else if (count > sk->top[0].count)
+    {
+        sk->top[0].key = key;
+        sk->top[0].count = count;
+        sr_flood_sift_down(sk, 0);
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flood_slide(..)
+ * Scope: Local
+ *
+ * Move the window on to now, dropping the slots that fell out of it,
+ * and count the top keys again from what is left.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_flood_slide(struct sr_flood* flood, uint64_t now)
+{
+    struct sr_flood_sketch* sk;
+    unsigned int i, n, moves = 0;
+    int k, r, w;
+
+    while (now >= flood->next_ns && moves++ < SR_FLOOD_SLOTS)
+    {
+        flood->cur = (flood->cur + 1) % SR_FLOOD_SLOTS;
+        flood->next_ns += SR_FLOOD_SLOT_MS * 1000000ULL;
+        for (k = 0; k < sr_flood_kinds; k++)
+        {
+            sk = &flood->k[k];
+            for (r = 0; r < SR_FLOOD_DEPTH; r++)
+            {
+                for (w = 0; w < SR_FLOOD_WIDTH; w++)
+                { sk->total[r][w] -= sk->slot[flood->cur][r][w]; }
+            }
+            memset(sk->slot[flood->cur], 0, sizeof(sk->slot[flood->cur]));
+        }
+    }
+    /* quiet for a whole window: it is all gone */
+    if (now >= flood->next_ns)
+    { flood->next_ns = now + SR_FLOOD_SLOT_MS * 1000000ULL; }
+
+    for (k = 0; k < sr_flood_kinds; k++)
+    {
+        sk = &flood->k[k];
+        for (i = 0, n = 0; i < sk->n_top; i++)
+        {
+            sk->top[n].key = sk->top[i].key;
+            if ((sk->top[n].count = sr_flood_count(sk, sk->top[i].key)) > 0)
+            { n++; }
+        }
+        sk->n_top = n;
+        for (i = n / 2; i-- > 0; )
+        { sr_flood_sift_down(sk, i); }
+    }
+}
+
+static struct sr_flood_drop* sr_flood_find(struct sr_flood* flood, int kind,
+                                           uint32_t key, uint64_t now)
+{
+    struct sr_flood_drop* d;
+    uint32_t h = sr_flood_hash(key ^ kind);
+    int i;
+
+    for (i = 0; i < SR_FLOOD_PROBE; i++)
+    {
+        d = &flood->drop[(h + i) & (SR_FLOOD_DROP_MAX - 1)];
+        if (d->used && d->kind == kind && d->key == key && d->until_ns > now)
+        { return d; }
+    }
+    return 0;
+}
+
+/* put key in the drop set for another SR_FLOOD_HOLD_S */
+static void sr_flood_offender(struct sr_flood* flood, int kind, uint32_t key,
+                              uint32_t count, uint64_t now)
+{
+    struct sr_flood_drop* d;
+    struct sr_flood_drop* slot = 0;
+    uint32_t h;
+    int i;
+
+    if (!(d = sr_flood_find(flood, kind, key, now)))
+    {
+        h = sr_flood_hash(key ^ kind);
+        for (i = 0; i < SR_FLOOD_PROBE; i++)
+        {
+            d = &flood->drop[(h + i) & (SR_FLOOD_DROP_MAX - 1)];
+            if (!slot || !d->used || d->until_ns < slot->until_ns)
+            { slot = d; }
+            if (!d->used || d->until_ns <= now)
+            { break; }
+        }
+        d = slot;
+        d->used = 1;
+        d->kind = kind;
+        d->key = key;
+        flood->offenders++;
+        if (kind == sr_flood_src)
+        {
+            SR_LOG(SR_LOG_WARN, "flood: dropping packets from %u.%u.%u.%u, %u in the last second",
+                   SR_LOG_IP(key), count);
+        }
+        else
+        {
+            SR_LOG(SR_LOG_WARN, "flood: dropping packets to %u.%u.%u.%u/%u, %u in the last second",
+                   SR_LOG_IP(key), SR_FLOOD_DST_LEN, count);
+        }
+    }
+    d->count = count;
+    d->until_ns = now + SR_FLOOD_HOLD_S * 1000000000ULL;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flood_check(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flood_check(struct sr_flood* flood, const uint8_t* packet, unsigned int len)
+{
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    struct sr_flood_sketch* sk;
+    uint32_t key[sr_flood_kinds];
+    uint32_t count;
+    uint64_t now = sr_stats_now_ns();
+    int k, drop = 0;
+
+    key[sr_flood_src] = ip->ip_src;
+    key[sr_flood_dst] = ip->ip_dst & htonl(0xffffffff << (32 - SR_FLOOD_DST_LEN));
+
+    pthread_mutex_lock(&flood->lock);
+    if (now >= flood->next_ns)
+    { sr_flood_slide(flood, now); }
+
+    for (k = 0; k < sr_flood_kinds; k++)
+    {
+        sk = &flood->k[k];
+        count = sr_flood_add(sk, flood->cur, key[k]);
+        sr_flood_top_update(sk, key[k], count);
+
+        if (sk->threshold && count > sk->threshold)
+        { sr_flood_offender(flood, k, key[k], count, now); }
+        else if (!sk->threshold || !sr_flood_find(flood, k, key[k], now))
+        { continue; }
+        sk->dropped++;
+        drop = 1;
+    }
+    pthread_mutex_unlock(&flood->lock);
+
+    return drop;
+} /* -- sr_flood_check -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flood_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flood_open(struct sr_instance* sr, unsigned int src_pps, unsigned int dst_pps)
+{
+    struct sr_flood* flood;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if (!(flood = (struct sr_flood*)calloc(1, sizeof(struct sr_flood))))
+    {
+        fprintf(stderr, "flood: out of memory\n");
+        return -1;
+    }
+    flood->sr = sr;
+    pthread_mutex_init(&flood->lock, 0);
+    flood->next_ns = sr_stats_now_ns() + SR_FLOOD_SLOT_MS * 1000000ULL;
+    flood->k[sr_flood_src].threshold = src_pps;
+    flood->k[sr_flood_dst].threshold = dst_pps;
+    sr->flood = flood;
+
+    SR_LOG(SR_LOG_INFO, "flood: dropping sources over %u pps, destinations over %u pps",
+           src_pps, dst_pps);
+    return 0;
+} /* -- sr_flood_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flood_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flood_close(struct sr_instance* sr)
+{
+    struct sr_flood* flood = sr->flood;
+
+    if (!flood)
+    { return; }
+    sr->flood = 0;
+    pthread_mutex_destroy(&flood->lock);
+    free(flood);
+} /* -- sr_flood_close -- */
+
+static int sr_flood_top_cmp(const void* a, const void* b)
+{
+    uint32_t x = ((const struct sr_flood_top*)a)->count;
+    uint32_t y = ((const struct sr_flood_top*)b)->count;
+
+    return x > y ? -1 : x < y;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flood_ctl(..)
+ * Scope: Global
+ *
+ * "flood" shows the heaviest sources and destinations of the last
+ * second and what is being dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flood_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_flood* flood = sr->flood;
+    struct sr_flood_top top[SR_FLOOD_TOPK];
+    struct sr_flood_sketch* sk;
+    struct sr_flood_drop* d;
+    struct in_addr a;
+    uint64_t now = sr_stats_now_ns();
+    unsigned int i, n;
+    int k;
+
+    if (argc != 1)
+    { return -1; }
+    if (!flood)
+    {
+        fprintf(out, "flood tracking is off\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&flood->lock);
+    if (now >= flood->next_ns)
+    { sr_flood_slide(flood, now); }
+    for (k = 0; k < sr_flood_kinds; k++)
+    {
+        sk = &flood->k[k];
+        fprintf(out, "%s: threshold %u pps, %lu packets dropped\n",
+                sr_flood_kind_name[k], sk->threshold, sk->dropped);
+        n = sk->n_top;
+        memcpy(top, sk->top, n * sizeof(struct sr_flood_top));
+        qsort(top, n, sizeof(struct sr_flood_top), sr_flood_top_cmp);
+        for (i = 0; i < n; i++)
+        {
+            a.s_addr = top[i].key;
+            fprintf(out, "  %-18s %10u\n", inet_ntoa(a), top[i].count);
+        }
+    }
+    fprintf(out, "drop set (%lu offenders so far):\n", flood->offenders);
+    for (i = 0; i < SR_FLOOD_DROP_MAX; i++)
+    {
+        d = &flood->drop[i];
+        if (!d->used || d->until_ns <= now)
+        { continue; }
+        a.s_addr = d->key;
+        fprintf(out, "  %-11s %s/%d %u pps, %.1f s left\n", sr_flood_kind_name[d->kind],
+                inet_ntoa(a), d->kind == sr_flood_dst ? SR_FLOOD_DST_LEN : 32, d->count,
+                (d->until_ns - now) / 1e9);
+    }
+    pthread_mutex_unlock(&flood->lock);
+
+    return 0;
+} /* -- sr_flood_ctl -- */
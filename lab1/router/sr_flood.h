@@ -0,0 +1,71 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flood.h
+ *
+ * Description:
+ *
+ * Heavy hitter tracking and flood mitigation in bounded memory. Under a
+ * scan or a flood the router used to answer every packet with its ICMP
+ * errors and ARP requests, with no idea who was sending them.
+ *
+ * Every IP packet that arrives is counted twice, by source address and
+ * by destination /SR_FLOOD_DST_LEN, in count-min sketches
+ * (SR_FLOOD_DEPTH rows of SR_FLOOD_WIDTH counters). Each kind of key has
+ * a sketch per SR_FLOOD_SLOT_MS of the last second and a running total
+ * of them, so a count is the packets of the last second, give or take a
+ * slot, read as the smallest of SR_FLOOD_DEPTH counters. A count-min
+ * sketch only ever overcounts, and by little for the keys that matter.
+ * The SR_FLOOD_TOPK biggest keys of each kind are kept in a heap.
+ *
+ * A source sending more than its threshold a second goes in the drop
+ * set and its packets are dropped on arrival, before the router does
+ * anything for them, until it has been under the threshold for
+ * SR_FLOOD_HOLD_S. The same goes for a destination prefix, if given a
+ * threshold too: traffic towards it is dropped, which sacrifices the
+ * target to keep the router answering for everyone else. The drop set
+ * holds SR_FLOOD_DROP_MAX keys; when it is full, the one due to leave
+ * first makes room.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOOD_H
+#define SR_FLOOD_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_flood;
+
+#define SR_FLOOD_DEPTH    4
+#define SR_FLOOD_WIDTH    2048    /* power of two */
+#define SR_FLOOD_SLOTS    4
+#define SR_FLOOD_SLOT_MS  250     /* SR_FLOOD_SLOTS of these make the window */
+#define SR_FLOOD_TOPK     16
+#define SR_FLOOD_DROP_MAX 256
+#define SR_FLOOD_PROBE    8
+#define SR_FLOOD_HOLD_S   10
+#define SR_FLOOD_DST_LEN  24
+
+/* Track heavy hitters, dropping sources above src_pps packets a second,
+   and destination prefixes above dst_pps; 0 only tracks. Returns 0 on
+   success and sets sr->flood. */
+int  sr_flood_open(struct sr_instance* sr, unsigned int src_pps,
+                   unsigned int dst_pps);
+void sr_flood_close(struct sr_instance* sr);
+
+/* Count an IP packet, header already checked. Returns 1 if it is from
+   or to an offender and should be dropped. */
+int  sr_flood_check(struct sr_flood* flood, const uint8_t* packet,
+                    unsigned int len);
+
+/* control socket "flood" command */
+int  sr_flood_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_FLOOD_H -- */
@@ -0,0 +1,684 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.c
+ *
+ * Description:
+ *
+ * Flow cache and IPFIX exporter. See sr_flow.h.
+ *
+ * Each cache entry carries its own spin lock, in the same cache line as
+ * the counters, so the packet path and the exporter's walk only ever
+ * contend for one flow at a time. The packet path looks for its flow
+ * without locks and locks only the slot it finds, checking the key
+ * again under the lock. A new flow goes in under the insert lock of its
+ * hash as well, so two packets of it can't both find it missing and
+ * take two slots. Flows pushed out of the cache go to the exporter
+ * through the pending list under flow->lock, which also guards stop.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_flow.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+
+#define SR_FLOW_PENDING  1024    /* pushed out flows waiting for export */
+#define SR_FLOW_FIELDS   13
+#define SR_FLOW_REC_LEN  52      /* bytes a data record takes */
+#define SR_FLOW_INSERT_LOCKS 1024 /* power of two */
+
+#ifdef CLOCK_REALTIME_COARSE
+#define SR_FLOW_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define SR_FLOW_CLOCK CLOCK_REALTIME
+#endif
+
+/* one cache line; addresses and ports in network order */
+struct sr_flow_entry
+{
+    uint32_t src;
+    uint32_t dst;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t  proto;
+    uint8_t  iface;             /* sr_stats index + 1, 0 unknown */
+    uint8_t  tos;
+    uint8_t  tcp_flags;         /* OR of all seen */
+    uint8_t  used;
+    uint8_t  lock;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first_ms;
+    uint64_t last_ms;
+} __attribute__ ((aligned (64)));
+
+/* a flow on its way out */
+struct sr_flow_rec
+{
+    struct sr_flow_entry e;
+    uint8_t reason;
+};
+
+struct sr_flow
+{
+    struct sr_instance* sr;
+    struct sr_flow_entry* table;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stop;
+    unsigned int n_pending;
+    struct sr_flow_rec pending[SR_FLOW_PENDING];
+    uint8_t insert_lock[SR_FLOW_INSERT_LOCKS];
+
+    /* the exporter's own */
+    uint8_t msg[SR_FLOW_MTU];
+    unsigned int msg_len;
+    unsigned int msg_recs;
+    unsigned int set_at;        /* where the data set starts in msg */
+    uint32_t seq;
+    time_t template_at;
+    struct sr_flow_rec out[SR_FLOW_PENDING];
+    unsigned int in_use;        /* at the last walk */
+    unsigned long records;
+    unsigned long messages;
+    unsigned long send_errors;
+
+    /* the packet path's, atomic */
+    unsigned long created;
+    unsigned long evicted;
+    unsigned long lost;         /* packets not counted */
+};
+
+/* (information element, length) of each field of a record, in order */
+static const uint16_t sr_flow_template[SR_FLOW_FIELDS][2] =
+{
+    {   8, 4 },     /* sourceIPv4Address */
+    {  12, 4 },     /* destinationIPv4Address */
+    {   7, 2 },     /* sourceTransportPort */
+    {  11, 2 },     /* destinationTransportPort */
+    {   4, 1 },     /* protocolIdentifier */
+    {   5, 1 },     /* ipClassOfService */
+    {   6, 1 },     /* tcpControlBits */
+    { 136, 1 },     /* flowEndReason */
+    {  10, 4 },     /* ingressInterface */
+    {   2, 8 },     /* packetDeltaCount */
+    {   1, 8 },     /* octetDeltaCount */
+    { 152, 8 },     /* flowStartMilliseconds */
+    { 153, 8 }      /* flowEndMilliseconds */
+};
+
+static uint64_t sr_flow_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(SR_FLOW_CLOCK, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sr_flow_spin_lock(uint8_t* lock)
+{
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+    { }
+}
+
+static void sr_flow_spin_unlock(uint8_t* lock)
+{
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static void sr_flow_lock_entry(struct sr_flow_entry* e)
+{
+    sr_flow_spin_lock(&e->lock);
+}
+
+static void sr_flow_unlock_entry(struct sr_flow_entry* e)
+{
+    sr_flow_spin_unlock(&e->lock);
+}
+
+static uint32_t sr_flow_hash(const struct sr_flow_entry* k)
+{
+    uint32_t h;
+
+    h = k->src * 0x9e3779b1;
+    h ^= k->dst;
+    h *= 0x85ebca6b;
+    h ^= ((uint32_t)k->sport << 16 | k->dport) ^ ((uint32_t)k->proto << 8 | k->iface);
+    h ^= h >> 15;
+    h *= 0x2c1b3c6d;
+    h ^= h >> 12;
+    return h;
+}
+
+static int sr_flow_same(const struct sr_flow_entry* a, const struct sr_flow_entry* b)
+{
+    return a->src == b->src && a->dst == b->dst && a->sport == b->sport &&
+           a->dport == b->dport && a->proto == b->proto && a->iface == b->iface;
+}
+
+/* Look for key's flow in its slots without locking them. The answer is
+   only a hint, to be checked under the slot's lock; on a miss, *spare is
+   the first free slot and *victim the one seen longest ago. */
+static struct sr_flow_entry* sr_flow_find(struct sr_flow* flow,
+                                          const struct sr_flow_entry* key, uint32_t h,
+                                          struct sr_flow_entry** spare,
+                                          struct sr_flow_entry** victim)
+{
+    struct sr_flow_entry* e;
+    int i;
+
+    *spare = *victim = 0;
+    for (i = 0; i < SR_FLOW_PROBE; i++)
+    {
+        e = &flow->table[(h + i) & (SR_FLOW_ENTRIES - 1)];
+        if (!__atomic_load_n(&e->used, __ATOMIC_RELAXED))
+        {
+            if (!*spare)
+            { *spare = e; }
+        }
+        else if (sr_flow_same(e, key))
+        { return e; }
+        else if (!*victim || e->last_ms < (*victim)->last_ms)
+        { *victim = e; }
+    }
+    return 0;
+}
+
+/* Count a packet of key's flow in e, if e still holds it. */
+static int sr_flow_hit(struct sr_flow_entry* e, const struct sr_flow_entry* key,
+                       uint16_t bytes, uint64_t now)
+{
+    sr_flow_lock_entry(e);
+    if (!e->used || !sr_flow_same(e, key))
+    {
+        sr_flow_unlock_entry(e);
+        return 0;
+    }
+    e->packets++;
+    e->bytes += bytes;
+    e->last_ms = now;
+    e->tcp_flags |= key->tcp_flags;
+    sr_flow_unlock_entry(e);
+    return 1;
+}
+
+static void sr_flow_put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void sr_flow_put32(uint8_t* p, uint32_t v)
+{
+    sr_flow_put16(p, v >> 16);
+    sr_flow_put16(p + 2, v);
+}
+
+static void sr_flow_put64(uint8_t* p, uint64_t v)
+{
+    sr_flow_put32(p, v >> 32);
+    sr_flow_put32(p + 4, v);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_account(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flow_account(struct sr_flow* flow, const uint8_t* packet,
+                     unsigned int len, int iface)
+{
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    const uint8_t* l4 = (const uint8_t*)ip + ip->ip_hl * 4;
+    const uint8_t* end = packet + len;
+    struct sr_flow_entry key, seen;
+    struct sr_flow_entry* e;
+    struct sr_flow_entry* victim;
+    struct sr_flow_entry* spare;
+    struct sr_flow_rec* out;
+    uint64_t now = sr_flow_now_ms();
+    uint16_t bytes = ntohs(ip->ip_len);
+    uint8_t* insert_lock;
+    uint32_t h;
+    int i;
+
+    memset(&key, 0, sizeof(key));
+    key.src = ip->ip_src;
+    key.dst = ip->ip_dst;
+    key.proto = ip->ip_p;
+    key.tos = ip->ip_tos;
+    if ((ntohs(ip->ip_off) & IP_OFFMASK) == 0)
+    {
+        if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) && l4 + 4 <= end)
+        {
+            memcpy(&key.sport, l4, 2);
+            memcpy(&key.dport, l4 + 2, 2);
+            if (ip->ip_p == ip_protocol_tcp && l4 + sizeof(sr_tcp_hdr_t) <= end)
+            { key.tcp_flags = ((const sr_tcp_hdr_t*)l4)->tcp_flags; }
+        }
+        else if (ip->ip_p == ip_protocol_icmp && l4 + 2 <= end)
+        { key.dport = htons(l4[0] << 8 | l4[1]); }
+    }
+    key.iface = iface < 0 ? 0 : iface + 1;
+
+    h = sr_flow_hash(&key);
+    if ((e = sr_flow_find(flow, &key, h, &spare, &victim)) &&
+        sr_flow_hit(e, &key, bytes, now))
+    { return; }
+
+    /* A new flow, or one that left while we looked. Look again under the
+       insert lock, which a second packet of the flow would wait on, then
+       lock the slot to take and make sure it is still what we saw: a free
+       slot still free, the oldest flow still there. */
+    insert_lock = &flow->insert_lock[h & (SR_FLOW_INSERT_LOCKS - 1)];
+    sr_flow_spin_lock(insert_lock);
+    for (i = 0; ; i++)
+    {
+        if (i == SR_FLOW_PROBE)
+        {
+            sr_flow_spin_unlock(insert_lock);
+            __atomic_fetch_add(&flow->lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if ((e = sr_flow_find(flow, &key, h, &spare, &victim)))
+        {
+            if (sr_flow_hit(e, &key, bytes, now))
+            {
+                sr_flow_spin_unlock(insert_lock);
+                return;
+            }
+            continue;
+        }
+        if (!spare)
+        { seen = *victim; }
+        e = spare ? spare : victim;
+        sr_flow_lock_entry(e);
+        if (!e->used || (!spare && sr_flow_same(e, &seen)))
+        { break; }
+        sr_flow_unlock_entry(e);
+    }
+
+    /* With the exporter that far behind, what the old flow has counted
+       is worth more than the new flow's first packet. */
+    if (e->used)
+    {
+        pthread_mutex_lock(&flow->lock);
+        if (flow->n_pending == SR_FLOW_PENDING)
+        {
+            pthread_mutex_unlock(&flow->lock);
+            sr_flow_unlock_entry(e);
+            sr_flow_spin_unlock(insert_lock);
+            __atomic_fetch_add(&flow->lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        out = &flow->pending[flow->n_pending++];
+        out->e = *e;
+        out->reason = sr_flow_end_resource;
+        if (flow->n_pending == SR_FLOW_PENDING / 2)
+        { pthread_cond_signal(&flow->wake); }
+        pthread_mutex_unlock(&flow->lock);
+        __atomic_fetch_add(&flow->evicted, 1, __ATOMIC_RELAXED);
+    }
+    key.used = 1;
+    key.lock = 1;               /* held */
+    key.packets = 1;
+    key.bytes = bytes;
+    key.first_ms = key.last_ms = now;
+    *e = key;
+    sr_flow_unlock_entry(e);
+    sr_flow_spin_unlock(insert_lock);
+    __atomic_fetch_add(&flow->created, 1, __ATOMIC_RELAXED);
+} /* -- sr_flow_account -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_flush(..)
+ * Scope: Local
+ *
+ * Send the message being built, if it has any records.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_flow_flush(struct sr_flow* flow)
+{
+    if (flow->msg_recs == 0)
+    { return; }
+
+    sr_flow_put16(flow->msg + flow->set_at + 2, flow->msg_len - flow->set_at);
+    sr_flow_put16(flow->msg, 10);                       /* version */
+    sr_flow_put16(flow->msg + 2, flow->msg_len);
+    sr_flow_put32(flow->msg + 4, (uint32_t)time(0));   /* export time */
+    sr_flow_put32(flow->msg + 8, flow->seq);
+    sr_flow_put32(flow->msg + 12, flow->sr->topo_id);   /* observation domain */
+
+    if (send(flow->fd, flow->msg, flow->msg_len, 0) != (ssize_t)flow->msg_len)
+    { flow->send_errors++; }
+    flow->messages++;
+    flow->records += flow->msg_recs;
+    flow->seq += flow->msg_recs;
+    flow->msg_len = 0;
+    flow->msg_recs = 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_add(..)
+ * Scope: Local
+ *
+ * Put a record in the message being built, starting one (with the
+ * template, when it is due) if need be.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_flow_add(struct sr_flow* flow, const struct sr_flow_rec* r)
+{
+    uint8_t* p;
+    time_t now;
+    int i;
+
+    if (r->e.packets == 0)
+    { return; }
+    if (flow->msg_len + SR_FLOW_REC_LEN > SR_FLOW_MTU)
+    { sr_flow_flush(flow); }
+
+    if (flow->msg_len == 0)
+    {
+        flow->msg_len = 16;
+        now = time(0);
+        if (flow->template_at == 0 || now - flow->template_at >= SR_FLOW_TEMPLATE_S)
+        {
+            p = flow->msg + flow->msg_len;
+            sr_flow_put16(p, 2);                        /* template set */
+            sr_flow_put16(p + 2, 8 + 4 * SR_FLOW_FIELDS);
+            sr_flow_put16(p + 4, SR_FLOW_TEMPLATE_ID);
+            sr_flow_put16(p + 6, SR_FLOW_FIELDS);
+            for (i = 0; i < SR_FLOW_FIELDS; i++)
+            {
+                sr_flow_put16(p + 8 + 4 * i, sr_flow_template[i][0]);
+                sr_flow_put16(p + 10 + 4 * i, sr_flow_template[i][1]);
+            }
+            flow->msg_len += 8 + 4 * SR_FLOW_FIELDS;
+            flow->template_at = now;
+        }
+        flow->set_at = flow->msg_len;
+        sr_flow_put16(flow->msg + flow->msg_len, SR_FLOW_TEMPLATE_ID);
+        flow->msg_len += 4;
+    }
+
+    p = flow->msg + flow->msg_len;
+    memcpy(p, &r->e.src, 4);
+    memcpy(p + 4, &r->e.dst, 4);
+    memcpy(p + 8, &r->e.sport, 2);
+    memcpy(p + 10, &r->e.dport, 2);
+    p[12] = r->e.proto;
+    p[13] = r->e.tos;
+    p[14] = r->e.tcp_flags;
+    p[15] = r->reason;
+    sr_flow_put32(p + 16, r->e.iface);
+    sr_flow_put64(p + 20, r->e.packets);
+    sr_flow_put64(p + 28, r->e.bytes);
+    sr_flow_put64(p + 36, r->e.first_ms);
+    sr_flow_put64(p + 44, r->e.last_ms);
+    flow->msg_len += SR_FLOW_REC_LEN;
+    flow->msg_recs++;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_walk(..)
+ * Scope: Local
+ *
+ * Export the flows that are due, or all of them if force.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_flow_walk(struct sr_flow* flow, int force)
+{
+    struct sr_flow_entry* e;
+    struct sr_flow_rec r;
+    uint64_t now = sr_flow_now_ms();
+    unsigned int i, in_use = 0;
+
+    for (i = 0; i < SR_FLOW_ENTRIES; i++)
+    {
+        e = &flow->table[i];
+        if (!__atomic_load_n(&e->used, __ATOMIC_RELAXED))
+        { continue; }
+
+        sr_flow_lock_entry(e);
+        r.reason = 0;
+        if (!e->used)
+        { }
+        else if (force)
+        { r.reason = sr_flow_end_forced; }
+        else if (e->tcp_flags & (TCP_FIN | TCP_RST))
+        { r.reason = sr_flow_end_fin; }
+        else if (now - e->last_ms >= SR_FLOW_IDLE_S * 1000)
+        { r.reason = sr_flow_end_idle; }
+        else if (now - e->first_ms >= SR_FLOW_ACTIVE_S * 1000)
+        { r.reason = sr_flow_end_active; }
+
+        if (r.reason)
+        {
+            r.e = *e;
+            if (r.reason == sr_flow_end_active)
+            {
+                e->packets = 0;
+                e->bytes = 0;
+                e->first_ms = now;
+            }
+            else
+            { e->used = 0; }
+        }
+        in_use += e->used;
+        sr_flow_unlock_entry(e);
+
+        if (r.reason)
+        { sr_flow_add(flow, &r); }
+    }
+    flow->in_use = in_use;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_exporter(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_flow_exporter(void* arg)
+{
+    struct sr_flow* flow = (struct sr_flow*)arg;
+    struct timespec ts;
+    unsigned int i, n;
+    int stop;
+
+    do
+    {
+        pthread_mutex_lock(&flow->lock);
+        if (!flow->stop)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec++;
+            pthread_cond_timedwait(&flow->wake, &flow->lock, &ts);
+        }
+        stop = flow->stop;
+        n = flow->n_pending;
+        memcpy(flow->out, flow->pending, n * sizeof(struct sr_flow_rec));
+        flow->n_pending = 0;
+        pthread_mutex_unlock(&flow->lock);
+
+        for (i = 0; i < n; i++)
+        { sr_flow_add(flow, &flow->out[i]); }
+        sr_flow_walk(flow, stop);
+        sr_flow_flush(flow);
+    } while (!stop);
+
+    return 0;
+} /* -- sr_flow_exporter -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flow_open(struct sr_instance* sr, unsigned short port)
+{
+    struct sr_flow* flow;
+    struct sockaddr_in addr;
+    pthread_condattr_t attr;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if (!(flow = (struct sr_flow*)calloc(1, sizeof(struct sr_flow))) ||
+        posix_memalign((void**)&flow->table, 64,
+                       SR_FLOW_ENTRIES * sizeof(struct sr_flow_entry)) != 0)
+    {
+        fprintf(stderr, "flow: out of memory\n");
+        free(flow);
+        return -1;
+    }
+    memset(flow->table, 0, SR_FLOW_ENTRIES * sizeof(struct sr_flow_entry));
+    flow->sr = sr;
+
+    /* connected, so a send needs no address and a missing collector
+       is only a counted error */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((flow->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        connect(flow->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        perror("flow collector");
+        if (flow->fd >= 0)
+        { close(flow->fd); }
+        free(flow->table);
+        free(flow);
+        return -1;
+    }
+
+    pthread_mutex_init(&flow->lock, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flow->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&flow->thread, 0, sr_flow_exporter, flow) != 0)
+    {
+        perror("pthread_create");
+        close(flow->fd);
+        free(flow->table);
+        free(flow);
+        return -1;
+    }
+    sr->flow = flow;
+
+    SR_LOG(SR_LOG_INFO, "flow: exporting to 127.0.0.1:%u", port);
+    return 0;
+} /* -- sr_flow_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_flow_close(struct sr_instance* sr)
+{
+    struct sr_flow* flow = sr->flow;
+
+    if (!flow)
+    { return; }
+
+    sr->flow = 0;
+    pthread_mutex_lock(&flow->lock);
+    flow->stop = 1;
+    pthread_cond_signal(&flow->wake);
+    pthread_mutex_unlock(&flow->lock);
+    pthread_join(flow->thread, 0);
+
+    close(flow->fd);
+    pthread_mutex_destroy(&flow->lock);
+    pthread_cond_destroy(&flow->wake);
+    free(flow->table);
+    free(flow);
+} /* -- sr_flow_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_ctl(..)
+ * Scope: Global
+ *
+ * "flows" shows the exporter's counters and the flows in the cache
+ * with the most bytes.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_flow_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_flow* flow = sr->flow;
+    struct sr_flow_entry top[10];
+    struct sr_flow_entry* e;
+    struct in_addr src, dst;
+    char src_s[16];
+    unsigned int i, j, n = 0;
+
+    if (argc != 1)
+    { return -1; }
+    if (!flow)
+    {
+        fprintf(out, "flow export is off\n");
+        return 0;
+    }
+
+    fprintf(out, "cache %u/%u flows, %lu new, %lu pushed out, %lu packets not counted\n",
+            flow->in_use, SR_FLOW_ENTRIES,
+            __atomic_load_n(&flow->created, __ATOMIC_RELAXED),
+            __atomic_load_n(&flow->evicted, __ATOMIC_RELAXED),
+            __atomic_load_n(&flow->lost, __ATOMIC_RELAXED));
+    fprintf(out, "exported %lu records in %lu messages, %lu send errors\n",
+            flow->records, flow->messages, flow->send_errors);
+
+    for (i = 0; i < SR_FLOW_ENTRIES; i++)
+    {
+        e = &flow->table[i];
+        if (!__atomic_load_n(&e->used, __ATOMIC_RELAXED))
+        { continue; }
+        sr_flow_lock_entry(e);
+        if (e->used && (n < 10 || e->bytes > top[n - 1].bytes))
+        {
+            j = n < 10 ? n++ : n - 1;
+            for (; j > 0 && top[j - 1].bytes < e->bytes; j--)
+            { top[j] = top[j - 1]; }
+            top[j] = *e;
+        }
+        sr_flow_unlock_entry(e);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        src.s_addr = top[i].src;
+        dst.s_addr = top[i].dst;
+        strncpy(src_s, inet_ntoa(src), sizeof(src_s) - 1);
+        src_s[sizeof(src_s) - 1] = 0;
+        fprintf(out, "%s:%u > %s:%u proto %u in %u  %lu packets %lu bytes\n",
+                src_s, ntohs(top[i].sport), inet_ntoa(dst), ntohs(top[i].dport),
+                top[i].proto, top[i].iface,
+                (unsigned long)top[i].packets, (unsigned long)top[i].bytes);
+    }
+
+    return 0;
+} /* -- sr_flow_ctl -- */
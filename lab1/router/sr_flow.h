@@ -0,0 +1,84 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flow.h
+ *
+ * Description:
+ *
+ * Per-flow packet and byte accounting, exported as IPFIX (RFC 7011)
+ * over UDP to a collector on 127.0.0.1, for when a pcap of everything
+ * is more than is wanted.
+ *
+ * A flow is the 5-tuple and the interface it came in on; ICMP carries
+ * type and code in the destination port, as IPFIX collectors expect.
+ * Every IP packet the ACL lets in is counted, as it arrived (before
+ * NAT). The cache is a fixed table of SR_FLOW_ENTRIES one-cache-line
+ * entries with open addressing: a flow lives within SR_FLOW_PROBE slots
+ * of where its key hashes, and the count for a packet of a flow already
+ * there is one locked update of that line. A new flow with all of its
+ * slots taken pushes out the one seen longest ago, which is exported
+ * early; if the exporter is too far behind to take it, the new flow's
+ * packet goes uncounted instead.
+ *
+ * Once a second the exporter walks the table and exports
+ *
+ *   - flows idle for SR_FLOW_IDLE_S, and flows that sent a FIN or RST,
+ *     which then leave the cache;
+ *   - what a flow did over the last SR_FLOW_ACTIVE_S, if it has been
+ *     going that long, and it carries on counting from zero.
+ *
+ * Records are template SR_FLOW_TEMPLATE_ID, sent again every
+ * SR_FLOW_TEMPLATE_S as UDP asks; the observation domain is the topology
+ * id. What is left is exported when the router stops.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOW_H
+#define SR_FLOW_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_flow;
+
+#define SR_FLOW_PORT        4739    /* IPFIX */
+#define SR_FLOW_ENTRIES     65536   /* power of two; 4 MB */
+#define SR_FLOW_PROBE       8
+#define SR_FLOW_ACTIVE_S    60
+#define SR_FLOW_IDLE_S      15
+#define SR_FLOW_TEMPLATE_S  10
+#define SR_FLOW_TEMPLATE_ID 256
+#define SR_FLOW_MTU         1400    /* largest message sent */
+
+/* flowEndReason */
+enum sr_flow_end
+{
+    sr_flow_end_idle     = 1,
+    sr_flow_end_active   = 2,
+    sr_flow_end_fin      = 3,
+    sr_flow_end_forced   = 4,       /* the router stopped */
+    sr_flow_end_resource = 5        /* pushed out of the cache */
+};
+
+/* Count flows and export them to 127.0.0.1:port. Call once the topology
+   is known. Returns 0 on success and sets sr->flow. */
+int  sr_flow_open(struct sr_instance* sr, unsigned short port);
+
+/* Export what is left and stop. */
+void sr_flow_close(struct sr_instance* sr);
+
+/* Count an IP packet, header already checked, that came in on the
+   interface with counter index iface (struct sr_if stats). */
+void sr_flow_account(struct sr_flow* flow, const uint8_t* packet,
+                     unsigned int len, int iface);
+
+/* control socket "flows" command */
+int  sr_flow_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_FLOW_H -- */
@@ -0,0 +1,453 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fpm.c
+ *
+ * Description:
+ *
+ * zebra FPM listener. See sr_fpm.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "sr_fpm.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+#include "sr_log.h"
+
+#define SR_FPM_BUF (64 * 1024)   /* bytes read before a batch is applied */
+
+/* the most messages a full buffer can hold */
+#define SR_FPM_BATCH_MAX (SR_FPM_BUF / (sizeof(struct sr_fpm_hdr) + \
+                                        sizeof(struct sr_fpm_nlmsg) + \
+                                        sizeof(struct sr_fpm_rtmsg)))
+
+/* why a message did not become a change */
+enum sr_fpm_skip
+{
+    sr_fpm_skip_other,          /* not a route message */
+    sr_fpm_skip_family,         /* not IPv4 */
+    sr_fpm_skip_no_gateway,     /* a connected route */
+    sr_fpm_skip_unresolved,     /* no way to tell the interface */
+    sr_fpm_skip_malformed,
+    sr_fpm_skip_max
+};
+
+static const char* sr_fpm_skip_names[sr_fpm_skip_max] = {
+    "other",
+    "family",
+    "no_gateway",
+    "unresolved",
+    "malformed"};
+
+/* written by the listener only; the control thread reads them as they
+   are */
+static struct
+{
+    unsigned long connections;
+    unsigned long messages;
+    unsigned long replaced;
+    unsigned long withdrawn;
+    unsigned long skipped[sr_fpm_skip_max];
+    unsigned long batches;
+    unsigned long failed;       /* batches sr_rt_apply() turned down */
+    double apply_secs;
+    double apply_max;
+} sr_fpm_stats;
+
+static struct sr_instance* sr_fpm_sr;
+static int sr_fpm_fd = -1;
+static int sr_fpm_client = -1;
+static int sr_fpm_stop;
+static pthread_t sr_fpm_thread;
+static pthread_mutex_t sr_fpm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double sr_fpm_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the sr interface for a route through gw, preferring the one zebra named */
+static int sr_fpm_iface(struct sr_instance* sr, int32_t oif, struct in_addr gw,
+                        char* name)
+{
+    char kname[IF_NAMESIZE];
+    struct sr_rt rt;
+
+    if (oif > 0 && if_indextoname(oif, kname) && sr_get_interface(sr, kname))
+    {
+        strncpy(name, kname, sr_IFACE_NAMELEN - 1);
+        name[sr_IFACE_NAMELEN - 1] = 0;
+        return 0;
+    }
+    if (sr_rt_for_dst(sr, gw.s_addr, &rt) == 0)
+    {
+        memcpy(name, rt.interface, sr_IFACE_NAMELEN);
+        return 0;
+    }
+    return -1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fpm_parse(..)
+ * Scope: Local
+ *
+ * Turn one netlink message into a change for sr_rt_apply(). Returns 0
+ * with op filled in, or the reason to leave the message out. Of several
+ * paths only the first is used.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fpm_parse(struct sr_instance* sr, const uint8_t* msg,
+                        unsigned int len, struct sr_rt_op* op)
+{
+    const struct sr_fpm_nlmsg* nl = (const struct sr_fpm_nlmsg*)msg;
+    const struct sr_fpm_rtmsg* rtm;
+    const struct sr_fpm_rtattr* rta;
+    const struct sr_fpm_nexthop* nh;
+    unsigned int off, end, nh_off, nh_end;
+    int has_gw = 0;
+    int32_t oif = 0;
+
+    if (len < sizeof(*nl) + sizeof(*rtm) || nl->len < sizeof(*nl) || nl->len > len)
+    { return sr_fpm_skip_malformed; }
+    if (nl->type != SR_FPM_RTM_NEWROUTE && nl->type != SR_FPM_RTM_DELROUTE)
+    { return sr_fpm_skip_other; }
+    if (nl->len < sizeof(*nl) + sizeof(*rtm))
+    { return sr_fpm_skip_malformed; }
+    rtm = (const struct sr_fpm_rtmsg*)(msg + sizeof(*nl));
+    if (rtm->family != AF_INET)
+    { return sr_fpm_skip_family; }
+    if (rtm->dst_len > 32)
+    { return sr_fpm_skip_malformed; }
+
+    memset(op, 0, sizeof(*op));
+    op->len = rtm->dst_len;
+
+    end = nl->len;
+    for (off = sizeof(*nl) + SR_FPM_ALIGN(sizeof(*rtm));
+         off + sizeof(*rta) <= end;
+         off += SR_FPM_ALIGN(rta->len))
+    {
+        rta = (const struct sr_fpm_rtattr*)(msg + off);
+        if (rta->len < sizeof(*rta) || off + rta->len > end)
+        { return sr_fpm_skip_malformed; }
+
+        switch (rta->type)
+        {
+            case SR_FPM_RTA_DST:
+                if (rta->len < sizeof(*rta) + 4)
+                { return sr_fpm_skip_malformed; }
+                memcpy(&op->dest.s_addr, rta + 1, 4);
+                break;
+            case SR_FPM_RTA_GATEWAY:
+                if (rta->len < sizeof(*rta) + 4)
+                { return sr_fpm_skip_malformed; }
+                memcpy(&op->gw.s_addr, rta + 1, 4);
+                has_gw = 1;
+                break;
+            case SR_FPM_RTA_OIF:
+                if (rta->len < sizeof(*rta) + 4)
+                { return sr_fpm_skip_malformed; }
+                memcpy(&oif, rta + 1, 4);
+                break;
+            case SR_FPM_RTA_MULTIPATH:
+                if (has_gw || rta->len < sizeof(*rta) + sizeof(*nh))
+                { break; }
+                nh = (const struct sr_fpm_nexthop*)(rta + 1);
+                if (nh->len < sizeof(*nh) || off + sizeof(*rta) + nh->len > end)
+                { return sr_fpm_skip_malformed; }
+                oif = nh->ifindex;
+                nh_end = off + sizeof(*rta) + nh->len;
+                for (nh_off = off + sizeof(*rta) + sizeof(*nh);
+                     nh_off + sizeof(struct sr_fpm_rtattr) + 4 <= nh_end;
+                     nh_off += SR_FPM_ALIGN(((const struct sr_fpm_rtattr*)(msg + nh_off))->len))
+                {
+                    const struct sr_fpm_rtattr* a = (const struct sr_fpm_rtattr*)(msg + nh_off);
+
+                    if (a->len < sizeof(*a))
+                    { return sr_fpm_skip_malformed; }
+                    if (a->type == SR_FPM_RTA_GATEWAY)
+                    {
+                        memcpy(&op->gw.s_addr, a + 1, 4);
+                        has_gw = 1;
+                        break;
+                    }
+                }
+                break;
+        }
+    }
+
+    /* a route sr can't forward on must not leave an older one behind */
+    if (nl->type == SR_FPM_RTM_DELROUTE || rtm->type != SR_FPM_RTN_UNICAST)
+    {
+        op->type = sr_rt_op_withdraw;
+        return 0;
+    }
+    if (!has_gw)
+    { return sr_fpm_skip_no_gateway; }
+    if (sr_fpm_iface(sr, oif, op->gw, op->interface) != 0)
+    { return sr_fpm_skip_unresolved; }
+    op->type = sr_rt_op_replace;
+    return 0;
+} /* -- sr_fpm_parse -- */
+
+/* apply a batch and account for it */
+static void sr_fpm_apply(struct sr_instance* sr, const struct sr_rt_op* ops,
+                         unsigned int n)
+{
+    unsigned int i, failed = 0;
+    double start, took;
+    int ret;
+
+    if (n == 0)
+    { return; }
+
+    start = sr_fpm_now();
+    ret = sr_rt_apply(sr, ops, n, &failed);
+    took = sr_fpm_now() - start;
+
+    sr_fpm_stats.batches++;
+    sr_fpm_stats.apply_secs += took;
+    if (took > sr_fpm_stats.apply_max)
+    { sr_fpm_stats.apply_max = took; }
+    if (ret != 0)
+    {
+        sr_fpm_stats.failed++;
+        SR_LOG(SR_LOG_ERR, "fpm: batch of %u changes failed at %u (%d)",
+               n, failed, ret);
+        return;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (ops[i].type == sr_rt_op_withdraw)
+        { sr_fpm_stats.withdrawn++; }
+        else
+        { sr_fpm_stats.replaced++; }
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fpm_serve(..)
+ * Scope: Local
+ *
+ * Read from zebra until it goes away. Each pass takes everything that
+ * is waiting, up to SR_FPM_BUF bytes, and applies the whole messages in
+ * it as one batch; a partial message waits for the next pass.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_fpm_serve(struct sr_instance* sr, int fd)
+{
+    static uint8_t buf[SR_FPM_BUF];
+    static struct sr_rt_op ops[SR_FPM_BATCH_MAX];
+    const struct sr_fpm_hdr* hdr;
+    unsigned int have = 0, off, n, mlen;
+    ssize_t r;
+    int why;
+
+    while (!__atomic_load_n(&sr_fpm_stop, __ATOMIC_ACQUIRE))
+    {
+        r = recv(fd, buf + have, SR_FPM_BUF - have, 0);
+        if (r < 0 && errno == EINTR)
+        { continue; }
+        if (r <= 0)
+        { break; }
+        have += r;
+        while (have < SR_FPM_BUF &&
+               (r = recv(fd, buf + have, SR_FPM_BUF - have, MSG_DONTWAIT)) > 0)
+        { have += r; }
+
+        n = 0;
+        for (off = 0; have - off >= sizeof(*hdr); off += mlen)
+        {
+            hdr = (const struct sr_fpm_hdr*)(buf + off);
+            mlen = ntohs(hdr->len);
+            if (hdr->version != SR_FPM_VERSION || mlen < sizeof(*hdr) ||
+                mlen > SR_FPM_MAX_MSG)
+            {
+                /* no way to find the next message; zebra will reconnect */
+                SR_LOG(SR_LOG_ERR, "fpm: bad header, version %u length %u",
+                       hdr->version, mlen);
+                sr_fpm_apply(sr, ops, n);
+                return;
+            }
+            if (mlen > have - off)
+            { break; }
+
+            sr_fpm_stats.messages++;
+            if (hdr->type != SR_FPM_MSG_NETLINK)
+            { why = sr_fpm_skip_other; }
+            else
+            {
+                why = sr_fpm_parse(sr, buf + off + sizeof(*hdr),
+                                   mlen - sizeof(*hdr), &ops[n]);
+            }
+            if (why == 0)
+            { n++; }
+            else
+            { sr_fpm_stats.skipped[why]++; }
+        }
+
+        sr_fpm_apply(sr, ops, n);
+        memmove(buf, buf + off, have - off);
+        have -= off;
+    }
+} /* -- sr_fpm_serve -- */
+
+static void* sr_fpm_listener(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    int fd;
+
+    while (!__atomic_load_n(&sr_fpm_stop, __ATOMIC_ACQUIRE))
+    {
+        fd = accept(sr_fpm_fd, 0, 0);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            { continue; }
+            break;
+        }
+
+        pthread_mutex_lock(&sr_fpm_lock);
+        sr_fpm_client = fd;
+        pthread_mutex_unlock(&sr_fpm_lock);
+        sr_fpm_stats.connections++;
+        SR_LOG(SR_LOG_INFO, "fpm: zebra connected");
+
+        sr_fpm_serve(sr, fd);
+
+        pthread_mutex_lock(&sr_fpm_lock);
+        sr_fpm_client = -1;
+        close(fd);
+        pthread_mutex_unlock(&sr_fpm_lock);
+        SR_LOG(SR_LOG_INFO, "fpm: zebra disconnected");
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fpm_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fpm_open(struct sr_instance* sr, unsigned short port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((sr_fpm_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(sr_fpm_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sr_fpm_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(sr_fpm_fd, 1) != 0)
+    {
+        perror("fpm listen");
+        close(sr_fpm_fd);
+        sr_fpm_fd = -1;
+        return -1;
+    }
+
+    sr_fpm_sr = sr;
+    sr_fpm_stop = 0;
+    if (pthread_create(&sr_fpm_thread, 0, sr_fpm_listener, sr) != 0)
+    {
+        perror("pthread_create");
+        close(sr_fpm_fd);
+        sr_fpm_fd = -1;
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_fpm_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fpm_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fpm_close(void)
+{
+    if (sr_fpm_fd < 0)
+    { return; }
+
+    __atomic_store_n(&sr_fpm_stop, 1, __ATOMIC_RELEASE);
+    shutdown(sr_fpm_fd, SHUT_RDWR);   /* wakes accept() */
+    pthread_mutex_lock(&sr_fpm_lock);
+    if (sr_fpm_client >= 0)
+    { shutdown(sr_fpm_client, SHUT_RDWR); }
+    pthread_mutex_unlock(&sr_fpm_lock);
+    pthread_join(sr_fpm_thread, 0);
+    close(sr_fpm_fd);
+    sr_fpm_fd = -1;
+    sr_fpm_sr = 0;
+} /* -- sr_fpm_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fpm_stats_write(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fpm_stats_write(FILE* out)
+{
+    int i;
+
+    if (!sr_fpm_sr)
+    { return; }
+
+    fprintf(out, "# HELP sr_fpm_connections_total zebra FPM connections accepted.\n");
+    fprintf(out, "# TYPE sr_fpm_connections_total counter\n");
+    fprintf(out, "sr_fpm_connections_total %lu\n", sr_fpm_stats.connections);
+    fprintf(out, "# HELP sr_fpm_messages_total FPM messages received.\n");
+    fprintf(out, "# TYPE sr_fpm_messages_total counter\n");
+    fprintf(out, "sr_fpm_messages_total %lu\n", sr_fpm_stats.messages);
+    fprintf(out, "# HELP sr_fpm_routes_total Route changes applied from zebra.\n");
+    fprintf(out, "# TYPE sr_fpm_routes_total counter\n");
+    fprintf(out, "sr_fpm_routes_total{op=\"replace\"} %lu\n", sr_fpm_stats.replaced);
+    fprintf(out, "sr_fpm_routes_total{op=\"withdraw\"} %lu\n", sr_fpm_stats.withdrawn);
+    fprintf(out, "# HELP sr_fpm_skipped_total FPM messages left out.\n");
+    fprintf(out, "# TYPE sr_fpm_skipped_total counter\n");
+    for (i = 0; i < sr_fpm_skip_max; i++)
+    {
+        fprintf(out, "sr_fpm_skipped_total{reason=\"%s\"} %lu\n",
+                sr_fpm_skip_names[i], sr_fpm_stats.skipped[i]);
+    }
+    fprintf(out, "# HELP sr_fpm_batches_total Batches applied to the routing table.\n");
+    fprintf(out, "# TYPE sr_fpm_batches_total counter\n");
+    fprintf(out, "sr_fpm_batches_total{result=\"ok\"} %lu\n",
+            sr_fpm_stats.batches - sr_fpm_stats.failed);
+    fprintf(out, "sr_fpm_batches_total{result=\"failed\"} %lu\n", sr_fpm_stats.failed);
+    fprintf(out, "# HELP sr_fpm_apply_seconds_total Time spent applying batches.\n");
+    fprintf(out, "# TYPE sr_fpm_apply_seconds_total counter\n");
+    fprintf(out, "sr_fpm_apply_seconds_total %.6f\n", sr_fpm_stats.apply_secs);
+    fprintf(out, "# HELP sr_fpm_apply_max_seconds Longest batch.\n");
+    fprintf(out, "# TYPE sr_fpm_apply_max_seconds gauge\n");
+    fprintf(out, "sr_fpm_apply_max_seconds %.6f\n", sr_fpm_stats.apply_max);
+} /* -- sr_fpm_stats_write -- */
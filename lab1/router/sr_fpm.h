@@ -0,0 +1,122 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fpm.h
+ *
+ * Description:
+ *
+ * Route feed from Quagga/FRR zebra over its Forwarding Plane Manager
+ * interface, so that what ospfd and bgpd decide reaches the data plane
+ * without going through the rtable file. Start zebra with the fpm module
+ * (zebra -M fpm, or fpm enabled at build time for Quagga); it connects to
+ * 127.0.0.1:2620 and sends every route it selects, then each change.
+ *
+ * Each FPM message is a 4 byte header followed by the netlink message
+ * zebra would have sent the kernel: RTM_NEWROUTE to add or replace a
+ * route, RTM_DELROUTE to take it out. Only IPv4 unicast routes with a
+ * gateway mean anything to sr, which ARPs for the next hop of every
+ * route; others are counted and left out (a blackhole or unreachable
+ * route withdraws the prefix instead). The outgoing interface is the one
+ * named by RTA_OIF when this host has an sr interface by that name, and
+ * otherwise the one sr already routes the gateway through.
+ *
+ * Whatever has arrived by the time the listener gets to the socket is
+ * applied as one batch with sr_rt_apply(), so a burst of changes after a
+ * link goes down costs one pass under the routing table lock.
+ *
+ * The wire structures below mirror <linux/rtnetlink.h>. Netlink fields
+ * are in the sender's byte order, so zebra and sr must share a host;
+ * the FPM header length is in network order.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FPM_H
+#define SR_FPM_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
+#define SR_FPM_PORT        2620
+#define SR_FPM_VERSION     1
+#define SR_FPM_MSG_NETLINK 1
+#define SR_FPM_MAX_MSG     4096   /* longest FPM message, header included */
+
+struct sr_fpm_hdr
+{
+    uint8_t  version;
+    uint8_t  type;
+    uint16_t len;                 /* network order, header included */
+} __attribute__ ((packed)) ;
+
+/* struct nlmsghdr */
+struct sr_fpm_nlmsg
+{
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t seq;
+    uint32_t pid;
+};
+
+#define SR_FPM_RTM_NEWROUTE 24
+#define SR_FPM_RTM_DELROUTE 25
+#define SR_FPM_NLM_F_REQUEST 0x001
+#define SR_FPM_NLM_F_REPLACE 0x100
+#define SR_FPM_NLM_F_CREATE  0x400
+
+/* struct rtmsg */
+struct sr_fpm_rtmsg
+{
+    uint8_t  family;
+    uint8_t  dst_len;
+    uint8_t  src_len;
+    uint8_t  tos;
+    uint8_t  table;
+    uint8_t  protocol;
+    uint8_t  scope;
+    uint8_t  type;
+    uint32_t flags;
+};
+
+#define SR_FPM_RTN_UNICAST 1
+
+/* struct rtattr */
+struct sr_fpm_rtattr
+{
+    uint16_t len;                 /* header included */
+    uint16_t type;
+};
+
+#define SR_FPM_RTA_DST       1
+#define SR_FPM_RTA_OIF       4
+#define SR_FPM_RTA_GATEWAY   5
+#define SR_FPM_RTA_MULTIPATH 9
+
+/* struct rtnexthop, one per path inside RTA_MULTIPATH */
+struct sr_fpm_nexthop
+{
+    uint16_t len;                 /* attributes that follow included */
+    uint8_t  flags;
+    uint8_t  hops;
+    int32_t  ifindex;
+};
+
+/* netlink pads everything to 4 bytes */
+#define SR_FPM_ALIGN(len) (((len) + 3) & ~3)
+
+/* Listen on 127.0.0.1:port and apply what zebra sends to sr's routing
+   table. Call once the interfaces are known. Returns 0 on success. */
+int  sr_fpm_open(struct sr_instance* sr, unsigned short port);
+void sr_fpm_close(void);
+
+/* counters for the control socket "stats" command */
+void sr_fpm_stats_write(FILE* out);
+
+#endif /* -- SR_FPM_H -- */
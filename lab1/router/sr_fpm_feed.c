@@ -0,0 +1,263 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fpm_feed.c
+ *
+ * Description:
+ *
+ * Stand-in for zebra's FPM client, to drive sr -f without a routing
+ * daemon. Reads a script of route changes and sends them the way zebra
+ * does: connected to the router's FPM port, one RTM_NEWROUTE or
+ * RTM_DELROUTE per change, written out in buffer-sized chunks.
+ *
+ *   add <prefix>/<len> <gw> [ifindex]
+ *   del <prefix>/<len>
+ *   gen add|del <count> <prefix>/<len> <gw>   count prefixes in a row
+ *   flush                                     send what is buffered
+ *   sleep <ms>                                flush, then wait
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fpm.h"
+
+#define FEED_BUF (64 * 1024)
+
+static uint8_t feed_buf[FEED_BUF];
+static unsigned int feed_have;
+static unsigned long feed_sent;
+static int feed_fd;
+
+static void usage(char* );
+static void feed_flush(void);
+static void feed_route(int , struct in_addr , int , struct in_addr , int32_t );
+static int parse_prefix(const char* , struct in_addr* , int* );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    const char* host = "127.0.0.1";
+    unsigned int port = SR_FPM_PORT;
+    char line[512], cmd[16], a1[64], a2[64], a3[64], a4[64];
+    struct sockaddr_in addr;
+    struct hostent* he;
+    struct in_addr dest, gw;
+    struct timespec t0, t1, ts;
+    unsigned long i, count;
+    int c, n, len, lineno = 0;
+    FILE* in = stdin;
+
+    while ((c = getopt(argc, argv, "hs:p:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 's':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi((char *) optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind < argc && !(in = fopen(argv[optind], "r")))
+    {
+        perror(argv[optind]);
+        exit(1);
+    }
+
+    if (!(he = gethostbyname(host)))
+    {
+        fprintf(stderr, "unknown host %s\n", host);
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    memcpy(&addr.sin_addr, he->h_addr, 4);
+    if ((feed_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(feed_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (fgets(line, sizeof(line), in))
+    {
+        lineno++;
+        n = sscanf(line, "%15s %63s %63s %63s %63s", cmd, a1, a2, a3, a4);
+        if (n < 1 || cmd[0] == '#')
+        { continue; }
+
+        if (strcmp(cmd, "add") == 0 && n >= 3 && parse_prefix(a1, &dest, &len) == 0 &&
+            inet_aton(a2, &gw))
+        { feed_route(SR_FPM_RTM_NEWROUTE, dest, len, gw, n == 4 ? atoi(a3) : 0); }
+        else if (strcmp(cmd, "del") == 0 && n == 2 && parse_prefix(a1, &dest, &len) == 0)
+        {
+            gw.s_addr = 0;
+            feed_route(SR_FPM_RTM_DELROUTE, dest, len, gw, 0);
+        }
+        else if (strcmp(cmd, "gen") == 0 && n == 5 &&
+                 (strcmp(a1, "add") == 0 || strcmp(a1, "del") == 0) &&
+                 parse_prefix(a3, &dest, &len) == 0 && len > 0 && inet_aton(a4, &gw))
+        {
+            count = strtoul(a2, 0, 10);
+            for (i = 0; i < count; i++)
+            {
+                struct in_addr d;
+
+                d.s_addr = htonl(ntohl(dest.s_addr) + (uint32_t)(i << (32 - len)));
+                feed_route(a1[0] == 'a' ? SR_FPM_RTM_NEWROUTE : SR_FPM_RTM_DELROUTE,
+                           d, len, gw, 0);
+            }
+        }
+        else if (strcmp(cmd, "flush") == 0)
+        { feed_flush(); }
+        else if (strcmp(cmd, "sleep") == 0 && n == 2)
+        {
+            feed_flush();
+            ts.tv_sec = atoi(a1) / 1000;
+            ts.tv_nsec = (atoi(a1) % 1000) * 1000000L;
+            nanosleep(&ts, 0);
+        }
+        else
+        {
+            fprintf(stderr, "line %d: can't make sense of: %s", lineno, line);
+            exit(1);
+        }
+    }
+    feed_flush();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("%lu route messages sent in %.3f ms\n", feed_sent,
+           (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    /* let the router read everything before it sees the hang up */
+    shutdown(feed_fd, SHUT_WR);
+    while (read(feed_fd, line, sizeof(line)) > 0);
+    close(feed_fd);
+    return 0;
+}/* -- main -- */
+
+static void feed_flush(void)
+{
+    unsigned int off = 0;
+    ssize_t r;
+
+    while (off < feed_have)
+    {
+        if ((r = write(feed_fd, feed_buf + off, feed_have - off)) <= 0)
+        {
+            perror("write");
+            exit(1);
+        }
+        off += r;
+    }
+    feed_have = 0;
+}
+
+static void feed_attr(uint8_t* msg, unsigned int* off, int type,
+                      const void* data, unsigned int len)
+{
+    struct sr_fpm_rtattr* rta = (struct sr_fpm_rtattr*)(msg + *off);
+
+    rta->type = type;
+    rta->len = sizeof(*rta) + len;
+    memcpy(rta + 1, data, len);
+    *off += SR_FPM_ALIGN(rta->len);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: feed_route(..)
+ * Scope: local
+ *
+ * Queue one route message laid out the way zebra's netlink encoder does.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void feed_route(int type, struct in_addr dest, int len, struct in_addr gw,
+                       int32_t oif)
+{
+    uint8_t msg[128];
+    struct sr_fpm_hdr* hdr = (struct sr_fpm_hdr*)msg;
+    struct sr_fpm_nlmsg* nl = (struct sr_fpm_nlmsg*)(hdr + 1);
+    struct sr_fpm_rtmsg* rtm = (struct sr_fpm_rtmsg*)(nl + 1);
+    unsigned int off = sizeof(*hdr) + sizeof(*nl) + sizeof(*rtm);
+
+    memset(msg, 0, sizeof(msg));
+    rtm->family = AF_INET;
+    rtm->dst_len = len;
+    rtm->table = 254;             /* RT_TABLE_MAIN */
+    rtm->protocol = 11;           /* RTPROT_ZEBRA */
+    rtm->type = SR_FPM_RTN_UNICAST;
+
+    if (len > 0)
+    { feed_attr(msg, &off, SR_FPM_RTA_DST, &dest.s_addr, 4); }
+    if (type == SR_FPM_RTM_NEWROUTE)
+    {
+        feed_attr(msg, &off, SR_FPM_RTA_GATEWAY, &gw.s_addr, 4);
+        if (oif)
+        { feed_attr(msg, &off, SR_FPM_RTA_OIF, &oif, 4); }
+    }
+
+    nl->len = off - sizeof(*hdr);
+    nl->type = type;
+    nl->flags = SR_FPM_NLM_F_REQUEST |
+                (type == SR_FPM_RTM_NEWROUTE ? SR_FPM_NLM_F_CREATE | SR_FPM_NLM_F_REPLACE : 0);
+    hdr->version = SR_FPM_VERSION;
+    hdr->type = SR_FPM_MSG_NETLINK;
+    hdr->len = htons(off);
+
+    if (feed_have + off > FEED_BUF)
+    { feed_flush(); }
+    memcpy(feed_buf + feed_have, msg, off);
+    feed_have += off;
+    feed_sent++;
+}
+
+static int parse_prefix(const char* s, struct in_addr* dest, int* len)
+{
+    char addr[32];
+    const char* slash = strchr(s, '/');
+
+    if (!slash || slash - s >= (int)sizeof(addr))
+    { return -1; }
+    memcpy(addr, s, slash - s);
+    addr[slash - s] = 0;
+    *len = atoi(slash + 1);
+    if (!inet_aton(addr, dest) || *len < 0 || *len > 32)
+    { return -1; }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router FPM feeder\n");
+    printf("Format: %s [-s host] [-p port] [script]\n", argv0);
+    printf("   sends the route changes in script (default stdin) to sr -f\n");
+    printf("   add <prefix>/<len> <gw> [ifindex] | del <prefix>/<len> |\n");
+    printf("   gen add|del <count> <prefix>/<len> <gw> | flush | sleep <ms>\n");
+    printf("   defaults host=127.0.0.1 port=%d\n", SR_FPM_PORT);
+} /* -- usage -- */
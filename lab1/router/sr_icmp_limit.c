@@ -0,0 +1,144 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp_limit.c
+ *
+ * Description:
+ *
+ * Token bucket rate limiting of ICMP errors. See sr_icmp_limit.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_icmp_limit.h"
+
+#define SR_ICMP_TOKEN 1000UL  /* tokens per message */
+
+static unsigned long sr_icmp_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* top up a bucket for the time since it was last looked at */
+static void sr_icmp_refill(struct sr_icmp_bucket* b, unsigned int rate,
+                           unsigned int burst, unsigned long now)
+{
+    unsigned long max = burst * SR_ICMP_TOKEN;
+
+    /* rate is per second and a message costs 1000 tokens, so each
+       millisecond earns rate tokens */
+    b->tokens += (now - b->last_ms) * rate;
+    if (b->tokens > max)
+    { b->tokens = max; }
+    b->last_ms = now;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_limit_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_icmp_limit_init(struct sr_icmp_limit* limit)
+{
+    /* -- REQUIRES -- */
+    assert(limit);
+
+    memset(limit, 0, sizeof(*limit));
+    limit->global_rate = SR_ICMP_GLOBAL_RATE;
+    limit->global_burst = SR_ICMP_GLOBAL_BURST;
+    limit->peer_rate = SR_ICMP_PEER_RATE;
+    limit->peer_burst = SR_ICMP_PEER_BURST;
+
+    limit->global.tokens = limit->global_burst * SR_ICMP_TOKEN;
+    limit->global.last_ms = sr_icmp_now_ms();
+
+    return pthread_mutex_init(&limit->lock, 0);
+} /* -- sr_icmp_limit_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_limit_destroy(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_icmp_limit_destroy(struct sr_icmp_limit* limit)
+{
+    pthread_mutex_destroy(&limit->lock);
+} /* -- sr_icmp_limit_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_allow(..)
+ * Scope: Global
+ *
+ * Both buckets have to have a token before either is charged, so a
+ * message refused by its peer bucket doesn't use up global budget.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_icmp_allow(struct sr_icmp_limit* limit, uint32_t dst,
+                  uint8_t type, uint8_t code)
+{
+    struct sr_icmp_bucket* peer = 0;
+    unsigned long now;
+    uint32_t h;
+
+    /* -- REQUIRES -- */
+    assert(limit);
+
+    /* fragmentation needed: path MTU discovery relies on it */
+    if (type == 3 && code == 4)
+    { return 1; }
+
+    now = sr_icmp_now_ms();
+
+    pthread_mutex_lock(&limit->lock);
+
+    if (limit->peer_rate)
+    {
+        h = (dst ^ ((uint32_t)type << 24)) * 2654435761U;
+        peer = &limit->peers[h >> (32 - SR_ICMP_PEERS_BITS)];
+
+        if (!peer->used || peer->dst != dst || peer->type != type)
+        {
+            peer->used = 1;
+            peer->dst = dst;
+            peer->type = type;
+            peer->tokens = limit->peer_burst * SR_ICMP_TOKEN;
+            peer->last_ms = now;
+        }
+        else
+        { sr_icmp_refill(peer, limit->peer_rate, limit->peer_burst, now); }
+
+        if (peer->tokens < SR_ICMP_TOKEN)
+        {
+            limit->suppressed_peer++;
+            pthread_mutex_unlock(&limit->lock);
+            return 0;
+        }
+    }
+
+    if (limit->global_rate)
+    {
+        sr_icmp_refill(&limit->global, limit->global_rate,
+                       limit->global_burst, now);
+        if (limit->global.tokens < SR_ICMP_TOKEN)
+        {
+            limit->suppressed_global++;
+            pthread_mutex_unlock(&limit->lock);
+            return 0;
+        }
+        limit->global.tokens -= SR_ICMP_TOKEN;
+    }
+
+    if (peer)
+    { peer->tokens -= SR_ICMP_TOKEN; }
+    limit->sent++;
+
+    pthread_mutex_unlock(&limit->lock);
+    return 1;
+} /* -- sr_icmp_allow -- */
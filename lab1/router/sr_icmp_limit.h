@@ -0,0 +1,74 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp_limit.h
+ *
+ * Description:
+ *
+ * ICMP error rate limiting, along the lines of Linux's icmp_ratelimit and
+ * icmp_msgs_per_sec. Every error we are about to generate has to get a
+ * token from two buckets: one global bucket, and one for its (destination,
+ * type) pair. The per-pair buckets live in a small direct-mapped hash; a
+ * pair that collides with another simply takes over the slot with a full
+ * bucket, and the global bucket still bounds the total.
+ *
+ * Fragmentation-needed errors are never limited, since path MTU discovery
+ * depends on them.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ICMP_LIMIT_H
+#define SR_ICMP_LIMIT_H
+
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_ICMP_PEERS_BITS  8     /* 256 (destination, type) buckets */
+#define SR_ICMP_PEERS       (1 << SR_ICMP_PEERS_BITS)
+
+#define SR_ICMP_GLOBAL_RATE  1000 /* errors per second, all destinations */
+#define SR_ICMP_GLOBAL_BURST 50
+#define SR_ICMP_PEER_RATE    1    /* errors per second per (destination, type) */
+#define SR_ICMP_PEER_BURST   6
+
+struct sr_icmp_bucket
+{
+    uint32_t dst;                /* network order, peer buckets only */
+    uint8_t type;
+    uint8_t used;
+    unsigned long tokens;        /* in thousandths of a message */
+    unsigned long last_ms;       /* last refill */
+};
+
+struct sr_icmp_limit
+{
+    unsigned int global_rate;    /* 0: unlimited */
+    unsigned int global_burst;
+    unsigned int peer_rate;      /* 0: unlimited */
+    unsigned int peer_burst;
+
+    struct sr_icmp_bucket global;
+    struct sr_icmp_bucket peers[SR_ICMP_PEERS];
+
+    unsigned long sent;              /* errors allowed */
+    unsigned long suppressed_global; /* errors refused by the global bucket */
+    unsigned long suppressed_peer;   /* errors refused by a per-pair bucket */
+
+    pthread_mutex_t lock;
+};
+
+/* Set up the limiter with the default rates. Returns 0 on success. */
+int  sr_icmp_limit_init(struct sr_icmp_limit* limit);
+void sr_icmp_limit_destroy(struct sr_icmp_limit* limit);
+
+/* Returns 1 if an ICMP error of type/code may be sent to dst (network
+   order) now, taking the tokens for it; 0 if it should be suppressed. */
+int sr_icmp_allow(struct sr_icmp_limit* limit, uint32_t dst,
+                  uint8_t type, uint8_t code);
+
+#endif /* -- SR_ICMP_LIMIT_H -- */
@@ -41,6 +41,7 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  int stats;                    /* counter index (sr_stats.h), -1 if none */
   struct sr_if* next;
 };
 
@@ -48,6 +49,7 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_set_ether_speed(struct sr_instance*, uint32_t speed);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
@@ -0,0 +1,636 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_loadgen.c
+ *
+ * Description:
+ *
+ * Parametric synthetic traffic generator for load testing the router.
+ * Builds a routing table of random prefixes (1 to 1M entries), seeds the
+ * ARP cache for a chosen share of the next hops, then synthesizes frames
+ * straight into sr_handlepacket() and times every call. The mix is set on
+ * the command line:
+ *
+ *   - destination distribution over the table: uniform, Zipf or a
+ *     single flow
+ *   - ARP hit ratio: share of next hops that are already resolved
+ *   - share of packets that arrive with TTL 1
+ *   - share of packets that are ICMP echo requests to the router
+ *
+ * Reports throughput and service time percentiles along with what the
+ * router did with the traffic. Frames are generated before the clock
+ * starts, so only router work is measured. In a build with SR_TRACE,
+ * -T writes the stage trace of the run for sr_trace_summary.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifdef _SOLARIS_
+#define __EXTENSIONS__
+#endif /* _SOLARIS_ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_arpcache.h"
+#include "sr_utils.h"
+#include "sr_pbuf.h"
+#include "sr_trace.h"
+#include "sr_bench_util.h"
+
+extern char* optarg;
+
+#define DEFAULT_PACKETS   100000
+#define DEFAULT_TABLE     1000
+#define DEFAULT_LEN       98     /* bytes on the wire, same as a ping */
+#define DEFAULT_NEXTHOPS  64
+#define DEFAULT_IFACES    4
+#define MIN_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + \
+                 sizeof(sr_icmp_t3_hdr_t))
+
+enum sr_loadgen_dist
+{
+    dist_uniform,
+    dist_zipf,
+    dist_single
+};
+
+static void usage(char* );
+static uint64_t rnd(void);
+static double rnd_unit(void);
+static void sr_loadgen_ifaces(struct sr_instance* , int );
+static void sr_loadgen_table(struct sr_instance* , unsigned int ,
+                             uint32_t* , unsigned int );
+static void sr_loadgen_seed_arp(struct sr_instance* , uint32_t* ,
+                                unsigned int );
+static unsigned int sr_loadgen_pick(enum sr_loadgen_dist , double* ,
+                                    unsigned int );
+static void sr_loadgen_frame(uint8_t* , unsigned int , struct sr_if* ,
+                             uint32_t , uint8_t , int );
+static int cmp_u32(const void* , const void* );
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    int c, i;
+    char *rtable = 0;
+    char *ifaces = 0;
+    char *trace = 0;
+    unsigned int npackets = DEFAULT_PACKETS;
+    unsigned int table = DEFAULT_TABLE;
+    unsigned int len = DEFAULT_LEN;
+    unsigned int nnexthops = DEFAULT_NEXTHOPS;
+    enum sr_loadgen_dist dist = dist_uniform;
+    double zipf_s = 1.0;
+    double arp_hit = 1.0;
+    double ttl_frac = 0.0;
+    double icmp_frac = 0.0;
+    int verbose = 0;
+    struct sr_instance sr;
+    FILE* report;
+    struct sr_if** iflist;
+    unsigned int nifs;
+    struct sr_if* if_walker;
+    struct sr_rt** routes;
+    unsigned int nroutes;
+    struct sr_rt* rt_walker;
+    uint32_t nexthops[SR_ARPCACHE_SZ];
+    unsigned int nseeded;
+    double* cdf = 0;
+    uint8_t* arena;
+    struct sr_if** ingress;
+    uint32_t* lat;
+    unsigned long drops[sr_drop_max], drops_end[sr_drop_max];
+    unsigned int n, queued;
+    uint64_t start, t0, t1, elapsed;
+    struct sr_arpreq* req;
+    struct sr_packet* pkt;
+
+    while ((c = getopt(argc, argv, "hi:r:t:d:z:H:x:m:n:l:g:S:T:v")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'i':
+                ifaces = optarg;
+                break;
+            case 'r':
+                rtable = optarg;
+                break;
+            case 't':
+                table = atoi((char *) optarg);
+                break;
+            case 'd':
+                if (strcmp(optarg, "uniform") == 0)
+                { dist = dist_uniform; }
+                else if (strcmp(optarg, "zipf") == 0)
+                { dist = dist_zipf; }
+                else if (strcmp(optarg, "single") == 0)
+                { dist = dist_single; }
+                else
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'z':
+                zipf_s = atof((char *) optarg);
+                break;
+            case 'H':
+                arp_hit = atof((char *) optarg);
+                break;
+            case 'x':
+                ttl_frac = atof((char *) optarg);
+                break;
+            case 'm':
+                icmp_frac = atof((char *) optarg);
+                break;
+            case 'n':
+                npackets = atoi((char *) optarg);
+                break;
+            case 'l':
+                len = atoi((char *) optarg);
+                break;
+            case 'g':
+                nnexthops = atoi((char *) optarg);
+                break;
+            case 'S':
+                rnd_state = strtoull(optarg, 0, 0) | 1;
+                break;
+            case 'T':
+                trace = optarg;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    if (table < 1)
+    { table = 1; }
+    if (table > 1000000)
+    { table = 1000000; }
+    if (npackets < 1)
+    { npackets = 1; }
+    if (len < MIN_LEN)
+    { len = MIN_LEN; }
+    if (len > 1514)
+    { len = 1514; }
+    /* every next hop has to fit in the ARP cache */
+    if (nnexthops < 1)
+    { nnexthops = 1; }
+    if (nnexthops > SR_ARPCACHE_SZ)
+    { nnexthops = SR_ARPCACHE_SZ; }
+
+    /* -- interfaces and routing table -- */
+    sr_bench_init_instance(&sr);
+    if (ifaces)
+    {
+        if (sr_bench_load_ifaces(&sr, ifaces) != 0)
+        { exit(1); }
+    }
+    else
+    { sr_loadgen_ifaces(&sr, DEFAULT_IFACES); }
+
+    for (nifs = 0, if_walker = sr.if_list; if_walker; if_walker = if_walker->next)
+    { nifs++; }
+    iflist = (struct sr_if**)malloc(nifs * sizeof(struct sr_if*));
+    assert(iflist);
+    for (i = 0, if_walker = sr.if_list; if_walker; if_walker = if_walker->next)
+    { iflist[i++] = if_walker; }
+
+    if (rtable)
+    {
+        if (sr_load_rt(&sr, rtable) != 0)
+        {
+            fprintf(stderr, "Error setting up routing table from file %s\n",
+                    rtable);
+            exit(1);
+        }
+        /* use the table's own gateways as the next hops */
+        nnexthops = 0;
+        for (rt_walker = sr.routing_table; rt_walker; rt_walker = rt_walker->next)
+        {
+            for (n = 0; n < nnexthops && nexthops[n] != rt_walker->gw.s_addr; n++)
+            { }
+            if (n == nnexthops && nnexthops < SR_ARPCACHE_SZ)
+            { nexthops[nnexthops++] = rt_walker->gw.s_addr; }
+        }
+    }
+    else
+    {
+        for (n = 0; n < nnexthops; n++)
+        { nexthops[n] = htonl(0x0a800000 | (n + 1)); } /* 10.128.0.x */
+        sr_loadgen_table(&sr, table, nexthops, nnexthops);
+    }
+
+    for (nroutes = 0, rt_walker = sr.routing_table; rt_walker;
+         rt_walker = rt_walker->next)
+    { nroutes++; }
+    if (nroutes == 0)
+    {
+        fprintf(stderr, "Empty routing table\n");
+        exit(1);
+    }
+    routes = (struct sr_rt**)malloc(nroutes * sizeof(struct sr_rt*));
+    assert(routes);
+    for (n = 0, rt_walker = sr.routing_table; rt_walker; rt_walker = rt_walker->next)
+    { routes[n++] = rt_walker; }
+
+    /* shuffle so that popularity has nothing to do with table position */
+    for (n = nroutes - 1; n > 0; n--)
+    {
+        unsigned int j = rnd() % (n + 1);
+        rt_walker = routes[n];
+        routes[n] = routes[j];
+        routes[j] = rt_walker;
+    }
+
+    if (dist == dist_zipf)
+    {
+        double sum = 0;
+        cdf = (double*)malloc(nroutes * sizeof(double));
+        assert(cdf);
+        for (n = 0; n < nroutes; n++)
+        {
+            sum += 1.0 / pow(n + 1, zipf_s);
+            cdf[n] = sum;
+        }
+        for (n = 0; n < nroutes; n++)
+        { cdf[n] /= sum; }
+    }
+
+    /* -- generate the traffic before the clock starts -- */
+    arena   = (uint8_t*)malloc((size_t)npackets * len);
+    ingress = (struct sr_if**)malloc(npackets * sizeof(struct sr_if*));
+    lat     = (uint32_t*)malloc(npackets * sizeof(uint32_t));
+    assert(arena && ingress && lat);
+
+    for (n = 0; n < npackets; n++)
+    {
+        struct sr_if* in = iflist[rnd() % nifs];
+        uint32_t dst;
+        uint8_t ttl = 64;
+        int echo = 0;
+
+        if (rnd_unit() < icmp_frac)
+        {
+            dst = iflist[rnd() % nifs]->ip;
+            echo = 1;
+        }
+        else
+        {
+            rt_walker = routes[sr_loadgen_pick(dist, cdf, nroutes)];
+            dst = rt_walker->dest.s_addr |
+                  ((uint32_t)rnd() & ~rt_walker->mask.s_addr);
+            if (rnd_unit() < ttl_frac)
+            { ttl = 1; }
+        }
+
+        ingress[n] = in;
+        sr_loadgen_frame(arena + (size_t)n * len, len, in, dst, ttl, echo);
+    }
+
+    /* -- run -- */
+    sr_init(&sr);
+    nseeded = (unsigned int)(arp_hit * nnexthops + 0.5);
+    if (nseeded > nnexthops)
+    { nseeded = nnexthops; }
+    sr_loadgen_seed_arp(&sr, nexthops, nseeded);
+
+    report = sr_bench_report_stream(verbose);
+    memset(&sr_bench_tx, 0, sizeof(sr_bench_tx));
+    sr_stats_drops(drops);
+
+    start = sr_bench_now_ns();
+    for (n = 0; n < npackets; n++)
+    {
+        t0 = sr_bench_now_ns();
+        sr_handlepacket(&sr, arena + (size_t)n * len, len, ingress[n]->name);
+        t1 = sr_bench_now_ns();
+        lat[n] = (t1 - t0 > 0xffffffffULL) ? 0xffffffff : (uint32_t)(t1 - t0);
+
+        /* ARP entries time out after SR_ARPCACHE_TO; keep the seeded ones
+           alive on long runs so the hit ratio holds */
+        if ((n & 0xffff) == 0xffff)
+        { sr_loadgen_seed_arp(&sr, nexthops, nseeded); }
+    }
+    elapsed = sr_bench_now_ns() - start;
+
+    queued = 0;
+    pthread_mutex_lock(&(sr.cache.lock));
+    for (req = sr.cache.requests; req; req = req->next)
+    {
+        for (pkt = req->packets; pkt; pkt = pkt->next)
+        { queued++; }
+    }
+    pthread_mutex_unlock(&(sr.cache.lock));
+
+    qsort(lat, npackets, sizeof(uint32_t), cmp_u32);
+
+    /* -- report -- */
+    fprintf(report, "table:        %u routes, %u next hops (%u resolved), %u interfaces\n",
+            nroutes, nnexthops, nseeded, nifs);
+    fprintf(report, "traffic:      %u frames of %u bytes, %s",
+            npackets, len,
+            dist == dist_uniform ? "uniform" :
+            dist == dist_single ? "single flow" : "zipf");
+    if (dist == dist_zipf)
+    { fprintf(report, " (s=%.2f)", zipf_s); }
+    fprintf(report, ", ttl expiry %.1f%%, icmp to router %.1f%%\n",
+            ttl_frac * 100, icmp_frac * 100);
+    fprintf(report, "elapsed:      %.3f ms\n", elapsed / 1e6);
+    fprintf(report, "throughput:   %.0f pps\n", npackets * 1e9 / elapsed);
+    fprintf(report, "latency (ns): p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+            lat[npackets / 2],
+            lat[(unsigned int)(npackets * 0.90)],
+            lat[(unsigned int)(npackets * 0.99)],
+            lat[(unsigned int)(npackets * 0.999)],
+            lat[npackets - 1]);
+    fprintf(report, "transmitted:  %lu frames, %lu bytes (%lu ARP requests)\n",
+            sr_bench_tx.packets, sr_bench_tx.bytes, sr_bench_tx.arp_reqs);
+    fprintf(report, "arp queue:    %u frames waiting\n", queued);
+    fprintf(report, "icmp errors:  %lu sent, %lu rate limited (%lu global, %lu per destination)\n",
+            sr.icmp_limit.sent,
+            sr.icmp_limit.suppressed_global + sr.icmp_limit.suppressed_peer,
+            sr.icmp_limit.suppressed_global, sr.icmp_limit.suppressed_peer);
+    fprintf(report, "pbufs:        %lu in use, %lu allocations refused\n",
+            sr_pbuf_in_use(), sr_pbuf_exhausted());
+    sr_stats_drops(drops_end);
+    fprintf(report, "drops:\n");
+    for (i = 0; i < sr_drop_max; i++)
+    {
+        fprintf(report, "  %-14s %lu\n", sr_drop_name((enum sr_drop_reason)i),
+                drops_end[i] - drops[i]);
+    }
+    if (trace)
+    {
+#ifdef SR_TRACE
+        long nrecs = sr_trace_dump(trace);
+        if (nrecs >= 0)
+        { fprintf(report, "trace:        %ld records written to %s\n", nrecs, trace); }
+#else
+        fprintf(stderr, "-T: built without SR_TRACE, no trace written\n");
+#endif /* SR_TRACE */
+    }
+    fflush(report);
+
+    return 0;
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router synthetic load generator\n");
+    printf("Format: %s [-i interfaces] [-r routing table | -t table size]\n", argv0);
+    printf("           [-d uniform|zipf|single] [-z zipf exponent] [-g next hops]\n");
+    printf("           [-H arp hit ratio] [-x ttl expiry fraction]\n");
+    printf("           [-m icmp to router fraction] [-n packets] [-l frame length]\n");
+    printf("           [-S seed] [-T trace file] [-v]\n");
+    printf("   defaults packets=%d table=%d length=%d next hops=%d\n",
+           DEFAULT_PACKETS, DEFAULT_TABLE, DEFAULT_LEN, DEFAULT_NEXTHOPS);
+    printf("            uniform, arp hit ratio 1.0, no ttl expiry, no icmp\n");
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: rnd(..), rnd_unit(..)
+ * Scope: local
+ *
+ * xorshift64*; fast and reproducible for a given -S seed.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint64_t rnd(void)
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 2685821657736338717ULL;
+}
+
+static double rnd_unit(void)
+{
+    return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_loadgen_ifaces(..)
+ * Scope: local
+ *
+ * Make up n interfaces eth0 .. eth<n-1> with addresses 10.255.<i>.1
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_loadgen_ifaces(struct sr_instance* sr, int n)
+{
+    char name[sr_IFACE_NAMELEN];
+    unsigned char addr[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        snprintf(name, sizeof(name), "eth%d", i);
+        addr[5] = (unsigned char)(i + 1);
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, addr);
+        sr_set_ether_ip(sr, htonl(0x0aff0001 | (i << 8)));
+    }
+} /* -- sr_loadgen_ifaces -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_loadgen_table(..)
+ * Scope: local
+ *
+ * Fill the routing table with n random prefixes spread over the next hops.
+ * Lengths are skewed towards /24 the way real tables are. A prefix drawn
+ * again is drawn over, so the table has n routes unless memory runs out.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_loadgen_table(struct sr_instance* sr, unsigned int n,
+                             uint32_t* nexthops, unsigned int nnexthops)
+{
+    struct in_addr dest, gw, mask;
+    struct sr_if* if_walker;
+    unsigned int i = 0, j, nifs = 0;
+    int plen, ret;
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    { nifs++; }
+
+    while (i < n)
+    {
+        double r = rnd_unit();
+        plen = r < 0.55 ? 24 : r < 0.90 ? 16 + (int)(rnd() % 8) :
+                               8 + (int)(rnd() % 8);
+
+        mask.s_addr = htonl(SR_FIB_MASK(plen));
+        dest.s_addr = htonl((uint32_t)rnd()) & mask.s_addr;
+        j = rnd() % nnexthops;
+        gw.s_addr = nexthops[j];
+
+        /* a next hop always sits behind the same interface */
+        if_walker = sr->if_list;
+        for (plen = j % nifs; plen > 0; plen--)
+        { if_walker = if_walker->next; }
+
+        if ((ret = sr_add_rt_entry(sr, dest, gw, mask, if_walker->name)) == 0)
+        { i++; }
+        else if (ret == SR_RT_NOMEM)
+        {
+            fprintf(stderr, "Out of memory after %u of %u routes\n", i, n);
+            return;
+        }
+    }
+} /* -- sr_loadgen_table -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_loadgen_seed_arp(..)
+ * Scope: local
+ *
+ * Make sure the first n next hops are resolved: refresh their ARP entries
+ * if present, insert them otherwise.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_loadgen_seed_arp(struct sr_instance* sr, uint32_t* nexthops,
+                                unsigned int n)
+{
+    struct sr_arpcache* cache = &(sr->cache);
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int i;
+    int j;
+    struct sr_arpreq* req;
+
+    pthread_mutex_lock(&(cache->lock));
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < SR_ARPCACHE_SZ; j++)
+        {
+            if (cache->entries[j].valid && cache->entries[j].ip == nexthops[i])
+            {
+                cache->entries[j].added = time(NULL);
+                break;
+            }
+        }
+        if (j < SR_ARPCACHE_SZ)
+        { continue; }
+
+        mac[0] = 0x02;
+        mac[1] = 0x00;
+        memcpy(mac + 2, &nexthops[i], 4);
+        if ((req = sr_arpcache_insert(cache, mac, nexthops[i], 0)) != 0)
+        { sr_arpreq_destroy(cache, req); }
+    }
+    pthread_mutex_unlock(&(cache->lock));
+} /* -- sr_loadgen_seed_arp -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_loadgen_pick(..)
+ * Scope: local
+ *
+ * Draw a route index from the destination distribution.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned int sr_loadgen_pick(enum sr_loadgen_dist dist, double* cdf,
+                                    unsigned int n)
+{
+    unsigned int lo, hi, mid;
+    double u;
+
+    switch (dist)
+    {
+        case dist_single:
+            return 0;
+        case dist_zipf:
+            u = rnd_unit();
+            lo = 0;
+            hi = n - 1;
+            while (lo < hi)
+            {
+                mid = (lo + hi) / 2;
+                if (cdf[mid] < u)
+                { lo = mid + 1; }
+                else
+                { hi = mid; }
+            }
+            return lo;
+        default:
+            return rnd() % n;
+    }
+} /* -- sr_loadgen_pick -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_loadgen_frame(..)
+ * Scope: local
+ *
+ * Write a frame of len bytes, as received on iface, addressed to dst. Echo
+ * requests are ICMP, everything else UDP.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_loadgen_frame(uint8_t* buf, unsigned int len, struct sr_if* iface,
+                             uint32_t dst, uint8_t ttl, int echo)
+{
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)buf;
+    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    sr_icmp_hdr_t* icmp_hdr;
+    unsigned int ip_len = len - sizeof(sr_ethernet_hdr_t);
+
+    memset(buf, 0, len);
+
+    memcpy(e_hdr->ether_dhost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_shost[0] = 0x02;
+    e_hdr->ether_shost[1] = 0xee;
+    memcpy(e_hdr->ether_shost + 2, &iface->ip, 4);
+    e_hdr->ether_type = htons(ethertype_ip);
+
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = 5;
+    ip_hdr->ip_len = htons(ip_len);
+    ip_hdr->ip_id = htons((uint16_t)rnd());
+    ip_hdr->ip_ttl = ttl;
+    ip_hdr->ip_p = echo ? ip_protocol_icmp : 17;
+    ip_hdr->ip_src = (iface->ip & htonl(0xffffff00)) | htonl(2 + rnd() % 200);
+    ip_hdr->ip_dst = dst;
+    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+
+    if (echo)
+    {
+        icmp_hdr = (sr_icmp_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t) +
+                                    sizeof(sr_ip_hdr_t));
+        icmp_hdr->icmp_type = 8;
+        icmp_hdr->icmp_sum = cksum(icmp_hdr, ip_len - sizeof(sr_ip_hdr_t));
+    }
+} /* -- sr_loadgen_frame -- */
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
@@ -0,0 +1,230 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Binary log ring and its formatting thread. See sr_log.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sr_ring.h"
+#include "sr_log.h"
+
+#define SR_LOG_IDLE_US 10000  /* formatter poll interval when idle */
+
+/* A message as it sits in the ring */
+struct sr_log_rec
+{
+    struct timeval ts;
+    const struct sr_log_site* site;
+    unsigned long suppressed;
+    uint32_t args[SR_LOG_MAX_ARGS];
+    char str[SR_LOG_STR_LEN];
+};
+
+int sr_log_level = SR_LOG_WARN;
+
+static struct sr_ring sr_log_ring;
+static FILE* sr_log_out;
+static int sr_log_running;
+static int sr_log_stop;
+static unsigned long sr_log_dropped;
+static pthread_t sr_log_thread;
+
+static const char* sr_log_names[] = { "ERR", "WARN", "INFO", "DEBUG" };
+
+static void* sr_log_formatter(void* );
+static void  sr_log_format(const struct sr_log_rec* );
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_log_open(FILE* out)
+{
+    /* -- REQUIRES -- */
+    assert(out);
+
+    if (sr_log_running)
+    { return 0; }
+
+    if (sr_ring_init(&sr_log_ring, SR_LOG_SLOTS, sizeof(struct sr_log_rec)) != 0)
+    {
+        fprintf(stderr, "sr_log_open: out of memory\n");
+        return -1;
+    }
+
+    sr_log_out = out;
+    sr_log_stop = 0;
+    if (pthread_create(&sr_log_thread, 0, sr_log_formatter, 0) != 0)
+    {
+        perror("pthread_create");
+        sr_ring_destroy(&sr_log_ring);
+        return -1;
+    }
+
+    __atomic_store_n(&sr_log_running, 1, __ATOMIC_RELEASE);
+    return 0;
+} /* -- sr_log_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_close(..)
+ * Scope: Global
+ *
+ * Format whatever is still queued and stop the thread. Not safe against
+ * threads that are still logging.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_close(void)
+{
+    if (!sr_log_running)
+    { return; }
+
+    __atomic_store_n(&sr_log_running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&sr_log_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sr_log_thread, 0);
+
+    if (sr_log_dropped)
+    { fprintf(sr_log_out, "log: %lu messages lost (ring full)\n", sr_log_dropped); }
+    fflush(sr_log_out);
+
+    sr_ring_destroy(&sr_log_ring);
+} /* -- sr_log_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_emit(..)
+ * Scope: Global
+ *
+ * Rate limit, then queue the message for the formatter.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_emit(struct sr_log_site* site, const char* str,
+                 const uint32_t* args, unsigned int nargs)
+{
+    struct sr_log_rec* rec;
+    struct timeval tv;
+
+    if (!__atomic_load_n(&sr_log_running, __ATOMIC_ACQUIRE))
+    { return; }
+
+    gettimeofday(&tv, 0);
+
+    /* the per site counters are best effort if two threads log from the
+       same site in the same instant */
+    if (site->window != (unsigned long)tv.tv_sec)
+    {
+        site->window = tv.tv_sec;
+        site->count = 0;
+    }
+    if (site->count >= SR_LOG_RATE)
+    {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    site->count++;
+
+    rec = (struct sr_log_rec*)sr_ring_claim(&sr_log_ring);
+    if (rec == 0)
+    {
+        __atomic_fetch_add(&sr_log_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec->ts = tv;
+    rec->site = site;
+    rec->suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    if (nargs > SR_LOG_MAX_ARGS)
+    { nargs = SR_LOG_MAX_ARGS; }
+    memset(rec->args, 0, sizeof(rec->args));
+    memcpy(rec->args, args, nargs * sizeof(uint32_t));
+    if (str)
+    {
+        strncpy(rec->str, str, SR_LOG_STR_LEN - 1);
+        rec->str[SR_LOG_STR_LEN - 1] = 0;
+    }
+
+    sr_ring_publish(&sr_log_ring, rec);
+} /* -- sr_log_emit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_formatter(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_log_formatter(void* arg)
+{
+    struct sr_log_rec* rec;
+    struct timespec idle;
+    int stop, n;
+
+    (void)arg;
+    idle.tv_sec = 0;
+    idle.tv_nsec = SR_LOG_IDLE_US * 1000;
+
+    for (;;)
+    {
+        stop = __atomic_load_n(&sr_log_stop, __ATOMIC_ACQUIRE);
+
+        for (n = 0; (rec = (struct sr_log_rec*)sr_ring_peek(&sr_log_ring)) != 0; n++)
+        {
+            sr_log_format(rec);
+            sr_ring_release(&sr_log_ring);
+        }
+        if (n)
+        { fflush(sr_log_out); }
+
+        if (stop)
+        { break; }
+
+        nanosleep(&idle, 0);
+    }
+
+    return 0;
+} /* -- sr_log_formatter -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_format(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_log_format(const struct sr_log_rec* rec)
+{
+    const struct sr_log_site* site = rec->site;
+    const uint32_t* a = rec->args;
+    struct tm tm;
+    time_t secs = rec->ts.tv_sec;
+
+    localtime_r(&secs, &tm);
+    fprintf(sr_log_out, "%02d:%02d:%02d.%06ld %-5s ", tm.tm_hour, tm.tm_min,
+            tm.tm_sec, (long)rec->ts.tv_usec, sr_log_names[site->level]);
+
+    /* unused arguments are zero and ignored by printf */
+    if (site->has_str)
+    {
+        fprintf(sr_log_out, site->fmt, rec->str,
+                a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+    else
+    {
+        fprintf(sr_log_out, site->fmt,
+                a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+
+    if (rec->suppressed)
+    { fprintf(sr_log_out, " (%lu similar suppressed)", rec->suppressed); }
+    fputc('\n', sr_log_out);
+} /* -- sr_log_format -- */
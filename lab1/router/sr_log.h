@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Leveled, rate limited logging that is cheap enough for the packet path.
+ *
+ *   SR_LOG(SR_LOG_WARN, "bad checksum from %u.%u.%u.%u", SR_LOG_IP(ip));
+ *   SR_LOG_S(SR_LOG_DEBUG, iface, "%s: forwarding %u bytes", len);
+ *
+ * Levels above SR_LOG_COMPILE_LEVEL compile to nothing. Levels above the
+ * runtime level (sr_log_level, set with sr -d) cost one predictable
+ * branch. An enabled message is not formatted where it is logged: its
+ * call site, timestamp and up to SR_LOG_MAX_ARGS integer arguments (plus
+ * one short string for SR_LOG_S) are put in a lock-free ring and a
+ * background thread does the printf. Arguments are therefore integers;
+ * use SR_LOG_IP() to log an address. For SR_LOG_S the string is always
+ * the first conversion in the format.
+ *
+ * Each call site allows SR_LOG_RATE messages a second and counts the
+ * rest; the count is reported with the next message from that site.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#include <stdio.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_LOG_ERR   0
+#define SR_LOG_WARN  1
+#define SR_LOG_INFO  2
+#define SR_LOG_DEBUG 3
+
+/* e.g. make OPT=-DSR_LOG_COMPILE_LEVEL=1 to build without info/debug */
+#ifndef SR_LOG_COMPILE_LEVEL
+#ifdef _DEBUG_
+#define SR_LOG_COMPILE_LEVEL SR_LOG_DEBUG
+#else
+#define SR_LOG_COMPILE_LEVEL SR_LOG_INFO
+#endif
+#endif
+
+#define SR_LOG_MAX_ARGS 6
+#define SR_LOG_STR_LEN  16    /* bytes of the SR_LOG_S string kept */
+#define SR_LOG_RATE     10    /* messages per second per call site */
+#define SR_LOG_SLOTS    1024  /* messages the ring can hold */
+
+/* One per call site, static so it costs nothing until used */
+struct sr_log_site
+{
+    int level;
+    const char* file;
+    int line;
+    const char* fmt;
+    int has_str;
+    unsigned long window;        /* second the current count is for */
+    unsigned int count;          /* messages logged in that second */
+    unsigned long suppressed;    /* messages rate limited since the last one */
+};
+
+extern int sr_log_level;
+
+#ifdef __GNUC__
+#define SR_LOG_LIKELY(x)   __builtin_expect(!!(x), 1)
+#define SR_LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define SR_LOG_LIKELY(x)   (x)
+#define SR_LOG_UNLIKELY(x) (x)
+#endif
+
+/* True if a message at lvl would be logged; use it to guard expensive
+   diagnostics such as table dumps. */
+#define SR_LOG_ON(lvl) \
+    ((lvl) <= SR_LOG_COMPILE_LEVEL && SR_LOG_UNLIKELY((lvl) <= sr_log_level))
+
+#define SR_LOG_EMIT(lvl, has_str, str, fmt, args...) \
+    do { \
+        if (SR_LOG_ON(lvl)) \
+        { \
+            static struct sr_log_site sr_log_site_ = \
+                { (lvl), __FILE__, __LINE__, fmt, (has_str), 0, 0, 0 }; \
+            uint32_t sr_log_args_[] = { 0, ## args }; \
+            sr_log_emit(&sr_log_site_, (str), sr_log_args_ + 1, \
+                        sizeof(sr_log_args_) / sizeof(uint32_t) - 1); \
+        } \
+    } while (0)
+
+#define SR_LOG(lvl, fmt, args...)        SR_LOG_EMIT(lvl, 0, (const char*)0, fmt, ## args)
+#define SR_LOG_S(lvl, str, fmt, args...) SR_LOG_EMIT(lvl, 1, (const char*)(str), fmt, ## args)
+
+/* network order address as four arguments for "%u.%u.%u.%u" */
+#define SR_LOG_IP(a) \
+    ((ntohl(a) >> 24) & 0xff), ((ntohl(a) >> 16) & 0xff), \
+    ((ntohl(a) >> 8) & 0xff), (ntohl(a) & 0xff)
+
+/* Start the formatting thread writing to out. Until it is started, and
+   after sr_log_close(), messages are dropped. */
+int  sr_log_open(FILE* out);
+void sr_log_close(void);
+
+/* Use the macros rather than calling this directly */
+void sr_log_emit(struct sr_log_site* site, const char* str,
+                 const uint32_t* args, unsigned int nargs);
+
+#endif /* -- SR_LOG_H -- */
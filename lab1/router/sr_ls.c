@@ -0,0 +1,1766 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ls.c
+ *
+ * Description:
+ *
+ * Link-state routing between sr instances. See sr_ls.h.
+ *
+ * Everything here is guarded by ls->lock. Packets are handled on the
+ * thread that reads them; hellos, ageing and the route computation run
+ * on a thread of their own.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_ls.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_pbuf.h"
+#include "sr_utils.h"
+#include "sr_log.h"
+
+#define SR_LS_INF        0xffffffffU
+#define SR_LS_HASH       1024           /* router id buckets */
+#define SR_LS_PFX_HASH   (1 << 14)      /* prefix buckets */
+#define SR_LS_MAX_SEEN   32             /* routers listed in a hello */
+#define SR_LS_MAX_CHG    64             /* link changes queued for a partial
+                                           computation; more and the whole
+                                           tree is recomputed */
+
+/* room for an LSA's links and prefixes in one packet */
+#define SR_LS_LSA_ROOM (SR_LS_MTU - sizeof(sr_ip_hdr_t) - \
+                        sizeof(struct sr_ls_hdr) - sizeof(struct sr_ls_lsa))
+
+/* a router heard on one of our links */
+struct sr_ls_adj
+{
+    int used;
+    char iface[sr_IFACE_NAMELEN];
+    uint32_t id;                    /* host order */
+    uint32_t ip;                    /* its address on the link, network order */
+    uint64_t heard_ms;
+    int two_way;                    /* it hears us too */
+};
+
+/* a router in the database, with its LSA and where it sits in the
+   shortest path tree */
+struct sr_ls_router
+{
+    int used;
+    uint32_t id;                    /* host order */
+    uint32_t seq;
+    uint64_t recv_ms;
+    unsigned int n_links;
+    struct sr_ls_link* links;       /* host order, sorted by router id */
+    unsigned int n_prefixes;
+    struct sr_ls_pfx* prefixes;     /* prefix network order, cost host order */
+    int hash_next;
+
+    uint32_t dist;                  /* SR_LS_INF when unreachable */
+    int parent;
+    int heap_pos;
+    int touched;                    /* in ls->touched this computation */
+    uint32_t nh_gw;                 /* first hop, 0 for us and the unreachable */
+    char nh_iface[sr_IFACE_NAMELEN];
+};
+
+/* a router offering a prefix */
+struct sr_ls_adv
+{
+    int router;
+    uint32_t cost;
+};
+
+struct sr_ls_prefix
+{
+    uint32_t prefix;                /* network order */
+    int len;
+    int is_static;                  /* routed by the rtable, hands off */
+    int dirty;                      /* queued in ls->dirty */
+    struct sr_ls_adv* adv;
+    unsigned int n_adv;
+    unsigned int size_adv;
+    int installed;                  /* what the routing table has from us */
+    uint32_t gw;
+    char iface[sr_IFACE_NAMELEN];
+    struct sr_ls_prefix* next;
+};
+
+struct sr_ls
+{
+    struct sr_instance* sr;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int stop;
+
+    uint32_t id;                    /* host order */
+    int self;                       /* our entry in routers */
+    struct sr_ls_adj adj[SR_LS_MAX_ADJ];
+
+    struct sr_ls_router routers[SR_LS_MAX_ROUTERS];
+    int buckets[SR_LS_HASH];
+    unsigned int n_routers;
+    struct sr_ls_prefix* pfx[SR_LS_PFX_HASH];
+    unsigned long n_pfx;
+
+    /* the rtable as it was at the start */
+    struct sr_rt* statics;
+    unsigned int n_statics;
+
+    /* work for the next computation */
+    int pending;
+    uint64_t pending_since;
+    int spf_needed;                 /* the whole tree, or ... */
+    int cut[SR_LS_MAX_CHG];         /* ... routers whose tree link got worse */
+    unsigned int n_cut;
+    int grow[SR_LS_MAX_CHG];        /* ... and routers with a link that got better */
+    unsigned int n_grow;
+    struct sr_ls_prefix** dirty;
+    unsigned int n_dirty;
+    unsigned int size_dirty;
+
+    uint64_t next_hello_ms;
+    uint64_t next_refresh_ms;
+
+    /* scratch for the computation */
+    int heap[SR_LS_MAX_ROUTERS];
+    unsigned int heap_n;
+    int touched[SR_LS_MAX_ROUTERS];
+    unsigned int n_touched;
+    int lost[SR_LS_MAX_ROUTERS];
+    uint32_t old_dist[SR_LS_MAX_ROUTERS];
+    uint32_t old_gw[SR_LS_MAX_ROUTERS];
+    char old_iface[SR_LS_MAX_ROUTERS][sr_IFACE_NAMELEN];
+
+    struct
+    {
+        unsigned long rx;
+        unsigned long rx_bad;
+        unsigned long lsas_new;
+        unsigned long lsas_old;
+        unsigned long spf_full;
+        unsigned long spf_incr;     /* computations of part of the tree */
+        unsigned long spf_avoided;  /* link changes that left the tree be */
+        unsigned long partial;      /* LSAs that only moved prefixes */
+        unsigned long route_changes;
+        double spf_last;
+        double spf_max;
+    } stats;
+};
+
+static void sr_ls_originate(struct sr_ls* ls, int force);
+
+static uint64_t sr_ls_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double sr_ls_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* cost of sending out of an interface */
+static uint32_t sr_ls_if_cost(const struct sr_if* ifp)
+{
+    uint32_t speed = ifp->speed ? ifp->speed : SR_LS_DEFAULT_SPEED;
+    uint32_t cost = SR_LS_REF_SPEED / speed;
+
+    return cost ? cost : 1;
+}
+
+static int sr_ls_if_adjacent(struct sr_ls* ls, const char* iface)
+{
+    int i;
+
+    for (i = 0; i < SR_LS_MAX_ADJ; i++)
+    {
+        if (ls->adj[i].used && ls->adj[i].two_way &&
+            strncmp(ls->adj[i].iface, iface, sr_IFACE_NAMELEN) == 0)
+        { return 1; }
+    }
+    return 0;
+}
+
+/* the cheapest adjacency to router id, or -1 */
+static int sr_ls_best_adj(struct sr_ls* ls, uint32_t id)
+{
+    struct sr_if* ifp;
+    uint32_t cost, best_cost = SR_LS_INF;
+    int i, best = -1;
+
+    for (i = 0; i < SR_LS_MAX_ADJ; i++)
+    {
+        if (!ls->adj[i].used || !ls->adj[i].two_way || ls->adj[i].id != id)
+        { continue; }
+        ifp = sr_get_interface(ls->sr, ls->adj[i].iface);
+        cost = ifp ? sr_ls_if_cost(ifp) : SR_LS_INF;
+        if (best < 0 || cost < best_cost)
+        {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+/*---------------------------------------------------------------------
+ * Routers and prefixes
+ *---------------------------------------------------------------------*/
+
+static int sr_ls_find(struct sr_ls* ls, uint32_t id)
+{
+    int i;
+
+    for (i = ls->buckets[id & (SR_LS_HASH - 1)]; i >= 0; i = ls->routers[i].hash_next)
+    {
+        if (ls->routers[i].id == id)
+        { return i; }
+    }
+    return -1;
+}
+
+static int sr_ls_add_router(struct sr_ls* ls, uint32_t id)
+{
+    struct sr_ls_router* r;
+    int i, b = id & (SR_LS_HASH - 1);
+
+    for (i = 0; i < SR_LS_MAX_ROUTERS && ls->routers[i].used; i++);
+    if (i == SR_LS_MAX_ROUTERS)
+    { return -1; }
+
+    r = &ls->routers[i];
+    memset(r, 0, sizeof(*r));
+    r->used = 1;
+    r->id = id;
+    r->dist = SR_LS_INF;
+    r->parent = -1;
+    r->heap_pos = -1;
+    r->hash_next = ls->buckets[b];
+    ls->buckets[b] = i;
+    ls->n_routers++;
+    return i;
+}
+
+/* forget a router that no longer has an LSA */
+static void sr_ls_drop_router(struct sr_ls* ls, int idx)
+{
+    int* pp = &ls->buckets[ls->routers[idx].id & (SR_LS_HASH - 1)];
+
+    while (*pp != idx)
+    { pp = &ls->routers[*pp].hash_next; }
+    *pp = ls->routers[idx].hash_next;
+    free(ls->routers[idx].links);
+    free(ls->routers[idx].prefixes);
+    memset(&ls->routers[idx], 0, sizeof(ls->routers[idx]));
+    ls->n_routers--;
+}
+
+/* cost of the link from router idx to router id, or SR_LS_INF */
+static uint32_t sr_ls_link_cost(struct sr_ls* ls, int idx, uint32_t id)
+{
+    const struct sr_ls_router* r = &ls->routers[idx];
+    unsigned int lo = 0, hi = r->n_links, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (r->links[mid].router_id < id)
+        { lo = mid + 1; }
+        else
+        { hi = mid; }
+    }
+    return lo < r->n_links && r->links[lo].router_id == id ? r->links[lo].cost : SR_LS_INF;
+}
+
+static unsigned int sr_ls_pfx_hash(uint32_t prefix, int len)
+{
+    uint32_t h = (ntohl(prefix) ^ (uint32_t)len * 0x9e3779b9U) * 0x85ebca6bU;
+    return (h >> 16) & (SR_LS_PFX_HASH - 1);
+}
+
+static struct sr_ls_prefix* sr_ls_pfx_get(struct sr_ls* ls, uint32_t prefix,
+                                          int len, int create)
+{
+    unsigned int b = sr_ls_pfx_hash(prefix, len);
+    struct sr_ls_prefix* p;
+
+    for (p = ls->pfx[b]; p; p = p->next)
+    {
+        if (p->prefix == prefix && p->len == len)
+        { return p; }
+    }
+    if (!create || !(p = (struct sr_ls_prefix*)calloc(1, sizeof(*p))))
+    { return 0; }
+    p->prefix = prefix;
+    p->len = len;
+    p->next = ls->pfx[b];
+    ls->pfx[b] = p;
+    ls->n_pfx++;
+    return p;
+}
+
+static void sr_ls_pfx_free(struct sr_ls* ls, struct sr_ls_prefix* p)
+{
+    struct sr_ls_prefix** pp = &ls->pfx[sr_ls_pfx_hash(p->prefix, p->len)];
+
+    while (*pp != p)
+    { pp = &(*pp)->next; }
+    *pp = p->next;
+    free(p->adv);
+    free(p);
+    ls->n_pfx--;
+}
+
+static void sr_ls_pending(struct sr_ls* ls)
+{
+    if (!ls->pending)
+    {
+        ls->pending = 1;
+        ls->pending_since = sr_ls_now_ms();
+        pthread_cond_signal(&ls->wake);
+    }
+}
+
+static void sr_ls_mark(struct sr_ls* ls, struct sr_ls_prefix* p)
+{
+    struct sr_ls_prefix** grown;
+
+    if (p->dirty)
+    { return; }
+    if (ls->n_dirty == ls->size_dirty)
+    {
+        unsigned int size = ls->size_dirty ? 2 * ls->size_dirty : 256;
+
+        if (!(grown = (struct sr_ls_prefix**)realloc(ls->dirty, size * sizeof(*grown))))
+        {
+            /* a full recomputation looks at everything */
+            ls->spf_needed = 1;
+            sr_ls_pending(ls);
+            return;
+        }
+        ls->dirty = grown;
+        ls->size_dirty = size;
+    }
+    p->dirty = 1;
+    ls->dirty[ls->n_dirty++] = p;
+    sr_ls_pending(ls);
+}
+
+static void sr_ls_mark_router(struct sr_ls* ls, int idx)
+{
+    const struct sr_ls_router* r = &ls->routers[idx];
+    struct sr_ls_prefix* p;
+    unsigned int i;
+
+    for (i = 0; i < r->n_prefixes; i++)
+    {
+        if ((p = sr_ls_pfx_get(ls, r->prefixes[i].prefix, r->prefixes[i].len, 0)))
+        { sr_ls_mark(ls, p); }
+    }
+}
+
+static void sr_ls_adv_del(struct sr_ls* ls, int idx, const struct sr_ls_pfx* a)
+{
+    struct sr_ls_prefix* p = sr_ls_pfx_get(ls, a->prefix, a->len, 0);
+    unsigned int i;
+
+    if (!p)
+    { return; }
+    for (i = 0; i < p->n_adv; i++)
+    {
+        if (p->adv[i].router == idx)
+        {
+            p->adv[i] = p->adv[--p->n_adv];
+            break;
+        }
+    }
+    sr_ls_mark(ls, p);
+}
+
+static void sr_ls_adv_add(struct sr_ls* ls, int idx, const struct sr_ls_pfx* a)
+{
+    struct sr_ls_prefix* p = sr_ls_pfx_get(ls, a->prefix, a->len, 1);
+    struct sr_ls_adv* grown;
+
+    if (!p)
+    { return; }
+    if (p->n_adv == p->size_adv)
+    {
+        unsigned int size = p->size_adv ? 2 * p->size_adv : 2;
+
+        if (!(grown = (struct sr_ls_adv*)realloc(p->adv, size * sizeof(*grown))))
+        { return; }
+        p->adv = grown;
+        p->size_adv = size;
+    }
+    p->adv[p->n_adv].router = idx;
+    p->adv[p->n_adv].cost = a->cost;
+    p->n_adv++;
+    sr_ls_mark(ls, p);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_moves_tree(..)
+ * Scope: Local
+ *
+ * Whether router idx going from the old links to the new ones can
+ * change the shortest path tree, queueing up what the next computation
+ * has to look at: the routers whose link to the tree got worse, whose
+ * subtrees have to find their way again, and the routers with a link
+ * that got better, to try it from. A link only counts when both ends
+ * list it, so one missing from the other end changes nothing either
+ * way. Equal cost alternatives are not taken up, so a tie changes
+ * nothing.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_queue(struct sr_ls* ls, int* list, unsigned int* n, int idx)
+{
+    unsigned int i;
+
+    for (i = 0; i < *n; i++)
+    {
+        if (list[i] == idx)
+        { return; }
+    }
+    if (*n == SR_LS_MAX_CHG)
+    { ls->spf_needed = 1; }
+    else
+    { list[(*n)++] = idx; }
+}
+
+static int sr_ls_moves_tree(struct sr_ls* ls, int idx,
+                            const struct sr_ls_link* old_links, unsigned int n_old,
+                            const struct sr_ls_link* new_links, unsigned int n_new)
+{
+    const struct sr_ls_router* r = &ls->routers[idx];
+    unsigned int i = 0, j = 0;
+    uint32_t id, oc, nc, rev;
+    int x, moves = 0;
+
+    while (i < n_old || j < n_new)
+    {
+        if (j == n_new || (i < n_old && old_links[i].router_id < new_links[j].router_id))
+        {
+            id = old_links[i].router_id;
+            oc = old_links[i++].cost;
+            nc = SR_LS_INF;
+        }
+        else if (i == n_old || new_links[j].router_id < old_links[i].router_id)
+        {
+            id = new_links[j].router_id;
+            oc = SR_LS_INF;
+            nc = new_links[j++].cost;
+        }
+        else
+        {
+            id = old_links[i].router_id;
+            oc = old_links[i++].cost;
+            nc = new_links[j++].cost;
+        }
+        if (oc == nc || (x = sr_ls_find(ls, id)) < 0 ||
+            (rev = sr_ls_link_cost(ls, x, r->id)) == SR_LS_INF)
+        { continue; }
+
+        if (nc > oc)
+        {
+            /* gone or dearer: matters if the tree runs over it */
+            if (ls->routers[x].parent == idx)
+            {
+                sr_ls_queue(ls, ls->cut, &ls->n_cut, x);
+                moves = 1;
+            }
+            if (nc == SR_LS_INF && r->parent == x)
+            {
+                sr_ls_queue(ls, ls->cut, &ls->n_cut, idx);
+                moves = 1;
+            }
+        }
+        else
+        {
+            /* new or cheaper: matters if it shortens a path */
+            if (r->dist != SR_LS_INF &&
+                (uint64_t)r->dist + nc < ls->routers[x].dist)
+            {
+                sr_ls_queue(ls, ls->grow, &ls->n_grow, idx);
+                moves = 1;
+            }
+            if (oc == SR_LS_INF && ls->routers[x].dist != SR_LS_INF &&
+                (uint64_t)ls->routers[x].dist + rev < r->dist)
+            {
+                sr_ls_queue(ls, ls->grow, &ls->n_grow, x);
+                moves = 1;
+            }
+        }
+    }
+    return moves;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_set_lsa(..)
+ * Scope: Local
+ *
+ * Put a new LSA for router idx in place, taking over links (sorted by
+ * router id) and prefixes, and queue up what it affects. An LSA with no
+ * links and no prefixes takes the router out.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_set_lsa(struct sr_ls* ls, int idx, uint32_t seq,
+                          struct sr_ls_link* links, unsigned int n_links,
+                          struct sr_ls_pfx* prefixes, unsigned int n_prefixes)
+{
+    struct sr_ls_router* r = &ls->routers[idx];
+    int links_same, prefixes_same;
+    unsigned int i;
+
+    r->seq = seq;
+    r->recv_ms = sr_ls_now_ms();
+
+    links_same = n_links == r->n_links &&
+                 (n_links == 0 || memcmp(links, r->links, n_links * sizeof(*links)) == 0);
+    prefixes_same = n_prefixes == r->n_prefixes &&
+                    (n_prefixes == 0 ||
+                     memcmp(prefixes, r->prefixes, n_prefixes * sizeof(*prefixes)) == 0);
+
+    if (!links_same && !ls->spf_needed)
+    {
+        if (sr_ls_moves_tree(ls, idx, r->links, r->n_links, links, n_links))
+        { sr_ls_pending(ls); }
+        else
+        { ls->stats.spf_avoided++; }
+    }
+    if (links_same && !prefixes_same)
+    { ls->stats.partial++; }
+
+    if (!prefixes_same)
+    {
+        for (i = 0; i < r->n_prefixes; i++)
+        { sr_ls_adv_del(ls, idx, &r->prefixes[i]); }
+        for (i = 0; i < n_prefixes; i++)
+        { sr_ls_adv_add(ls, idx, &prefixes[i]); }
+    }
+
+    free(r->links);
+    free(r->prefixes);
+    r->links = links;
+    r->n_links = n_links;
+    r->prefixes = prefixes;
+    r->n_prefixes = n_prefixes;
+}
+
+static int sr_ls_link_cmp(const void* a, const void* b)
+{
+    uint32_t x = ((const struct sr_ls_link*)a)->router_id;
+    uint32_t y = ((const struct sr_ls_link*)b)->router_id;
+    return x < y ? -1 : x > y;
+}
+
+/*---------------------------------------------------------------------
+ * Sending
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_send(struct sr_ls* ls, struct sr_if* ifp, uint8_t type,
+                       const uint8_t* body, unsigned int body_len)
+{
+    unsigned int ls_len = sizeof(struct sr_ls_hdr) + body_len;
+    unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + ls_len;
+    struct sr_pbuf* pbuf = sr_pbuf_alloc(len);
+    sr_ethernet_hdr_t* eth;
+    sr_ip_hdr_t* ip;
+    struct sr_ls_hdr* hdr;
+
+    if (!pbuf)
+    { return; }
+    eth = (sr_ethernet_hdr_t*)pbuf->data;
+    ip = (sr_ip_hdr_t*)(eth + 1);
+    hdr = (struct sr_ls_hdr*)(ip + 1);
+
+    memset(eth->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, ifp->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_hl = 5;
+    ip->ip_v = 4;
+    ip->ip_tos = 0xc0;            /* network control */
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + ls_len);
+    ip->ip_id = 0;
+    ip->ip_off = htons(IP_DF);
+    ip->ip_ttl = 1;
+    ip->ip_p = ip_protocol_ls;
+    ip->ip_src = ifp->ip;
+    ip->ip_dst = htonl(0xffffffff);
+    ip->ip_sum = 0;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    hdr->version = SR_LS_VERSION;
+    hdr->type = type;
+    hdr->len = htons(ls_len);
+    hdr->router_id = htonl(ls->id);
+    hdr->sum = 0;
+    hdr->pad = 0;
+    memcpy(hdr + 1, body, body_len);
+    hdr->sum = cksum(hdr, ls_len);
+
+    sr_send_pbuf(ls->sr, pbuf, ifp->name);
+}
+
+static void sr_ls_send_hello(struct sr_ls* ls, struct sr_if* ifp)
+{
+    uint8_t body[sizeof(struct sr_ls_hello) + SR_LS_MAX_SEEN * 4];
+    struct sr_ls_hello* h = (struct sr_ls_hello*)body;
+    uint32_t id;
+    int i, n = 0;
+
+    for (i = 0; i < SR_LS_MAX_ADJ && n < SR_LS_MAX_SEEN; i++)
+    {
+        if (ls->adj[i].used && strncmp(ls->adj[i].iface, ifp->name, sr_IFACE_NAMELEN) == 0)
+        {
+            id = htonl(ls->adj[i].id);
+            memcpy(body + sizeof(*h) + 4 * n++, &id, 4);
+        }
+    }
+    h->hello_ms = htons(SR_LS_HELLO_MS);
+    h->dead_ms = htons(SR_LS_DEAD_MS);
+    h->n_seen = htons(n);
+    h->pad = 0;
+    sr_ls_send(ls, ifp, sr_ls_hello, body, sizeof(*h) + 4 * n);
+}
+
+/* send the LSA of router idx out of one interface, or every adjacent
+   one but except */
+static void sr_ls_flood(struct sr_ls* ls, int idx, struct sr_if* only,
+                        const char* except)
+{
+    uint8_t body[SR_LS_MTU];
+    const struct sr_ls_router* r = &ls->routers[idx];
+    struct sr_ls_lsa* lsa = (struct sr_ls_lsa*)body;
+    struct sr_ls_link* l = (struct sr_ls_link*)(lsa + 1);
+    struct sr_ls_pfx* p = (struct sr_ls_pfx*)(l + r->n_links);
+    struct sr_if* ifp;
+    unsigned int i;
+
+    if (r->n_links * sizeof(*l) + r->n_prefixes * sizeof(*p) > SR_LS_LSA_ROOM)
+    {
+        SR_LOG(SR_LOG_ERR, "ls: LSA of %u.%u.%u.%u too big to flood",
+               SR_LOG_IP(htonl(r->id)));
+        return;
+    }
+
+    lsa->router_id = htonl(r->id);
+    lsa->seq = htonl(r->seq);
+    lsa->n_links = htons(r->n_links);
+    lsa->n_prefixes = htons(r->n_prefixes);
+    for (i = 0; i < r->n_links; i++)
+    {
+        l[i].router_id = htonl(r->links[i].router_id);
+        l[i].cost = htonl(r->links[i].cost);
+    }
+    for (i = 0; i < r->n_prefixes; i++)
+    {
+        p[i] = r->prefixes[i];
+        p[i].cost = htonl(r->prefixes[i].cost);
+    }
+
+    for (ifp = ls->sr->if_list; ifp; ifp = ifp->next)
+    {
+        if (only ? ifp != only :
+            (!sr_ls_if_adjacent(ls, ifp->name) ||
+             (except && strncmp(ifp->name, except, sr_IFACE_NAMELEN) == 0)))
+        { continue; }
+        sr_ls_send(ls, ifp, sr_ls_update, body, (uint8_t*)(p + r->n_prefixes) - body);
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_originate(..)
+ * Scope: Local
+ *
+ * Describe ourselves from the adjacencies and the rtable, and if that
+ * differs from what we last said (or force is set), say it again with
+ * the next sequence number.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_originate(struct sr_ls* ls, int force)
+{
+    struct sr_ls_router* me = &ls->routers[ls->self];
+    struct sr_ls_link* links;
+    struct sr_ls_pfx* prefixes;
+    struct sr_if* ifp;
+    unsigned int n_links = 0, n_prefixes = 0, max_prefixes, i, j;
+    uint32_t cost;
+    int a;
+
+    links = (struct sr_ls_link*)malloc(SR_LS_MAX_ADJ * sizeof(*links) + 1);
+    prefixes = (struct sr_ls_pfx*)malloc(SR_LS_LSA_ROOM);
+    if (!links || !prefixes)
+    {
+        free(links);
+        free(prefixes);
+        return;
+    }
+
+    for (a = 0; a < SR_LS_MAX_ADJ; a++)
+    {
+        if (!ls->adj[a].used || !ls->adj[a].two_way ||
+            !(ifp = sr_get_interface(ls->sr, ls->adj[a].iface)))
+        { continue; }
+        cost = sr_ls_if_cost(ifp);
+        for (i = 0; i < n_links && links[i].router_id != ls->adj[a].id; i++);
+        if (i == n_links)
+        {
+            links[n_links].router_id = ls->adj[a].id;
+            links[n_links++].cost = cost;
+        }
+        else if (cost < links[i].cost)
+        { links[i].cost = cost; }
+    }
+    qsort(links, n_links, sizeof(*links), sr_ls_link_cmp);
+
+    max_prefixes = (SR_LS_LSA_ROOM - n_links * sizeof(struct sr_ls_link)) /
+                   sizeof(struct sr_ls_pfx);
+    memset(prefixes, 0, SR_LS_LSA_ROOM);
+    for (ifp = ls->sr->if_list; ifp && n_prefixes < max_prefixes; ifp = ifp->next)
+    {
+        prefixes[n_prefixes].prefix = ifp->ip;
+        prefixes[n_prefixes].len = 32;
+        prefixes[n_prefixes++].cost = 0;
+    }
+    for (i = 0; i < ls->n_statics; i++)
+    {
+        const struct sr_rt* s = &ls->statics[i];
+
+        if (sr_ls_if_adjacent(ls, s->interface) ||
+            !(ifp = sr_get_interface(ls->sr, s->interface)))
+        { continue; }
+        if (n_prefixes == max_prefixes)
+        {
+            SR_LOG(SR_LOG_WARN, "ls: too many routes to offer, %u left out",
+                   ls->n_statics - i);
+            break;
+        }
+        prefixes[n_prefixes].prefix = s->dest.s_addr;
+        for (j = 32; j > 0 && !(ntohl(s->mask.s_addr) & (1U << (32 - j))); j--);
+        prefixes[n_prefixes].len = j;
+        prefixes[n_prefixes++].cost = sr_ls_if_cost(ifp);
+    }
+
+    if (!force && n_links == me->n_links && n_prefixes == me->n_prefixes &&
+        memcmp(links, me->links, n_links * sizeof(*links)) == 0 &&
+        memcmp(prefixes, me->prefixes, n_prefixes * sizeof(*prefixes)) == 0)
+    {
+        free(links);
+        free(prefixes);
+        return;
+    }
+
+    sr_ls_set_lsa(ls, ls->self, me->seq + 1, links, n_links, prefixes, n_prefixes);
+    sr_ls_flood(ls, ls->self, 0, 0);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_spf(..)
+ * Scope: Local
+ *
+ * Dijkstra from us over the links both ends agree on, then mark the
+ * prefixes of every router whose distance or first hop moved.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_ls_heap_less(struct sr_ls* ls, int a, int b)
+{
+    const struct sr_ls_router* x = &ls->routers[ls->heap[a]];
+    const struct sr_ls_router* y = &ls->routers[ls->heap[b]];
+
+    return x->dist < y->dist || (x->dist == y->dist && x->id < y->id);
+}
+
+static void sr_ls_heap_swap(struct sr_ls* ls, int a, int b)
+{
+    int t = ls->heap[a];
+
+    ls->heap[a] = ls->heap[b];
+    ls->heap[b] = t;
+    ls->routers[ls->heap[a]].heap_pos = a;
+    ls->routers[ls->heap[b]].heap_pos = b;
+}
+
+static void sr_ls_heap_up(struct sr_ls* ls, int i)
+{
+    while (i > 0 && sr_ls_heap_less(ls, i, (i - 1) / 2))
+    {
+        sr_ls_heap_swap(ls, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int sr_ls_heap_pop(struct sr_ls* ls)
+{
+    int top = ls->heap[0], i = 0, c;
+
+    ls->routers[top].heap_pos = -1;
+    if (--ls->heap_n > 0)
+    {
+        ls->heap[0] = ls->heap[ls->heap_n];
+        ls->routers[ls->heap[0]].heap_pos = 0;
+        while ((c = 2 * i + 1) < (int)ls->heap_n)
+        {
+            if (c + 1 < (int)ls->heap_n && sr_ls_heap_less(ls, c + 1, c))
+            { c++; }
+            if (!sr_ls_heap_less(ls, c, i))
+            { break; }
+            sr_ls_heap_swap(ls, i, c);
+            i = c;
+        }
+    }
+    return top;
+}
+
+static void sr_ls_heap_push(struct sr_ls* ls, int x)
+{
+    struct sr_ls_router* v = &ls->routers[x];
+
+    if (v->heap_pos < 0)
+    {
+        v->heap_pos = ls->heap_n;
+        ls->heap[ls->heap_n++] = x;
+    }
+    sr_ls_heap_up(ls, v->heap_pos);
+}
+
+/* remember where router i was, before the computation moves it */
+static void sr_ls_touch(struct sr_ls* ls, int i)
+{
+    struct sr_ls_router* v = &ls->routers[i];
+
+    if (v->touched)
+    { return; }
+    v->touched = 1;
+    ls->old_dist[i] = v->dist;
+    ls->old_gw[i] = v->nh_gw;
+    memcpy(ls->old_iface[i], v->nh_iface, sr_IFACE_NAMELEN);
+    ls->touched[ls->n_touched++] = i;
+}
+
+/* router x by way of router i, over a link costing cost: the first hop
+   is the adjacency if i is us, and i's otherwise. Returns 0 if there is
+   no adjacency to take. */
+static int sr_ls_reach(struct sr_ls* ls, int x, int i, uint64_t nd)
+{
+    struct sr_ls_router* v = &ls->routers[x];
+    int a;
+
+    if (i == ls->self)
+    {
+        if ((a = sr_ls_best_adj(ls, v->id)) < 0)
+        { return 0; }
+        sr_ls_touch(ls, x);
+        v->nh_gw = ls->adj[a].ip;
+        memcpy(v->nh_iface, ls->adj[a].iface, sr_IFACE_NAMELEN);
+    }
+    else
+    {
+        sr_ls_touch(ls, x);
+        v->nh_gw = ls->routers[i].nh_gw;
+        memcpy(v->nh_iface, ls->routers[i].nh_iface, sr_IFACE_NAMELEN);
+    }
+    v->dist = (uint32_t)nd;
+    v->parent = i;
+    return 1;
+}
+
+static void sr_ls_relax(struct sr_ls* ls, int i)
+{
+    struct sr_ls_router* u = &ls->routers[i];
+    uint64_t nd;
+    unsigned int k;
+    int x;
+
+    if (u->dist == SR_LS_INF)
+    { return; }
+    for (k = 0; k < u->n_links; k++)
+    {
+        if ((x = sr_ls_find(ls, u->links[k].router_id)) < 0 ||
+            sr_ls_link_cost(ls, x, u->id) == SR_LS_INF)
+        { continue; }
+        nd = (uint64_t)u->dist + u->links[k].cost;
+        if (nd >= ls->routers[x].dist || !sr_ls_reach(ls, x, i, nd))
+        { continue; }
+        sr_ls_heap_push(ls, x);
+    }
+}
+
+/* settle what is on the heap, then mark the routers that moved */
+static void sr_ls_settle(struct sr_ls* ls)
+{
+    struct sr_ls_router* v;
+    unsigned int t;
+    int i;
+
+    while (ls->heap_n > 0)
+    { sr_ls_relax(ls, sr_ls_heap_pop(ls)); }
+
+    for (t = 0; t < ls->n_touched; t++)
+    {
+        i = ls->touched[t];
+        v = &ls->routers[i];
+        v->touched = 0;
+        if (v->dist != ls->old_dist[i] || v->nh_gw != ls->old_gw[i] ||
+            strncmp(v->nh_iface, ls->old_iface[i], sr_IFACE_NAMELEN) != 0)
+        { sr_ls_mark_router(ls, i); }
+    }
+    ls->n_touched = 0;
+    ls->n_cut = 0;
+    ls->n_grow = 0;
+}
+
+static void sr_ls_spf(struct sr_ls* ls)
+{
+    struct sr_ls_router* v;
+    int i;
+
+    for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+    {
+        if (!ls->routers[i].used)
+        { continue; }
+        v = &ls->routers[i];
+        sr_ls_touch(ls, i);
+        v->dist = SR_LS_INF;
+        v->parent = -1;
+        v->heap_pos = -1;
+        v->nh_gw = 0;
+        v->nh_iface[0] = 0;
+    }
+
+    ls->routers[ls->self].dist = 0;
+    sr_ls_heap_push(ls, ls->self);
+    sr_ls_settle(ls);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_spf_incr(..)
+ * Scope: Local
+ *
+ * Bring the tree up to date with the link changes sr_ls_moves_tree()
+ * queued, touching only the part of it they affect. The subtree below
+ * each link that got worse is taken down and every router in it starts
+ * again from its best neighbour outside; the routers with a link that
+ * got better try it. Dijkstra then runs from just those, and stops
+ * where distances stop improving.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_spf_incr(struct sr_ls* ls)
+{
+    struct sr_ls_router* w;
+    struct sr_ls_router* y;
+    unsigned int c, k, n_lost = 0, n_stack;
+    uint32_t cost;
+    uint64_t nd;
+    int i, x;
+
+    /* -- take down the subtrees hanging off the worse links; a router's
+          children are among the routers it lists, as a tree link needs
+          both ends -- */
+    for (c = 0; c < ls->n_cut; c++)
+    {
+        n_stack = 0;
+        ls->heap[n_stack++] = ls->cut[c];
+        while (n_stack > 0)
+        {
+            i = ls->heap[--n_stack];
+            w = &ls->routers[i];
+            if (!w->used || i == ls->self || w->dist == SR_LS_INF)
+            { continue; }
+            for (k = 0; k < w->n_links; k++)
+            {
+                if ((x = sr_ls_find(ls, w->links[k].router_id)) >= 0 &&
+                    ls->routers[x].parent == i)
+                { ls->heap[n_stack++] = x; }
+            }
+            sr_ls_touch(ls, i);
+            w->dist = SR_LS_INF;
+            w->parent = -1;
+            w->nh_gw = 0;
+            w->nh_iface[0] = 0;
+            ls->lost[n_lost++] = i;
+        }
+    }
+
+    /* -- each one starts from its best neighbour still on the tree -- */
+    for (c = 0; c < n_lost; c++)
+    {
+        i = ls->lost[c];
+        w = &ls->routers[i];
+        for (k = 0; k < w->n_links; k++)
+        {
+            if ((x = sr_ls_find(ls, w->links[k].router_id)) < 0)
+            { continue; }
+            y = &ls->routers[x];
+            if (y->dist == SR_LS_INF ||
+                (cost = sr_ls_link_cost(ls, x, w->id)) == SR_LS_INF)
+            { continue; }
+            nd = (uint64_t)y->dist + cost;
+            if (nd < w->dist)
+            { sr_ls_reach(ls, i, x, nd); }
+        }
+        if (w->dist != SR_LS_INF)
+        { sr_ls_heap_push(ls, i); }
+    }
+
+    /* -- and the better links are tried from where they start -- */
+    for (c = 0; c < ls->n_grow; c++)
+    {
+        i = ls->grow[c];
+        if (ls->routers[i].used && ls->routers[i].heap_pos < 0)
+        { sr_ls_relax(ls, i); }
+    }
+
+    sr_ls_settle(ls);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_compute(..)
+ * Scope: Local
+ *
+ * Bring the routing table up to date with the database: recompute the
+ * tree if a change asked for it, then pick a way to each marked prefix
+ * and hand what changed to sr_rt_apply() in one go.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_compute(struct sr_ls* ls)
+{
+    struct sr_rt_op* ops;
+    struct sr_ls_prefix* p;
+    const struct sr_ls_router* r;
+    const struct sr_ls_router* best;
+    unsigned int i, k, n = 0, failed;
+    uint64_t d, best_d;
+    double start;
+    int local, ret;
+
+    ls->pending = 0;
+    if (ls->spf_needed || ls->n_cut || ls->n_grow)
+    {
+        start = sr_ls_now();
+        if (ls->spf_needed)
+        {
+            ls->spf_needed = 0;
+            sr_ls_spf(ls);
+            ls->stats.spf_full++;
+        }
+        else
+        {
+            sr_ls_spf_incr(ls);
+            ls->stats.spf_incr++;
+        }
+        ls->stats.spf_last = sr_ls_now() - start;
+        if (ls->stats.spf_last > ls->stats.spf_max)
+        { ls->stats.spf_max = ls->stats.spf_last; }
+    }
+    if (ls->n_dirty == 0)
+    { return; }
+
+    if (!(ops = (struct sr_rt_op*)malloc(ls->n_dirty * sizeof(struct sr_rt_op))))
+    {
+        /* try again on the next tick */
+        sr_ls_pending(ls);
+        return;
+    }
+
+    for (i = 0; i < ls->n_dirty; i++)
+    {
+        p = ls->dirty[i];
+        p->dirty = 0;
+        if (p->is_static)
+        { continue; }
+
+        best = 0;
+        best_d = SR_LS_INF;
+        local = 0;
+        for (k = 0; k < p->n_adv; k++)
+        {
+            if (p->adv[k].router == ls->self)
+            {
+                local = 1;
+                break;
+            }
+            r = &ls->routers[p->adv[k].router];
+            if (r->dist == SR_LS_INF || !r->nh_gw)
+            { continue; }
+            d = (uint64_t)r->dist + p->adv[k].cost;
+            if (d < best_d || (d == best_d && best && r->id < best->id))
+            {
+                best = r;
+                best_d = d;
+            }
+        }
+        if (local)
+        { best = 0; }
+
+        if (best && (!p->installed || p->gw != best->nh_gw ||
+                     strncmp(p->iface, best->nh_iface, sr_IFACE_NAMELEN) != 0))
+        {
+            ops[n].type = sr_rt_op_replace;
+            ops[n].dest.s_addr = p->prefix;
+            ops[n].len = p->len;
+            ops[n].gw.s_addr = best->nh_gw;
+            memcpy(ops[n].interface, best->nh_iface, sr_IFACE_NAMELEN);
+            n++;
+            p->installed = 1;
+            p->gw = best->nh_gw;
+            memcpy(p->iface, best->nh_iface, sr_IFACE_NAMELEN);
+        }
+        else if (!best && p->installed)
+        {
+            ops[n].type = sr_rt_op_withdraw;
+            ops[n].dest.s_addr = p->prefix;
+            ops[n].len = p->len;
+            n++;
+            p->installed = 0;
+        }
+
+        if (!p->installed && p->n_adv == 0)
+        { sr_ls_pfx_free(ls, p); }
+    }
+    ls->n_dirty = 0;
+
+    if (n > 0)
+    {
+        if ((ret = sr_rt_apply(ls->sr, ops, n, &failed)) != 0)
+        {
+            SR_LOG(SR_LOG_ERR, "ls: routing table refused %u changes (%d)", n, ret);
+        }
+        else
+        { ls->stats.route_changes += n; }
+    }
+    free(ops);
+}
+
+/*---------------------------------------------------------------------
+ * Receiving
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_hello_in(struct sr_ls* ls, uint32_t id, uint32_t src,
+                           const uint8_t* body, unsigned int len,
+                           const char* iface)
+{
+    const struct sr_ls_hello* h = (const struct sr_ls_hello*)body;
+    struct sr_if* ifp = sr_get_interface(ls->sr, iface);
+    struct sr_ls_adj* adj = 0;
+    unsigned int i, n_seen;
+    uint32_t seen;
+    int two_way = 0, fresh = 0;
+
+    if (!ifp || len < sizeof(*h) ||
+        len < sizeof(*h) + 4 * (n_seen = ntohs(h->n_seen)))
+    {
+        ls->stats.rx_bad++;
+        return;
+    }
+    for (i = 0; i < n_seen; i++)
+    {
+        memcpy(&seen, body + sizeof(*h) + 4 * i, 4);
+        if (ntohl(seen) == ls->id)
+        { two_way = 1; }
+    }
+
+    for (i = 0; i < SR_LS_MAX_ADJ; i++)
+    {
+        if (ls->adj[i].used && ls->adj[i].id == id &&
+            strncmp(ls->adj[i].iface, iface, sr_IFACE_NAMELEN) == 0)
+        {
+            adj = &ls->adj[i];
+            break;
+        }
+    }
+    if (!adj)
+    {
+        for (i = 0; i < SR_LS_MAX_ADJ && ls->adj[i].used; i++);
+        if (i == SR_LS_MAX_ADJ)
+        {
+            SR_LOG(SR_LOG_WARN, "ls: no room for another neighbour");
+            return;
+        }
+        adj = &ls->adj[i];
+        memset(adj, 0, sizeof(*adj));
+        adj->used = 1;
+        adj->id = id;
+        strncpy(adj->iface, iface, sr_IFACE_NAMELEN - 1);
+        fresh = 1;
+    }
+    adj->ip = src;
+    adj->heard_ms = sr_ls_now_ms();
+
+    if (two_way != adj->two_way)
+    {
+        adj->two_way = two_way;
+        if (two_way)
+        {
+            SR_LOG_S(SR_LOG_INFO, iface, "%s: neighbour %u.%u.%u.%u up",
+                     SR_LOG_IP(htonl(id)));
+        }
+        else
+        {
+            SR_LOG_S(SR_LOG_INFO, iface, "%s: neighbour %u.%u.%u.%u down",
+                     SR_LOG_IP(htonl(id)));
+        }
+        if (two_way)
+        {
+            /* bring it up to date with everything we know */
+            for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+            {
+                if (ls->routers[i].used && (int)i != ls->self)
+                { sr_ls_flood(ls, i, ifp, 0); }
+            }
+        }
+        sr_ls_originate(ls, 0);
+        ls->spf_needed = 1;
+        sr_ls_pending(ls);
+    }
+    if (fresh)
+    {
+        /* let it hear us without waiting for the next hello */
+        sr_ls_send_hello(ls, ifp);
+    }
+}
+
+static void sr_ls_update_in(struct sr_ls* ls, const uint8_t* body,
+                            unsigned int len, const char* iface)
+{
+    const struct sr_ls_lsa* lsa = (const struct sr_ls_lsa*)body;
+    const struct sr_ls_link* wl;
+    const struct sr_ls_pfx* wp;
+    struct sr_ls_link* links = 0;
+    struct sr_ls_pfx* prefixes = 0;
+    unsigned int n_links, n_prefixes, i;
+    uint32_t id, seq;
+    int idx;
+
+    if (len < sizeof(*lsa))
+    {
+        ls->stats.rx_bad++;
+        return;
+    }
+    n_links = ntohs(lsa->n_links);
+    n_prefixes = ntohs(lsa->n_prefixes);
+    if (len < sizeof(*lsa) + n_links * sizeof(*wl) + n_prefixes * sizeof(*wp) ||
+        n_links * sizeof(*wl) + n_prefixes * sizeof(*wp) > SR_LS_LSA_ROOM)
+    {
+        /* one we couldn't flood on in a packet of our own */
+        ls->stats.rx_bad++;
+        return;
+    }
+    if (!sr_ls_if_adjacent(ls, iface))
+    { return; }
+    id = ntohl(lsa->router_id);
+    seq = ntohl(lsa->seq);
+
+    if (id == ls->id)
+    {
+        /* ours from before a restart: carry on past it. An echo of
+           the current one, as a neighbour's database brings, is not
+           news. */
+        if (seq > ls->routers[ls->self].seq)
+        {
+            ls->routers[ls->self].seq = seq;
+            sr_ls_originate(ls, 1);
+        }
+        return;
+    }
+
+    idx = sr_ls_find(ls, id);
+    if (idx >= 0 && seq <= ls->routers[idx].seq)
+    {
+        ls->stats.lsas_old++;
+        return;
+    }
+    if (idx < 0 && (idx = sr_ls_add_router(ls, id)) < 0)
+    {
+        SR_LOG(SR_LOG_WARN, "ls: database full, ignoring %u.%u.%u.%u",
+               SR_LOG_IP(htonl(id)));
+        return;
+    }
+    ls->stats.lsas_new++;
+
+    if ((n_links && !(links = (struct sr_ls_link*)malloc(n_links * sizeof(*links)))) ||
+        (n_prefixes && !(prefixes = (struct sr_ls_pfx*)malloc(n_prefixes * sizeof(*prefixes)))))
+    {
+        free(links);
+        free(prefixes);
+        return;
+    }
+    wl = (const struct sr_ls_link*)(lsa + 1);
+    for (i = 0; i < n_links; i++)
+    {
+        links[i].router_id = ntohl(wl[i].router_id);
+        links[i].cost = ntohl(wl[i].cost);
+    }
+    qsort(links, n_links, sizeof(*links), sr_ls_link_cmp);
+    wp = (const struct sr_ls_pfx*)(wl + n_links);
+    for (i = 0; i < n_prefixes; i++)
+    {
+        prefixes[i] = wp[i];
+        prefixes[i].cost = ntohl(wp[i].cost);
+        if (prefixes[i].len > 32)
+        { prefixes[i].len = 32; }
+        prefixes[i].prefix &= htonl(SR_FIB_MASK(prefixes[i].len));
+        memset(prefixes[i].pad, 0, sizeof(prefixes[i].pad));
+    }
+
+    sr_ls_set_lsa(ls, idx, seq, links, n_links, prefixes, n_prefixes);
+    sr_ls_flood(ls, idx, 0, iface);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_input(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ls_input(struct sr_ls* ls, uint8_t* packet, unsigned int len,
+                 const char* iface)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+    struct sr_ls_hdr* hdr;
+    unsigned int hl = ip->ip_hl * 4, ls_len;
+    uint16_t sum;
+    uint32_t id;
+
+    pthread_mutex_lock(&ls->lock);
+    ls->stats.rx++;
+
+    if (hl < sizeof(sr_ip_hdr_t) ||
+        len < sizeof(sr_ethernet_hdr_t) + hl + sizeof(struct sr_ls_hdr))
+    { goto bad; }
+    hdr = (struct sr_ls_hdr*)((uint8_t*)ip + hl);
+    ls_len = ntohs(hdr->len);
+    if (hdr->version != SR_LS_VERSION || ls_len < sizeof(*hdr) ||
+        ls_len > len - sizeof(sr_ethernet_hdr_t) - hl)
+    { goto bad; }
+    sum = hdr->sum;
+    hdr->sum = 0;
+    if (cksum(hdr, ls_len) != sum)
+    {
+        hdr->sum = sum;
+        goto bad;
+    }
+    hdr->sum = sum;
+
+    if ((id = ntohl(hdr->router_id)) != ls->id)
+    {
+        if (hdr->type == sr_ls_hello)
+        {
+            sr_ls_hello_in(ls, id, ip->ip_src, (uint8_t*)(hdr + 1),
+                           ls_len - sizeof(*hdr), iface);
+        }
+        else if (hdr->type == sr_ls_update)
+        { sr_ls_update_in(ls, (uint8_t*)(hdr + 1), ls_len - sizeof(*hdr), iface); }
+    }
+    pthread_mutex_unlock(&ls->lock);
+    return;
+
+bad:
+    ls->stats.rx_bad++;
+    pthread_mutex_unlock(&ls->lock);
+} /* -- sr_ls_input -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_timer(..)
+ * Scope: Local
+ *
+ * Hellos, dead neighbours, refreshing and ageing LSAs, and the route
+ * computation once changes have had SR_LS_SPF_DELAY_MS to gather.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_ls_timer(void* arg)
+{
+    struct sr_ls* ls = (struct sr_ls*)arg;
+    struct sr_if* ifp;
+    struct timespec ts;
+    uint64_t now, wake;
+    int i, changed;
+
+    pthread_mutex_lock(&ls->lock);
+    while (!ls->stop)
+    {
+        now = sr_ls_now_ms();
+
+        if (now >= ls->next_hello_ms)
+        {
+            changed = 0;
+            for (i = 0; i < SR_LS_MAX_ADJ; i++)
+            {
+                if (ls->adj[i].used && now - ls->adj[i].heard_ms > SR_LS_DEAD_MS)
+                {
+                    SR_LOG_S(SR_LOG_INFO, ls->adj[i].iface, "%s: neighbour %u.%u.%u.%u dead",
+                             SR_LOG_IP(htonl(ls->adj[i].id)));
+                    changed |= ls->adj[i].two_way;
+                    ls->adj[i].used = 0;
+                }
+            }
+            if (changed)
+            {
+                sr_ls_originate(ls, 0);
+                ls->spf_needed = 1;
+                sr_ls_pending(ls);
+            }
+            for (ifp = ls->sr->if_list; ifp; ifp = ifp->next)
+            { sr_ls_send_hello(ls, ifp); }
+            ls->next_hello_ms = now + SR_LS_HELLO_MS;
+        }
+
+        if (now >= ls->next_refresh_ms)
+        {
+            sr_ls_originate(ls, 1);
+            for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+            {
+                if (ls->routers[i].used && i != ls->self &&
+                    now - ls->routers[i].recv_ms > SR_LS_MAX_AGE_MS)
+                {
+                    sr_ls_set_lsa(ls, i, ls->routers[i].seq, 0, 0, 0, 0);
+                    sr_ls_drop_router(ls, i);
+                }
+            }
+            ls->next_refresh_ms = now + SR_LS_REFRESH_MS;
+        }
+
+        if (ls->pending && now >= ls->pending_since + SR_LS_SPF_DELAY_MS)
+        { sr_ls_compute(ls); }
+
+        wake = ls->next_hello_ms;
+        if (ls->pending && ls->pending_since + SR_LS_SPF_DELAY_MS < wake)
+        { wake = ls->pending_since + SR_LS_SPF_DELAY_MS; }
+        if (wake > now)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += (wake - now) / 1000;
+            ts.tv_nsec += ((wake - now) % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&ls->wake, &ls->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&ls->lock);
+    return 0;
+} /* -- sr_ls_timer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_open(..)
+ * Scope: Global
+ *
+ * Router id is the highest interface address, as in OSPF.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ls_open(struct sr_instance* sr)
+{
+    struct sr_ls* ls;
+    struct sr_if* ifp;
+    struct sr_rt* rt;
+    struct sr_ls_prefix* p;
+    pthread_condattr_t attr;
+    unsigned int n;
+    int i;
+
+    if (!sr->if_list)
+    {
+        fprintf(stderr, "ls: no interfaces\n");
+        return -1;
+    }
+    if (!(ls = (struct sr_ls*)calloc(1, sizeof(struct sr_ls))))
+    {
+        fprintf(stderr, "ls: out of memory\n");
+        return -1;
+    }
+    ls->sr = sr;
+    for (i = 0; i < SR_LS_HASH; i++)
+    { ls->buckets[i] = -1; }
+    for (ifp = sr->if_list; ifp; ifp = ifp->next)
+    {
+        if (ntohl(ifp->ip) > ls->id)
+        { ls->id = ntohl(ifp->ip); }
+    }
+
+    /* -- what the rtable routes stays as it is, and is offered on; what
+       a snapshot put back is ours to confirm or withdraw -- */
+    pthread_rwlock_rdlock(&sr->rt_lock);
+    for (n = 0, rt = sr->routing_table; rt; rt = rt->next)
+    { n++; }
+    ls->statics = (struct sr_rt*)calloc(n ? n : 1, sizeof(struct sr_rt));
+    for (rt = sr->routing_table; rt && ls->statics; rt = rt->next)
+    {
+        if (!rt->tentative)
+        { ls->statics[ls->n_statics++] = *rt; }
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+    if (!ls->statics)
+    {
+        free(ls);
+        return -1;
+    }
+    for (n = 0; n < ls->n_statics; n++)
+    {
+        uint32_t m = ntohl(ls->statics[n].mask.s_addr);
+
+        if ((p = sr_ls_pfx_get(ls, ls->statics[n].dest.s_addr,
+                               ~m ? __builtin_clz(~m) : 32, 1)))
+        { p->is_static = 1; }
+    }
+
+    ls->self = sr_ls_add_router(ls, ls->id);
+    ls->routers[ls->self].dist = 0;
+
+    pthread_mutex_init(&ls->lock, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ls->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&ls->lock);
+    sr_ls_originate(ls, 1);
+    ls->next_hello_ms = sr_ls_now_ms();
+    ls->next_refresh_ms = ls->next_hello_ms + SR_LS_REFRESH_MS;
+    pthread_mutex_unlock(&ls->lock);
+
+    if (pthread_create(&ls->thread, 0, sr_ls_timer, ls) != 0)
+    {
+        perror("pthread_create");
+        free(ls->statics);
+        free(ls);
+        return -1;
+    }
+    sr->ls = ls;
+
+    SR_LOG(SR_LOG_INFO, "ls: router id %u.%u.%u.%u", SR_LOG_IP(htonl(ls->id)));
+    return 0;
+} /* -- sr_ls_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_close(..)
+ * Scope: Global
+ *
+ * The routes put in the table are left there.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ls_close(struct sr_instance* sr)
+{
+    struct sr_ls* ls = sr->ls;
+    struct sr_ls_prefix* p;
+    int i;
+
+    if (!ls)
+    { return; }
+
+    pthread_mutex_lock(&ls->lock);
+    ls->stop = 1;
+    pthread_cond_signal(&ls->wake);
+    pthread_mutex_unlock(&ls->lock);
+    pthread_join(ls->thread, 0);
+    sr->ls = 0;
+
+    for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+    {
+        free(ls->routers[i].links);
+        free(ls->routers[i].prefixes);
+    }
+    for (i = 0; i < SR_LS_PFX_HASH; i++)
+    {
+        while ((p = ls->pfx[i]))
+        {
+            ls->pfx[i] = p->next;
+            free(p->adv);
+            free(p);
+        }
+    }
+    free(ls->dirty);
+    free(ls->statics);
+    pthread_mutex_destroy(&ls->lock);
+    pthread_cond_destroy(&ls->wake);
+    free(ls);
+} /* -- sr_ls_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_check(..)
+ * Scope: Local
+ *
+ * Finish any computation due, then recompute the whole tree and list
+ * the routers whose distance or first hop the incremental computation
+ * got different. The routes follow the recomputed tree.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ls_check(struct sr_ls* ls, FILE* out)
+{
+    struct sr_ls_router* r;
+    struct in_addr a;
+    uint32_t* dist;
+    uint32_t* gw;
+    char (*iface)[sr_IFACE_NAMELEN];
+    unsigned int n = 0, differ = 0;
+    int i;
+
+    dist = (uint32_t*)malloc(SR_LS_MAX_ROUTERS * sizeof(uint32_t));
+    gw = (uint32_t*)malloc(SR_LS_MAX_ROUTERS * sizeof(uint32_t));
+    iface = (char (*)[sr_IFACE_NAMELEN])malloc(SR_LS_MAX_ROUTERS * sr_IFACE_NAMELEN);
+    if (!dist || !gw || !iface)
+    {
+        fprintf(out, "out of memory\n");
+        free(dist);
+        free(gw);
+        free(iface);
+        return;
+    }
+
+    if (ls->pending)
+    { sr_ls_compute(ls); }
+    for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+    {
+        r = &ls->routers[i];
+        dist[i] = r->dist;
+        gw[i] = r->nh_gw;
+        memcpy(iface[i], r->nh_iface, sr_IFACE_NAMELEN);
+    }
+
+    sr_ls_spf(ls);
+    for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+    {
+        r = &ls->routers[i];
+        if (!r->used)
+        { continue; }
+        n++;
+        if (r->dist == dist[i] && r->nh_gw == gw[i] &&
+            strncmp(r->nh_iface, iface[i], sr_IFACE_NAMELEN) == 0)
+        { continue; }
+
+        differ++;
+        a.s_addr = htonl(r->id);
+        fprintf(out, "%s", inet_ntoa(a));
+        a.s_addr = gw[i];
+        fprintf(out, " incremental dist %u via %s %s,", dist[i], inet_ntoa(a), iface[i]);
+        a.s_addr = r->nh_gw;
+        fprintf(out, " full dist %u via %s %s\n", r->dist, inet_ntoa(a), r->nh_iface);
+    }
+    fprintf(out, "checked %u routers, %u differ\n", n, differ);
+
+    if (ls->n_dirty)
+    { sr_ls_compute(ls); }
+    free(dist);
+    free(gw);
+    free(iface);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ls_ctl(..)
+ * Scope: Global
+ *
+ * "ls" shows the neighbours and how the computation has been going,
+ * "ls db" every router in the database and the way to it, "ls check"
+ * the routers an incremental computation put somewhere a full one
+ * would not.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ls_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_ls* ls = sr->ls;
+    const struct sr_ls_router* r;
+    struct in_addr a;
+    unsigned int k;
+    int i;
+
+    if (argc > 2 ||
+        (argc == 2 && strcmp(argv[1], "db") != 0 && strcmp(argv[1], "check") != 0))
+    { return -1; }
+    if (!ls)
+    {
+        fprintf(out, "link state routing is off\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&ls->lock);
+    if (argc == 1)
+    {
+        a.s_addr = htonl(ls->id);
+        fprintf(out, "router %s seq %u\n", inet_ntoa(a), ls->routers[ls->self].seq);
+        for (i = 0; i < SR_LS_MAX_ADJ; i++)
+        {
+            if (!ls->adj[i].used)
+            { continue; }
+            a.s_addr = htonl(ls->adj[i].id);
+            fprintf(out, "neighbour %s on %s", inet_ntoa(a), ls->adj[i].iface);
+            a.s_addr = ls->adj[i].ip;
+            fprintf(out, " at %s %s\n", inet_ntoa(a), ls->adj[i].two_way ? "up" : "init");
+        }
+        fprintf(out, "routers %u prefixes %lu\n", ls->n_routers, ls->n_pfx);
+        fprintf(out, "received %lu bad %lu lsas %lu stale %lu\n", ls->stats.rx,
+                ls->stats.rx_bad, ls->stats.lsas_new, ls->stats.lsas_old);
+        fprintf(out, "spf %lu partial %lu avoided %lu prefix only %lu last %.6f s max %.6f s\n",
+                ls->stats.spf_full, ls->stats.spf_incr, ls->stats.spf_avoided, ls->stats.partial,
+                ls->stats.spf_last, ls->stats.spf_max);
+        fprintf(out, "route changes %lu\n", ls->stats.route_changes);
+    }
+    else if (strcmp(argv[1], "check") == 0)
+    { sr_ls_check(ls, out); }
+    else
+    {
+        for (i = 0; i < SR_LS_MAX_ROUTERS; i++)
+        {
+            r = &ls->routers[i];
+            if (!r->used)
+            { continue; }
+            a.s_addr = htonl(r->id);
+            fprintf(out, "%s seq %u", inet_ntoa(a), r->seq);
+            if (i == ls->self)
+            { fprintf(out, " self"); }
+            else if (r->dist == SR_LS_INF)
+            { fprintf(out, " unreachable"); }
+            else
+            {
+                a.s_addr = r->nh_gw;
+                fprintf(out, " dist %u via %s %s", r->dist, inet_ntoa(a), r->nh_iface);
+            }
+            fprintf(out, "\n");
+            for (k = 0; k < r->n_links; k++)
+            {
+                a.s_addr = htonl(r->links[k].router_id);
+                fprintf(out, "  link %s cost %u\n", inet_ntoa(a), r->links[k].cost);
+            }
+            for (k = 0; k < r->n_prefixes; k++)
+            {
+                a.s_addr = r->prefixes[k].prefix;
+                fprintf(out, "  prefix %s/%u cost %u\n", inet_ntoa(a),
+                        r->prefixes[k].len, r->prefixes[k].cost);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ls->lock);
+
+    return 0;
+} /* -- sr_ls_ctl -- */
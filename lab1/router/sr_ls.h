@@ -0,0 +1,143 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ls.h
+ *
+ * Description:
+ *
+ * A small link-state routing protocol run between sr instances, so the
+ * routers of a lab2 topology work out their routes themselves instead of
+ * each needing a hand written rtable.
+ *
+ * Packets are IP protocol 253 (ip_protocol_ls, from the range RFC 3692
+ * sets aside for experiments), sent to 255.255.255.255 with a TTL of 1
+ * out of one interface, so they never leave the link.
+ *
+ *  - Every SR_LS_HELLO_MS each interface says hello, listing the routers
+ *    it has heard on that link. A neighbour that lists us back is
+ *    adjacent; one not heard for SR_LS_DEAD_MS is gone.
+ *  - Each router describes itself in an LSA: its adjacent routers, with
+ *    the cost of the interface it reaches them through (SR_LS_REF_SPEED
+ *    over the interface speed), and the prefixes it can deliver to: its
+ *    interface addresses, and the routes of its rtable that leave through
+ *    interfaces with no adjacency, e.g. towards hosts or an upstream.
+ *  - LSAs are flooded to every adjacency and kept in each router's
+ *    database. A router sends its whole database to a new neighbour and
+ *    reissues its own LSA when its adjacencies change or every
+ *    SR_LS_REFRESH_MS, so a lost packet is made good within one refresh.
+ *    An LSA not refreshed for SR_LS_MAX_AGE_MS is dropped.
+ *
+ * Routes follow the shortest paths from this router (a link counts only
+ * when both ends list each other). The computation is incremental:
+ *
+ *  - an LSA whose links did not change only reroutes its own prefixes;
+ *  - a link that went away or got dearer without being on the shortest
+ *    path tree, or that appeared or got cheaper without shortening any
+ *    path, changes nothing;
+ *  - otherwise only the part of the tree the change reaches is
+ *    recomputed: the subtree below a link that went away or got dearer
+ *    finds its way again from the rest of the tree, and Dijkstra runs
+ *    on from the ends of a link that appeared or got cheaper, stopping
+ *    where no distance improves. The whole tree is recomputed when our
+ *    own adjacencies change, or when more than a few dozen links change
+ *    at once;
+ *  - either way, only the prefixes of routers whose distance or first
+ *    hop moved are looked at again.
+ *
+ * The resulting route changes go to the routing table as one
+ * sr_rt_apply() batch. A prefix the rtable routes itself is left alone.
+ * Changes arriving close together are handled together, SR_LS_SPF_DELAY_MS
+ * after the first.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LS_H
+#define SR_LS_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_ls;
+
+#define SR_LS_VERSION       1
+#define SR_LS_HELLO_MS      1000
+#define SR_LS_DEAD_MS       4000
+#define SR_LS_REFRESH_MS    30000
+#define SR_LS_MAX_AGE_MS    (4 * SR_LS_REFRESH_MS)
+#define SR_LS_SPF_DELAY_MS  5
+#define SR_LS_MAX_ROUTERS   4096    /* routers in the database */
+#define SR_LS_MAX_ADJ       64      /* neighbours, over all interfaces */
+#define SR_LS_MTU           1500    /* largest packet, IP header included */
+#define SR_LS_REF_SPEED     100000  /* Mbit/s that costs 1 */
+#define SR_LS_DEFAULT_SPEED 100     /* Mbit/s of an interface VNS gave none for */
+
+enum sr_ls_type
+{
+    sr_ls_hello  = 1,
+    sr_ls_update = 2
+};
+
+/* every packet, right after the IP header; all fields network order */
+struct sr_ls_hdr
+{
+    uint8_t  version;
+    uint8_t  type;
+    uint16_t len;                 /* this header and what follows */
+    uint32_t router_id;           /* of the sender */
+    uint16_t sum;                 /* over this header and what follows */
+    uint16_t pad;
+} __attribute__ ((packed)) ;
+
+/* sr_ls_hello: followed by n_seen router ids heard on this link */
+struct sr_ls_hello
+{
+    uint16_t hello_ms;
+    uint16_t dead_ms;
+    uint16_t n_seen;
+    uint16_t pad;
+} __attribute__ ((packed)) ;
+
+/* sr_ls_update: one LSA, followed by n_links struct sr_ls_link then
+   n_prefixes struct sr_ls_pfx */
+struct sr_ls_lsa
+{
+    uint32_t router_id;
+    uint32_t seq;                 /* higher is newer */
+    uint16_t n_links;
+    uint16_t n_prefixes;
+} __attribute__ ((packed)) ;
+
+struct sr_ls_link
+{
+    uint32_t router_id;           /* the neighbour */
+    uint32_t cost;
+} __attribute__ ((packed)) ;
+
+struct sr_ls_pfx
+{
+    uint32_t prefix;
+    uint8_t  len;
+    uint8_t  pad[3];
+    uint32_t cost;
+} __attribute__ ((packed)) ;
+
+/* Start the protocol on every interface of sr. Call once the interfaces
+   and the rtable are loaded; the rtable's routes are the ones offered to
+   the other routers. Returns 0 on success and sets sr->ls. */
+int  sr_ls_open(struct sr_instance* sr);
+void sr_ls_close(struct sr_instance* sr);
+
+/* A protocol packet (whole frame) received on iface. */
+void sr_ls_input(struct sr_ls* ls, uint8_t* packet, unsigned int len,
+                 const char* iface);
+
+/* control socket "ls" command */
+int sr_ls_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_LS_H -- */
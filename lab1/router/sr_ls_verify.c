@@ -0,0 +1,627 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ls_verify.c
+ *
+ * Description:
+ *
+ * Offline check of the link-state packet parser (sr_ls.c). Brings up a
+ * router with one interface, makes a neighbour adjacent to it, and hands
+ * sr_ls_input() LSAs that are truncated, claim more links or prefixes
+ * than they carry, are too big to flood on, or are otherwise malformed,
+ * alongside good ones. Each must be counted as the "ls" control command
+ * reports: bad, new or stale.
+ *
+ * Then feeds it many good LSAs cut short and with bytes changed at
+ * random, checksummed again so they get past the header to the parser,
+ * and checks that a good LSA is still taken after them. Best run from a
+ * build with -fsanitize=address (make OPT=-fsanitize=address), which
+ * catches any read past a packet; with -v to see its report, and
+ * ASAN_OPTIONS=detect_leaks=0, as the interface list is never freed.
+ *
+ * Last, checks the incremental shortest path computation. Builds a
+ * random topology of SPF_ROUTERS routers behind the neighbour out of
+ * their LSAs, then adds links, takes them away and changes their cost
+ * at random, a few at a time or many at once, and one end before the
+ * other. After each batch the "ls check" control command compares every
+ * router's distance and first hop with a full recompute. Costs are drawn
+ * from a wide range so that no two paths tie, as on a tie the two can
+ * rightly pick different ways.
+ *
+ * Exits 1 if any count is not what it should be, or any router differs.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_ls.h"
+#include "sr_bench_util.h"
+
+extern char* optarg;
+extern int optind;
+
+#define DEFAULT_FUZZ    100000
+#define DEFAULT_SEED    1
+#define SELF_IP         0x0a000001    /* 10.0.0.1, our router id */
+#define PEER_IP         0x0a000002
+#define FRAME_MAX       (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 65535)
+#define DEFAULT_CHANGES 20000
+#define SPF_ROUTERS     64            /* the neighbour and the routers behind it */
+#define SPF_ID          0x0a040000    /* router i's id is SPF_ID + i, but 0's is PEER_IP */
+#define SPF_DEGREE      3             /* links per router to start with, on average */
+#define SPF_MAX_COST    (1 << 20)
+#define SPF_BATCH       80            /* changes at once, at most; more than
+                                         the incremental computation takes */
+
+/* the "ls" command's counters */
+struct ls_counts
+{
+    unsigned long rx;
+    unsigned long bad;
+    unsigned long fresh;
+    unsigned long stale;
+};
+
+static uint8_t frame[FRAME_MAX];
+static uint8_t body[65535];
+static uint32_t spf_cost[SPF_ROUTERS][SPF_ROUTERS];   /* what i lists for j, 0: none */
+static uint32_t spf_seq[SPF_ROUTERS];
+static FILE* report;
+static int failed = 0;
+
+static void usage(char* );
+static void ls_counts(struct sr_instance* , struct ls_counts* );
+static unsigned int lsa(uint32_t , uint32_t , unsigned int , unsigned int ,
+                        unsigned int , unsigned int );
+static unsigned int ls_frame(uint8_t , uint32_t , unsigned int );
+static void expect(struct sr_instance* , const char* , unsigned int ,
+                   unsigned long , unsigned long , unsigned long );
+static void hello_peer(struct sr_instance* );
+static uint32_t spf_id(int );
+static int spf_link(int );
+static void spf_lsa(struct sr_instance* , int );
+static void spf_check(struct sr_instance* , unsigned long );
+static unsigned int spf_differ(struct sr_instance* , unsigned long );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    struct sr_instance sr;
+    struct sr_ls_hello* hello = (struct sr_ls_hello*)body;
+    struct sr_ls_hdr* hdr;
+    struct ls_counts before, after;
+    unsigned char mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 1 };
+    unsigned long fuzz = DEFAULT_FUZZ, changes = DEFAULT_CHANGES, k;
+    unsigned int seed = DEFAULT_SEED;
+    unsigned int len, n, i, n_links, n_prefixes;
+    uint32_t seen;
+    int c, verbose = 0;
+
+    while ((c = getopt(argc, argv, "c:hn:s:v")) != EOF)
+    {
+        switch (c)
+        {
+            case 'c':
+                changes = strtoul(optarg, 0, 10);
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'n':
+                fuzz = strtoul(optarg, 0, 10);
+                break;
+            case 's':
+                seed = (unsigned int)strtoul(optarg, 0, 10);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    sr_bench_init_instance(&sr);
+    sr_add_interface(&sr, "eth1");
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, htonl(SELF_IP));
+    report = sr_bench_report_stream(verbose);
+    sr_init(&sr);
+    if (sr_ls_open(&sr) != 0)
+    { exit(1); }
+    srand(seed);
+
+    /* -- a neighbour that hears us, so its updates are listened to -- */
+    hello_peer(&sr);
+
+    /* -- malformed and oversized -- */
+    len = ls_frame(sr_ls_update, PEER_IP, sizeof(struct sr_ls_lsa) - 1);
+    expect(&sr, "shorter than an LSA", len, 1, 0, 0);
+
+    n = lsa(0x0a010001, 1, 1, 0, 65535, 0);
+    expect(&sr, "65535 links, 1 there", ls_frame(sr_ls_update, PEER_IP, n), 1, 0, 0);
+
+    n = lsa(0x0a010001, 1, 2, 9, 2, 10);
+    expect(&sr, "10 prefixes, 9 there", ls_frame(sr_ls_update, PEER_IP, n), 1, 0, 0);
+
+    n = lsa(0x0a010001, 1, 4000, 2700, 65535, 65535);
+    expect(&sr, "both counts at their largest", ls_frame(sr_ls_update, PEER_IP, n), 1, 0, 0);
+
+    n = lsa(0x0a010001, 1, 200, 0, 200, 0);
+    expect(&sr, "200 links, too big to flood on", ls_frame(sr_ls_update, PEER_IP, n),
+           1, 0, 0);
+
+    n = lsa(0x0a010001, 1, 3, 120, 3, 120);
+    expect(&sr, "a link more than fits", ls_frame(sr_ls_update, PEER_IP, n), 1, 0, 0);
+
+    n = lsa(0x0a010001, 1, 2, 0, 2, 0);
+    len = ls_frame(sr_ls_update, PEER_IP, n);
+    hdr = (struct sr_ls_hdr*)(frame + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+    hdr->sum ^= 1;
+    expect(&sr, "bad checksum", len, 1, 0, 0);
+
+    ls_frame(sr_ls_update, PEER_IP, n);
+    expect(&sr, "length past the frame", len - 1, 1, 0, 0);
+
+    ls_frame(sr_ls_update, PEER_IP, n);
+    hdr->version++;
+    hdr->sum = 0;
+    hdr->sum = cksum(hdr, ntohs(hdr->len));
+    expect(&sr, "unknown version", len, 1, 0, 0);
+
+    memset(hello, 0, sizeof(*hello));
+    hello->n_seen = htons(2);
+    seen = htonl(SELF_IP);
+    memcpy(hello + 1, &seen, 4);
+    len = ls_frame(sr_ls_hello, PEER_IP, sizeof(*hello) + 4);
+    expect(&sr, "hello listing more than it holds", len, 1, 0, 0);
+
+    /* -- good ones; 2 links and 120 prefixes are all the room SR_LS_MTU
+       leaves after the headers -- */
+    n = lsa(0x0a010001, 1, 2, 120, 2, 120);
+    expect(&sr, "exactly fills a packet", ls_frame(sr_ls_update, PEER_IP, n), 0, 1, 0);
+    expect(&sr, "same again", ls_frame(sr_ls_update, PEER_IP, n), 0, 0, 1);
+
+    n = lsa(SELF_IP, 1, 0, 1, 0, 1);
+    expect(&sr, "an echo of our own", ls_frame(sr_ls_update, PEER_IP, n), 0, 0, 0);
+
+    n = lsa(0x0a010002, 1, 1, 1, 1, 1);
+    body[n - 8] = 40;    /* prefix length */
+    expect(&sr, "prefix longer than 32", ls_frame(sr_ls_update, PEER_IP, n), 0, 1, 0);
+
+    /* -- good LSAs, cut short and with bytes changed -- */
+    ls_counts(&sr, &before);
+    for (k = 0; k < fuzz; k++)
+    {
+        n_links = rand() % 8;
+        n_prefixes = rand() % 8;
+        n = lsa(0x0a020000 + rand() % 64, k + 1, n_links, n_prefixes,
+                n_links, n_prefixes);
+        for (i = rand() % 4; i > 0; i--)
+        {
+            switch (rand() % 4)
+            {
+                case 0:
+                    n = rand() % (n + 1);
+                    break;
+                case 1:
+                    n += rand() % 64;
+                    break;
+                default:
+                    /* not the router id, so the database stays small */
+                    if (n > 4)
+                    { body[4 + rand() % (n - 4)] = rand() & 0xff; }
+            } /* switch */
+        }
+        sr_ls_input(sr.ls, frame, ls_frame(sr_ls_update, PEER_IP, n), "eth1");
+    }
+    ls_counts(&sr, &after);
+    fprintf(report, "%lu changed LSAs: %lu bad, %lu new, %lu stale\n", fuzz,
+            after.bad - before.bad, after.fresh - before.fresh,
+            after.stale - before.stale);
+    if (after.rx - before.rx != fuzz)
+    {
+        fprintf(report, "  FAILED: %lu of them received\n", after.rx - before.rx);
+        failed = 1;
+    }
+
+    n = lsa(0x0a030001, 1, 1, 1, 1, 1);
+    expect(&sr, "good one after them", ls_frame(sr_ls_update, PEER_IP, n), 0, 1, 0);
+
+    spf_check(&sr, changes);
+
+    sr_ls_close(&sr);
+    fprintf(report, failed ? "FAILED\n" : "ok\n");
+    return failed;
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router link-state parser check\n");
+    printf("Format: %s [-n changed LSAs] [-c link changes] [-s seed] [-v]\n", argv0);
+    printf("   -v  keep the router's own output\n");
+    printf("   defaults changed LSAs=%d link changes=%d seed=%d\n", DEFAULT_FUZZ,
+           DEFAULT_CHANGES, DEFAULT_SEED);
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: ls_counts(..)
+ * Scope: local
+ *
+ * Read the counters off the "ls" control command.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void ls_counts(struct sr_instance* sr, struct ls_counts* counts)
+{
+    char* av[1] = { "ls" };
+    char line[256];
+    FILE* fp;
+    int found = 0;
+
+    fp = tmpfile();
+    assert(fp);
+    sr_ls_ctl(sr, 1, av, fp);
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "received %lu bad %lu lsas %lu stale %lu", &counts->rx,
+                   &counts->bad, &counts->fresh, &counts->stale) == 4)
+        { found = 1; }
+    }
+    fclose(fp);
+    if (!found)
+    {
+        fprintf(report, "no counters in the ls command's output\n");
+        exit(1);
+    }
+} /* -- ls_counts -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lsa(..)
+ * Scope: local
+ *
+ * Write an LSA with n_links links and n_prefixes prefixes to body, but
+ * saying it has claim_links and claim_prefixes. Returns its length.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned int lsa(uint32_t id, uint32_t seq, unsigned int n_links,
+                        unsigned int n_prefixes, unsigned int claim_links,
+                        unsigned int claim_prefixes)
+{
+    struct sr_ls_lsa* l = (struct sr_ls_lsa*)body;
+    struct sr_ls_link* link = (struct sr_ls_link*)(l + 1);
+    struct sr_ls_pfx* pfx = (struct sr_ls_pfx*)(link + n_links);
+    unsigned int i;
+
+    assert(sizeof(*l) + n_links * sizeof(*link) + n_prefixes * sizeof(*pfx) <= sizeof(body));
+
+    l->router_id = htonl(id);
+    l->seq = htonl(seq);
+    l->n_links = htons(claim_links);
+    l->n_prefixes = htons(claim_prefixes);
+    for (i = 0; i < n_links; i++)
+    {
+        link[i].router_id = htonl(i == 0 ? PEER_IP : 0x0a100000 + i);
+        link[i].cost = htonl(1 + i);
+    }
+    for (i = 0; i < n_prefixes; i++)
+    {
+        memset(&pfx[i], 0, sizeof(pfx[i]));
+        pfx[i].prefix = htonl(0xac100000 + (i << 8));
+        pfx[i].len = 24;
+        pfx[i].cost = htonl(1);
+    }
+    return (uint8_t*)(pfx + n_prefixes) - body;
+} /* -- lsa -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: ls_frame(..)
+ * Scope: local
+ *
+ * Put the first len bytes of body in a protocol packet from router id to
+ * us, in frame. Returns the length of the frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned int ls_frame(uint8_t type, uint32_t id, unsigned int len)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    struct sr_ls_hdr* hdr = (struct sr_ls_hdr*)(ip + 1);
+
+    if (len > sizeof(body) - sizeof(*hdr))
+    { len = sizeof(body) - sizeof(*hdr); }
+    memset(frame, 0, sizeof(*eth) + sizeof(*ip) + sizeof(*hdr));
+    memset(eth->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_ttl = 1;
+    ip->ip_p = ip_protocol_ls;
+    ip->ip_src = htonl(id);
+    ip->ip_dst = 0xffffffff;
+    ip->ip_len = htons(sizeof(*ip) + sizeof(*hdr) + len);
+    hdr->version = SR_LS_VERSION;
+    hdr->type = type;
+    hdr->len = htons(sizeof(*hdr) + len);
+    hdr->router_id = htonl(id);
+    memcpy(hdr + 1, body, len);
+    hdr->sum = cksum(hdr, sizeof(*hdr) + len);
+    return sizeof(*eth) + sizeof(*ip) + sizeof(*hdr) + len;
+} /* -- ls_frame -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: expect(..)
+ * Scope: local
+ *
+ * Hand the frame to the parser and check what it was counted as.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void expect(struct sr_instance* sr, const char* what, unsigned int len,
+                   unsigned long bad, unsigned long fresh, unsigned long stale)
+{
+    struct ls_counts before, after;
+
+    ls_counts(sr, &before);
+    sr_ls_input(sr->ls, frame, len, "eth1");
+    ls_counts(sr, &after);
+
+    after.bad -= before.bad;
+    after.fresh -= before.fresh;
+    after.stale -= before.stale;
+    if (after.bad == bad && after.fresh == fresh && after.stale == stale)
+    {
+        fprintf(report, "%-34s ok\n", what);
+        return;
+    }
+    fprintf(report, "%-34s FAILED: bad %lu new %lu stale %lu, want %lu %lu %lu\n",
+            what, after.bad, after.fresh, after.stale, bad, fresh, stale);
+    failed = 1;
+} /* -- expect -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: hello_peer(..)
+ * Scope: local
+ *
+ * A hello from the neighbour, hearing us.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void hello_peer(struct sr_instance* sr)
+{
+    struct sr_ls_hello* hello = (struct sr_ls_hello*)body;
+    uint32_t seen = htonl(SELF_IP);
+
+    memset(hello, 0, sizeof(*hello));
+    hello->n_seen = htons(1);
+    memcpy(hello + 1, &seen, 4);
+    sr_ls_input(sr->ls, frame, ls_frame(sr_ls_hello, PEER_IP, sizeof(*hello) + 4), "eth1");
+} /* -- hello_peer -- */
+
+static uint32_t spf_id(int i)
+{
+    return i == 0 ? PEER_IP : SPF_ID + i;
+} /* -- spf_id -- */
+
+/* one of the routers i lists, at random, or -1 */
+static int spf_link(int i)
+{
+    int j, n = 0, pick = -1;
+
+    for (j = 0; j < SPF_ROUTERS; j++)
+    {
+        if (spf_cost[i][j] && rand() % ++n == 0)
+        { pick = j; }
+    }
+    return pick;
+} /* -- spf_link -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: spf_lsa(..)
+ * Scope: local
+ *
+ * Send router i's LSA as spf_cost has it, with a prefix of its own. The
+ * neighbour lists us as well.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void spf_lsa(struct sr_instance* sr, int i)
+{
+    struct sr_ls_lsa* l = (struct sr_ls_lsa*)body;
+    struct sr_ls_link* link = (struct sr_ls_link*)(l + 1);
+    struct sr_ls_pfx* pfx;
+    unsigned int n = 0;
+    int j;
+
+    if (i == 0)
+    {
+        link[n].router_id = htonl(SELF_IP);
+        link[n++].cost = htonl(1);
+    }
+    for (j = 0; j < SPF_ROUTERS; j++)
+    {
+        if (spf_cost[i][j])
+        {
+            link[n].router_id = htonl(spf_id(j));
+            link[n++].cost = htonl(spf_cost[i][j]);
+        }
+    }
+    pfx = (struct sr_ls_pfx*)(link + n);
+    memset(pfx, 0, sizeof(*pfx));
+    pfx->prefix = htonl(0xac200000 + (i << 8));
+    pfx->len = 24;
+    pfx->cost = htonl(1);
+
+    l->router_id = htonl(spf_id(i));
+    l->seq = htonl(++spf_seq[i]);
+    l->n_links = htons(n);
+    l->n_prefixes = htons(1);
+    sr_ls_input(sr->ls, frame, ls_frame(sr_ls_update, spf_id(i),
+                                        (uint8_t*)(pfx + 1) - body), "eth1");
+} /* -- spf_lsa -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: spf_check(..)
+ * Scope: local
+ *
+ * Make that many random link changes, checking the tree after each batch.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void spf_check(struct sr_instance* sr, unsigned long changes)
+{
+    char* av[1] = { "ls" };
+    char line[256];
+    FILE* fp;
+    unsigned long k = 0, batches = 0, bad = 0, full = 0, incr = 0, avoided = 0;
+    unsigned int b, n;
+    uint32_t cost;
+    int i, j, found = 0;
+
+    /* -- a ring, so everything starts reachable, and links at random -- */
+    for (i = 0; i < SPF_ROUTERS; i++)
+    {
+        j = (i + 1) % SPF_ROUTERS;
+        spf_cost[i][j] = 1 + rand() % SPF_MAX_COST;
+        spf_cost[j][i] = 1 + rand() % SPF_MAX_COST;
+    }
+    for (n = 0; n < SPF_ROUTERS * (SPF_DEGREE - 2) / 2; n++)
+    {
+        i = rand() % SPF_ROUTERS;
+        j = rand() % SPF_ROUTERS;
+        if (i != j)
+        {
+            spf_cost[i][j] = 1 + rand() % SPF_MAX_COST;
+            spf_cost[j][i] = 1 + rand() % SPF_MAX_COST;
+        }
+    }
+    for (i = 0; i < SPF_ROUTERS; i++)
+    { spf_lsa(sr, i); }
+    bad += spf_differ(sr, 0);
+
+    while (k < changes)
+    {
+        /* -- mostly one change, now and then a lot -- */
+        b = rand() % 8 ? 1 : 1 + rand() % SPF_BATCH;
+        for (n = 0; n < b && k < changes; n++, k++)
+        {
+            i = rand() % SPF_ROUTERS;
+            j = rand() % (SPF_ROUTERS - 1);
+            if (j >= i)
+            { j++; }
+            cost = 1 + rand() % SPF_MAX_COST;
+
+            switch (rand() % 4)
+            {
+                case 0:
+                    /* -- a link appears at both ends -- */
+                    spf_cost[i][j] = cost;
+                    spf_cost[j][i] = 1 + rand() % SPF_MAX_COST;
+                    spf_lsa(sr, i);
+                    spf_lsa(sr, j);
+                    break;
+                case 1:
+                    /* -- one end lists a link or stops listing it -- */
+                    spf_cost[i][j] = spf_cost[i][j] ? 0 : cost;
+                    spf_lsa(sr, i);
+                    break;
+                default:
+                    /* -- one of i's links goes away at both ends, or gets
+                          dearer or cheaper -- */
+                    if ((j = spf_link(i)) < 0)
+                    { break; }
+                    if (rand() % 2)
+                    {
+                        spf_cost[i][j] = spf_cost[j][i] = 0;
+                        spf_lsa(sr, j);
+                    }
+                    else
+                    { spf_cost[i][j] = cost; }
+                    spf_lsa(sr, i);
+            } /* switch */
+        }
+        /* -- and the neighbour stays up, however long this takes -- */
+        hello_peer(sr);
+        bad += spf_differ(sr, ++batches);
+    }
+
+    fp = tmpfile();
+    assert(fp);
+    sr_ls_ctl(sr, 1, av, fp);
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "spf %lu partial %lu avoided %lu", &full, &incr, &avoided) == 3)
+        { found = 1; }
+    }
+    fclose(fp);
+
+    fprintf(report, "%lu link changes in %lu batches: spf %lu partial %lu avoided %lu,"
+            " %lu routers differ\n", changes, batches, full, incr, avoided, bad);
+    if (!found || bad || (changes && incr == 0))
+    {
+        fprintf(report, "  FAILED%s\n", bad ? "" : ": the incremental computation never ran");
+        failed = 1;
+    }
+} /* -- spf_check -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: spf_differ(..)
+ * Scope: local
+ *
+ * Run the "ls check" control command. Returns how many routers it found
+ * differ, after printing them.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned int spf_differ(struct sr_instance* sr, unsigned long batch)
+{
+    char* av[2] = { "ls", "check" };
+    char line[256];
+    FILE* fp;
+    unsigned int n, differ = 0;
+    int found = 0;
+
+    fp = tmpfile();
+    assert(fp);
+    sr_ls_ctl(sr, 2, av, fp);
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "checked %u routers, %u differ", &n, &differ) == 2)
+        { found = 1; }
+        else
+        { fprintf(report, "  batch %lu: %s", batch, line); }
+    }
+    fclose(fp);
+    if (!found)
+    {
+        fprintf(report, "no result from the ls check command\n");
+        exit(1);
+    }
+    return differ;
+} /* -- spf_differ -- */
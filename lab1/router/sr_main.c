@@ -29,9 +29,22 @@
 #include <getopt.h>
 #endif /* _LINUX_ */
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_ctl.h"
+#include "sr_fpm.h"
+#include "sr_ls.h"
+#include "sr_bfd.h"
+#include "sr_qos.h"
+#include "sr_acl.h"
+#include "sr_flow.h"
+#include "sr_flood.h"
+#include "sr_snap.h"
+#include "sr_log.h"
+#include "sr_nat.h"
+#include "sr_pbuf.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_trace.h"
 
 extern char* optarg;
 
@@ -50,6 +63,10 @@ static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static int  sr_ctl_stats(void* arg, int argc, char** argv, FILE* out);
+#ifdef SR_TRACE
+static int  sr_ctl_trace(void* arg, int argc, char** argv, FILE* out);
+#endif /* SR_TRACE */
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -65,11 +82,30 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    unsigned long log_rotate_bytes = 0;
+    unsigned int log_rotate_secs = 0;
+    struct sr_capture_policy log_policy;
+    int nat = 0;
+    unsigned int nat_icmp_to = 0, nat_tcp_est_to = 0, nat_tcp_trans_to = 0;
+    unsigned int nat_udp_to = 0;
+    char *ctl_path = 0;
+    unsigned int fpm_port = 0;
+    int ls = 0;
+    unsigned int bfd_ms = 0;
+    char *qos_specs[SR_QOS_MAX_IFACES];
+    int qos_n = 0;
+    char *acl_file = 0;
+    unsigned int flow_port = 0;
+    char *flood_spec = 0;
+    unsigned int flood_src = 0, flood_dst = 0;
+    char *snap_file = 0;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    sr_capture_policy_init(&log_policy);
+
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:C:G:S:i:L:F:d:nI:E:R:U:c:f:oB:Q:A:x:H:T:W:")) != EOF)
     {
         switch (c)
         {
@@ -95,6 +131,89 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'C':
+                log_rotate_bytes = strtoul(optarg, 0, 10) * 1000000UL;
+                break;
+            case 'G':
+                log_rotate_secs = atoi((char *) optarg);
+                break;
+            case 'S':
+                log_policy.sample = atoi((char *) optarg);
+                break;
+            case 'i':
+                if(log_policy.n_ifaces == SR_CAPTURE_MAX_IFACES)
+                {
+                    fprintf(stderr,"At most %d capture interfaces\n",
+                            SR_CAPTURE_MAX_IFACES);
+                    exit(1);
+                }
+                strncpy(log_policy.ifaces[log_policy.n_ifaces++], optarg,
+                        sr_IFACE_NAMELEN - 1);
+                break;
+            case 'L':
+                log_policy.snaplen = atoi((char *) optarg);
+                if(log_policy.snaplen < sizeof(struct sr_ethernet_hdr) ||
+                   log_policy.snaplen > PACKET_DUMP_SIZE)
+                {
+                    fprintf(stderr,"Snaplen must be between %d and %d\n",
+                            (int)sizeof(struct sr_ethernet_hdr),
+                            PACKET_DUMP_SIZE);
+                    exit(1);
+                }
+                break;
+            case 'F':
+                if(sr_capture_compile(&log_policy.filter, optarg) != 0)
+                { exit(1); }
+                break;
+            case 'd':
+                sr_log_level = atoi((char *) optarg);
+                break;
+            case 'n':
+                nat = 1;
+                break;
+            case 'I':
+                nat_icmp_to = atoi((char *) optarg);
+                break;
+            case 'E':
+                nat_tcp_est_to = atoi((char *) optarg);
+                break;
+            case 'R':
+                nat_tcp_trans_to = atoi((char *) optarg);
+                break;
+            case 'U':
+                nat_udp_to = atoi((char *) optarg);
+                break;
+            case 'c':
+                ctl_path = optarg;
+                break;
+            case 'f':
+                fpm_port = atoi((char *) optarg);
+                break;
+            case 'o':
+                ls = 1;
+                break;
+            case 'B':
+                bfd_ms = atoi((char *) optarg);
+                break;
+            case 'Q':
+                if(qos_n < SR_QOS_MAX_IFACES)
+                { qos_specs[qos_n++] = optarg; }
+                break;
+            case 'A':
+                acl_file = optarg;
+                break;
+            case 'x':
+                flow_port = atoi((char *) optarg);
+                break;
+            case 'H':
+                flood_spec = optarg;
+                flood_src = atoi((char *) optarg);
+                if(strchr(optarg, ':'))
+                { flood_dst = atoi(strchr(optarg, ':') + 1); }
+                break;
+            case 'W':
+                snap_file = optarg;
+                break;
             case 'r':
                 rtable = optarg;
                 break;
@@ -107,6 +226,21 @@ int main(int argc, char **argv)
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
 
+    /* -- NAT is set up in sr_init once the interfaces are known -- */
+    if(nat)
+    {
+        sr.nat = (struct sr_nat*)calloc(1, sizeof(struct sr_nat));
+        assert(sr.nat);
+        sr.nat->icmp_timeout = nat_icmp_to;
+        sr.nat->tcp_est_timeout = nat_tcp_est_to;
+        sr.nat->tcp_trans_timeout = nat_tcp_trans_to;
+        sr.nat->udp_timeout = nat_udp_to;
+    }
+
+    /* -- start the log formatter before anything logs -- */
+    if(sr_log_open(stderr) != 0)
+    { exit(1); }
+
     /* -- set up routing table from file -- */
     if(template == NULL) {
         sr.template[0] = '\0';
@@ -126,8 +260,9 @@ int main(int argc, char **argv)
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr.capture = sr_capture_open(logfile, log_rotate_bytes,
+                                     log_rotate_secs, &log_policy);
+        if(!sr.capture)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -135,6 +270,27 @@ int main(int argc, char **argv)
         }
     }
 
+    /* -- the ingress filter, in place before the first packet -- */
+    if(acl_file)
+    {
+        if(sr_acl_open(&sr, acl_file) != 0)
+        { exit(1); }
+    }
+
+    /* -- heavy hitters, and dropping floods before we answer them -- */
+    if(flood_spec)
+    {
+        if(sr_flood_open(&sr, flood_src, flood_dst) != 0)
+        { exit(1); }
+    }
+
+    /* -- per-flow accounting, exported as IPFIX -- */
+    if(flow_port)
+    {
+        if(sr_flow_open(&sr, flow_port) != 0)
+        { exit(1); }
+    }
+
     Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
     if(template)
         Debug("Requesting topology template %s\n", template);
@@ -159,6 +315,64 @@ int main(int argc, char **argv)
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    /* -- what the last run knew, so forwarding needn't start cold -- */
+    if(snap_file)
+    {
+        if(sr_snap_open(&sr, snap_file) != 0)
+        { exit(1); }
+    }
+
+    /* -- control socket, once there is a router to look at -- */
+    if(ctl_path)
+    {
+        sr_ctl_register("stats", "stats", sr_ctl_stats, &sr);
+        sr_ctl_register("route",
+                        "route add|replace <prefix>/<len> <gw> <iface> | del <prefix>/<len> |"
+                        " get <addr> | dump | begin | commit | abort",
+                        sr_rt_ctl, &sr);
+        sr_ctl_on_hangup(sr_rt_ctl_hangup, &sr);
+        sr_ctl_register("ls", "ls [db|check]", sr_ls_ctl, &sr);
+        sr_ctl_register("bfd", "bfd", sr_bfd_ctl, &sr);
+        sr_ctl_register("qos", "qos", sr_qos_ctl, &sr);
+        sr_ctl_register("acl", "acl [load <file>]", sr_acl_ctl, &sr);
+        sr_ctl_register("flows", "flows", sr_flow_ctl, &sr);
+        sr_ctl_register("flood", "flood", sr_flood_ctl, &sr);
+        sr_ctl_register("snapshot", "snapshot [save]", sr_snap_ctl, &sr);
+#ifdef SR_TRACE
+        sr_ctl_register("trace", "trace <dump file>", sr_ctl_trace, 0);
+#endif /* SR_TRACE */
+        if(sr_ctl_open(ctl_path) != 0)
+        { exit(1); }
+    }
+
+    /* -- routes from zebra, on top of the rtable -- */
+    if(fpm_port)
+    {
+        if(sr_fpm_open(&sr, fpm_port) != 0)
+        { exit(1); }
+    }
+
+    /* -- routes from the other routers, on top of the rtable -- */
+    if(ls)
+    {
+        if(sr_ls_open(&sr) != 0)
+        { exit(1); }
+    }
+
+    /* -- watch the next hops, failing over when one dies -- */
+    if(bfd_ms)
+    {
+        if(sr_bfd_open(&sr, bfd_ms) != 0)
+        { exit(1); }
+    }
+
+    /* -- queue by class on the links slower than we are -- */
+    if(qos_n)
+    {
+        if(sr_qos_open(&sr, qos_specs, qos_n) != 0)
+        { exit(1); }
+    }
+
     /* -- whizbang main loop ;-) */
     while( sr_read_from_server(&sr) == 1);
 
@@ -178,7 +392,31 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-C rotate log every N million bytes]\n");
+    printf("           [-G rotate log every N seconds] \n");
+    printf("           [-S log 1 in N packets] [-i log only on interface]\n");
+    printf("           [-L log snaplen] [-F log filter] \n");
+    printf("           [-d message level 0=error 1=warn 2=info 3=debug]\n");
+    printf("           [-n enable NAT, external interface %s]\n", SR_NAT_EXT_IFACE);
+    printf("           [-I NAT ICMP query timeout, default %d s]\n", SR_NAT_ICMP_TO);
+    printf("           [-E NAT established TCP timeout, default %d s]\n", SR_NAT_TCP_EST_TO);
+    printf("           [-R NAT transitory TCP timeout, default %d s]\n", SR_NAT_TCP_TRANS_TO);
+    printf("           [-U NAT UDP timeout, default %d s]\n", SR_NAT_UDP_TO);
+    printf("           [-c control socket path]\n");
+    printf("           [-f take routes from zebra FPM on 127.0.0.1:port, usually %d]\n",
+           SR_FPM_PORT);
+    printf("           [-o run link-state routing with the other routers]\n");
+    printf("           [-B watch next hops with BFD every N ms, usually %d]\n",
+           SR_BFD_DEFAULT_MS);
+    printf("           [-Q shape iface[=Mbit/s] or all, with class queues]\n");
+    printf("           [-A filter arriving packets with the ACL in file]\n");
+    printf("           [-x export flows as IPFIX to 127.0.0.1:port, usually %d]\n",
+           SR_FLOW_PORT);
+    printf("           [-H drop sources over N pps[:destination /%d prefixes over M pps],\n"
+           "               0 to only track them]\n", SR_FLOOD_DST_LEN);
+    printf("           [-W keep the ARP cache and routes in file for a warm restart]\n");
+    printf("   log filter terms (all must match): arp ip icmp tcp udp\n");
+    printf("           proto N, src|dst|net a.b.c.d[/len] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -220,11 +458,29 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    sr_snap_close(sr);
+    sr_flow_close(sr);
+    sr_flood_close(sr);
+    sr_qos_close(sr);
+    sr_bfd_close(sr);
+    sr_acl_close(sr);
+    sr_ls_close(sr);
+    sr_fpm_close();
+    sr_ctl_close();
+
+    if(sr->capture)
     {
-        sr_dump_close(sr->logfile);
+        sr_capture_close(sr->capture);
     }
 
+    if(sr->nat)
+    {
+        sr_nat_destroy(sr->nat);
+        free(sr->nat);
+    }
+
+    sr_log_close();
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -247,10 +503,96 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
-    sr->routing_table = 0;
-    sr->logfile = 0;
+    sr_rt_init(sr);
+    sr->capture = 0;
+    sr->nat = 0;
+    sr->ls = 0;
+    sr->bfd = 0;
+    sr->qos = 0;
+    sr->acl = 0;
+    sr->flow = 0;
+    sr->flood = 0;
+    sr->snap = 0;
 } /* -- sr_init_instance -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_ctl_stats(..)
+ * Scope: Local
+ *
+ * "stats" on the control socket: the packet path counters, then the
+ * state of the buffer pool, ICMP rate limits and NAT.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int sr_ctl_stats(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    unsigned int nat_mappings;
+    unsigned long nat_expired;
+
+    if(argc != 1)
+    { return -1; }
+
+    sr_stats_write(out);
+
+    fprintf(out, "# HELP sr_pbufs_in_use Packet buffers handed out.\n");
+    fprintf(out, "# TYPE sr_pbufs_in_use gauge\n");
+    fprintf(out, "sr_pbufs_in_use %lu\n", sr_pbuf_in_use());
+    fprintf(out, "# HELP sr_pbufs_refused_total Allocations refused, pool empty.\n");
+    fprintf(out, "# TYPE sr_pbufs_refused_total counter\n");
+    fprintf(out, "sr_pbufs_refused_total %lu\n", sr_pbuf_exhausted());
+
+    fprintf(out, "# HELP sr_icmp_errors_total ICMP errors sent or rate limited.\n");
+    fprintf(out, "# TYPE sr_icmp_errors_total counter\n");
+    fprintf(out, "sr_icmp_errors_total{result=\"sent\"} %lu\n", sr->icmp_limit.sent);
+    fprintf(out, "sr_icmp_errors_total{result=\"limited_global\"} %lu\n",
+            sr->icmp_limit.suppressed_global);
+    fprintf(out, "sr_icmp_errors_total{result=\"limited_peer\"} %lu\n",
+            sr->icmp_limit.suppressed_peer);
+
+    if(sr->nat)
+    {
+        sr_nat_stats(sr->nat, &nat_mappings, &nat_expired);
+        fprintf(out, "# HELP sr_nat_mappings NAT mappings in use.\n");
+        fprintf(out, "# TYPE sr_nat_mappings gauge\n");
+        fprintf(out, "sr_nat_mappings %u\n", nat_mappings);
+        fprintf(out, "# HELP sr_nat_expired_total NAT mappings timed out.\n");
+        fprintf(out, "# TYPE sr_nat_expired_total counter\n");
+        fprintf(out, "sr_nat_expired_total %lu\n", nat_expired);
+    }
+
+    sr_fpm_stats_write(out);
+
+    return 0;
+} /* -- sr_ctl_stats -- */
+
+#ifdef SR_TRACE
+/*-----------------------------------------------------------------------------
+ * Method: sr_ctl_trace(..)
+ * Scope: local
+ *
+ * Control command: dump the stage trace rings for sr_trace_summary.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_ctl_trace(void* arg, int argc, char** argv, FILE* out)
+{
+    long n;
+
+    if(argc != 2)
+    { return -1; }
+
+    if((n = sr_trace_dump(argv[1])) < 0)
+    {
+        fprintf(out, "error: can't write %s\n", argv[1]);
+        return 0;
+    }
+    fprintf(out, "%ld records written to %s\n", n, argv[1]);
+
+    return 0;
+} /* -- sr_ctl_trace -- */
+#endif /* SR_TRACE */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_verify_routing_table()
  * Scope: Global
@@ -0,0 +1,688 @@
+
+#include <signal.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "sr_nat.h"
+#include "sr_utils.h"
+#include <unistd.h>
+
+/* Where the fields NAT rewrites sit in a transport header */
+struct sr_nat_l4 {
+  sr_nat_mapping_type type;
+  uint8_t *hdr;          /* start of the transport header */
+  unsigned int aux_off;  /* port or icmp id we translate */
+  unsigned int sum_off;  /* transport checksum */
+  int pseudo;            /* checksum covers the IP addresses */
+  int sum_optional;      /* a zero checksum means none (UDP) */
+};
+
+static uint16_t sr_nat_get16(const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static void sr_nat_put16(uint8_t *p, uint16_t v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+/* Where an internal (ip, port/id) lives: the top bits of the hash pick
+   the shard, the next ones the bucket within it */
+static uint32_t sr_nat_hash_int(uint32_t ip_int, uint16_t aux_int,
+    sr_nat_mapping_type type) {
+  uint32_t h = ip_int * 2654435761U;
+  h ^= (uint32_t)aux_int << 8 ^ type;
+  return h * 2246822519U;
+}
+
+static struct sr_nat_shard *sr_nat_shard_int(struct sr_nat *nat, uint32_t h) {
+  return &nat->shards[h >> (32 - SR_NAT_SHARD_BITS)];
+}
+
+static unsigned int sr_nat_bucket_int(uint32_t h) {
+  return (h << SR_NAT_SHARD_BITS) >> (32 - SR_NAT_SHARD_HASH_BITS);
+}
+
+/* The shard whose range holds an external port / icmp id, or NULL if
+   it is below the ranges */
+static struct sr_nat_shard *sr_nat_shard_ext(struct sr_nat *nat, uint16_t aux_ext) {
+  unsigned int aux = ntohs(aux_ext);
+
+  if (aux < SR_NAT_AUX_MIN || aux >= SR_NAT_AUX_MIN + SR_NAT_SHARDS * SR_NAT_SHARD_AUX)
+    return NULL;
+  return &nat->shards[(aux - SR_NAT_AUX_MIN) / SR_NAT_SHARD_AUX];
+}
+
+static unsigned int sr_nat_bucket_ext(uint16_t aux_ext, sr_nat_mapping_type type) {
+  uint32_t h = ((uint32_t)type << 16 | aux_ext) * 2654435761U;
+  return h >> (32 - SR_NAT_SHARD_HASH_BITS);
+}
+
+/* -- everything below that takes a shard must be called with its lock
+   held -- */
+
+static struct sr_nat_mapping *sr_nat_find_ext(struct sr_nat_shard *sh,
+    uint16_t aux_ext, sr_nat_mapping_type type) {
+  struct sr_nat_mapping *m = sh->by_ext[sr_nat_bucket_ext(aux_ext, type)];
+
+  while (m && (m->aux_ext != aux_ext || m->type != type))
+    m = m->ext_next;
+  return m;
+}
+
+static struct sr_nat_mapping *sr_nat_find_int(struct sr_nat_shard *sh,
+    uint32_t h, uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type) {
+  struct sr_nat_mapping *m = sh->by_int[sr_nat_bucket_int(h)];
+
+  while (m && (m->ip_int != ip_int || m->aux_int != aux_int || m->type != type))
+    m = m->int_next;
+  return m;
+}
+
+static void sr_nat_wheel_add(struct sr_nat_shard *sh, struct sr_nat_mapping *m) {
+  struct sr_nat_mapping **slot = &sh->wheel[m->expires & (SR_NAT_WHEEL_SLOTS - 1)];
+
+  m->next = *slot;
+  if (m->next)
+    m->next->pprev = &m->next;
+  m->pprev = slot;
+  *slot = m;
+}
+
+static void sr_nat_wheel_del(struct sr_nat_mapping *m) {
+  *m->pprev = m->next;
+  if (m->next)
+    m->next->pprev = m->pprev;
+}
+
+/* Set m's expiry. Later is free, the sweep catches up with it; earlier
+   moves the mapping to its new slot. */
+static void sr_nat_reschedule(struct sr_nat_shard *sh, struct sr_nat_mapping *m,
+    time_t expires) {
+  if (expires < m->expires) {
+    m->expires = expires;
+    sr_nat_wheel_del(m);
+    sr_nat_wheel_add(sh, m);
+  }
+  else
+    m->expires = expires;
+}
+
+/* UDP services whose flows are one request and one answer */
+static int sr_nat_udp_short(uint16_t dport) {
+  switch (ntohs(dport)) {
+    case 53:    /* DNS */
+    case 123:   /* NTP */
+      return 1;
+  }
+  return 0;
+}
+
+/* How long a mapping lives without traffic */
+static unsigned int sr_nat_idle_timeout(struct sr_nat *nat,
+    sr_nat_mapping_type type, int short_lived) {
+  switch (type) {
+    case nat_mapping_icmp:
+      return nat->icmp_timeout;
+    case nat_mapping_udp:
+      return short_lived ? SR_NAT_UDP_QUERY_TO : nat->udp_timeout;
+    default:
+      return nat->tcp_trans_timeout;  /* until the handshake completes */
+  }
+}
+
+/* Next free external port / icmp id (network order) in the shard's
+   range, searching on from the last one handed out. Returns -1 if all
+   are in use. */
+static int sr_nat_alloc_aux(struct sr_nat_shard *sh, sr_nat_mapping_type type) {
+  uint64_t *used = sh->aux_used[type];
+  unsigned int w = sh->aux_next[type] / 64;
+  unsigned int i, bit;
+
+  for (i = 0; i < SR_NAT_SHARD_WORDS; i++) {
+    if (~used[w]) {
+      bit = w * 64 + __builtin_ctzll(~used[w]);
+      used[w] |= (uint64_t)1 << (bit % 64);
+      sh->aux_next[type] = (bit + 1) % SR_NAT_SHARD_AUX;
+      return htons(sh->aux_base + bit);
+    }
+    w = (w + 1) % SR_NAT_SHARD_WORDS;
+  }
+  return -1;
+}
+
+static void sr_nat_free_aux(struct sr_nat_shard *sh, sr_nat_mapping_type type,
+    uint16_t aux_ext) {
+  unsigned int bit = ntohs(aux_ext) - sh->aux_base;
+  sh->aux_used[type][bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+static struct sr_nat_mapping *sr_nat_new_mapping(struct sr_nat *nat,
+    struct sr_nat_shard *sh, uint32_t h, uint32_t ip_int, uint16_t aux_int,
+    sr_nat_mapping_type type, int short_lived) {
+  struct sr_nat_mapping *m;
+  unsigned int b;
+  int aux_ext;
+
+  if ((aux_ext = sr_nat_alloc_aux(sh, type)) < 0)
+    return NULL;
+  if ((m = (struct sr_nat_mapping *)calloc(1, sizeof(*m))) == NULL) {
+    sr_nat_free_aux(sh, type, aux_ext);
+    return NULL;
+  }
+
+  m->type = type;
+  m->ip_int = ip_int;
+  m->ip_ext = nat->ip_ext;
+  m->aux_int = aux_int;
+  m->aux_ext = aux_ext;
+  m->short_lived = short_lived;
+  m->last_updated = time(NULL);
+  m->expires = m->last_updated + sr_nat_idle_timeout(nat, type, short_lived);
+  sr_nat_wheel_add(sh, m);
+
+  b = sr_nat_bucket_int(h);
+  m->int_next = sh->by_int[b];
+  sh->by_int[b] = m;
+  b = sr_nat_bucket_ext(m->aux_ext, type);
+  m->ext_next = sh->by_ext[b];
+  sh->by_ext[b] = m;
+  sh->count++;
+
+  return m;
+}
+
+/* Take m out of both indexes and give back its port. The caller unlinks
+   it from the wheel. */
+static void sr_nat_unindex(struct sr_nat_shard *sh, struct sr_nat_mapping *m) {
+  struct sr_nat_mapping **pp;
+
+  pp = &sh->by_int[sr_nat_bucket_int(sr_nat_hash_int(m->ip_int, m->aux_int, m->type))];
+  while (*pp != m)
+    pp = &(*pp)->int_next;
+  *pp = m->int_next;
+
+  pp = &sh->by_ext[sr_nat_bucket_ext(m->aux_ext, m->type)];
+  while (*pp != m)
+    pp = &(*pp)->ext_next;
+  *pp = m->ext_next;
+
+  sr_nat_free_aux(sh, m->type, m->aux_ext);
+  sh->count--;
+}
+
+static void sr_nat_free_mapping(struct sr_nat_mapping *m) {
+  struct sr_nat_connection *c;
+
+  while ((c = m->conns) != NULL) {
+    m->conns = c->next;
+    free(c);
+  }
+  free(m);
+}
+
+/* Copy m out for a caller, without the links into our tables */
+static int sr_nat_copy(const struct sr_nat_mapping *m, struct sr_nat_mapping *out) {
+  if (m == NULL)
+    return -1;
+  memcpy(out, m, sizeof(*out));
+  out->conns = NULL;
+  out->next = out->int_next = out->ext_next = NULL;
+  out->pprev = NULL;
+  return 0;
+}
+
+int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
+  struct sr_nat_shard *sh;
+  unsigned int s, t, bit;
+  int success = 0;
+
+  assert(nat);
+
+  for (s = 0; s < SR_NAT_SHARDS; s++) {
+    sh = &nat->shards[s];
+    success |= pthread_mutex_init(&(sh->lock), NULL);
+
+    memset(sh->wheel, 0, sizeof(sh->wheel));
+    sh->wheel_now = time(NULL);
+    sh->count = 0;
+    sh->expired = 0;
+    sh->by_ext = (struct sr_nat_mapping **)calloc(SR_NAT_SHARD_HASH_SIZE, sizeof(*sh->by_ext));
+    sh->by_int = (struct sr_nat_mapping **)calloc(SR_NAT_SHARD_HASH_SIZE, sizeof(*sh->by_int));
+    if (sh->by_ext == NULL || sh->by_int == NULL)
+      return -1;
+
+    /* the tail of the last bitmap word is past the range: never free */
+    sh->aux_base = SR_NAT_AUX_MIN + s * SR_NAT_SHARD_AUX;
+    memset(sh->aux_used, 0, sizeof(sh->aux_used));
+    for (t = 0; t < nat_mapping_max; t++) {
+      for (bit = SR_NAT_SHARD_AUX; bit < SR_NAT_SHARD_WORDS * 64; bit++)
+        sh->aux_used[t][bit / 64] |= (uint64_t)1 << (bit % 64);
+      sh->aux_next[t] = 0;
+    }
+  }
+
+  if (nat->icmp_timeout == 0)
+    nat->icmp_timeout = SR_NAT_ICMP_TO;
+  if (nat->tcp_est_timeout == 0)
+    nat->tcp_est_timeout = SR_NAT_TCP_EST_TO;
+  if (nat->tcp_trans_timeout == 0)
+    nat->tcp_trans_timeout = SR_NAT_TCP_TRANS_TO;
+  if (nat->udp_timeout == 0)
+    nat->udp_timeout = SR_NAT_UDP_TO;
+  nat->stop = 0;
+
+  /* Initialize timeout thread, now that there is something to time out */
+
+  pthread_attr_init(&(nat->thread_attr));
+  pthread_attr_setdetachstate(&(nat->thread_attr), PTHREAD_CREATE_JOINABLE);
+  pthread_attr_setscope(&(nat->thread_attr), PTHREAD_SCOPE_SYSTEM);
+  pthread_attr_setscope(&(nat->thread_attr), PTHREAD_SCOPE_SYSTEM);
+  pthread_create(&(nat->thread), &(nat->thread_attr), sr_nat_timeout, nat);
+
+  return success;
+}
+
+
+int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
+  struct sr_nat_shard *sh;
+  struct sr_nat_mapping *m;
+  unsigned int s, i;
+  int rc = 0;
+
+  __atomic_store_n(&nat->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(nat->thread, NULL);
+
+  for (s = 0; s < SR_NAT_SHARDS; s++) {
+    sh = &nat->shards[s];
+    pthread_mutex_lock(&(sh->lock));
+
+    for (i = 0; i < SR_NAT_WHEEL_SLOTS; i++) {
+      while ((m = sh->wheel[i]) != NULL) {
+        sh->wheel[i] = m->next;
+        sr_nat_free_mapping(m);
+      }
+    }
+    free(sh->by_ext);
+    free(sh->by_int);
+    sh->by_ext = sh->by_int = NULL;
+    sh->count = 0;
+
+    pthread_mutex_unlock(&(sh->lock));
+    rc |= pthread_mutex_destroy(&(sh->lock));
+  }
+
+  return rc;
+}
+
+/* Drop a TCP mapping's expired connections and work out when the
+   mapping itself is due: when its last connection is. */
+static time_t sr_nat_expire_conns(struct sr_nat_mapping *m, time_t now) {
+  struct sr_nat_connection **pp = &m->conns, *c;
+  time_t expires = 0;
+
+  while ((c = *pp) != NULL) {
+    if (c->expires <= now) {
+      *pp = c->next;
+      free(c);
+      continue;
+    }
+    if (c->expires > expires)
+      expires = c->expires;
+    pp = &c->next;
+  }
+  return expires;
+}
+
+/* Run one shard's wheel up to now */
+static void sr_nat_sweep(struct sr_nat_shard *sh, time_t curtime) {
+  struct sr_nat_mapping *m, *due;
+  time_t t;
+
+  /* after a clock jump, one turn of the wheel covers every slot */
+  if (curtime - sh->wheel_now > SR_NAT_WHEEL_SLOTS)
+    sh->wheel_now = curtime - SR_NAT_WHEEL_SLOTS;
+
+  for (t = sh->wheel_now + 1; t <= curtime; t++) {
+    due = sh->wheel[t & (SR_NAT_WHEEL_SLOTS - 1)];
+    sh->wheel[t & (SR_NAT_WHEEL_SLOTS - 1)] = NULL;
+
+    while ((m = due) != NULL) {
+      due = m->next;
+      if (m->type == nat_mapping_tcp)
+        m->expires = sr_nat_expire_conns(m, t);
+      if (m->expires <= t) {
+        sr_nat_unindex(sh, m);
+        sr_nat_free_mapping(m);
+        sh->expired++;
+      }
+      else
+        sr_nat_wheel_add(sh, m);
+    }
+  }
+  if (curtime > sh->wheel_now)
+    sh->wheel_now = curtime;
+}
+
+void *sr_nat_timeout(void *nat_ptr) {  /* Periodic Timout handling */
+  struct sr_nat *nat = (struct sr_nat *)nat_ptr;
+  unsigned int s;
+
+  while (!__atomic_load_n(&nat->stop, __ATOMIC_ACQUIRE)) {
+    sleep(1.0);
+
+    time_t curtime = time(NULL);
+
+    /* one shard at a time, so forwarding only ever waits on one */
+    for (s = 0; s < SR_NAT_SHARDS; s++) {
+      pthread_mutex_lock(&(nat->shards[s].lock));
+      sr_nat_sweep(&nat->shards[s], curtime);
+      pthread_mutex_unlock(&(nat->shards[s].lock));
+    }
+  }
+  return NULL;
+}
+
+/* Get the mapping associated with given external port. */
+int sr_nat_lookup_external(struct sr_nat *nat,
+    uint16_t aux_ext, sr_nat_mapping_type type, struct sr_nat_mapping *out) {
+  struct sr_nat_shard *sh = sr_nat_shard_ext(nat, aux_ext);
+  int rc;
+
+  if (sh == NULL)
+    return -1;
+
+  pthread_mutex_lock(&(sh->lock));
+  rc = sr_nat_copy(sr_nat_find_ext(sh, aux_ext, type), out);
+  pthread_mutex_unlock(&(sh->lock));
+
+  return rc;
+}
+
+/* Get the mapping associated with given internal (ip, port) pair. */
+int sr_nat_lookup_internal(struct sr_nat *nat,
+  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type,
+  struct sr_nat_mapping *out) {
+  uint32_t h = sr_nat_hash_int(ip_int, aux_int, type);
+  struct sr_nat_shard *sh = sr_nat_shard_int(nat, h);
+  int rc;
+
+  pthread_mutex_lock(&(sh->lock));
+  rc = sr_nat_copy(sr_nat_find_int(sh, h, ip_int, aux_int, type), out);
+  pthread_mutex_unlock(&(sh->lock));
+
+  return rc;
+}
+
+/* Insert a new mapping into the nat's mapping table, or find the one
+   the internal pair already has. */
+int sr_nat_insert_mapping(struct sr_nat *nat,
+  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type,
+  struct sr_nat_mapping *out) {
+  uint32_t h = sr_nat_hash_int(ip_int, aux_int, type);
+  struct sr_nat_shard *sh = sr_nat_shard_int(nat, h);
+  int rc;
+
+  pthread_mutex_lock(&(sh->lock));
+
+  struct sr_nat_mapping *mapping = sr_nat_find_int(sh, h, ip_int, aux_int, type);
+  if (mapping == NULL)
+    mapping = sr_nat_new_mapping(nat, sh, h, ip_int, aux_int, type, 0);
+  rc = sr_nat_copy(mapping, out);
+
+  pthread_mutex_unlock(&(sh->lock));
+  return rc;
+}
+
+void sr_nat_stats(struct sr_nat *nat, unsigned int *count,
+    unsigned long *expired) {
+  unsigned int s;
+
+  *count = 0;
+  *expired = 0;
+  for (s = 0; s < SR_NAT_SHARDS; s++) {
+    pthread_mutex_lock(&(nat->shards[s].lock));
+    *count += nat->shards[s].count;
+    *expired += nat->shards[s].expired;
+    pthread_mutex_unlock(&(nat->shards[s].lock));
+  }
+}
+
+/* Find the transport fields of a packet NAT can translate: TCP, UDP,
+   and ICMP echo requests going out / replies coming back. Returns -1 for anything
+   else. */
+static int sr_nat_classify(uint8_t *ip, unsigned int len, int outbound,
+    struct sr_nat_l4 *l4) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)ip;
+  unsigned int hl = ip_hdr->ip_hl * 4;
+
+  if (len < sizeof(sr_ip_hdr_t) || hl < sizeof(sr_ip_hdr_t) || len < hl)
+    return -1;
+  /* only the first fragment carries the transport header */
+  if (ip_hdr->ip_off & htons(IP_OFFMASK))
+    return -1;
+
+  l4->hdr = ip + hl;
+  switch (ip_hdr->ip_p) {
+    case ip_protocol_icmp:
+      if (len < hl + sizeof(sr_icmp_echo_hdr_t) ||
+          l4->hdr[0] != (outbound ? 8 : 0))
+        return -1;
+      l4->type = nat_mapping_icmp;
+      l4->aux_off = offsetof(sr_icmp_echo_hdr_t, icmp_id);
+      l4->sum_off = offsetof(sr_icmp_echo_hdr_t, icmp_sum);
+      l4->pseudo = 0;
+      l4->sum_optional = 0;
+      return 0;
+
+    case ip_protocol_tcp:
+      if (len < hl + sizeof(sr_tcp_hdr_t))
+        return -1;
+      l4->type = nat_mapping_tcp;
+      l4->aux_off = outbound ? offsetof(sr_tcp_hdr_t, tcp_sport)
+                             : offsetof(sr_tcp_hdr_t, tcp_dport);
+      l4->sum_off = offsetof(sr_tcp_hdr_t, tcp_sum);
+      l4->pseudo = 1;
+      l4->sum_optional = 0;
+      return 0;
+
+    case ip_protocol_udp:
+      if (len < hl + sizeof(sr_udp_hdr_t))
+        return -1;
+      l4->type = nat_mapping_udp;
+      l4->aux_off = outbound ? offsetof(sr_udp_hdr_t, udp_sport)
+                             : offsetof(sr_udp_hdr_t, udp_dport);
+      l4->sum_off = offsetof(sr_udp_hdr_t, udp_sum);
+      l4->pseudo = 1;
+      l4->sum_optional = 1;
+      return 0;
+  }
+  return -1;
+}
+
+/* Replace the source (outbound) or destination (inbound) address and the
+   translated port/id, patching both checksums. */
+static void sr_nat_rewrite(sr_ip_hdr_t *ip_hdr, struct sr_nat_l4 *l4,
+    int outbound, uint32_t addr, uint16_t aux) {
+  uint32_t old_addr = outbound ? ip_hdr->ip_src : ip_hdr->ip_dst;
+  uint16_t old_aux = sr_nat_get16(l4->hdr + l4->aux_off);
+  uint16_t sum = sr_nat_get16(l4->hdr + l4->sum_off);
+
+  /* the updates never produce 0, which UDP would read as "none" */
+  if (!l4->sum_optional || sum != 0) {
+    if (l4->pseudo)
+      sum = cksum_update32(sum, old_addr, addr);
+    sum = cksum_update16(sum, old_aux, aux);
+    sr_nat_put16(l4->hdr + l4->sum_off, sum);
+  }
+  sr_nat_put16(l4->hdr + l4->aux_off, aux);
+
+  ip_hdr->ip_sum = cksum_update32(ip_hdr->ip_sum, old_addr, addr);
+  if (outbound)
+    ip_hdr->ip_src = addr;
+  else
+    ip_hdr->ip_dst = addr;
+}
+
+static int sr_nat_tcp_syn(const struct sr_nat_l4 *l4) {
+  uint8_t flags = ((const sr_tcp_hdr_t *)l4->hdr)->tcp_flags;
+
+  return (flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN;
+}
+
+/* Follow one segment through its connection's state machine and push
+   the connection's expiry out. Only the inside can open a connection;
+   segments for anything else are refused with -1. */
+static int sr_nat_track_tcp(struct sr_nat *nat, struct sr_nat_shard *sh,
+    struct sr_nat_mapping *m, sr_ip_hdr_t *ip_hdr, struct sr_nat_l4 *l4, int outbound, time_t now) {
+  const sr_tcp_hdr_t *tcp = (const sr_tcp_hdr_t *)l4->hdr;
+  uint32_t ip_peer = outbound ? ip_hdr->ip_dst : ip_hdr->ip_src;
+  uint16_t port_peer = outbound ? tcp->tcp_dport : tcp->tcp_sport;
+  struct sr_nat_connection *c;
+  time_t old, expires;
+
+  for (c = m->conns; c; c = c->next)
+    if (c->ip_peer == ip_peer && c->port_peer == port_peer)
+      break;
+
+  /* an expired connection the sweep hasn't got to yet is gone, and a
+     new SYN after TIME_WAIT starts the connection over */
+  if (c == NULL || c->expires <= now || c->state == nat_tcp_time_wait) {
+    if (!outbound || !sr_nat_tcp_syn(l4))
+      return c && c->expires > now ? 0 : -1;
+    if (c == NULL) {
+      if ((c = (struct sr_nat_connection *)calloc(1, sizeof(*c))) == NULL)
+        return -1;
+      c->ip_peer = ip_peer;
+      c->port_peer = port_peer;
+      c->next = m->conns;
+      m->conns = c;
+    }
+    c->state = nat_tcp_syn_sent;
+    c->fin_out = c->fin_in = 0;
+  }
+
+  if (tcp->tcp_flags & TCP_RST)
+    c->state = nat_tcp_time_wait;
+  else if (c->state == nat_tcp_syn_sent) {
+    if (!outbound && (tcp->tcp_flags & TCP_SYN))
+      c->state = nat_tcp_established;
+  }
+  else {
+    if (tcp->tcp_flags & TCP_FIN) {
+      if (outbound)
+        c->fin_out = 1;
+      else
+        c->fin_in = 1;
+    }
+    if (c->fin_out && c->fin_in)
+      c->state = nat_tcp_time_wait;
+    else if (c->fin_out || c->fin_in)
+      c->state = nat_tcp_fin_wait;
+  }
+
+  old = c->expires;
+  c->expires = now + (c->state == nat_tcp_established ? nat->tcp_est_timeout
+                                                      : nat->tcp_trans_timeout);
+  if (c->expires >= m->expires)
+    m->expires = c->expires;
+  else if (old == m->expires) {
+    /* this connection was what kept the mapping alive and it is closing:
+       bring the mapping's slot forward so its port comes back early */
+    expires = sr_nat_expire_conns(m, now);
+    if (expires < m->expires)
+      sr_nat_reschedule(sh, m, expires);
+  }
+  return 0;
+}
+
+/* Note traffic on a mapping. Returns -1 if its connection refuses it. */
+static int sr_nat_touch(struct sr_nat *nat, struct sr_nat_shard *sh,
+    struct sr_nat_mapping *m, sr_ip_hdr_t *ip_hdr, struct sr_nat_l4 *l4,
+    int outbound) {
+  time_t now = time(NULL);
+
+  m->last_updated = now;
+  if (l4->type == nat_mapping_tcp)
+    return sr_nat_track_tcp(nat, sh, m, ip_hdr, l4, outbound, now);
+
+  /* once a short-lived flow has its answer the mapping only waits
+     briefly for stragglers */
+  if (m->short_lived && !outbound)
+    sr_nat_reschedule(sh, m, now + SR_NAT_UDP_ANSWER_TO);
+  else if (now + sr_nat_idle_timeout(nat, l4->type, m->short_lived) > m->expires)
+    m->expires = now + sr_nat_idle_timeout(nat, l4->type, m->short_lived);
+  return 0;
+}
+
+int sr_nat_outbound(struct sr_nat *nat, uint8_t *ip, unsigned int len) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)ip;
+  struct sr_nat_shard *sh;
+  struct sr_nat_mapping *m;
+  struct sr_nat_l4 l4;
+  uint16_t aux_int, aux_ext;
+  uint32_t h, ip_ext;
+
+  if (sr_nat_classify(ip, len, 1, &l4) != 0)
+    return -1;
+
+  aux_int = sr_nat_get16(l4.hdr + l4.aux_off);
+  h = sr_nat_hash_int(ip_hdr->ip_src, aux_int, l4.type);
+  sh = sr_nat_shard_int(nat, h);
+
+  pthread_mutex_lock(&(sh->lock));
+
+  m = sr_nat_find_int(sh, h, ip_hdr->ip_src, aux_int, l4.type);
+  if (m == NULL && (l4.type != nat_mapping_tcp || sr_nat_tcp_syn(&l4)))
+    m = sr_nat_new_mapping(nat, sh, h, ip_hdr->ip_src, aux_int, l4.type,
+        l4.type == nat_mapping_udp &&
+        sr_nat_udp_short(((sr_udp_hdr_t *)l4.hdr)->udp_dport));
+  if (m == NULL || sr_nat_touch(nat, sh, m, ip_hdr, &l4, 1) != 0) {
+    pthread_mutex_unlock(&(sh->lock));
+    return -1;
+  }
+  aux_ext = m->aux_ext;
+  ip_ext = m->ip_ext;
+
+  pthread_mutex_unlock(&(sh->lock));
+
+  sr_nat_rewrite(ip_hdr, &l4, 1, ip_ext, aux_ext);
+  return 1;
+}
+
+int sr_nat_inbound(struct sr_nat *nat, uint8_t *ip, unsigned int len) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)ip;
+  struct sr_nat_shard *sh;
+  struct sr_nat_mapping *m;
+  struct sr_nat_l4 l4;
+  uint16_t aux_int, aux_ext;
+  uint32_t ip_int;
+
+  if (ip_hdr->ip_dst != nat->ip_ext || sr_nat_classify(ip, len, 0, &l4) != 0)
+    return 0;
+
+  aux_ext = sr_nat_get16(l4.hdr + l4.aux_off);
+  if ((sh = sr_nat_shard_ext(nat, aux_ext)) == NULL)
+    return 0;
+
+  pthread_mutex_lock(&(sh->lock));
+
+  m = sr_nat_find_ext(sh, aux_ext, l4.type);
+  if (m == NULL) {
+    pthread_mutex_unlock(&(sh->lock));
+    return 0;
+  }
+  if (sr_nat_touch(nat, sh, m, ip_hdr, &l4, 0) != 0) {
+    pthread_mutex_unlock(&(sh->lock));
+    return -1;
+  }
+  aux_int = m->aux_int;
+  ip_int = m->ip_int;
+
+  pthread_mutex_unlock(&(sh->lock));
+
+  sr_nat_rewrite(ip_hdr, &l4, 0, ip_int, aux_int);
+  return 1;
+}
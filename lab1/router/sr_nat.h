@@ -0,0 +1,170 @@
+
+#ifndef SR_NAT_TABLE_H
+#define SR_NAT_TABLE_H
+
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_protocol.h"
+
+#define SR_NAT_EXT_IFACE     "eth2"   /* everything else is internal */
+
+#define SR_NAT_SHARD_BITS    3        /* 8 shards, each with its own lock */
+#define SR_NAT_SHARDS        (1 << SR_NAT_SHARD_BITS)
+#define SR_NAT_HASH_BITS     15       /* buckets per table over all shards;
+                                         tens of thousands of mappings keep
+                                         chains short */
+#define SR_NAT_SHARD_HASH_BITS (SR_NAT_HASH_BITS - SR_NAT_SHARD_BITS)
+#define SR_NAT_SHARD_HASH_SIZE (1 << SR_NAT_SHARD_HASH_BITS)
+
+/* External ports / icmp ids from SR_NAT_AUX_MIN up are split into one
+   contiguous range per shard, so an inbound port names its shard */
+#define SR_NAT_AUX_MIN       1024     /* lowest external port / icmp id */
+#define SR_NAT_SHARD_AUX     ((65536 - SR_NAT_AUX_MIN) / SR_NAT_SHARDS)
+#define SR_NAT_SHARD_WORDS   ((SR_NAT_SHARD_AUX + 63) / 64)
+
+#define SR_NAT_ICMP_TO       60       /* seconds, ICMP query mapping */
+#define SR_NAT_TCP_EST_TO    7440     /* seconds, established TCP */
+#define SR_NAT_TCP_TRANS_TO  300      /* seconds, transitory TCP */
+#define SR_NAT_UDP_TO        300      /* seconds, UDP */
+
+/* Short-lived UDP: a mapping opened towards a request/response service
+   (DNS, NTP) waits SR_NAT_UDP_QUERY_TO for its answer and is let go
+   SR_NAT_UDP_ANSWER_TO after the last answer, unless the inside keeps
+   asking. */
+#define SR_NAT_UDP_QUERY_TO  10
+#define SR_NAT_UDP_ANSWER_TO 2
+
+#define SR_NAT_WHEEL_SLOTS   8192     /* one second each; a power of two
+                                         longer than the longest timeout */
+
+typedef enum {
+  nat_mapping_icmp,
+  nat_mapping_tcp,
+  nat_mapping_udp,
+  nat_mapping_max
+} sr_nat_mapping_type;
+
+typedef enum {
+  nat_tcp_syn_sent,     /* outbound SYN seen, waiting for the other end */
+  nat_tcp_established,
+  nat_tcp_fin_wait,     /* one side has sent a FIN */
+  nat_tcp_time_wait     /* both FINs, or a RST */
+} sr_nat_tcp_state;
+
+struct sr_nat_connection {
+  uint32_t ip_peer;     /* remote end, network order */
+  uint16_t port_peer;
+  sr_nat_tcp_state state;
+  uint8_t fin_out;      /* which sides have sent a FIN */
+  uint8_t fin_in;
+  time_t expires;
+
+  struct sr_nat_connection *next;
+};
+
+struct sr_nat_mapping {
+  sr_nat_mapping_type type;
+  uint32_t ip_int; /* internal ip addr */
+  uint32_t ip_ext; /* external ip addr */
+  uint16_t aux_int; /* internal port or icmp id */
+  uint16_t aux_ext; /* external port or icmp id */
+  uint8_t short_lived; /* UDP request/response flow */
+  time_t last_updated; /* use to timeout mappings */
+  time_t expires;      /* latest expiry of the mapping or its connections */
+  struct sr_nat_connection *conns; /* list of connections. null for ICMP */
+  struct sr_nat_mapping *next;     /* chain in the timer wheel */
+  struct sr_nat_mapping **pprev;   /* whatever points at us there */
+  struct sr_nat_mapping *int_next; /* chain in by_int */
+  struct sr_nat_mapping *ext_next; /* chain in by_ext */
+};
+
+/* One slice of the NAT. Outbound packets pick a shard by hashing the
+   internal (ip, port/id); the mapping's external port comes from that
+   shard's range, so inbound packets find the same shard by port. */
+struct sr_nat_shard {
+  pthread_mutex_t lock;
+  unsigned int count;
+  unsigned int aux_base;  /* first external port / icmp id, host order */
+
+  /* (type, aux_ext) and (type, ip_int, aux_int) indexes */
+  struct sr_nat_mapping **by_ext;
+  struct sr_nat_mapping **by_int;
+
+  /* this shard's external ports / icmp ids in use, one bit each, and
+     where the next search starts */
+  uint64_t aux_used[nat_mapping_max][SR_NAT_SHARD_WORDS];
+  unsigned int aux_next[nat_mapping_max];
+
+  /* Timer wheel of mappings, slotted by expiry second. Traffic only
+     moves m->expires forward without touching the wheel; when the slot
+     comes round the mapping is either freed or put back in the slot of
+     its new expiry, so the sweep touches only mappings that are due.
+     A mapping is moved to an earlier slot when its last connection
+     starts closing. */
+  struct sr_nat_mapping *wheel[SR_NAT_WHEEL_SLOTS];
+  time_t wheel_now;     /* last second swept */
+  unsigned long expired;
+
+  char pad[64];         /* keeps the next shard's lock off our lines */
+};
+
+struct sr_nat {
+  struct sr_nat_shard shards[SR_NAT_SHARDS];
+
+  /* configuration; zero timeouts get the defaults in sr_nat_init */
+  uint32_t ip_ext;                  /* network order */
+  char ext_iface[sr_IFACE_NAMELEN];
+  unsigned int icmp_timeout;
+  unsigned int tcp_est_timeout;
+  unsigned int tcp_trans_timeout;
+  unsigned int udp_timeout;
+
+  /* threading */
+  pthread_attr_t thread_attr;
+  pthread_t thread;
+  int stop;
+};
+
+
+int   sr_nat_init(struct sr_nat *nat);     /* Initializes the nat */
+int   sr_nat_destroy(struct sr_nat *nat);  /* Destroys the nat (free memory) */
+void *sr_nat_timeout(void *nat_ptr);  /* Periodic Timout */
+
+/* The lookups below copy the mapping into *out, minus its links and
+   connections, and return 0; -1 if there is no such mapping. */
+
+/* Get the mapping associated with given external port. */
+int sr_nat_lookup_external(struct sr_nat *nat,
+    uint16_t aux_ext, sr_nat_mapping_type type, struct sr_nat_mapping *out);
+
+/* Get the mapping associated with given internal (ip, port) pair. */
+int sr_nat_lookup_internal(struct sr_nat *nat,
+  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type,
+  struct sr_nat_mapping *out);
+
+/* Insert a new mapping into the nat's mapping table, or find the one
+   the internal pair already has. -1 if the shard is out of ports. */
+int sr_nat_insert_mapping(struct sr_nat *nat,
+  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type,
+  struct sr_nat_mapping *out);
+
+/* Mappings in use and mappings expired so far, over all shards. */
+void sr_nat_stats(struct sr_nat *nat, unsigned int *count,
+    unsigned long *expired);
+
+/* Packet translation. ip points at the IP header of a len byte packet.
+   Outbound packets (internal host -> external interface) get their
+   source rewritten, creating a mapping if needed; inbound packets
+   addressed to ip_ext get their destination rewritten back. Checksums
+   are patched incrementally; a UDP checksum of zero (none) is left
+   alone. TCP is tracked per connection: outbound
+   connections must start with a SYN, and inbound segments only pass
+   for a connection the inside opened. Returns 1 if the packet was
+   translated, 0 if it isn't NAT traffic (inbound only: e.g. a ping to
+   the router itself) and -1 if it must be dropped. */
+int sr_nat_outbound(struct sr_nat *nat, uint8_t *ip, unsigned int len);
+int sr_nat_inbound(struct sr_nat *nat, uint8_t *ip, unsigned int len);
+
+#endif
@@ -0,0 +1,341 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_nat_verify.c
+ *
+ * Description:
+ *
+ * Offline check of the ICMP errors the router sends about packets that
+ * cross the NAT. Sets up a NAT between an inside host on eth1 and the
+ * outside on SR_NAT_EXT_IFACE and sends echoes and echo replies that
+ * find no route, or wait on an ARP request that times out. The error
+ * must go back out the interface the packet came in on, to the sender
+ * of the packet. Its quote must be the header and ICMP id as the sender
+ * sent them: not the NAT's external address and id for an outbound
+ * packet, and not the inside host's for an inbound one.
+ *
+ * Each case is run through sr_handlepacket() and sr_handlepacket_burst().
+ * ARP requests are timed out by hand rather than waited for.
+ *
+ * Exits 1 if any error is missing or wrong.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_nat.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_bench_util.h"
+
+#define INSIDE_IF     "eth1"
+#define INSIDE_IP     "192.168.1.1"
+#define INSIDE_HOST   "192.168.1.10"
+#define OUTSIDE_IP    "10.0.2.1"
+#define OUTSIDE_GW    "10.0.2.2"
+#define OUTSIDE_HOST  "8.8.8.8"         /* routed, via OUTSIDE_GW */
+#define NOWHERE       "9.9.9.9"         /* not routed */
+#define UNROUTED_HOST "172.31.0.5"      /* inside, but not routed */
+#define ECHO_ID       77
+#define FRAME_LEN     (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 64)
+
+/* the last destination or host unreachable the router sent */
+struct nat_error
+{
+    int seen;
+    char iface[sr_IFACE_NAMELEN];
+    uint8_t code;
+    uint32_t dst;           /* network order, as are the quoted fields */
+    uint32_t quote_src;
+    uint32_t quote_dst;
+    uint16_t quote_id;
+};
+
+static struct nat_error last;
+static pthread_mutex_t last_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* report;
+static int failed = 0;
+
+static void usage(char* );
+static void tap(const uint8_t* , unsigned int , const char* );
+static void echo(struct sr_instance* , int , const char* , uint8_t ,
+                 const char* , const char* , uint16_t );
+static void expire_arp(struct sr_instance* );
+static void expect(const char* , const char* , uint8_t , const char* ,
+                   const char* , const char* , uint16_t );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    struct sr_instance sr;
+    struct sr_nat_mapping m;
+    struct in_addr dest, gw, mask;
+    unsigned char mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 1 };
+    uint16_t ext_id, unrouted_id;
+    int c, burst, verbose = 0;
+
+    while ((c = getopt(argc, argv, "hv")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    sr_bench_init_instance(&sr);
+    sr_add_interface(&sr, INSIDE_IF);
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, inet_addr(INSIDE_IP));
+    mac[5] = 2;
+    sr_add_interface(&sr, SR_NAT_EXT_IFACE);
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, inet_addr(OUTSIDE_IP));
+
+    dest.s_addr = inet_addr("8.0.0.0");
+    gw.s_addr = inet_addr(OUTSIDE_GW);
+    mask.s_addr = inet_addr("255.0.0.0");
+    sr_add_rt_entry(&sr, dest, gw, mask, SR_NAT_EXT_IFACE);
+    dest.s_addr = inet_addr("192.168.1.0");
+    gw.s_addr = inet_addr(INSIDE_HOST);
+    mask.s_addr = inet_addr("255.255.255.0");
+    sr_add_rt_entry(&sr, dest, gw, mask, INSIDE_IF);
+
+    sr.nat = (struct sr_nat*)calloc(1, sizeof(struct sr_nat));
+    assert(sr.nat);
+    report = sr_bench_report_stream(verbose);
+    sr_init(&sr);
+    /* every case draws the same errors to the same two hosts */
+    sr.icmp_limit.global_rate = 0;
+    sr.icmp_limit.peer_rate = 0;
+    sr_bench_set_tap(tap);
+
+    /* an inside host the NAT has a mapping for but the rtable can't reach */
+    if (sr_nat_insert_mapping(sr.nat, inet_addr(UNROUTED_HOST), htons(ECHO_ID),
+                              nat_mapping_icmp, &m) != 0)
+    {
+        fprintf(report, "no NAT mapping for %s\n", UNROUTED_HOST);
+        exit(1);
+    }
+    unrouted_id = m.aux_ext;
+
+    for (burst = 0; burst < 2; burst++)
+    {
+        fprintf(report, "%s:\n", burst ? "sr_handlepacket_burst" : "sr_handlepacket");
+
+        echo(&sr, burst, INSIDE_IF, 8, INSIDE_HOST, NOWHERE, htons(ECHO_ID));
+        expect("out, no route", INSIDE_IF, 0, INSIDE_HOST,
+               INSIDE_HOST, NOWHERE, htons(ECHO_ID));
+
+        echo(&sr, burst, INSIDE_IF, 8, INSIDE_HOST, OUTSIDE_HOST, htons(ECHO_ID));
+        expire_arp(&sr);
+        expect("out, ARP timeout", INSIDE_IF, 1, INSIDE_HOST,
+               INSIDE_HOST, OUTSIDE_HOST, htons(ECHO_ID));
+
+        if (sr_nat_lookup_internal(sr.nat, inet_addr(INSIDE_HOST), htons(ECHO_ID),
+                                   nat_mapping_icmp, &m) != 0)
+        {
+            fprintf(report, "  no NAT mapping for %s\n", INSIDE_HOST);
+            exit(1);
+        }
+        ext_id = m.aux_ext;
+
+        echo(&sr, burst, SR_NAT_EXT_IFACE, 0, OUTSIDE_HOST, OUTSIDE_IP, unrouted_id);
+        expect("in, no route", SR_NAT_EXT_IFACE, 0, OUTSIDE_HOST,
+               OUTSIDE_HOST, OUTSIDE_IP, unrouted_id);
+
+        echo(&sr, burst, SR_NAT_EXT_IFACE, 0, OUTSIDE_HOST, OUTSIDE_IP, ext_id);
+        expire_arp(&sr);
+        expect("in, ARP timeout", SR_NAT_EXT_IFACE, 1, OUTSIDE_HOST,
+               OUTSIDE_HOST, OUTSIDE_IP, ext_id);
+    }
+
+    sr_bench_set_tap(0);
+    fprintf(report, failed ? "FAILED\n" : "ok\n");
+    return failed;
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router NAT ICMP error check\n");
+    printf("Format: %s [-v]\n", argv0);
+    printf("   -v  keep the router's own output\n");
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: tap(..)
+ * Scope: local
+ *
+ * Keep the destination and host unreachable messages the router sends.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void tap(const uint8_t* buf, unsigned int len, const char* iface)
+{
+    const sr_ip_hdr_t* ip = (const sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    const sr_icmp_t3_hdr_t* icmp = (const sr_icmp_t3_hdr_t*)(ip + 1);
+    const sr_ip_hdr_t* quote = (const sr_ip_hdr_t*)icmp->data;
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t) ||
+        ethertype((uint8_t*)buf) != ethertype_ip || ip->ip_p != ip_protocol_icmp ||
+        icmp->icmp_type != 3)
+    { return; }
+
+    pthread_mutex_lock(&last_lock);
+    last.seen = 1;
+    snprintf(last.iface, sizeof(last.iface), "%s", iface);
+    last.code = icmp->icmp_code;
+    last.dst = ip->ip_dst;
+    last.quote_src = quote->ip_src;
+    last.quote_dst = quote->ip_dst;
+    last.quote_id = ((const sr_icmp_echo_hdr_t*)(quote + 1))->icmp_id;
+    pthread_mutex_unlock(&last_lock);
+} /* -- tap -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: echo(..)
+ * Scope: local
+ *
+ * Hand the router an echo request (type 8) or reply (type 0) arriving on
+ * iface, one frame at a time or as a burst of one.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void echo(struct sr_instance* sr, int burst, const char* iface, uint8_t type,
+                 const char* src, const char* dst, uint16_t id)
+{
+    uint8_t frame[FRAME_LEN];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    sr_icmp_echo_hdr_t* icmp = (sr_icmp_echo_hdr_t*)(ip + 1);
+    struct sr_if* ifp = sr_get_interface(sr, iface);
+    uint8_t* packets[1];
+    unsigned int lens[1];
+    char* ifaces[1];
+
+    assert(ifp);
+    memset(frame, 0, sizeof(frame));
+    memcpy(eth->ether_dhost, ifp->addr, ETHER_ADDR_LEN);
+    eth->ether_shost[0] = 0x02;
+    eth->ether_shost[5] = 0xaa;
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(sizeof(frame) - sizeof(*eth));
+    ip->ip_ttl = 64;
+    ip->ip_p = ip_protocol_icmp;
+    ip->ip_src = inet_addr(src);
+    ip->ip_dst = inet_addr(dst);
+    ip->ip_sum = cksum(ip, sizeof(*ip));
+
+    icmp->icmp_type = type;
+    icmp->icmp_id = id;
+    icmp->icmp_sum = cksum(icmp, sizeof(frame) - sizeof(*eth) - sizeof(*ip));
+
+    pthread_mutex_lock(&last_lock);
+    memset(&last, 0, sizeof(last));
+    pthread_mutex_unlock(&last_lock);
+
+    if (burst)
+    {
+        packets[0] = frame;
+        lens[0] = sizeof(frame);
+        ifaces[0] = (char*)iface;
+        sr_handlepacket_burst(sr, packets, lens, ifaces, 1);
+    }
+    else
+    { sr_handlepacket(sr, frame, sizeof(frame), (char*)iface); }
+} /* -- echo -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: expire_arp(..)
+ * Scope: local
+ *
+ * Make every pending ARP request look as if it has been sent five times,
+ * and sweep.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void expire_arp(struct sr_instance* sr)
+{
+    struct sr_arpreq* req;
+
+    pthread_mutex_lock(&sr->cache.lock);
+    for (req = sr->cache.requests; req; req = req->next)
+    {
+        req->times_sent = 5;
+        req->sent = 0;
+    }
+    pthread_mutex_unlock(&sr->cache.lock);
+    sr_arpcache_sweepreqs(sr);
+} /* -- expire_arp -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: expect(..)
+ * Scope: local
+ *
+ * Check the last unreachable sent. An id of 0 means any.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void expect(const char* what, const char* iface, uint8_t code, const char* dst,
+                   const char* quote_src, const char* quote_dst, uint16_t quote_id)
+{
+    struct nat_error e;
+    struct in_addr a;
+
+    pthread_mutex_lock(&last_lock);
+    e = last;
+    pthread_mutex_unlock(&last_lock);
+
+    if (e.seen && strcmp(e.iface, iface) == 0 && e.code == code &&
+        e.dst == inet_addr(dst) && e.quote_src == inet_addr(quote_src) &&
+        e.quote_dst == inet_addr(quote_dst) && (quote_id == 0 || e.quote_id == quote_id))
+    {
+        fprintf(report, "  %-18s ok\n", what);
+        return;
+    }
+
+    failed = 1;
+    if (!e.seen)
+    {
+        fprintf(report, "  %-18s FAILED: no unreachable sent\n", what);
+        return;
+    }
+    a.s_addr = e.dst;
+    fprintf(report, "  %-18s FAILED: code %u on %s to %s", what, e.code, e.iface,
+            inet_ntoa(a));
+    a.s_addr = e.quote_src;
+    fprintf(report, " quoting %s", inet_ntoa(a));
+    a.s_addr = e.quote_dst;
+    fprintf(report, " -> %s id %u\n", inet_ntoa(a), ntohs(e.quote_id));
+} /* -- expect -- */
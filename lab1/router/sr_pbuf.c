@@ -0,0 +1,156 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pbuf.c
+ *
+ * Description:
+ *
+ * Packet buffer pool with per-thread caches. See sr_pbuf.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "sr_pbuf.h"
+
+/* free buffers cached by one thread */
+struct sr_pbuf_cache
+{
+    struct sr_pbuf* head;
+    unsigned int count;
+};
+
+static struct sr_pbuf* sr_pbuf_mem;       /* the whole pool */
+static struct sr_pbuf* sr_pbuf_free_list; /* buffers not in any cache */
+static pthread_mutex_t sr_pbuf_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long sr_pbuf_allocated;
+static unsigned long sr_pbuf_failed;
+
+static __thread struct sr_pbuf_cache sr_pbuf_cache;
+
+/*---------------------------------------------------------------------
+ * Method: sr_pbuf_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_pbuf_init(void)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&sr_pbuf_lock);
+    if (sr_pbuf_mem == 0)
+    {
+        sr_pbuf_mem = (struct sr_pbuf*)malloc(SR_PBUF_COUNT * sizeof(struct sr_pbuf));
+        if (sr_pbuf_mem == 0)
+        {
+            pthread_mutex_unlock(&sr_pbuf_lock);
+            fprintf(stderr, "sr_pbuf_init: out of memory\n");
+            return -1;
+        }
+        for (i = 0; i < SR_PBUF_COUNT; i++)
+        {
+            sr_pbuf_mem[i].next = sr_pbuf_free_list;
+            sr_pbuf_free_list = &sr_pbuf_mem[i];
+        }
+    }
+    pthread_mutex_unlock(&sr_pbuf_lock);
+
+    return 0;
+} /* -- sr_pbuf_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pbuf_alloc(..)
+ * Scope: Global
+ *
+ * Take a buffer from this thread's cache, refilling half the cache from
+ * the pool when it runs dry.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_pbuf* sr_pbuf_alloc(unsigned int len)
+{
+    struct sr_pbuf_cache* cache = &sr_pbuf_cache;
+    struct sr_pbuf* p;
+
+    if (len > SR_PBUF_DATA)
+    { return 0; }
+
+    if (cache->head == 0)
+    {
+        pthread_mutex_lock(&sr_pbuf_lock);
+        while (sr_pbuf_free_list && cache->count < SR_PBUF_CACHE / 2)
+        {
+            p = sr_pbuf_free_list;
+            sr_pbuf_free_list = p->next;
+            p->next = cache->head;
+            cache->head = p;
+            cache->count++;
+        }
+        pthread_mutex_unlock(&sr_pbuf_lock);
+
+        if (cache->head == 0)
+        {
+            __atomic_fetch_add(&sr_pbuf_failed, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    p = cache->head;
+    cache->head = p->next;
+    cache->count--;
+    __atomic_fetch_add(&sr_pbuf_allocated, 1, __ATOMIC_RELAXED);
+
+    p->next = 0;
+    p->data = p->mem + SR_PBUF_HEADROOM;
+    p->len = len;
+    return p;
+} /* -- sr_pbuf_alloc -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pbuf_free(..)
+ * Scope: Global
+ *
+ * Put a buffer in this thread's cache, which need not be the cache it
+ * came from. A full cache gives half its buffers back to the pool.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pbuf_free(struct sr_pbuf* p)
+{
+    struct sr_pbuf_cache* cache = &sr_pbuf_cache;
+    struct sr_pbuf* q;
+
+    if (p == 0)
+    { return; }
+
+    __atomic_fetch_sub(&sr_pbuf_allocated, 1, __ATOMIC_RELAXED);
+
+    p->next = cache->head;
+    cache->head = p;
+    cache->count++;
+
+    if (cache->count >= SR_PBUF_CACHE)
+    {
+        pthread_mutex_lock(&sr_pbuf_lock);
+        while (cache->count > SR_PBUF_CACHE / 2)
+        {
+            q = cache->head;
+            cache->head = q->next;
+            q->next = sr_pbuf_free_list;
+            sr_pbuf_free_list = q;
+            cache->count--;
+        }
+        pthread_mutex_unlock(&sr_pbuf_lock);
+    }
+} /* -- sr_pbuf_free -- */
+
+unsigned long sr_pbuf_in_use(void)
+{
+    return __atomic_load_n(&sr_pbuf_allocated, __ATOMIC_RELAXED);
+}
+
+unsigned long sr_pbuf_exhausted(void)
+{
+    return __atomic_load_n(&sr_pbuf_failed, __ATOMIC_RELAXED);
+}
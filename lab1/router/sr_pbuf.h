@@ -0,0 +1,63 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pbuf.h
+ *
+ * Description:
+ *
+ * Fixed-size packet buffers for the frames the router generates itself
+ * (ICMP errors, ARP requests and replies). Buffers come from one pool
+ * allocated up front; each thread keeps a small cache of free buffers
+ * so the common alloc/free pair touches no lock and no malloc.
+ *
+ * Every buffer leaves SR_PBUF_HEADROOM bytes in front of the frame so the
+ * transport can prepend its own header without copying the frame.
+ *
+ * Ownership is explicit: whoever allocates a buffer either frees it or
+ * hands it to sr_send_pbuf(), which always gives it back to the pool,
+ * whether or not the send succeeded.
+ *
+ *   struct sr_pbuf* p = sr_pbuf_alloc(len);
+ *   if (p) { ...fill p->data...; sr_send_pbuf(sr, p, iface); }
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PBUF_H
+#define SR_PBUF_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_PBUF_HEADROOM 64     /* room for the VNS packet header */
+#define SR_PBUF_DATA     2048   /* largest frame a buffer holds */
+#define SR_PBUF_COUNT    4096   /* buffers in the pool, most of them for
+                                   the egress queues (sr_qos.h) */
+#define SR_PBUF_CACHE    64     /* most free buffers a thread keeps */
+
+struct sr_pbuf
+{
+    struct sr_pbuf* next;       /* free list link */
+    uint8_t* data;              /* start of the frame */
+    unsigned int len;           /* frame length */
+    uint64_t queued_ns;         /* when sr_qos queued it */
+    uint8_t mem[SR_PBUF_HEADROOM + SR_PBUF_DATA];
+};
+
+/* Allocate the pool. Safe to call more than once. Returns 0 on
+   success. */
+int sr_pbuf_init(void);
+
+/* A buffer for a len byte frame, or NULL if len is too big or the pool
+   is exhausted. */
+struct sr_pbuf* sr_pbuf_alloc(unsigned int len);
+void sr_pbuf_free(struct sr_pbuf* p);
+
+/* Buffers currently handed out, and allocations refused because the
+   pool was empty. */
+unsigned long sr_pbuf_in_use(void);
+unsigned long sr_pbuf_exhausted(void);
+
+#endif /* -- SR_PBUF_H -- */
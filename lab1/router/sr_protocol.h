@@ -102,6 +102,54 @@ struct sr_icmp_t3_hdr {
 typedef struct sr_icmp_t3_hdr sr_icmp_t3_hdr_t;
 
 
+/* Structure of an ICMP echo request/reply header
+ */
+struct sr_icmp_echo_hdr {
+  uint8_t icmp_type;
+  uint8_t icmp_code;
+  uint16_t icmp_sum;
+  uint16_t icmp_id;
+  uint16_t icmp_seq;
+
+} __attribute__ ((packed)) ;
+typedef struct sr_icmp_echo_hdr sr_icmp_echo_hdr_t;
+
+
+/* Structure of a TCP header, naked of options.
+ */
+struct sr_tcp_hdr {
+  uint16_t tcp_sport;           /* source port */
+  uint16_t tcp_dport;           /* destination port */
+  uint32_t tcp_seq;             /* sequence number */
+  uint32_t tcp_ack;             /* acknowledgement number */
+  uint8_t tcp_off;              /* data offset in the high 4 bits */
+  uint8_t tcp_flags;
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+#define TCP_URG 0x20
+  uint16_t tcp_win;             /* window */
+  uint16_t tcp_sum;             /* checksum, includes the pseudo header */
+  uint16_t tcp_urp;             /* urgent pointer */
+
+} __attribute__ ((packed)) ;
+typedef struct sr_tcp_hdr sr_tcp_hdr_t;
+
+
+/* Structure of a UDP header
+ */
+struct sr_udp_hdr {
+  uint16_t udp_sport;           /* source port */
+  uint16_t udp_dport;           /* destination port */
+  uint16_t udp_len;             /* header and data */
+  uint16_t udp_sum;             /* checksum, 0 if not computed */
+
+} __attribute__ ((packed)) ;
+typedef struct sr_udp_hdr sr_udp_hdr_t;
+
+
 
 
 /*
@@ -152,6 +200,9 @@ typedef struct sr_ethernet_hdr sr_ethernet_hdr_t;
 
 enum sr_ip_protocol {
   ip_protocol_icmp = 0x0001,
+  ip_protocol_tcp = 0x0006,
+  ip_protocol_udp = 0x0011,
+  ip_protocol_ls = 0x00fd,    /* sr_ls.h; RFC 3692 experimental */
 };
 
 enum sr_ethertype {
@@ -0,0 +1,616 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_qos.c
+ *
+ * Description:
+ *
+ * Egress queueing and shaping. See sr_qos.h.
+ *
+ * The queues are guarded by qos->lock. Senders queue on whatever thread
+ * they run on; one scheduler thread takes frames off and writes them to
+ * VNS, outside the lock. CoDel runs as DRR takes a frame off, so its
+ * drops never use up the bucket.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_qos.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_pbuf.h"
+#include "sr_log.h"
+#include "sr_utils.h"
+
+#define SR_QOS_BATCH 32     /* frames sent per trip out of the lock */
+#define SR_QOS_HELD_MAX (SR_PBUF_COUNT - SR_QOS_PBUF_RESERVE)
+
+struct sr_qos_queue
+{
+    struct sr_pbuf* head;
+    struct sr_pbuf* tail;
+    unsigned int n;
+    unsigned int qbytes;
+    unsigned int quantum;
+    unsigned int deficit;
+    unsigned long sent;
+    unsigned long bytes;
+    unsigned long drops;
+    uint64_t delay_ns;      /* summed over the frames sent */
+    uint64_t delay_max_ns;
+
+    /* CoDel, as named in RFC 8289 */
+    uint64_t first_above_ns;
+    uint64_t drop_next_ns;
+    unsigned int count;
+    unsigned int lastcount;
+    int dropping;
+    unsigned long marks;
+    unsigned long codel_drops;
+};
+
+struct sr_qos_if
+{
+    char name[sr_IFACE_NAMELEN];
+    double rate;            /* bytes a second */
+    double depth;
+    double tokens;
+    uint64_t last_ns;
+    struct sr_qos_queue q[sr_qos_classes];
+    unsigned int backlog;
+    int cur;                /* class DRR is serving */
+    int fresh;              /* and it has yet to get its quantum */
+};
+
+struct sr_qos
+{
+    struct sr_instance* sr;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int stop;
+    unsigned int held;      /* frames queued, over all interfaces */
+    int n_ifs;
+    struct sr_qos_if ifs[SR_QOS_MAX_IFACES];
+};
+
+static const char* sr_qos_class_name[sr_qos_classes] =
+    { "control", "interactive", "default", "bulk" };
+static const unsigned int sr_qos_quantum[sr_qos_classes] = { 2, 4, 2, 1 };
+
+static uint64_t sr_qos_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct sr_qos_if* sr_qos_if_find(struct sr_qos* qos, const char* iface)
+{
+    int i;
+
+    for (i = 0; i < qos->n_ifs; i++)
+    {
+        if (strncmp(qos->ifs[i].name, iface, sr_IFACE_NAMELEN) == 0)
+        { return &qos->ifs[i]; }
+    }
+    return 0;
+}
+
+/* the class of a frame, by its DSCP */
+static int sr_qos_classify(const uint8_t* frame, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)frame;
+    unsigned int dscp;
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+        ntohs(eth->ether_type) != ethertype_ip)
+    { return sr_qos_control; }
+
+    dscp = ((const sr_ip_hdr_t*)(eth + 1))->ip_tos >> 2;
+    if (dscp >= 48)
+    { return sr_qos_control; }
+    if (dscp == 46 || dscp == 40 || (dscp >= 24 && dscp <= 38 && !(dscp & 1)))
+    { return sr_qos_interactive; }
+    if (dscp == 8 || dscp == 10 || dscp == 12 || dscp == 14)
+    { return sr_qos_bulk; }
+    return sr_qos_default;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_enqueue(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_qos_enqueue(struct sr_qos* qos, struct sr_pbuf* pbuf, const char* iface)
+{
+    struct sr_qos_if* qi = sr_qos_if_find(qos, iface);
+    struct sr_qos_queue* q;
+
+    if (!qi)
+    {
+        sr_pbuf_free(pbuf);
+        return -1;
+    }
+    pbuf->next = 0;
+    pbuf->queued_ns = sr_qos_now();
+
+    pthread_mutex_lock(&qos->lock);
+    q = &qi->q[sr_qos_classify(pbuf->data, pbuf->len)];
+    if (q->n >= SR_QOS_QLEN || qos->held >= SR_QOS_HELD_MAX)
+    {
+        q->drops++;
+        pthread_mutex_unlock(&qos->lock);
+        SR_DROP(qos->sr, sr_drop_queue);
+        sr_pbuf_free(pbuf);
+        return -1;
+    }
+    if (q->tail)
+    { q->tail->next = pbuf; }
+    else
+    { q->head = pbuf; }
+    q->tail = pbuf;
+    q->n++;
+    q->qbytes += pbuf->len;
+    qos->held++;
+    if (qi->backlog++ == 0)
+    { pthread_cond_signal(&qos->wake); }
+    pthread_mutex_unlock(&qos->lock);
+
+    return 0;
+} /* -- sr_qos_enqueue -- */
+
+/* mark a frame CE if its transport is ECN capable; 0 if it isn't */
+static int sr_qos_ecn_mark(struct sr_pbuf* p)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)p->data;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(p->data + sizeof(sr_ethernet_hdr_t));
+    uint16_t from, to;
+
+    if (p->len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+        ntohs(eth->ether_type) != ethertype_ip || (ip->ip_tos & 3) == 0)
+    { return 0; }
+
+    /* tos shares its checksum word with version and header length */
+    memcpy(&from, ip, 2);
+    ip->ip_tos |= 3;
+    memcpy(&to, ip, 2);
+    ip->ip_sum = cksum_update16(ip->ip_sum, from, to);
+    return 1;
+}
+
+static uint64_t sr_qos_control_law(uint64_t t, unsigned int count)
+{
+    return t + (uint64_t)(SR_QOS_INTERVAL_US * 1000.0 / sqrt(count));
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_codel(..)
+ * Scope: Local
+ *
+ * RFC 8289's dequeue for p, just taken off q at now: whether to drop
+ * it. When CoDel would drop an ECN capable frame it is marked instead,
+ * and sent.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_qos_codel(struct sr_qos_queue* q, struct sr_pbuf* p, uint64_t now)
+{
+    uint64_t sojourn = now - p->queued_ns;
+    unsigned int delta;
+    int ok_to_drop = 0;
+
+    if (sojourn < SR_QOS_TARGET_US * 1000ULL || q->qbytes <= SR_QOS_FRAME)
+    { q->first_above_ns = 0; }
+    else if (q->first_above_ns == 0)
+    { q->first_above_ns = now + SR_QOS_INTERVAL_US * 1000ULL; }
+    else if (now >= q->first_above_ns)
+    { ok_to_drop = 1; }
+
+    if (q->dropping)
+    {
+        if (!ok_to_drop)
+        {
+            q->dropping = 0;
+            return 0;
+        }
+        if (now < q->drop_next_ns)
+        { return 0; }
+        q->count++;
+        q->drop_next_ns = sr_qos_control_law(q->drop_next_ns, q->count);
+    }
+    else if (ok_to_drop)
+    {
+        /* a state entered again soon after leaving it picks up the
+           rate it had reached */
+        q->dropping = 1;
+        delta = q->count - q->lastcount;
+        q->count = (delta > 1 &&
+                    now - q->drop_next_ns < 16 * SR_QOS_INTERVAL_US * 1000ULL) ?
+                   delta : 1;
+        q->drop_next_ns = sr_qos_control_law(now, q->count);
+        q->lastcount = q->count;
+    }
+    else
+    { return 0; }
+
+    if (sr_qos_ecn_mark(p))
+    {
+        q->marks++;
+        return 0;
+    }
+    q->codel_drops++;
+    return 1;
+} /* -- sr_qos_codel -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_dequeue(..)
+ * Scope: Local
+ *
+ * The next frame deficit round robin picks for qi, if the bucket has
+ * the bytes for it; 0 otherwise, with *need set to the bytes it lacks.
+ * Frames CoDel drops on the way go on *dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_pbuf* sr_qos_dequeue(struct sr_qos_if* qi, uint64_t now,
+                                      double* need, struct sr_pbuf** dropped)
+{
+    struct sr_qos_queue* q;
+    struct sr_pbuf* p;
+
+    *need = 0;
+    while (qi->backlog > 0)
+    {
+        q = &qi->q[qi->cur];
+        if (q->n == 0)
+        {
+            q->deficit = 0;
+            qi->cur = (qi->cur + 1) % sr_qos_classes;
+            qi->fresh = 1;
+            continue;
+        }
+        if (qi->fresh)
+        {
+            q->deficit += q->quantum;
+            qi->fresh = 0;
+        }
+        p = q->head;
+        if (p->len > q->deficit)
+        {
+            qi->cur = (qi->cur + 1) % sr_qos_classes;
+            qi->fresh = 1;
+            continue;
+        }
+        if (qi->tokens < p->len)
+        {
+            *need = p->len - qi->tokens;
+            return 0;
+        }
+
+        if (!(q->head = p->next))
+        { q->tail = 0; }
+        q->n--;
+        q->qbytes -= p->len;
+        qi->backlog--;
+        if (sr_qos_codel(q, p, now))
+        {
+            p->next = *dropped;
+            *dropped = p;
+            continue;
+        }
+        q->deficit -= p->len;
+        qi->tokens -= p->len;
+        q->sent++;
+        q->bytes += p->len;
+        q->delay_ns += now - p->queued_ns;
+        if (now - p->queued_ns > q->delay_max_ns)
+        { q->delay_max_ns = now - p->queued_ns; }
+        return p;
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_run(..)
+ * Scope: Local
+ *
+ * The scheduler: refill each backlogged interface's bucket, send what
+ * it allows, and sleep until the first interface can send again or a
+ * frame arrives at an idle one.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_qos_run(void* arg)
+{
+    struct sr_qos* qos = (struct sr_qos*)arg;
+    struct sr_qos_if* qi;
+    struct sr_pbuf* batch[SR_QOS_BATCH];
+    struct sr_pbuf* dropped;
+    struct timespec ts;
+    uint64_t now, wait_ns;
+    double need;
+    unsigned int backlog;
+    int i, k, n, busy;
+
+    pthread_mutex_lock(&qos->lock);
+    for (;;)
+    {
+        now = sr_qos_now();
+        wait_ns = 0;
+        busy = 0;
+
+        for (i = 0; i < qos->n_ifs; i++)
+        {
+            qi = &qos->ifs[i];
+            qi->tokens += (now - qi->last_ns) * qi->rate / 1e9;
+            if (qi->tokens > qi->depth)
+            { qi->tokens = qi->depth; }
+            qi->last_ns = now;
+            if (qi->backlog == 0)
+            { continue; }
+
+            dropped = 0;
+            backlog = qi->backlog;
+            for (n = 0; n < SR_QOS_BATCH &&
+                        (batch[n] = sr_qos_dequeue(qi, now, &need, &dropped)); n++);
+            qos->held -= backlog - qi->backlog;
+            if (n > 0 || dropped)
+            {
+                pthread_mutex_unlock(&qos->lock);
+                for (k = 0; k < n; k++)
+                { sr_send_pbuf_now(qos->sr, batch[k], qi->name); }
+                while (dropped)
+                {
+                    batch[0] = dropped;
+                    dropped = dropped->next;
+                    SR_DROP(qos->sr, sr_drop_codel);
+                    sr_pbuf_free(batch[0]);
+                }
+                pthread_mutex_lock(&qos->lock);
+                busy = 1;
+            }
+            else if (need > 0 && (wait_ns == 0 || need * 1e9 / qi->rate < wait_ns))
+            { wait_ns = need * 1e9 / qi->rate + 1; }
+        }
+
+        if (busy)
+        { continue; }
+        if (qos->stop)
+        { break; }
+        if (wait_ns == 0)
+        { pthread_cond_wait(&qos->wake, &qos->lock); }
+        else
+        {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += wait_ns / 1000000000;
+            ts.tv_nsec += wait_ns % 1000000000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&qos->wake, &qos->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&qos->lock);
+    return 0;
+} /* -- sr_qos_run -- */
+
+static int sr_qos_add_if(struct sr_qos* qos, struct sr_if* ifp, double mbps)
+{
+    struct sr_qos_if* qi;
+    int c;
+
+    if (sr_qos_if_find(qos, ifp->name))
+    { return 0; }
+    if (qos->n_ifs == SR_QOS_MAX_IFACES)
+    {
+        fprintf(stderr, "qos: more than %d interfaces\n", SR_QOS_MAX_IFACES);
+        return -1;
+    }
+    if (mbps <= 0)
+    {
+        fprintf(stderr, "qos: no speed for %s, give one as %s=Mbit/s\n",
+                ifp->name, ifp->name);
+        return -1;
+    }
+
+    qi = &qos->ifs[qos->n_ifs++];
+    memset(qi, 0, sizeof(*qi));
+    snprintf(qi->name, sizeof(qi->name), "%s", ifp->name);
+    qi->rate = mbps * 1e6 / 8;
+    qi->depth = qi->rate * SR_QOS_BURST_US / 1e6;
+    if (qi->depth < 2 * SR_QOS_FRAME)
+    { qi->depth = 2 * SR_QOS_FRAME; }
+    qi->tokens = qi->depth;
+    qi->last_ns = sr_qos_now();
+    qi->fresh = 1;
+    for (c = 0; c < sr_qos_classes; c++)
+    { qi->q[c].quantum = sr_qos_quantum[c] * SR_QOS_FRAME; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_qos_open(struct sr_instance* sr, char** specs, int n)
+{
+    struct sr_qos* qos;
+    struct sr_if* ifp;
+    pthread_condattr_t attr;
+    char name[sr_IFACE_NAMELEN];
+    const char* eq;
+    double mbps;
+    int i, ret = 0;
+
+    if (!(qos = (struct sr_qos*)calloc(1, sizeof(struct sr_qos))))
+    {
+        fprintf(stderr, "qos: out of memory\n");
+        return -1;
+    }
+    qos->sr = sr;
+
+    for (i = 0; i < n && ret == 0; i++)
+    {
+        if (strcmp(specs[i], "all") == 0)
+        {
+            for (ifp = sr->if_list; ifp && ret == 0; ifp = ifp->next)
+            {
+                if (ifp->speed)
+                { ret = sr_qos_add_if(qos, ifp, ifp->speed); }
+            }
+            continue;
+        }
+        eq = strchr(specs[i], '=');
+        if ((eq ? eq - specs[i] : (long)strlen(specs[i])) >= sr_IFACE_NAMELEN)
+        {
+            fprintf(stderr, "qos: bad interface in %s\n", specs[i]);
+            ret = -1;
+            break;
+        }
+        memset(name, 0, sizeof(name));
+        memcpy(name, specs[i], eq ? eq - specs[i] : (long)strlen(specs[i]));
+        if (!(ifp = sr_get_interface(sr, name)))
+        {
+            fprintf(stderr, "qos: no interface %s\n", name);
+            ret = -1;
+            break;
+        }
+        mbps = eq ? atof(eq + 1) : ifp->speed;
+        ret = sr_qos_add_if(qos, ifp, mbps);
+    }
+    if (ret != 0)
+    {
+        free(qos);
+        return -1;
+    }
+
+    pthread_mutex_init(&qos->lock, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&qos->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&qos->thread, 0, sr_qos_run, qos) != 0)
+    {
+        perror("pthread_create");
+        free(qos);
+        return -1;
+    }
+    sr->qos = qos;
+
+    for (i = 0; i < qos->n_ifs; i++)
+    {
+        SR_LOG_S(SR_LOG_INFO, qos->ifs[i].name, "%s: shaped to %u kbit/s",
+                 (uint32_t)(qos->ifs[i].rate * 8 / 1000));
+    }
+    return 0;
+} /* -- sr_qos_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_qos_close(struct sr_instance* sr)
+{
+    struct sr_qos* qos = sr->qos;
+    struct sr_pbuf* p;
+    int i, c;
+
+    if (!qos)
+    { return; }
+
+    pthread_mutex_lock(&qos->lock);
+    qos->stop = 1;
+    pthread_cond_signal(&qos->wake);
+    pthread_mutex_unlock(&qos->lock);
+    pthread_join(qos->thread, 0);
+    sr->qos = 0;
+
+    for (i = 0; i < qos->n_ifs; i++)
+    {
+        for (c = 0; c < sr_qos_classes; c++)
+        {
+            while ((p = qos->ifs[i].q[c].head))
+            {
+                qos->ifs[i].q[c].head = p->next;
+                sr_pbuf_free(p);
+            }
+        }
+    }
+    pthread_mutex_destroy(&qos->lock);
+    pthread_cond_destroy(&qos->wake);
+    free(qos);
+} /* -- sr_qos_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_shaped(..)
+ * Scope: Global
+ *
+ * The interfaces don't change once open, so no lock is needed.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_qos_shaped(struct sr_qos* qos, const char* iface)
+{
+    return sr_qos_if_find(qos, iface) != 0;
+} /* -- sr_qos_shaped -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_qos_ctl(..)
+ * Scope: Global
+ *
+ * "qos" shows each shaped interface and its classes.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_qos_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_qos* qos = sr->qos;
+    const struct sr_qos_if* qi;
+    const struct sr_qos_queue* q;
+    int i, c;
+
+    if (argc != 1)
+    { return -1; }
+    if (!qos)
+    {
+        fprintf(out, "no interface is shaped\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&qos->lock);
+    fprintf(out, "buffers held %u of %u\n", qos->held, SR_QOS_HELD_MAX);
+    for (i = 0; i < qos->n_ifs; i++)
+    {
+        qi = &qos->ifs[i];
+        fprintf(out, "%s rate %.0f kbit/s bucket %.0f/%.0f bytes queued %u\n",
+                qi->name, qi->rate * 8 / 1000, qi->tokens, qi->depth, qi->backlog);
+        for (c = 0; c < sr_qos_classes; c++)
+        {
+            q = &qi->q[c];
+            fprintf(out, "  %-11s queued %u sent %lu bytes %lu drops %lu delay avg %.3f max %.3f ms\n",
+                    sr_qos_class_name[c], q->n, q->sent, q->bytes, q->drops,
+                    q->sent ? q->delay_ns / 1e6 / q->sent : 0.0, q->delay_max_ns / 1e6);
+            fprintf(out, "  %-11s codel marks %lu drops %lu%s\n", "",
+                    q->marks, q->codel_drops, q->dropping ? " (dropping)" : "");
+        }
+    }
+    pthread_mutex_unlock(&qos->lock);
+
+    return 0;
+} /* -- sr_qos_ctl -- */
@@ -0,0 +1,110 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_qos.h
+ *
+ * Description:
+ *
+ * Egress queueing: per-interface priority classes served by deficit
+ * round robin, shaped by a token bucket to the speed of the link, so
+ * that a short interactive packet does not wait behind a queue of bulk
+ * transfer at a bottleneck.
+ *
+ * Without it every frame is written to VNS the moment it is sent, and
+ * a link slower than the router can only queue (and drop) out of sight,
+ * in arrival order. With it, a frame leaving a shaped interface is put
+ * in one of the classes below by its DSCP (non-IP frames, ARP, count as
+ * control) and goes to VNS when the scheduler thread picks it and the
+ * bucket has the bytes for it. Interfaces that are not shaped send
+ * straight away as before.
+ *
+ *   class        DSCP                          quantum
+ *   control      CS6, CS7                      2 frames
+ *   interactive  EF, CS5, CS4, AF4x, CS3, AF3x  4 frames
+ *   default      everything else               2 frames
+ *   bulk         CS1, AF1x                     1 frame
+ *
+ * DRR gives each class with something queued its quantum of bytes per
+ * round, so a class gets at least its share of the link whatever the
+ * others send, and a packet waits behind at most one round of the
+ * others rather than everything queued ahead of it. Each class holds at
+ * most SR_QOS_QLEN frames; beyond that frames are dropped at the tail.
+ * Queued frames live in packet buffers (sr_pbuf.h), and all the queues
+ * together hold at most SR_PBUF_COUNT less SR_QOS_PBUF_RESERVE of them,
+ * so the ICMP, ARP, link-state and BFD frames the router makes itself
+ * always find a buffer.
+ *
+ * The rate is what -Q gives for the interface, or else the speed VNS
+ * reported for it; the bucket holds SR_QOS_BURST_US of it, and at least
+ * two full frames.
+ *
+ * A queue that stays full is kept short by CoDel (RFC 8289), run on each
+ * class as frames leave it. Once every frame has waited longer than
+ * SR_QOS_TARGET_US for SR_QOS_INTERVAL_US, CoDel signals congestion on
+ * one frame, then again at intervals shrinking as 1/sqrt(signals) until
+ * the wait is back under target. A frame from an ECN capable transport
+ * (ECT in the IP header) is marked CE, the checksum patched to match,
+ * and still sent; anything else is dropped. The tail drop above is then
+ * only for bursts.
+ *
+ * CoDel can only act on a queue that can hold more than SR_QOS_TARGET_US
+ * of its share of the link, so SR_QOS_QLEN is a backstop well above what
+ * CoDel lets stand: 1000 full frames are 12 Mbit, more than the target's
+ * worth of a class up to about 2.4 Gbit/s. A shaped rate above that, or
+ * many busy classes on fast links sharing the buffer budget, leaves the
+ * queues too short for CoDel and back to tail drop.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_QOS_H
+#define SR_QOS_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_pbuf;
+struct sr_qos;
+
+#define SR_QOS_MAX_IFACES 16
+#define SR_QOS_QLEN       1000    /* frames a class holds, a backstop */
+#define SR_QOS_PBUF_RESERVE 512   /* packet buffers the queues leave alone */
+#define SR_QOS_FRAME      1514    /* quantum unit, largest ethernet frame */
+#define SR_QOS_BURST_US   2000    /* bucket depth, in time at the rate */
+#define SR_QOS_TARGET_US  5000    /* CoDel: acceptable standing delay */
+#define SR_QOS_INTERVAL_US 100000 /* CoDel: how long it may last, ~ an RTT */
+
+enum sr_qos_class
+{
+    sr_qos_control = 0,
+    sr_qos_interactive,
+    sr_qos_default,
+    sr_qos_bulk,
+    sr_qos_classes
+};
+
+/* Shape the interfaces named in specs, each "iface=Mbit/s", "iface" for
+   the speed VNS reported, or "all" for every interface with a reported
+   speed. Call once the interfaces are known. Returns 0 on success and
+   sets sr->qos. */
+int  sr_qos_open(struct sr_instance* sr, char** specs, int n);
+
+/* Stop, dropping whatever is still queued. */
+void sr_qos_close(struct sr_instance* sr);
+
+/* Whether frames for iface are queued; no locking. */
+int  sr_qos_shaped(struct sr_qos* qos, const char* iface);
+
+/* Queue a frame for a shaped interface, taking the buffer. Returns 0, or
+   -1 if the frame was dropped. */
+int  sr_qos_enqueue(struct sr_qos* qos, struct sr_pbuf* pbuf, const char* iface);
+
+/* control socket "qos" command */
+int  sr_qos_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_QOS_H -- */
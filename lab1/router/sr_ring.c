@@ -0,0 +1,164 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * Bounded multi-producer, single-consumer lock-free ring. See sr_ring.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_ring.h"
+
+/* Every slot starts with this header; the caller's data follows it. */
+struct sr_ring_hdr
+{
+    unsigned long seq;  /* == pos: free, == pos+1: published */
+    unsigned long pos;  /* position the slot was claimed at */
+};
+
+#define SR_RING_HDR_SIZE \
+    ((sizeof(struct sr_ring_hdr) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+
+static struct sr_ring_hdr* slot_at(struct sr_ring* ring, unsigned long pos)
+{
+    return (struct sr_ring_hdr*)(ring->slots + (pos & ring->mask) * ring->slot_size);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ring_init(struct sr_ring* ring, unsigned long nslots, size_t size)
+{
+    unsigned long n = 1, i;
+
+    /* -- REQUIRES -- */
+    assert(ring);
+
+    while (n < nslots)
+    { n <<= 1; }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->mask = n - 1;
+    /* keep slots on their own cache lines so producers filling neighbouring
+       slots don't bounce lines between cores */
+    ring->slot_size = (SR_RING_HDR_SIZE + size + SR_CACHE_LINE - 1) &
+                      ~(size_t)(SR_CACHE_LINE - 1);
+
+    ring->slots = (unsigned char*)malloc(n * ring->slot_size);
+    if (ring->slots == 0)
+    { return -1; }
+
+    for (i = 0; i < n; i++)
+    { slot_at(ring, i)->seq = i; }
+
+    return 0;
+} /* -- sr_ring_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_destroy(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ring_destroy(struct sr_ring* ring)
+{
+    if (ring && ring->slots)
+    {
+        free(ring->slots);
+        ring->slots = 0;
+    }
+} /* -- sr_ring_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_claim(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_ring_claim(struct sr_ring* ring)
+{
+    struct sr_ring_hdr* hdr;
+    unsigned long pos, seq;
+    long dif;
+
+    pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        hdr = slot_at(ring, pos);
+        seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        dif = (long)seq - (long)pos;
+
+        if (dif == 0)
+        {
+            /* our turn if nobody else takes it first */
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if (dif < 0)
+        {
+            /* the consumer hasn't released this slot yet: full */
+            return 0;
+        }
+        else
+        {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    hdr->pos = pos;
+    return (unsigned char*)hdr + SR_RING_HDR_SIZE;
+} /* -- sr_ring_claim -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_publish(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ring_publish(struct sr_ring* ring, void* slot)
+{
+    struct sr_ring_hdr* hdr =
+        (struct sr_ring_hdr*)((unsigned char*)slot - SR_RING_HDR_SIZE);
+
+    (void)ring;
+    __atomic_store_n(&hdr->seq, hdr->pos + 1, __ATOMIC_RELEASE);
+} /* -- sr_ring_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_peek(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_ring_peek(struct sr_ring* ring)
+{
+    struct sr_ring_hdr* hdr = slot_at(ring, ring->tail);
+
+    if (__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE) != ring->tail + 1)
+    { return 0; }
+
+    return (unsigned char*)hdr + SR_RING_HDR_SIZE;
+} /* -- sr_ring_peek -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_release(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ring_release(struct sr_ring* ring)
+{
+    struct sr_ring_hdr* hdr = slot_at(ring, ring->tail);
+
+    /* hand the slot back to producers one lap from now */
+    __atomic_store_n(&hdr->seq, ring->tail + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->tail++;
+} /* -- sr_ring_release -- */
@@ -0,0 +1,57 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ *
+ * Description:
+ *
+ * Bounded lock-free ring of fixed-size slots with any number of producers
+ * and a single consumer. Producers claim a slot, fill it in place and
+ * publish it; the consumer peeks at the oldest published slot and
+ * releases it when done. Neither side ever blocks: a producer that finds
+ * the ring full gets NULL back and decides what to do (usually count a
+ * drop).
+ *
+ * Each slot carries a sequence number that says whose turn it is, so
+ * producers only contend on the claim counter and never on each other's
+ * data (see Vyukov's bounded MPMC queue).
+ *
+ *   void* p = sr_ring_claim(ring);          producer
+ *   if (p) { ...fill p...; sr_ring_publish(ring, p); }
+ *
+ *   while ((p = sr_ring_peek(ring)) != 0)    consumer
+ *   { ...use p...; sr_ring_release(ring); }
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#include <stddef.h>
+
+#define SR_CACHE_LINE 64
+
+struct sr_ring
+{
+    unsigned long mask;       /* slots - 1; slots is a power of two */
+    size_t slot_size;         /* bytes per slot, header included */
+    unsigned char* slots;
+    char pad0[SR_CACHE_LINE];
+    unsigned long head;       /* next slot to claim, shared by producers */
+    char pad1[SR_CACHE_LINE];
+    unsigned long tail;       /* next slot to consume, consumer only */
+    char pad2[SR_CACHE_LINE];
+};
+
+/* Set up a ring of at least nslots slots of size bytes each. Returns 0 on
+   success. */
+int   sr_ring_init(struct sr_ring* ring, unsigned long nslots, size_t size);
+void  sr_ring_destroy(struct sr_ring* ring);
+
+/* Producer side. Returns a slot to fill or NULL if the ring is full. */
+void* sr_ring_claim(struct sr_ring* ring);
+void  sr_ring_publish(struct sr_ring* ring, void* slot);
+
+/* Consumer side. Returns the oldest published slot or NULL. */
+void* sr_ring_peek(struct sr_ring* ring);
+void  sr_ring_release(struct sr_ring* ring);
+
+#endif /* -- SR_RING_H -- */
@@ -12,6 +12,8 @@
  **********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "sr_if.h"
@@ -20,6 +22,31 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_log.h"
+#include "sr_pbuf.h"
+#include "sr_nat.h"
+#include "sr_trace.h"
+#include "sr_ls.h"
+#include "sr_bfd.h"
+#include "sr_acl.h"
+#include "sr_flow.h"
+#include "sr_flood.h"
+
+/* the longest IP header and the 8 bytes of data an ICMP error quotes */
+#define SR_IP_QUOTE_MAX (60 + 8)
+
+static int  sr_ip_hdr_ok(struct sr_instance *, uint8_t *, unsigned int);
+static int  sr_ip_ingress_ok(struct sr_instance *, uint8_t *, unsigned int, char *, int);
+static int  sr_ip_for_me(struct sr_instance *, uint32_t);
+static void sr_ip_deliver_local(struct sr_instance *, uint8_t *, unsigned int, char *);
+static int  sr_ip_dec_ttl(struct sr_instance *, uint8_t *, char *);
+static int  sr_ip_rewrite(struct sr_instance *, uint8_t *, unsigned int, struct sr_rt *,
+						  const uint8_t *, unsigned int);
+static unsigned int sr_ip_quote(uint8_t *, unsigned int, uint8_t *);
+static int  sr_ip_nat_inbound(struct sr_instance *, uint8_t *, unsigned int, char *,
+							  uint8_t *, unsigned int *);
+static int  sr_ip_nat_forward(struct sr_instance *, uint8_t *, unsigned int, char *,
+							  struct sr_rt *, int, uint8_t *, unsigned int *);
 
 /*---------------------------------------------------------------------
 	* Method: sr_init(void)
@@ -37,6 +64,27 @@ void sr_init(struct sr_instance *sr)
 	/* Initialize cache and cache cleanup thread */
 	sr_arpcache_init(&(sr->cache));
 
+	/* buffers for the frames we generate ourselves */
+	sr_pbuf_init();
+
+	/* ICMP error rate limiting */
+	sr_icmp_limit_init(&(sr->icmp_limit));
+
+	/* NAT translates to the address of its external interface */
+	if (sr->nat)
+	{
+		if (sr->nat->ext_iface[0] == 0)
+			strncpy(sr->nat->ext_iface, SR_NAT_EXT_IFACE, sr_IFACE_NAMELEN - 1);
+		struct sr_if *ext_if = sr_get_interface(sr, sr->nat->ext_iface);
+		if (ext_if == NULL)
+		{
+			fprintf(stderr, "NAT: no external interface %s\n", sr->nat->ext_iface);
+			exit(1);
+		}
+		sr->nat->ip_ext = ext_if->ip;
+		sr_nat_init(sr->nat);
+	}
+
 	pthread_attr_init(&(sr->attr));
 	pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
 	pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
@@ -75,43 +123,261 @@ void sr_handlepacket(struct sr_instance *sr,
 	assert(packet);
 	assert(interface);
 
-	printf("*** -> Received packet of length %d \n", len);
+	uint64_t start = sr_stats_now_ns();
+	struct sr_if *in_if = sr_get_interface(sr, interface);
+	int in_stats = in_if ? in_if->stats : -1;
 
-	/* fill in code here */
+	SR_TRACE_OPEN(len);
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: received %u bytes", len);
+	sr_stats_rx(in_stats, len);
 
 	if (len < sizeof(sr_ethernet_hdr_t))
 	{
-		fprintf(stderr, "** Error: packet is wayy to short for ethernet header \n");
-		return;
+		SR_LOG_S(SR_LOG_WARN, interface, "%s: frame too short for ethernet (%u bytes)", len);
+		SR_DROP(sr, sr_drop_short_eth);
 	}
-
 	/* it is an IP packet */
-	if (ethertype(packet) == ethertype_ip)
+	else if (ethertype(packet) == ethertype_ip)
 	{
-		sr_handle_ip(sr, packet, len, interface);
+		SR_TRACE_STAMP(sr_trace_parse);
+		sr_handle_ip(sr, packet, len, interface, in_stats);
 	}
 	/* it is a ARP packet */
 	else if (ethertype(packet) == ethertype_arp)
 	{
+		SR_TRACE_STAMP(sr_trace_parse);
 		sr_handle_arp(sr, packet, len, interface);
 	}
+	else
+	{
+		SR_DROP(sr, sr_drop_ethertype);
+	}
+
+	sr_stats_hist_add(sr_hist_service, sr_stats_now_ns() - start, 1);
+	SR_TRACE_CLOSE();
 
 } /* end sr_handlepacket*/
 
-void sr_handle_ip(struct sr_instance *sr,
-				  uint8_t *packet,
-				  unsigned int len,
-				  char *interface)
+/* Prefetch the headers of the frame we will look at next so that its cache
+   line is on its way in while we work on the current one. */
+#ifdef __GNUC__
+#define SR_PREFETCH(p) __builtin_prefetch((p), 1, 3)
+#else
+#define SR_PREFETCH(p) do{}while(0)
+#endif
+
+/* where a frame goes after the stage that just looked at it */
+enum sr_burst_next
 {
-	/* check that the packet is large enough to hold an IP header */
-	if (len - sizeof(sr_ethernet_hdr_t) < sizeof(sr_ip_hdr_t))
+	sr_burst_done,		/* consumed or dropped */
+	sr_burst_ip,		/* needs checksum validation */
+	sr_burst_forward,	/* valid transit packet, needs a route */
+	sr_burst_rewrite,	/* routed, needs its next hop resolved */
+	sr_burst_tx			/* ready to go out on rts[i].interface */
+};
+
+/*---------------------------------------------------------------------
+	* Method: sr_handlepacket_burst(..)
+	* Scope:  Global
+	*
+	* Process a vector of received frames. Rather than pushing each frame
+	* through the whole stack before looking at the next one, every stage
+	* (classify, checksum, route lookup, next hop rewrite, transmit) is run
+	* over the whole vector before moving to the next stage. This keeps the
+	* code and tables of one stage hot in the cache while it runs, and lets
+	* us prefetch the next frame's headers as we go.
+	*
+	* The result is the same as calling sr_handlepacket() on each frame in
+	* order, except that locally delivered and error traffic may be emitted
+	* ahead of forwarded frames from earlier in the same burst. Bursts
+	* longer than SR_BURST_MAX are processed in chunks.
+	*
+	* Packets and interface names are lent, as with sr_handlepacket().
+	*
+	*---------------------------------------------------------------------*/
+
+void sr_handlepacket_burst(struct sr_instance *sr,
+						   uint8_t **packets /* lent */,
+						   unsigned int *lens,
+						   char **interfaces /* lent */,
+						   unsigned int n)
+{
+	unsigned char next[SR_BURST_MAX];
+	unsigned char nat_in[SR_BURST_MAX];
+	uint8_t quotes[SR_BURST_MAX][SR_IP_QUOTE_MAX];
+	unsigned int quote_lens[SR_BURST_MAX];
+	int in_stats[SR_BURST_MAX];
+	struct sr_rt rts[SR_BURST_MAX];
+	struct sr_if *in_if;
+	unsigned int i, cnt;
+	uint64_t start;
+
+	/* REQUIRES */
+	assert(sr);
+	assert(packets);
+	assert(lens);
+	assert(interfaces);
+
+	while (n > SR_BURST_MAX)
 	{
-		fprintf(stderr, "** Error: packet is wayy to short \n");
+		sr_handlepacket_burst(sr, packets, lens, interfaces, SR_BURST_MAX);
+		packets += SR_BURST_MAX;
+		lens += SR_BURST_MAX;
+		interfaces += SR_BURST_MAX;
+		n -= SR_BURST_MAX;
+	}
+	if (n == 0)
 		return;
+
+	start = sr_stats_now_ns();
+	SR_TRACE_OPEN_BURST(n);
+
+	/* stage 1: parse and classify on ethertype. ARP is rare and stays
+	   on the scalar path. */
+	for (i = 0; i < n; i++)
+	{
+		if (i + 1 < n)
+			SR_PREFETCH(packets[i + 1]);
+
+		in_if = sr_get_interface(sr, interfaces[i]);
+		in_stats[i] = in_if ? in_if->stats : -1;
+		sr_stats_rx(in_stats[i], lens[i]);
+		next[i] = sr_burst_done;
+		if (lens[i] < sizeof(sr_ethernet_hdr_t))
+		{
+			SR_LOG_S(SR_LOG_WARN, interfaces[i], "%s: frame too short for ethernet (%u bytes)", lens[i]);
+			SR_DROP(sr, sr_drop_short_eth);
+			continue;
+		}
+
+		if (ethertype(packets[i]) == ethertype_ip)
+			next[i] = sr_burst_ip;
+		else if (ethertype(packets[i]) == ethertype_arp)
+			sr_handle_arp(sr, packets[i], lens[i], interfaces[i]);
+		else
+			SR_DROP(sr, sr_drop_ethertype);
+	}
+	SR_TRACE_STAMP_BURST(sr_trace_parse);
+
+	/* stage 2: validate the IP header and split local from transit
+	   traffic. Transit packets get their TTL decremented here. */
+	for (i = 0; i < n; i++)
+	{
+		if (next[i] != sr_burst_ip)
+			continue;
+		if (i + 1 < n)
+			SR_PREFETCH(packets[i + 1] + sizeof(sr_ethernet_hdr_t));
+
+		next[i] = sr_burst_done;
+		quote_lens[i] = 0;
+		if (!sr_ip_hdr_ok(sr, packets[i], lens[i]) ||
+			!sr_ip_ingress_ok(sr, packets[i], lens[i], interfaces[i], in_stats[i]))
+			continue;
+
+		if (sr->nat)
+		{
+			int rc = sr_ip_nat_inbound(sr, packets[i], lens[i], interfaces[i],
+									   quotes[i], &quote_lens[i]);
+			if (rc < 0)
+				continue;
+			nat_in[i] = rc;
+		}
+		else
+			nat_in[i] = 0;
+
+		sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packets[i] + sizeof(sr_ethernet_hdr_t));
+		if (sr_ip_for_me(sr, ip_hdr->ip_dst))
+			sr_ip_deliver_local(sr, packets[i], lens[i], interfaces[i]);
+		else if (sr_ip_dec_ttl(sr, packets[i], interfaces[i]))
+			next[i] = sr_burst_forward;
+	}
+	SR_TRACE_STAMP_BURST(sr_trace_cksum);
+
+	/* stage 3: longest prefix match for every transit packet */
+	for (i = 0; i < n; i++)
+	{
+		if (next[i] != sr_burst_forward)
+			continue;
+
+		sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packets[i] + sizeof(sr_ethernet_hdr_t));
+		if (sr_rt_for_dst(sr, ip_hdr->ip_dst, &rts[i]) != 0)
+		{
+			SR_LOG(SR_LOG_DEBUG, "no route to %u.%u.%u.%u", SR_LOG_IP(ip_hdr->ip_dst));
+			/* send icmp destination net unreachable (type 3, code 0)
+			   about the packet as it arrived */
+			if (quote_lens[i])
+				memcpy(ip_hdr, quotes[i], quote_lens[i]);
+			sr_send_icmp_t3(sr, packets[i], 3, 0, interfaces[i]);
+			SR_DROP(sr, sr_drop_no_route);
+			next[i] = sr_burst_done;
+			continue;
+		}
+		if (sr->nat &&
+			sr_ip_nat_forward(sr, packets[i], lens[i], interfaces[i], &rts[i], nat_in[i],
+							  quotes[i], &quote_lens[i]) != 0)
+		{
+			next[i] = sr_burst_done;
+			continue;
+		}
+		next[i] = sr_burst_rewrite;
+	}
+	SR_TRACE_STAMP_BURST(sr_trace_fib);
+
+	/* stage 4: resolve next hops and rewrite the ethernet headers. The
+	   cache lock is recursive, so holding it across the stage turns the
+	   per-lookup locking into a cheap re-entry. */
+	pthread_mutex_lock(&(sr->cache.lock));
+	for (i = 0, cnt = 0; i < n; i++)
+	{
+		if (next[i] != sr_burst_rewrite)
+			continue;
+		if (i + 1 < n)
+			SR_PREFETCH(packets[i + 1]);
+
+		next[i] = sr_burst_done;
+		if (sr_ip_rewrite(sr, packets[i], lens[i], &rts[i], quotes[i], quote_lens[i]))
+		{
+			next[i] = sr_burst_tx;
+			cnt++;
+		}
 	}
+	pthread_mutex_unlock(&(sr->cache.lock));
+	SR_TRACE_STAMP_BURST(sr_trace_rewrite);
+
+	/* stage 5: transmit, in arrival order */
+	for (i = 0; cnt > 0 && i < n; i++)
+	{
+		if (next[i] != sr_burst_tx)
+			continue;
+		sr_send_packet(sr, packets[i], lens[i], rts[i].interface);
+		cnt--;
+	}
+	SR_TRACE_STAMP_BURST(sr_trace_send);
+	SR_TRACE_CLOSE();
+
+	/* one timing for the whole burst: each frame gets its share */
+	sr_stats_hist_add(sr_hist_service, (sr_stats_now_ns() - start) / n, n);
+
+} /* end sr_handlepacket_burst */
 
-	Debug("Sensed an ip frame, processing it\n");
-	print_hdrs(packet, len);
+/*---------------------------------------------------------------------
+	* Method: sr_ip_hdr_ok(..)
+	* Scope:  Local
+	*
+	* Check that the frame is long enough to hold an IP header and that the
+	* header checksum is correct. Returns 1 if the header can be trusted.
+	*
+	*---------------------------------------------------------------------*/
+
+static int sr_ip_hdr_ok(struct sr_instance *sr, uint8_t *packet, unsigned int len)
+{
+	/* check that the packet is large enough to hold an IP header */
+	if (len - sizeof(sr_ethernet_hdr_t) < sizeof(sr_ip_hdr_t))
+	{
+		SR_LOG(SR_LOG_WARN, "packet too short for IP header (%u bytes)", len);
+		SR_DROP(sr, sr_drop_short_ip);
+		return 0;
+	}
 
 	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
 
@@ -120,107 +386,414 @@ void sr_handle_ip(struct sr_instance *sr,
 	ip_hdr->ip_sum = 0;
 	if (ip_sum != cksum(ip_hdr, sizeof(sr_ip_hdr_t)))
 	{
-		fprintf(stderr, "** Error: packet has a wrong checksum \n");
-		print_hdrs(packet, len);
+		SR_LOG(SR_LOG_WARN, "bad IP header checksum from %u.%u.%u.%u", SR_LOG_IP(ip_hdr->ip_src));
 		ip_hdr->ip_sum = ip_sum;
-		return;
+		SR_DROP(sr, sr_drop_cksum);
+		return 0;
 	}
-	else
+	ip_hdr->ip_sum = ip_sum;
+
+	return 1;
+}
+
+/*---------------------------------------------------------------------
+	* Method: sr_ip_ingress_ok(..)
+	* Scope:  Local
+	*
+	* Checks on the packet as it arrived: drop it if it is part of a flood
+	* or the ACL denies it, and count what is let in to its flow; in_stats
+	* is the counter index of the interface it came in on. Returns 1 if it
+	* may pass.
+	*
+	*---------------------------------------------------------------------*/
+
+static int sr_ip_ingress_ok(struct sr_instance *sr, uint8_t *packet,
+						unsigned int len, char *interface, int in_stats)
+{
+	enum sr_acl_action action;
+
+	if (sr->flood && sr_flood_check(sr->flood, packet, len))
 	{
-		ip_hdr->ip_sum = ip_sum;
+		SR_DROP(sr, sr_drop_flood);
+		return 0;
 	}
 
-	/* check if it is for me */
-	uint32_t ip_dst = ip_hdr->ip_dst;
+	action = sr->acl ? sr_acl_check(sr->acl, packet, len, interface) : sr_acl_allow;
+	if (action == sr_acl_allow)
+	{
+		if (sr->flow)
+			sr_flow_account(sr->flow, packet, len, in_stats);
+		return 1;
+	}
+
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: ACL drops packet from %u.%u.%u.%u",
+			 SR_LOG_IP(((sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t)))->ip_src));
+	/* administratively prohibited (type 3, code 13) */
+	if (action == sr_acl_reject)
+		sr_send_icmp_t3(sr, packet, 3, 13, interface);
+	SR_DROP(sr, sr_drop_acl);
+	return 0;
+}
+
+/*---------------------------------------------------------------------
+	* Method: sr_ip_for_me(struct sr_instance* sr, uint32_t ip_dst)
+	* Scope:  Local
+	*
+	* Returns 1 if ip_dst (network byte order) is one of our interfaces,
+	* or the limited broadcast address.
+	*
+	*---------------------------------------------------------------------*/
+
+static int sr_ip_for_me(struct sr_instance *sr, uint32_t ip_dst)
+{
 	struct sr_if *if_list = sr->if_list;
-	int for_me = 0;
+	if (ip_dst == 0xffffffff)
+		return 1;
 	while (if_list != NULL)
 	{
 		if (if_list->ip == ip_dst)
-		{
-			for_me = 1;
-			break;
-		}
+			return 1;
 		if_list = if_list->next;
 	}
+	return 0;
+}
 
-	/* it is for me */
-	if (for_me)
+/*---------------------------------------------------------------------
+	* Method: sr_ip_deliver_local(..)
+	* Scope:  Local
+	*
+	* Handle an IP packet addressed to one of the router's interfaces.
+	*
+	*---------------------------------------------------------------------*/
+
+static void sr_ip_deliver_local(struct sr_instance *sr,
+								uint8_t *packet,
+								unsigned int len,
+								char *interface)
+{
+	uint8_t ip_p = ip_protocol(packet + sizeof(sr_ethernet_hdr_t));
+	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+	/* link-state routing */
+	if (ip_p == ip_protocol_ls && sr->ls)
 	{
-		uint8_t ip_p = ip_protocol(packet + sizeof(sr_ethernet_hdr_t));
-		/* if it is ICMP echo req */
-		if (ip_p == ip_protocol_icmp)
-		{
-			Debug("\tThe ip packet is for me, sending a icmp echo reply back.\n");
-			/* send icmp echo reply (type 0, code 0) */
-			sr_send_icmp(sr, packet, 0, 0, interface);
-			return;
-		}
-		/* if it is TCP/UDP */
-		else
-		{
-			Debug("\tTCP/UDP request received on iface %s, sending port unreachable\n", interface);
-			/* send icmp port unreachable (type 3, code 3) */
-			sr_send_icmp_t3(sr, packet, 3, 3, interface);
-			return;
-		}
+		sr_ls_input(sr->ls, packet, len, interface);
 	}
-	/* it is not for me */
+	/* next hop failure detection */
+	else if (ip_p == ip_protocol_udp && sr->bfd &&
+			 len >= sizeof(sr_ethernet_hdr_t) + ip_hdr->ip_hl * 4 + sizeof(sr_udp_hdr_t) &&
+			 ((sr_udp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr->ip_hl * 4))->udp_dport == htons(SR_BFD_PORT))
+	{
+		sr_bfd_input(sr->bfd, packet, len, interface);
+	}
+	/* nothing else sent to everyone is answered */
+	else if (ip_hdr->ip_dst == 0xffffffff)
+	{
+		SR_DROP(sr, sr_drop_broadcast);
+	}
+	/* if it is ICMP echo req */
+	else if (ip_p == ip_protocol_icmp)
+	{
+		/* reflect it as an echo reply; other ICMP to us needs no answer */
+		if (sr_send_icmp_echo_reply(sr, packet, len, interface) != 0)
+			SR_DROP(sr, sr_drop_icmp);
+	}
+	/* if it is TCP/UDP */
 	else
 	{
-		Debug("\tGot a packet not destined to the router, forwarding it\n");
+		SR_LOG_S(SR_LOG_DEBUG, interface, "%s: protocol %u for us, sending port unreachable", ip_p);
+		/* send icmp port unreachable (type 3, code 3) */
+		sr_send_icmp_t3(sr, packet, 3, 3, interface);
+		SR_DROP(sr, sr_drop_port_unreach);
+	}
+}
 
-		/* decrement the TTL by 1 */
-		ip_hdr->ip_ttl--;
+/*---------------------------------------------------------------------
+	* Method: sr_ip_dec_ttl(..)
+	* Scope:  Local
+	*
+	* Decrement the TTL of a packet we are about to forward and fix up the
+	* header checksum. If the TTL runs out a time exceeded message is sent
+	* back and 0 is returned.
+	*
+	*---------------------------------------------------------------------*/
 
-		if (ip_hdr->ip_ttl == 0)
-		{
-			/* send icmp time exceeded (type 11, code 0) */
-			sr_send_icmp_t3(sr, packet, 11, 0, interface);
-			return;
-		}
+static int sr_ip_dec_ttl(struct sr_instance *sr,
+						 uint8_t *packet,
+						 char *interface)
+{
+	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
 
-		/* recompute the packet checksum */
-		ip_hdr->ip_sum = 0;
-		ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+	/* decrement the TTL by 1 */
+	ip_hdr->ip_ttl--;
 
-		/* find out which entry in the routing table has the longest prefix match 
-			 with the destination IP address */
-		struct sr_rt *out_rt = sr_rt_for_dst(sr, ip_hdr->ip_dst);
+	if (ip_hdr->ip_ttl == 0)
+	{
+		/* send icmp time exceeded (type 11, code 0) */
+		sr_send_icmp_t3(sr, packet, 11, 0, interface);
+		SR_DROP(sr, sr_drop_ttl);
+		return 0;
+	}
 
-		/* if ip address is not match in routing table */
-		if (out_rt == NULL)
-		{
-			Debug("\tI don't have a routing table for that!\n");
-			/* send icmp destination net unreachable (type 3, code 0)*/
-			sr_send_icmp_t3(sr, packet, 3, 0, interface);
-			return;
-		}
+	/* recompute the packet checksum */
+	ip_hdr->ip_sum = 0;
+	ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
 
-		sr_print_routing_entry(out_rt);
+	return 1;
+}
 
-		/* get the interface to send the packet */
-		struct sr_if *if_entry = sr_get_interface(sr, out_rt->interface);
+/*---------------------------------------------------------------------
+	* Method: sr_ip_rewrite(..)
+	* Scope:  Local
+	*
+	* Resolve the next hop of out_rt and rewrite the ethernet header of the
+	* packet for it. Returns 1 if the packet is ready to be sent; otherwise
+	* the packet has been queued on an ARP request and 0 is returned. Either
+	* way it is counted against the outgoing interface.
+	*
+	* quote_len bytes of quote are the packet's header as it arrived, if
+	* NAT has rewritten it since; they go with it onto the ARP queue, so
+	* that host unreachable quotes what the sender sent.
+	*
+	*---------------------------------------------------------------------*/
 
-		/* check ARP cache for the next-hop MAC address*/
-		struct sr_arpentry *entry = sr_arpcache_lookup(&(sr->cache), out_rt->gw.s_addr);
+static int sr_ip_rewrite(struct sr_instance *sr,
+						 uint8_t *packet,
+						 unsigned int len,
+						 struct sr_rt *out_rt,
+						 const uint8_t *quote,
+						 unsigned int quote_len)
+{
+	/* get the interface to send the packet */
+	struct sr_if *if_entry = sr_get_interface(sr, out_rt->interface);
 
-		if (entry)
-		{
-			Debug("Using next_hop_ip->mac mapping in entry to send the packet\n");
-			sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)packet;
-			memcpy(ethernet_hdr->ether_shost, if_entry->addr, ETHER_ADDR_LEN);
-			memcpy(ethernet_hdr->ether_dhost, entry->mac, ETHER_ADDR_LEN);
-			sr_send_packet(sr, packet, len, out_rt->interface);
-		}
-		else
+	/* check ARP cache for the next-hop MAC address*/
+	struct sr_arpentry *entry = sr_arpcache_lookup(&(sr->cache), out_rt->gw.s_addr);
+	SR_TRACE_STAMP(sr_trace_arp);
+
+	if (entry)
+	{
+		SR_LOG(SR_LOG_DEBUG, "next hop %u.%u.%u.%u resolved", SR_LOG_IP(out_rt->gw.s_addr));
+		sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)packet;
+		memcpy(ethernet_hdr->ether_shost, if_entry->addr, ETHER_ADDR_LEN);
+		memcpy(ethernet_hdr->ether_dhost, entry->mac, ETHER_ADDR_LEN);
+		free(entry);
+		sr_stats_forwarded(if_entry->stats);
+		SR_TRACE_STAMP(sr_trace_rewrite);
+		return 1;
+	}
+
+	SR_LOG(SR_LOG_DEBUG, "next hop %u.%u.%u.%u unresolved, queueing on ARP", SR_LOG_IP(out_rt->gw.s_addr));
+	sr_arpcache_queuereq(&(sr->cache), out_rt->gw.s_addr, packet, len, out_rt->interface,
+						 quote, quote_len);
+	sr_stats_arp_queued(if_entry ? if_entry->stats : -1);
+	return 0;
+}
+
+/*---------------------------------------------------------------------
+	* Method: sr_ip_quote(..)
+	* Scope:  Local
+	*
+	* Save the IP header and 8 bytes of data, what an ICMP error quotes,
+	* before NAT rewrites them. quote has room for SR_IP_QUOTE_MAX bytes.
+	* Returns the number saved.
+	*
+	*---------------------------------------------------------------------*/
+
+static unsigned int sr_ip_quote(uint8_t *packet,
+								unsigned int len,
+								uint8_t *quote)
+{
+	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+	unsigned int quote_len = ip_hdr->ip_hl * 4 + 8;
+
+	if (quote_len > len - sizeof(sr_ethernet_hdr_t))
+		quote_len = len - sizeof(sr_ethernet_hdr_t);
+	memcpy(quote, ip_hdr, quote_len);
+	return quote_len;
+}
+
+/*---------------------------------------------------------------------
+	* Method: sr_ip_nat_inbound(..)
+	* Scope:  Local
+	*
+	* A packet that came in on the NAT's external interface addressed to
+	* its external address gets its internal destination back if it
+	* belongs to a mapping. Returns 1 if it was translated, 0 if it isn't
+	* NAT traffic and -1 if it was dropped (a TCP segment for a connection
+	* the inside never opened).
+	*
+	* An ICMP error about a translated packet has to quote the header the
+	* sender knows, not the one with the internal address and port, so
+	* that header is saved in quote (*quote_len is 0 if there was no
+	* translation). A translated packet is on its way in, so its TTL runs
+	* out here if it is going to.
+	*
+	*---------------------------------------------------------------------*/
+
+static int sr_ip_nat_inbound(struct sr_instance *sr,
+							 uint8_t *packet,
+							 unsigned int len,
+							 char *interface,
+							 uint8_t *quote,
+							 unsigned int *quote_len)
+{
+	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+
+	*quote_len = 0;
+	if (strncmp(interface, sr->nat->ext_iface, sr_IFACE_NAMELEN) != 0)
+		return 0;
+
+	*quote_len = sr_ip_quote(packet, len, quote);
+	int rc = sr_nat_inbound(sr->nat, packet + sizeof(sr_ethernet_hdr_t),
+							len - sizeof(sr_ethernet_hdr_t));
+	if (rc <= 0)
+		*quote_len = 0;
+	if (rc < 0)
+	{
+		SR_LOG_S(SR_LOG_DEBUG, interface, "%s: NAT refusing segment from %u.%u.%u.%u",
+				 SR_LOG_IP(ip_hdr->ip_src));
+		SR_DROP(sr, sr_drop_nat);
+	}
+	else if (rc > 0 && ip_hdr->ip_ttl <= 1)
+	{
+		/* send icmp time exceeded (type 11, code 0) about the packet as
+		   it arrived */
+		memcpy(ip_hdr, quote, *quote_len);
+		sr_send_icmp_t3(sr, packet, 11, 0, interface);
+		SR_DROP(sr, sr_drop_ttl);
+		return -1;
+	}
+	return rc;
+}
+
+/*---------------------------------------------------------------------
+	* Method: sr_ip_nat_forward(..)
+	* Scope:  Local
+	*
+	* Called once a transit packet has its route. Traffic leaving through
+	* the external interface from the inside is translated; traffic coming
+	* the other way is only let in if sr_ip_nat_inbound() translated it.
+	* Returns 0 to carry on forwarding, -1 if the packet was dropped. The
+	* header of a packet translated here is saved in quote first, as
+	* sr_ip_nat_inbound() does.
+	*
+	*---------------------------------------------------------------------*/
+
+static int sr_ip_nat_forward(struct sr_instance *sr,
+							 uint8_t *packet,
+							 unsigned int len,
+							 char *interface,
+							 struct sr_rt *out_rt,
+							 int nat_in,
+							 uint8_t *quote,
+							 unsigned int *quote_len)
+{
+	struct sr_nat *nat = sr->nat;
+	int from_ext = strncmp(interface, nat->ext_iface, sr_IFACE_NAMELEN) == 0;
+	int to_ext = strncmp(out_rt->interface, nat->ext_iface, sr_IFACE_NAMELEN) == 0;
+
+	/* not crossing the NAT */
+	if (from_ext == to_ext)
+		return 0;
+
+	if (to_ext)
+	{
+		*quote_len = sr_ip_quote(packet, len, quote);
+		if (sr_nat_outbound(nat, packet + sizeof(sr_ethernet_hdr_t),
+							len - sizeof(sr_ethernet_hdr_t)) > 0)
+			return 0;
+	}
+	else if (nat_in)
+		return 0;
+
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: NAT dropping packet for %u.%u.%u.%u",
+			 SR_LOG_IP(((sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t)))->ip_dst));
+	SR_DROP(sr, sr_drop_nat);
+	return -1;
+}
+
+void sr_handle_ip(struct sr_instance *sr,
+				  uint8_t *packet,
+				  unsigned int len,
+				  char *interface,
+				  int in_stats)
+{
+	if (!sr_ip_hdr_ok(sr, packet, len))
+	{
+		return;
+	}
+	SR_TRACE_STAMP(sr_trace_cksum);
+
+	/* filter on the addresses the packet came in with */
+	if (!sr_ip_ingress_ok(sr, packet, len, interface, in_stats))
+	{
+		return;
+	}
+
+	/* replies to translated traffic get their internal destination back */
+	uint8_t quote[SR_IP_QUOTE_MAX];
+	unsigned int quote_len = 0;
+	int nat_in = sr->nat ? sr_ip_nat_inbound(sr, packet, len, interface, quote, &quote_len) : 0;
+	if (nat_in < 0)
+	{
+		return;
+	}
+
+	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: IP proto %u to %u.%u.%u.%u",
+			 ip_hdr->ip_p, SR_LOG_IP(ip_hdr->ip_dst));
+
+	/* it is for me */
+	if (sr_ip_for_me(sr, ip_hdr->ip_dst))
+	{
+		sr_ip_deliver_local(sr, packet, len, interface);
+		return;
+	}
+
+	/* it is not for me */
+	if (!sr_ip_dec_ttl(sr, packet, interface))
+	{
+		return;
+	}
+
+	/* find out which entry in the routing table has the longest prefix match 
+		 with the destination IP address */
+	struct sr_rt rt;
+	struct sr_rt *out_rt = &rt;
+	int routed = sr_rt_for_dst(sr, ip_hdr->ip_dst, &rt) == 0;
+	SR_TRACE_STAMP(sr_trace_fib);
+
+	/* if ip address is not match in routing table */
+	if (!routed)
+	{
+		SR_LOG(SR_LOG_DEBUG, "no route to %u.%u.%u.%u", SR_LOG_IP(ip_hdr->ip_dst));
+		/* send icmp destination net unreachable (type 3, code 0)
+		   about the packet as it arrived */
+		if (quote_len)
+			memcpy(ip_hdr, quote, quote_len);
+		sr_send_icmp_t3(sr, packet, 3, 0, interface);
+		SR_DROP(sr, sr_drop_no_route);
+		return;
+	}
+
+	SR_LOG_S(SR_LOG_DEBUG, out_rt->interface, "%s: routed via %u.%u.%u.%u",
+			 SR_LOG_IP(out_rt->gw.s_addr));
+
+	if (sr->nat)
+	{
+		if (sr_ip_nat_forward(sr, packet, len, interface, out_rt, nat_in,
+							  quote, &quote_len) != 0)
 		{
-			Debug("\tNo entry found for receiver IP, queing packet and sending ARP req\n");
-			/* sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)packet; */
-			/* memcpy(ethernet_hdr->ether_shost, if_entry->addr, ETHER_ADDR_LEN); */
-			/* memset(ethernet_hdr->ether_dhost, 0x00, ETHER_ADDR_LEN); */
-			sr_arpcache_queuereq(&(sr->cache), out_rt->gw.s_addr, packet, len, out_rt->interface);
+			return;
 		}
+		SR_TRACE_STAMP(sr_trace_nat);
+	}
+
+	if (sr_ip_rewrite(sr, packet, len, out_rt, quote, quote_len))
+	{
+		sr_send_packet(sr, packet, len, out_rt->interface);
+		SR_TRACE_STAMP(sr_trace_send);
 	}
 }
 
@@ -232,16 +805,17 @@ void sr_handle_arp(struct sr_instance *sr,
 	/* check that the packet is large enough to hold an arp header */
 	if (len - sizeof(sr_ethernet_hdr_t) < sizeof(sr_arp_hdr_t))
 	{
-		fprintf(stderr, "** Error: packet is wayy to short for arp header\n");
-		return -1;
+		SR_LOG_S(SR_LOG_WARN, interface, "%s: frame too short for ARP (%u bytes)", len);
+		SR_DROP(sr, sr_drop_arp);
+		return;
 	}
 
-	Debug("Sensed an ARP frame, processing it\n");
-	print_hdrs(packet, len);
-
 	sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
 	unsigned short ar_op = ntohs(arp_hdr->ar_op);
 
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: ARP op %u from %u.%u.%u.%u",
+			 ar_op, SR_LOG_IP(arp_hdr->ar_sip));
+
 	/* reply to me */
 	if (ar_op == arp_op_reply)
 	{
@@ -254,7 +828,8 @@ void sr_handle_arp(struct sr_instance *sr,
 	}
 	else
 	{
-		Debug("Didn't get an ARP frame I understood, quitting!\n");
+		SR_LOG_S(SR_LOG_DEBUG, interface, "%s: unknown ARP op %u", ar_op);
+		SR_DROP(sr, sr_drop_arp);
 		return;
 	}
 }
@@ -267,24 +842,27 @@ void sr_handle_arp_reply(struct sr_instance *sr,
 	struct sr_if *iface = sr_get_interface(sr, interface);
 	if (iface->ip == arp_hdr->ar_tip)
 	{
-		Debug("\tGot ARP reply at interfce %s, caching it\n", iface->name);
+		SR_LOG_S(SR_LOG_DEBUG, iface->name, "%s: caching ARP reply for %u.%u.%u.%u",
+				 SR_LOG_IP(arp_hdr->ar_sip));
 		/* cache it */
 		struct sr_arpcache *cache = &(sr->cache);
 		pthread_mutex_lock(&(cache->lock));
 		unsigned char mac[ETHER_ADDR_LEN];
 		memcpy(mac, arp_hdr->ar_sha, ETHER_ADDR_LEN);
 		uint32_t ip = arp_hdr->ar_sip;
-		struct sr_arpreq *req = sr_arpcache_insert(cache, mac, ip);
+		struct sr_arpreq *req = sr_arpcache_insert(cache, mac, ip, interface);
 
-		sr_arpcache_dump(cache);
+		if (SR_LOG_ON(SR_LOG_DEBUG))
+			sr_arpcache_dump(cache);
 
 		/* go through my request queue and send outstanding packets */
 		if (req)
 		{
+			sr_stats_hist_add(sr_hist_arp, sr_stats_now_ns() - req->queued_ns, 1);
 			struct sr_packet *packet = req->packets;
 			while (packet)
 			{
-				Debug("Forwarding ia packet that has been waiting for ARP reply\n");
+				SR_LOG_S(SR_LOG_DEBUG, iface->name, "%s: sending %u bytes held for ARP", packet->len);
 				sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)packet->buf;
 				memcpy(ethernet_hdr->ether_dhost, mac, ETHER_ADDR_LEN);
 				memcpy(ethernet_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
@@ -297,80 +875,62 @@ void sr_handle_arp_reply(struct sr_instance *sr,
 	}
 }
 
-struct sr_rt *sr_rt_for_dst(struct sr_instance *sr, uint32_t dst)
-{
-	struct sr_rt *rt_walker = sr->routing_table;
-	struct sr_rt *best_rt = NULL;
-	uint32_t longest_mask = 0;
-
-	while (rt_walker)
-	{
-		uint32_t d1 = rt_walker->mask.s_addr & dst;
-
-		if (d1 == rt_walker->dest.s_addr)
-			if (longest_mask == 0 || rt_walker->mask.s_addr > longest_mask)
-			{
-				best_rt = rt_walker;
-				longest_mask = rt_walker->mask.s_addr;
-			}
-
-		rt_walker = rt_walker->next;
-	}
-	return best_rt;
-}
+/*---------------------------------------------------------------------
+	* Method: sr_send_icmp_echo_reply(..)
+	* Scope:  Global
+	*
+	* Answer an ICMP echo request addressed to us by turning the received
+	* frame around in place: swap the addresses, make it an echo reply and
+	* patch the checksums incrementally. The whole payload is echoed and
+	* nothing is allocated. Returns -1 without sending anything if the
+	* packet isn't a well formed echo request.
+	*
+	*---------------------------------------------------------------------*/
 
-int sr_send_icmp(struct sr_instance *sr,
-				 uint8_t *packet,
-				 uint8_t icmp_type,
-				 uint8_t icmp_code,
-				 char *interface)
+int sr_send_icmp_echo_reply(struct sr_instance *sr,
+							uint8_t *packet /* lent */,
+							unsigned int len,
+							char *interface)
 {
-	/* get the ethernet header and ip header of input packet */
 	sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)packet;
 	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-	sr_icmp_t3_hdr_t *icmp_t3_hdr = (sr_icmp_t3_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-
-	/* get interface we should be sending the packet out on*/
+	unsigned int ip_hl = ip_hdr->ip_hl * 4;
+	unsigned int ip_len = ntohs(ip_hdr->ip_len);
+	sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)((uint8_t *)ip_hdr + ip_hl);
 	struct sr_if *rec_iface = sr_get_interface(sr, interface);
+	uint16_t from, to;
+	uint32_t addr;
 
-	/* allocate space for icmp packet */
-	unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t);
-	uint8_t *icmp_packet = (uint8_t *)malloc(len);
-
-	/* construct icmp header */
-	sr_icmp_t3_hdr_t *icmp_hdr = (sr_icmp_t3_hdr_t *)(icmp_packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-	icmp_hdr->icmp_type = icmp_type;
-	icmp_hdr->icmp_code = icmp_code;
-	icmp_hdr->unused = icmp_t3_hdr->unused;
-	icmp_hdr->next_mtu = icmp_t3_hdr->next_mtu;
-	memcpy(icmp_hdr->data, ip_hdr, ICMP_DATA_SIZE);
-	icmp_hdr->icmp_sum = 0;
-	icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_t3_hdr_t));
-
-	/* construct ip header */
-	sr_ip_hdr_t *ip_icmp_hdr = (sr_ip_hdr_t *)(icmp_packet + sizeof(sr_ethernet_hdr_t));
-	ip_icmp_hdr->ip_hl = 5;
-	ip_icmp_hdr->ip_v = ip_hdr->ip_v;
-	ip_icmp_hdr->ip_tos = ip_hdr->ip_tos;
-	ip_icmp_hdr->ip_len = htons(sizeof(sr_icmp_t3_hdr_t) + sizeof(sr_ip_hdr_t));
-	ip_icmp_hdr->ip_id = ip_hdr->ip_id;
-	ip_icmp_hdr->ip_off = htons(IP_DF);
-	ip_icmp_hdr->ip_dst = ip_hdr->ip_src;
-	ip_icmp_hdr->ip_src = rec_iface->ip;
-	ip_icmp_hdr->ip_p = ip_protocol_icmp;
-	ip_icmp_hdr->ip_ttl = 60;
-	ip_icmp_hdr->ip_sum = 0;
-	ip_icmp_hdr->ip_sum = cksum(ip_icmp_hdr, sizeof(sr_ip_hdr_t));
-
-	/* construct ethernet header */
-	sr_ethernet_hdr_t *ethernet_icmp_hdr = (sr_ethernet_hdr_t *)icmp_packet;
-	ethernet_icmp_hdr->ether_type = htons(ethertype_ip);
-	memcpy(ethernet_icmp_hdr->ether_dhost, ethernet_hdr->ether_shost, ETHER_ADDR_LEN);
-	memcpy(ethernet_icmp_hdr->ether_shost, rec_iface->addr, ETHER_ADDR_LEN);
-
-	print_hdrs(icmp_packet, len);
+	if (ip_hl < sizeof(sr_ip_hdr_t) ||
+		ip_len < ip_hl + sizeof(sr_icmp_hdr_t) ||
+		ip_len > len - sizeof(sr_ethernet_hdr_t) ||
+		icmp_hdr->icmp_type != 8 || rec_iface == NULL)
+		return -1;
 
-	return sr_send_packet(sr, icmp_packet, len, interface);
+	/* echo request (8) -> echo reply (0); type and code share a word */
+	memcpy(&from, &icmp_hdr->icmp_type, sizeof(from));
+	icmp_hdr->icmp_type = 0;
+	memcpy(&to, &icmp_hdr->icmp_type, sizeof(to));
+	icmp_hdr->icmp_sum = cksum_update16(icmp_hdr->icmp_sum, from, to);
+
+	/* swapping the addresses leaves the header checksum alone; only the
+	   fresh TTL, which shares a word with the protocol, needs patching */
+	addr = ip_hdr->ip_src;
+	ip_hdr->ip_src = ip_hdr->ip_dst;
+	ip_hdr->ip_dst = addr;
+	memcpy(&from, &ip_hdr->ip_ttl, sizeof(from));
+	ip_hdr->ip_ttl = INIT_TTL;
+	memcpy(&to, &ip_hdr->ip_ttl, sizeof(to));
+	ip_hdr->ip_sum = cksum_update16(ip_hdr->ip_sum, from, to);
+
+	memcpy(ethernet_hdr->ether_dhost, ethernet_hdr->ether_shost, ETHER_ADDR_LEN);
+	memcpy(ethernet_hdr->ether_shost, rec_iface->addr, ETHER_ADDR_LEN);
+
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: echo reply to %u.%u.%u.%u, %u bytes",
+			 SR_LOG_IP(ip_hdr->ip_dst), ip_len);
+
+	/* drop any ethernet padding that came in with the request */
+	return sr_send_packet(sr, packet, sizeof(sr_ethernet_hdr_t) + ip_len, interface);
 }
 
 int sr_send_icmp_t3(struct sr_instance *sr,
@@ -384,9 +944,20 @@ int sr_send_icmp_t3(struct sr_instance *sr,
 	sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
 	sr_icmp_t3_hdr_t *rec_icmp_hdr = (sr_icmp_t3_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 
-	/* allocate space for icmp packet */
+	/* don't let a scan or a traceroute sweep turn into an ICMP flood */
+	if (!sr_icmp_allow(&(sr->icmp_limit), ip_hdr->ip_src, icmp_type, icmp_code))
+	{
+		SR_LOG(SR_LOG_DEBUG, "ICMP type %u code %u to %u.%u.%u.%u rate limited",
+			   icmp_type, icmp_code, SR_LOG_IP(ip_hdr->ip_src));
+		return 0;
+	}
+
+	/* get a buffer for the icmp packet */
 	unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t);
-	uint8_t *icmp_packet = (uint8_t *)malloc(len);
+	struct sr_pbuf *pbuf = sr_pbuf_alloc(len);
+	if (pbuf == NULL)
+		return -1;
+	uint8_t *icmp_packet = pbuf->data;
 
 	/* get the interface receive the packet */
 	struct sr_if *rec_if = sr_get_interface(sr, interface);
@@ -422,20 +993,37 @@ int sr_send_icmp_t3(struct sr_instance *sr,
 	memcpy(ethernet_icmp_hdr->ether_dhost, ethernet_hdr->ether_shost, ETHER_ADDR_LEN);
 	memcpy(ethernet_icmp_hdr->ether_shost, rec_if->addr, ETHER_ADDR_LEN);
 
-	print_hdrs(icmp_packet, len);
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: sending ICMP type %u code %u to %u.%u.%u.%u",
+			 icmp_type, icmp_code, SR_LOG_IP(ip_icmp_hdr->ip_dst));
 
-	return sr_send_packet(sr, icmp_packet, len, interface);
+	return sr_send_pbuf(sr, pbuf, interface);
 }
 
 int sr_send_arp_req(struct sr_instance *sr,
 					struct sr_arpreq *req)
 {
-	/* allocate space for arp packet */
+	return sr_send_arp_probe(sr, req->ip, req->packets->iface);
+}
+
+/* Ask for the MAC of ip out of the named interface. */
+int sr_send_arp_probe(struct sr_instance *sr,
+					  uint32_t ip,
+					  const char *if_name)
+{
+	/* get a buffer for the arp packet */
 	unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-	uint8_t *packet = (uint8_t *)malloc(len);
+	struct sr_pbuf *pbuf = sr_pbuf_alloc(len);
+	if (pbuf == NULL)
+		return -1;
+	uint8_t *packet = pbuf->data;
 
 	/* get the interface to send the arp packet */
-	struct sr_if *iface = sr_get_interface(sr, req->packets->iface);
+	struct sr_if *iface = sr_get_interface(sr, if_name);
+	if (iface == NULL)
+	{
+		sr_pbuf_free(pbuf);
+		return -1;
+	}
 
 	/* construct the arp header */
 	sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
@@ -447,7 +1035,7 @@ int sr_send_arp_req(struct sr_instance *sr,
 	memcpy(arp_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
 	arp_hdr->ar_sip = iface->ip;
 	memset(arp_hdr->ar_tha, 0x00, ETHER_ADDR_LEN);
-	arp_hdr->ar_tip = req->ip;
+	arp_hdr->ar_tip = ip;
 
 	/* construct the ethernet header */
 	sr_ethernet_hdr_t *ethernet_hdr = (sr_ethernet_hdr_t *)packet;
@@ -455,9 +1043,9 @@ int sr_send_arp_req(struct sr_instance *sr,
 	memset(ethernet_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
 	ethernet_hdr->ether_type = htons(ethertype_arp);
 
-	print_hdrs(packet, len);
+	SR_LOG_S(SR_LOG_DEBUG, iface->name, "%s: ARP request for %u.%u.%u.%u", SR_LOG_IP(ip));
 
-	return sr_send_packet(sr, packet, len, iface->name);
+	return sr_send_pbuf(sr, pbuf, iface->name);
 }
 
 int sr_send_arp_reply(struct sr_instance *sr,
@@ -465,7 +1053,7 @@ int sr_send_arp_reply(struct sr_instance *sr,
 					  unsigned int rec_len,
 					  char *interface)
 {
-	Debug("\tGot ARP request at interfce %s, repling it\n", interface);
+	SR_LOG_S(SR_LOG_DEBUG, interface, "%s: answering ARP request");
 	/* get the ip and mac of own interface */
 	struct sr_if *iface = sr_get_interface(sr, interface);
 	uint32_t ip = iface->ip;
@@ -479,9 +1067,12 @@ int sr_send_arp_reply(struct sr_instance *sr,
 	sr_ethernet_hdr_t *rec_ethernet_hdr = (sr_ethernet_hdr_t *)rec_packet;
 	sr_arp_hdr_t *rec_arp_hdr = (sr_arp_hdr_t *)(rec_packet + sizeof(sr_ethernet_hdr_t));
 
-	/* allocate space for reply arp packet */
+	/* get a buffer for the reply arp packet */
 	unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-	uint8_t *packet = (uint8_t *)malloc(len);
+	struct sr_pbuf *pbuf = sr_pbuf_alloc(len);
+	if (pbuf == NULL)
+		return -1;
+	uint8_t *packet = pbuf->data;
 
 	/* construct the arp header */
 	sr_arp_hdr_t *arp_hdr = (sr_arp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
@@ -501,7 +1092,5 @@ int sr_send_arp_reply(struct sr_instance *sr,
 	memcpy(ethernet_hdr->ether_shost, mac, ETHER_ADDR_LEN);
 	ethernet_hdr->ether_type = ntohs(ethertype_arp);
 
-	print_hdrs(packet, len);
-
-	return sr_send_packet(sr, packet, len, interface);
+	return sr_send_pbuf(sr, pbuf, interface);
 }
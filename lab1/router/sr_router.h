@@ -15,6 +15,10 @@
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
+#include "sr_icmp_limit.h"
+#include "sr_stats.h"
+#include "sr_fib.h"
+#include "sr_rt.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -29,10 +33,24 @@
 
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
+#define SR_BURST_MAX 256 /* frames per stage pass in sr_handlepacket_burst */
 
 /* forward declare */
+struct sr_pbuf;
+struct sr_nat;
+struct sr_ls;
+struct sr_bfd;
+struct sr_qos;
+struct sr_acl;
+struct sr_flow;
+struct sr_flood;
+struct sr_snap;
 struct sr_if;
 struct sr_rt;
+struct sr_capture;
+
+/* count a frame dropped for reason why (enum sr_drop_reason) */
+#define SR_DROP(sr, why) SR_STATS_ADD(drops[(why)], 1)
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -51,9 +69,22 @@ struct sr_instance
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
     struct sr_rt* routing_table; /* routing table */
+    struct sr_rt* routing_tail; /* its last entry */
+    struct sr_fib fib; /* prefix trie over routing_table */
+    struct sr_rt_down rt_down; /* dead next hops */
+    pthread_rwlock_t rt_lock; /* guards all four, see sr_rt.h */
     struct sr_arpcache cache;   /* ARP cache */
+    struct sr_icmp_limit icmp_limit; /* ICMP error rate limits */
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_capture* capture; /* packet log, if any */
+    struct sr_nat* nat; /* NAT, if enabled */
+    struct sr_ls* ls; /* link-state routing, if enabled */
+    struct sr_bfd* bfd; /* next hop failure detection, if enabled */
+    struct sr_qos* qos; /* egress queueing, if enabled */
+    struct sr_acl* acl; /* ingress filter, if any */
+    struct sr_flow* flow; /* flow export, if enabled */
+    struct sr_flood* flood; /* heavy hitters and flood drops, if enabled */
+    struct sr_snap* snap; /* warm restart snapshot, if any */
 };
 
 /* -- sr_main.c -- */
@@ -61,24 +92,29 @@ int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_pbuf(struct sr_instance* , struct sr_pbuf* , const char*);
+int sr_send_pbuf_now(struct sr_instance* , struct sr_pbuf* , const char*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
-void sr_handle_ip(struct sr_instance*, uint8_t *, unsigned int, char *);
+void sr_handlepacket_burst(struct sr_instance* , uint8_t ** , unsigned int * ,
+                           char ** , unsigned int );
+void sr_handle_ip(struct sr_instance*, uint8_t *, unsigned int, char *, int);
 void sr_handle_arp(struct sr_instance*, uint8_t *, unsigned int, char *);
 void sr_handle_arp_reply(struct sr_instance*, sr_arp_hdr_t *, char *);
-struct sr_rt* sr_rt_for_dst(struct sr_instance *, uint32_t);
-int sr_send_icmp(struct sr_instance*, uint8_t *, uint8_t, uint8_t, char *);
+int sr_send_icmp_echo_reply(struct sr_instance*, uint8_t *, unsigned int, char *);
 int sr_send_icmp_t3(struct sr_instance*, uint8_t *, uint8_t, uint8_t, char *);
 int sr_send_arp_req(struct sr_instance*, struct sr_arpreq*);
+int sr_send_arp_probe(struct sr_instance*, uint32_t, const char*);
 int sr_send_arp_reply(struct sr_instance*, uint8_t *, unsigned int, char *);
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
 void sr_set_ether_ip(struct sr_instance* , uint32_t );
+void sr_set_ether_speed(struct sr_instance* , uint32_t );
 void sr_set_ether_addr(struct sr_instance* , const unsigned char* );
 void sr_print_if_list(struct sr_instance* );
 
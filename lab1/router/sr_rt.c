@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 
 #include <sys/socket.h>
@@ -20,10 +21,201 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_fib.h"
 #include "sr_router.h"
 
+#define SR_RT_BATCH_MAX (1 << 20) /* changes one control batch may hold */
+#define SR_RT_APPLY_CHUNK 4096    /* changes made per hold of rt_lock */
+
+/* Taken by whatever changes routes, around rt_lock, so that a batch
+   sr_rt_apply() makes in chunks has the table to itself between them. */
+static pthread_mutex_t sr_rt_writer = PTHREAD_MUTEX_INITIALIZER;
+
+/* what a change in a batch overwrote, so it can be put back */
+struct sr_rt_undo
+{
+    int existed;
+    struct in_addr gw;
+    char interface[sr_IFACE_NAMELEN];
+    struct in_addr backup_gw;
+    char backup_interface[sr_IFACE_NAMELEN];
+    int tentative;
+};
+
+/* the batch the control client is building; only the control thread
+   touches it */
+static struct
+{
+    int open;
+    int overflow;           /* more than SR_RT_BATCH_MAX changes */
+    struct sr_rt_op* ops;
+    unsigned int n;
+    unsigned int size;
+} sr_rt_batch;
+
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_init(..)
+ * Scope: Global
+ *
+ * Start with an empty table. Call before anything else in this file.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_init(struct sr_instance* sr)
+{
+    sr->routing_table = 0;
+    sr->routing_tail = 0;
+    sr_fib_init(&sr->fib);
+    sr->rt_down.n = 0;
+    pthread_rwlock_init(&sr->rt_lock, 0);
+} /* -- sr_rt_init -- */
+
+/* prefix length of a netmask, counting its leading ones */
+static int sr_rt_mask_len(struct in_addr mask)
+{
+    uint32_t m = ntohl(mask.s_addr);
+    return ~m ? __builtin_clz(~m) : 32;
+}
+
+/*---------------------------------------------------------------------
+ * The functions below change the table and expect the caller to hold
+ * rt_lock for writing.
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_insert(struct sr_instance* sr, struct in_addr dest, int len,
+                        struct in_addr gw, const char* if_name)
+{
+    struct sr_rt* rt = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+
+    if (!rt)
+    { return SR_RT_NOMEM; }
+    rt->dest.s_addr = dest.s_addr & htonl(SR_FIB_MASK(len));
+    rt->gw = gw;
+    rt->mask.s_addr = htonl(SR_FIB_MASK(len));
+    strncpy(rt->interface, if_name, sr_IFACE_NAMELEN);
+    rt->interface[sr_IFACE_NAMELEN - 1] = 0;
+    rt->backup_gw.s_addr = 0;
+    rt->backup_interface[0] = 0;
+    rt->tentative = 0;
+
+    if (sr_fib_insert(&sr->fib, rt->dest.s_addr, len, rt) != 0)
+    {
+        free(rt);
+        return SR_RT_NOMEM;
+    }
+
+    /* -- append, keeping the order routes were added in -- */
+    rt->next = 0;
+    rt->prev = sr->routing_tail;
+    if (sr->routing_tail)
+    { sr->routing_tail->next = rt; }
+    else
+    { sr->routing_table = rt; }
+    sr->routing_tail = rt;
+
+    return 0;
+}
+
+static void sr_rt_remove(struct sr_instance* sr, struct sr_rt* rt)
+{
+    sr_fib_remove(&sr->fib, rt->dest.s_addr, sr_rt_mask_len(rt->mask));
+
+    if (rt->prev)
+    { rt->prev->next = rt->next; }
+    else
+    { sr->routing_table = rt->next; }
+    if (rt->next)
+    { rt->next->prev = rt->prev; }
+    else
+    { sr->routing_tail = rt->prev; }
+    free(rt);
+}
+
+static void sr_rt_clear(struct sr_instance* sr)
+{
+    struct sr_rt* rt;
+
+    while ((rt = sr->routing_table))
+    {
+        sr->routing_table = rt->next;
+        free(rt);
+    }
+    sr->routing_tail = 0;
+    sr_fib_clear(&sr->fib);
+}
+
+static int sr_rt_apply_one(struct sr_instance* sr, const struct sr_rt_op* op,
+                           struct sr_rt_undo* undo)
+{
+    struct sr_rt* rt = sr_fib_find(&sr->fib, op->dest.s_addr, op->len);
+
+    undo->existed = rt != 0;
+    if (rt)
+    {
+        undo->gw = rt->gw;
+        memcpy(undo->interface, rt->interface, sr_IFACE_NAMELEN);
+        undo->backup_gw = rt->backup_gw;
+        memcpy(undo->backup_interface, rt->backup_interface, sr_IFACE_NAMELEN);
+        undo->tentative = rt->tentative;
+    }
+
+    switch (op->type)
+    {
+        case sr_rt_op_add:
+            if (rt)
+            { return SR_RT_EXISTS; }
+            return sr_rt_insert(sr, op->dest, op->len, op->gw, op->interface);
+        case sr_rt_op_replace:
+            if (!rt)
+            { return sr_rt_insert(sr, op->dest, op->len, op->gw, op->interface); }
+            rt->gw = op->gw;
+            strncpy(rt->interface, op->interface, sr_IFACE_NAMELEN);
+            rt->interface[sr_IFACE_NAMELEN - 1] = 0;
+            rt->backup_gw.s_addr = 0;
+            rt->backup_interface[0] = 0;
+            rt->tentative = 0;
+            return 0;
+        case sr_rt_op_del:
+            if (!rt)
+            { return SR_RT_MISSING; }
+            sr_rt_remove(sr, rt);
+            return 0;
+        case sr_rt_op_withdraw:
+            if (rt)
+            { sr_rt_remove(sr, rt); }
+            return 0;
+    }
+    return 0;
+}
+
+static void sr_rt_undo_one(struct sr_instance* sr, const struct sr_rt_op* op,
+                           const struct sr_rt_undo* undo)
+{
+    struct sr_rt* rt = sr_fib_find(&sr->fib, op->dest.s_addr, op->len);
+
+    if (!undo->existed)
+    {
+        if (rt)
+        { sr_rt_remove(sr, rt); }
+    }
+    else if (!rt && sr_rt_insert(sr, op->dest, op->len, undo->gw, undo->interface) != 0)
+    {
+        fprintf(stderr, "sr_rt_apply: out of memory putting back %s/%d\n",
+                inet_ntoa(op->dest), op->len);
+    }
+    else
+    {
+        rt = sr_fib_find(&sr->fib, op->dest.s_addr, op->len);
+        rt->gw = undo->gw;
+        memcpy(rt->interface, undo->interface, sr_IFACE_NAMELEN);
+        rt->backup_gw = undo->backup_gw;
+        memcpy(rt->backup_interface, undo->backup_interface, sr_IFACE_NAMELEN);
+        rt->tentative = undo->tentative;
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
  *
  *---------------------------------------------------------------------*/
 
@@ -39,6 +231,7 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
     struct in_addr gw_addr;
     struct in_addr mask_addr;
     int clear_routing_table = 0;
+    int n;
 
     /* -- REQUIRES -- */
     assert(filename);
@@ -52,7 +245,18 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
 
     while( fgets(line,BUFSIZ,fp) != 0)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
+        /* -- a short line would keep fields from the one before it -- */
+        n = sscanf(line,"%31s %31s %31s %31s",dest,gw,mask,iface);
+        if(n <= 0)
+        { continue; } /* blank */
+        if(n < 4)
+        {
+            line[strcspn(line, "\n")] = 0;
+            fprintf(stderr,
+                    "Error loading routing table, %d of 4 fields in: %s\n",
+                    n, line);
+            return -1;
+        }
         if(inet_aton(dest,&dest_addr) == 0)
         { 
             fprintf(stderr,
@@ -76,60 +280,329 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
         }
         if( clear_routing_table == 0 ){
             printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
+            pthread_mutex_lock(&sr_rt_writer);
+            pthread_rwlock_wrlock(&sr->rt_lock);
+            sr_rt_clear(sr);
+            pthread_rwlock_unlock(&sr->rt_lock);
+            pthread_mutex_unlock(&sr_rt_writer);
             clear_routing_table = 1;
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
+        if(sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface) == SR_RT_EXISTS &&
+           sr_rt_add_backup(sr,dest_addr,gw_addr,mask_addr,iface) == SR_RT_EXISTS)
+        {
+            fprintf(stderr, "Routing table has %s/%d more than twice, keeping the first two\n",
+                    dest, sr_rt_mask_len(mask_addr));
+        }
     } /* -- while -- */
 
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_add_rt_entry(..)
+ *
+ * Add a route unless its prefix is routed already. A mask with holes
+ * in it is taken as far as its leading ones go. Returns 0, SR_RT_EXISTS
+ * or SR_RT_NOMEM.
  *
  *---------------------------------------------------------------------*/
 
-void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
+int sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
 struct in_addr gw, struct in_addr mask,char* if_name)
 {
-    struct sr_rt* rt_walker = 0;
+    int len, ret;
 
     /* -- REQUIRES -- */
     assert(if_name);
     assert(sr);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
+    len = sr_rt_mask_len(mask);
+    if(htonl(SR_FIB_MASK(len)) != mask.s_addr)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        fprintf(stderr, "Netmask %s is not contiguous, using /%d\n",
+                inet_ntoa(mask), len);
+    }
 
-        return;
+    pthread_mutex_lock(&sr_rt_writer);
+    pthread_rwlock_wrlock(&sr->rt_lock);
+    if(sr_fib_find(&sr->fib, dest.s_addr, len))
+    { ret = SR_RT_EXISTS; }
+    else
+    { ret = sr_rt_insert(sr, dest, len, gw, if_name); }
+    pthread_rwlock_unlock(&sr->rt_lock);
+    pthread_mutex_unlock(&sr_rt_writer);
+
+    return ret;
+} /* -- sr_add_entry -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_add_backup(..)
+ * Scope: Global
+ *
+ * Give the route for a prefix a next hop to use while its own is dead.
+ * Returns 0, SR_RT_MISSING if the prefix isn't routed or SR_RT_EXISTS
+ * if the route has a backup already.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_add_backup(struct sr_instance* sr, struct in_addr dest,
+                     struct in_addr gw, struct in_addr mask, const char* if_name)
+{
+    struct sr_rt* rt;
+    int ret = 0;
+
+    pthread_mutex_lock(&sr_rt_writer);
+    pthread_rwlock_wrlock(&sr->rt_lock);
+    if (!(rt = sr_fib_find(&sr->fib, dest.s_addr, sr_rt_mask_len(mask))))
+    { ret = SR_RT_MISSING; }
+    else if (rt->backup_interface[0])
+    { ret = SR_RT_EXISTS; }
+    else
+    {
+        rt->backup_gw = gw;
+        strncpy(rt->backup_interface, if_name, sr_IFACE_NAMELEN);
+        rt->backup_interface[sr_IFACE_NAMELEN - 1] = 0;
     }
+    pthread_rwlock_unlock(&sr->rt_lock);
+    pthread_mutex_unlock(&sr_rt_writer);
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
+    return ret;
+} /* -- sr_rt_add_backup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_apply(..)
+ * Scope: Global
+ *
+ * Make the n changes in ops as one: if one fails, those before it are
+ * undone, *failed is set to its index and its error is returned.
+ * Forwarding sees the table either before all of them or after all of
+ * them, as long as there are at most SR_RT_APPLY_CHUNK; a bigger batch
+ * goes in that many at a time, letting go of rt_lock in between so that
+ * packets keep moving, and forwarding may see part of it meanwhile.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_apply(struct sr_instance* sr, const struct sr_rt_op* ops,
+                unsigned int n, unsigned int* failed)
+{
+    struct sr_rt_undo one;
+    struct sr_rt_undo* undo = &one;
+    unsigned int i;
+    int ret = 0;
+
+    if (n == 0)
+    { return 0; }
+    if (n > 1 && !(undo = (struct sr_rt_undo*)malloc(n * sizeof(struct sr_rt_undo))))
+    {
+        if (failed)
+        { *failed = 0; }
+        return SR_RT_NOMEM;
     }
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    pthread_mutex_lock(&sr_rt_writer);
+    pthread_rwlock_wrlock(&sr->rt_lock);
+    for (i = 0; i < n; i++)
+    {
+        if (i % SR_RT_APPLY_CHUNK == 0 && i > 0)
+        {
+            pthread_rwlock_unlock(&sr->rt_lock);
+            pthread_rwlock_wrlock(&sr->rt_lock);
+        }
+        if ((ret = sr_rt_apply_one(sr, &ops[i], &undo[i])) != 0)
+        {
+            if (failed)
+            { *failed = i; }
+            while (i-- > 0)
+            {
+                sr_rt_undo_one(sr, &ops[i], &undo[i]);
+                if (i % SR_RT_APPLY_CHUNK == 0 && i > 0)
+                {
+                    pthread_rwlock_unlock(&sr->rt_lock);
+                    pthread_rwlock_wrlock(&sr->rt_lock);
+                }
+            }
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+    pthread_mutex_unlock(&sr_rt_writer);
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    if (undo != &one)
+    { free(undo); }
+    return ret;
+} /* -- sr_rt_apply -- */
 
-} /* -- sr_add_entry -- */
+/*---------------------------------------------------------------------
+ * Method: sr_rt_restore(..)
+ * Scope: Global
+ *
+ * Put back a route saved in a snapshot, backup and all, marked
+ * tentative. Returns 0, SR_RT_EXISTS if the prefix is routed already
+ * (the rtable has the last word) or SR_RT_NOMEM.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_restore(struct sr_instance* sr, const struct sr_rt* saved)
+{
+    struct sr_rt* rt;
+    int len = sr_rt_mask_len(saved->mask);
+    int ret;
+
+    pthread_mutex_lock(&sr_rt_writer);
+    pthread_rwlock_wrlock(&sr->rt_lock);
+    if (sr_fib_find(&sr->fib, saved->dest.s_addr, len))
+    { ret = SR_RT_EXISTS; }
+    else if ((ret = sr_rt_insert(sr, saved->dest, len, saved->gw, saved->interface)) == 0)
+    {
+        rt = sr->routing_tail;
+        rt->backup_gw = saved->backup_gw;
+        memcpy(rt->backup_interface, saved->backup_interface, sr_IFACE_NAMELEN);
+        rt->backup_interface[sr_IFACE_NAMELEN - 1] = 0;
+        rt->tentative = 1;
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+    pthread_mutex_unlock(&sr_rt_writer);
+
+    return ret;
+} /* -- sr_rt_restore -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_expire_tentative(..)
+ * Scope: Global
+ *
+ * Remove the restored routes nothing has confirmed. Returns how many
+ * went.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_rt_expire_tentative(struct sr_instance* sr)
+{
+    struct sr_rt* rt;
+    struct sr_rt* next;
+    unsigned int n = 0;
+
+    pthread_mutex_lock(&sr_rt_writer);
+    pthread_rwlock_wrlock(&sr->rt_lock);
+    for (rt = sr->routing_table; rt; rt = next)
+    {
+        next = rt->next;
+        if (rt->tentative)
+        {
+            sr_rt_remove(sr, rt);
+            n++;
+        }
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+    pthread_mutex_unlock(&sr_rt_writer);
+
+    return n;
+} /* -- sr_rt_expire_tentative -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_for_dst(..)
+ * Scope: Global
+ *
+ * Copy the longest prefix match for dst (network byte order) into out.
+ * Returns 0, or -1 if nothing matches.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_gw_down(const struct sr_instance* sr, uint32_t gw)
+{
+    unsigned int i;
+
+    for (i = 0; i < sr->rt_down.n; i++)
+    {
+        if (sr->rt_down.gw[i] == gw)
+        { return 1; }
+    }
+    return 0;
+}
+
+/* the lookup while some next hop is dead: the most specific route with
+   a live next hop, its own or its backup */
+static struct sr_rt* sr_rt_lookup_live(struct sr_instance* sr, uint32_t dst,
+                                       int* backup)
+{
+    struct sr_rt* match[33];
+    struct sr_rt* rt;
+    unsigned int n = sr_fib_matches(&sr->fib, dst, match);
+
+    while (n-- > 0)
+    {
+        rt = match[n];
+        if (!sr_rt_gw_down(sr, rt->gw.s_addr))
+        {
+            *backup = 0;
+            return rt;
+        }
+        if (rt->backup_interface[0] && !sr_rt_gw_down(sr, rt->backup_gw.s_addr))
+        {
+            *backup = 1;
+            return rt;
+        }
+    }
+    return 0;
+}
+
+int sr_rt_for_dst(struct sr_instance* sr, uint32_t dst, struct sr_rt* out)
+{
+    struct sr_rt* rt;
+    int backup = 0;
+
+    pthread_rwlock_rdlock(&sr->rt_lock);
+    if (sr->rt_down.n == 0)
+    { rt = sr_fib_lookup(&sr->fib, dst); }
+    else
+    { rt = sr_rt_lookup_live(sr, dst, &backup); }
+    if (rt)
+    { *out = *rt; }
+    pthread_rwlock_unlock(&sr->rt_lock);
+
+    if (!rt)
+    { return -1; }
+    if (backup)
+    {
+        out->gw = out->backup_gw;
+        memcpy(out->interface, out->backup_interface, sr_IFACE_NAMELEN);
+        out->backup_interface[0] = 0;
+    }
+    out->next = out->prev = 0;
+    return 0;
+} /* -- sr_rt_for_dst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_nh_state(..)
+ * Scope: Global
+ *
+ * Mark next hop gw dead (up == 0) or alive again. Routes are not
+ * touched; lookups steer round dead next hops until they come back.
+ * Returns 0, or SR_RT_NOMEM if SR_RT_DOWN_MAX next hops are dead
+ * already.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_nh_state(struct sr_instance* sr, struct in_addr gw, int up)
+{
+    struct sr_rt_down* down = &sr->rt_down;
+    unsigned int i;
+    int ret = 0;
+
+    pthread_rwlock_wrlock(&sr->rt_lock);
+    for (i = 0; i < down->n && down->gw[i] != gw.s_addr; i++);
+    if (up && i < down->n)
+    { down->gw[i] = down->gw[--down->n]; }
+    else if (!up && i == down->n)
+    {
+        if (down->n < SR_RT_DOWN_MAX)
+        { down->gw[down->n++] = gw.s_addr; }
+        else
+        { ret = SR_RT_NOMEM; }
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+
+    return ret;
+} /* -- sr_rt_nh_state -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -173,6 +646,245 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\t\t",inet_ntoa(entry->dest));
     printf("%s\t",inet_ntoa(entry->gw));
     printf("%s\t",inet_ntoa(entry->mask));
-    printf("%s\n",entry->interface);
+    printf("%s",entry->interface);
+    if(entry->backup_interface[0])
+    {
+        printf("\tbackup %s",inet_ntoa(entry->backup_gw));
+        printf(" %s",entry->backup_interface);
+    }
+    printf("\n");
 
 } /* -- sr_print_routing_entry -- */
+
+/*---------------------------------------------------------------------
+ * Control socket
+ *---------------------------------------------------------------------*/
+
+/* "a.b.c.d/len" with no bits set past len */
+static int sr_rt_parse_prefix(const char* s, struct in_addr* dest, int* len)
+{
+    char addr[32];
+    const char* slash = strchr(s, '/');
+    char* end;
+    long l;
+
+    if (!slash || slash - s >= (long)sizeof(addr))
+    { return -1; }
+    memcpy(addr, s, slash - s);
+    addr[slash - s] = 0;
+    if (inet_aton(addr, dest) == 0)
+    { return -1; }
+    l = strtol(slash + 1, &end, 10);
+    if (*end || end == slash + 1 || l < 0 || l > 32)
+    { return -1; }
+    if (dest->s_addr & ~htonl(SR_FIB_MASK(l)))
+    { return -1; }
+    *len = (int)l;
+    return 0;
+}
+
+static void sr_rt_write(FILE* out, const struct sr_rt* rt)
+{
+    char dest[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &rt->dest, dest, sizeof(dest));
+    inet_ntop(AF_INET, &rt->gw, gw, sizeof(gw));
+    fprintf(out, "%s/%d %s %s", dest, sr_rt_mask_len(rt->mask), gw, rt->interface);
+    if (rt->backup_interface[0])
+    {
+        inet_ntop(AF_INET, &rt->backup_gw, gw, sizeof(gw));
+        fprintf(out, " backup %s %s", gw, rt->backup_interface);
+    }
+    if (rt->tentative)
+    { fprintf(out, " tentative"); }
+    fprintf(out, "\n");
+}
+
+static void sr_rt_write_walk(struct sr_rt* rt, void* out)
+{
+    sr_rt_write((FILE*)out, rt);
+}
+
+static const char* sr_rt_error(int err)
+{
+    switch (err)
+    {
+        case SR_RT_EXISTS:  return "prefix already routed";
+        case SR_RT_MISSING: return "no route for prefix";
+        case SR_RT_NOMEM:   return "out of memory";
+    }
+    return "failed";
+}
+
+/* parse an add, replace or del into op */
+static int sr_rt_parse_op(struct sr_instance* sr, int argc, char** argv,
+                          struct sr_rt_op* op, FILE* out)
+{
+    memset(op, 0, sizeof(*op));
+    if (strcmp(argv[1], "del") == 0)
+    {
+        op->type = sr_rt_op_del;
+        if (argc != 3 || sr_rt_parse_prefix(argv[2], &op->dest, &op->len) != 0)
+        { return -1; }
+        return 0;
+    }
+
+    op->type = strcmp(argv[1], "add") == 0 ? sr_rt_op_add : sr_rt_op_replace;
+    if (argc != 5 || sr_rt_parse_prefix(argv[2], &op->dest, &op->len) != 0 ||
+        inet_aton(argv[3], &op->gw) == 0)
+    { return -1; }
+    if (!sr_get_interface(sr, argv[4]))
+    {
+        fprintf(out, "error: no interface %s\n", argv[4]);
+        return 1;
+    }
+    strncpy(op->interface, argv[4], sr_IFACE_NAMELEN - 1);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_ctl(..)
+ * Scope: Global
+ *
+ * Control command:
+ *
+ *   route add <prefix>/<len> <gw> <iface>
+ *   route replace <prefix>/<len> <gw> <iface>
+ *   route del <prefix>/<len>
+ *   route get <addr>
+ *   route dump
+ *   route begin | commit | abort
+ *
+ * A single change is answered "ok" or with an error. Between begin and
+ * commit changes are only checked for syntax and held back, without an
+ * answer; commit then applies them all or none (sr_rt_apply) and answers
+ * for the lot. The batch is dropped if the client hangs up first.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_rt_op op;
+    struct sr_rt rt;
+    struct in_addr addr;
+    unsigned int failed;
+    int ret;
+
+    if (argc < 2)
+    { return -1; }
+
+    if (strcmp(argv[1], "add") == 0 || strcmp(argv[1], "replace") == 0 ||
+        strcmp(argv[1], "del") == 0)
+    {
+        if ((ret = sr_rt_parse_op(sr, argc, argv, &op, out)) != 0)
+        { return ret < 0 ? -1 : 0; }
+
+        if (sr_rt_batch.open)
+        {
+            if (sr_rt_batch.n == sr_rt_batch.size && !sr_rt_batch.overflow)
+            {
+                unsigned int size = sr_rt_batch.size ? sr_rt_batch.size * 2 : 64;
+                struct sr_rt_op* ops = 0;
+
+                if (size <= SR_RT_BATCH_MAX)
+                {
+                    ops = (struct sr_rt_op*)realloc(sr_rt_batch.ops,
+                                                    size * sizeof(struct sr_rt_op));
+                }
+                if (ops)
+                {
+                    sr_rt_batch.ops = ops;
+                    sr_rt_batch.size = size;
+                }
+                else
+                { sr_rt_batch.overflow = 1; }
+            }
+            if (!sr_rt_batch.overflow)
+            { sr_rt_batch.ops[sr_rt_batch.n++] = op; }
+            return 0;
+        }
+
+        if ((ret = sr_rt_apply(sr, &op, 1, 0)) != 0)
+        { fprintf(out, "error: %s %s\n", argv[2], sr_rt_error(ret)); }
+        else
+        { fprintf(out, "ok\n"); }
+        return 0;
+    }
+
+    if (strcmp(argv[1], "get") == 0)
+    {
+        if (argc != 3 || inet_aton(argv[2], &addr) == 0)
+        { return -1; }
+        if (sr_rt_for_dst(sr, addr.s_addr, &rt) != 0)
+        { fprintf(out, "no route\n"); }
+        else
+        { sr_rt_write(out, &rt); }
+        return 0;
+    }
+
+    if (strcmp(argv[1], "dump") == 0)
+    {
+        if (argc != 2)
+        { return -1; }
+        pthread_rwlock_rdlock(&sr->rt_lock);
+        sr_fib_walk(&sr->fib, sr_rt_write_walk, out);
+        pthread_rwlock_unlock(&sr->rt_lock);
+        return 0;
+    }
+
+    if (argc != 2)
+    { return -1; }
+
+    if (strcmp(argv[1], "begin") == 0)
+    {
+        if (sr_rt_batch.open)
+        { fprintf(out, "error: batch already open\n"); }
+        else
+        {
+            sr_rt_batch.open = 1;
+            sr_rt_batch.n = 0;
+            fprintf(out, "ok\n");
+        }
+        return 0;
+    }
+
+    if (strcmp(argv[1], "commit") == 0 || strcmp(argv[1], "abort") == 0)
+    {
+        if (!sr_rt_batch.open)
+        {
+            fprintf(out, "error: no batch open\n");
+            return 0;
+        }
+        if (argv[1][0] == 'a')
+        { fprintf(out, "ok, %u changes dropped\n", sr_rt_batch.n); }
+        else if (sr_rt_batch.overflow)
+        { fprintf(out, "error: more than %d changes, none applied\n", SR_RT_BATCH_MAX); }
+        else if ((ret = sr_rt_apply(sr, sr_rt_batch.ops, sr_rt_batch.n, &failed)) != 0)
+        {
+            op = sr_rt_batch.ops[failed];
+            fprintf(out, "error: change %u (%s/%d) %s, none applied\n",
+                    failed + 1, inet_ntoa(op.dest), op.len, sr_rt_error(ret));
+        }
+        else
+        { fprintf(out, "ok, %u changes\n", sr_rt_batch.n); }
+        sr_rt_ctl_hangup(sr);
+        return 0;
+    }
+
+    return -1;
+} /* -- sr_rt_ctl -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_ctl_hangup(..)
+ * Scope: Global
+ *
+ * Drop any batch in progress.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_ctl_hangup(void* arg)
+{
+    free(sr_rt_batch.ops);
+    memset(&sr_rt_batch, 0, sizeof(sr_rt_batch));
+} /* -- sr_rt_ctl_hangup -- */
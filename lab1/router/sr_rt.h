@@ -7,6 +7,23 @@
  *
  * Methods and datastructures for handeling the routing table
  *
+ * The table is the list at sr->routing_table, in the order routes were
+ * added, with a trie (sr_fib.h) over it for lookups. Both are guarded by
+ * sr->rt_lock: routes can be added and removed while packets are being
+ * forwarded, so lookups copy the route they find rather than hand out a
+ * pointer into the table.
+ *
+ * A route can have a backup next hop, given by a second rtable line for
+ * the same prefix. Next hops that failure detection (sr_bfd.h) reports
+ * dead go in sr->rt_down; a lookup steers round them, to the backup if
+ * the route has a live one and otherwise to the next less specific
+ * route, so failing over costs the same however many routes use the
+ * next hop.
+ *
+ * Routes restored at startup from a snapshot are tentative: they are
+ * used like any other, but go again unless a replace confirms them
+ * before sr_rt_expire_tentative() is called.
+ *
  *---------------------------------------------------------------------------*/
 
 #ifndef sr_RT_H
@@ -16,10 +33,21 @@
 #include <sys/types.h>
 #endif
 
+#include <stdio.h>
 #include <netinet/in.h>
 
 #include "sr_if.h"
 
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
 /* ----------------------------------------------------------------------------
  * struct sr_rt
  *
@@ -33,15 +61,77 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    struct in_addr backup_gw;
+    char   backup_interface[sr_IFACE_NAMELEN];  /* "" for no backup */
+    int    tentative;   /* restored from a snapshot (sr_snap.h), not
+                           confirmed since by a replace */
     struct sr_rt* next;
+    struct sr_rt* prev;
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_down
+ *
+ * Next hops known to be dead, guarded by rt_lock.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_DOWN_MAX 64
+
+struct sr_rt_down
+{
+    unsigned int n;
+    uint32_t gw[SR_RT_DOWN_MAX];            /* network order */
+};
 
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_op
+ *
+ * One change in a batch for sr_rt_apply().
+ *
+ * -------------------------------------------------------------------------- */
+
+enum sr_rt_op_type
+{
+    sr_rt_op_add,       /* the prefix must not be routed yet */
+    sr_rt_op_replace,   /* add, or overwrite the route the prefix has,
+                           backup included */
+    sr_rt_op_del,       /* the prefix must be routed */
+    sr_rt_op_withdraw   /* del if routed; never fails */
+};
+
+struct sr_rt_op
+{
+    enum sr_rt_op_type type;
+    struct in_addr dest;
+    int len;
+    struct in_addr gw;                      /* not used by del */
+    char interface[sr_IFACE_NAMELEN];       /* not used by del */
+};
+
+/* why sr_rt_apply() turned a batch down */
+#define SR_RT_EXISTS  -1    /* add of a prefix that is already routed */
+#define SR_RT_MISSING -2    /* del of a prefix that isn't */
+#define SR_RT_NOMEM   -3
+
+void sr_rt_init(struct sr_instance*);
 int sr_load_rt(struct sr_instance*,const char*);
-void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
+int sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+int sr_rt_add_backup(struct sr_instance*, struct in_addr, struct in_addr,
+                     struct in_addr, const char*);
+int sr_rt_apply(struct sr_instance*, const struct sr_rt_op*, unsigned int,
+                unsigned int*);
+int sr_rt_restore(struct sr_instance*, const struct sr_rt*);
+unsigned int sr_rt_expire_tentative(struct sr_instance*);
+int sr_rt_nh_state(struct sr_instance*, struct in_addr, int);
+int sr_rt_for_dst(struct sr_instance*, uint32_t, struct sr_rt*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
+/* control socket "route" command */
+int  sr_rt_ctl(void* sr, int argc, char** argv, FILE* out);
+void sr_rt_ctl_hangup(void* sr);
+
 
 #endif  /* --  sr_RT_H -- */
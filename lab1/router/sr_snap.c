@@ -0,0 +1,584 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snap.c
+ *
+ * Description:
+ *
+ * Snapshot of the ARP cache and the routing table, for warm restarts.
+ * See sr_snap.h.
+ *
+ * The file is a header, SR_ARPCACHE_SZ ARP records and room for cap
+ * routes, all of it mapped shared. The routing table is kept as the list
+ * of routes in the order they were added, which is what it takes to
+ * build the trie again; a trie of pointers means nothing to the next
+ * process. snap->lock keeps the writer thread and the control socket
+ * from saving at the same time.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_snap.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_arpcache.h"
+#include "sr_log.h"
+
+#define SR_SNAP_MAGIC   0x53525331  /* "SRS1" */
+#define SR_SNAP_VERSION 2
+
+/* addresses in network order */
+struct sr_snap_hdr
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t ifname_len;        /* sr_IFACE_NAMELEN of the writer */
+    uint32_t seq;               /* odd while a save is under way */
+    uint32_t n_arp;
+    uint32_t n_rt;
+    uint32_t sum;               /* over the n_arp and n_rt records */
+    uint64_t saved;             /* time(), seconds */
+};
+
+struct sr_snap_arp
+{
+    uint32_t ip;
+    uint8_t  mac[6];
+    uint16_t pad;
+    char     iface[sr_IFACE_NAMELEN];  /* where the reply came in */
+};
+
+struct sr_snap_rt
+{
+    uint32_t dest;
+    uint32_t mask;
+    uint32_t gw;
+    uint32_t backup_gw;
+    char     iface[sr_IFACE_NAMELEN];
+    char     backup_iface[sr_IFACE_NAMELEN];    /* "" for no backup */
+};
+
+struct sr_snap
+{
+    struct sr_instance* sr;
+    char* fname;
+    int fd;
+    uint8_t* map;
+    size_t size;
+    unsigned int cap;           /* routes the file has room for */
+    struct sr_snap_arp arp[SR_ARPCACHE_SZ];
+    pthread_t thread;
+    pthread_mutex_t lock;       /* one save at a time; guards the rest */
+    pthread_cond_t wake;
+    int stop;
+    int hold;                   /* restored routes still wait for a replace */
+
+    /* what the last start found */
+    const char* cold_why;       /* 0 if the snapshot was used */
+    unsigned int restored_arp;
+    unsigned int restored_rt;
+    unsigned int expired_rt;
+
+    unsigned long saves;
+    unsigned long save_errors;
+    time_t last_saved;
+    double last_save_ms;
+    unsigned long changed;      /* records the last save rewrote */
+};
+
+static struct sr_snap_hdr* sr_snap_hdr(struct sr_snap* snap)
+{
+    return (struct sr_snap_hdr*)snap->map;
+}
+
+static struct sr_snap_arp* sr_snap_arp(struct sr_snap* snap)
+{
+    return (struct sr_snap_arp*)(snap->map + sizeof(struct sr_snap_hdr));
+}
+
+static struct sr_snap_rt* sr_snap_rt(struct sr_snap* snap)
+{
+    return (struct sr_snap_rt*)(snap->map + sizeof(struct sr_snap_hdr) +
+                                SR_ARPCACHE_SZ * sizeof(struct sr_snap_arp));
+}
+
+static size_t sr_snap_size(unsigned int cap)
+{
+    return sizeof(struct sr_snap_hdr) +
+           SR_ARPCACHE_SZ * sizeof(struct sr_snap_arp) +
+           (size_t)cap * sizeof(struct sr_snap_rt);
+}
+
+static double sr_snap_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Fletcher-style, over 32 bit words; every record is a multiple of 4 */
+static uint32_t sr_snap_sum(const uint8_t* p, size_t len, uint32_t seed)
+{
+    const uint32_t* w = (const uint32_t*)p;
+    uint64_t a = seed, b = 0;
+    size_t i;
+
+    for (i = 0; i < len / 4; i++)
+    {
+        a += w[i];
+        b += a;
+    }
+    return (uint32_t)(a ^ (a >> 32) ^ b ^ (b >> 32));
+}
+
+/* copy a record into the map only if it differs, so unchanged pages stay
+   clean; returns 1 if it was written */
+static int sr_snap_put(void* to, const void* from, size_t len)
+{
+    if (memcmp(to, from, len) == 0)
+    { return 0; }
+    memcpy(to, from, len);
+    return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_map(..)
+ * Scope: Local
+ *
+ * Map the file with room for cap routes, growing it if need be.
+ * Returns 0 or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snap_map(struct sr_snap* snap, unsigned int cap)
+{
+    size_t size = sr_snap_size(cap);
+    uint8_t* map;
+
+    if (snap->map && size <= snap->size)
+    { return 0; }
+    if (ftruncate(snap->fd, size) != 0)
+    { return -1; }
+    map = (uint8_t*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, snap->fd, 0);
+    if (map == MAP_FAILED)
+    { return -1; }
+    if (snap->map)
+    { munmap(snap->map, snap->size); }
+    snap->map = map;
+    snap->size = size;
+    snap->cap = cap;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_save(..)
+ * Scope: Local
+ *
+ * Copy the ARP cache and the routing table into the file. With sync,
+ * wait for it to reach the disk. Expects snap->lock to be held. Returns
+ * 0 or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snap_save(struct sr_snap* snap, int sync)
+{
+    struct sr_instance* sr = snap->sr;
+    struct sr_arpcache* cache = &sr->cache;
+    struct sr_snap_hdr* hdr;
+    struct sr_snap_rt rec;
+    struct sr_snap_rt* to;
+    struct sr_rt* rt;
+    unsigned int i, n_arp = 0, n_rt, dirty = 0;
+    double start = sr_snap_now_ms();
+    uint32_t sum;
+
+    /* -- the ARP cache is small: take a copy rather than hold its lock -- */
+    memset(snap->arp, 0, sizeof(snap->arp));
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < SR_ARPCACHE_SZ; i++)
+    {
+        if (!cache->entries[i].valid || !cache->entries[i].iface[0])
+        { continue; }
+        snap->arp[n_arp].ip = cache->entries[i].ip;
+        memcpy(snap->arp[n_arp].mac, cache->entries[i].mac, 6);
+        memcpy(snap->arp[n_arp].iface, cache->entries[i].iface, sr_IFACE_NAMELEN);
+        n_arp++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    /* -- the routing table may be large: copy it straight in, under the
+          read lock so forwarding carries on -- */
+    pthread_rwlock_rdlock(&sr->rt_lock);
+    for (n_rt = 0, rt = sr->routing_table; rt; rt = rt->next)
+    { n_rt++; }
+    if (n_rt > snap->cap &&
+        sr_snap_map(snap, (n_rt + SR_SNAP_RT_CHUNK - 1) / SR_SNAP_RT_CHUNK * SR_SNAP_RT_CHUNK) != 0)
+    {
+        pthread_rwlock_unlock(&sr->rt_lock);
+        snap->save_errors++;
+        SR_LOG(SR_LOG_ERR, "snapshot: no room for %u routes", n_rt);
+        return -1;
+    }
+
+    hdr = sr_snap_hdr(snap);
+    __atomic_store_n(&hdr->seq, hdr->seq | 1, __ATOMIC_RELEASE);
+
+    to = sr_snap_rt(snap);
+    for (i = 0, rt = sr->routing_table; rt; rt = rt->next, i++)
+    {
+        memset(&rec, 0, sizeof(rec));
+        rec.dest = rt->dest.s_addr;
+        rec.mask = rt->mask.s_addr;
+        rec.gw = rt->gw.s_addr;
+        rec.backup_gw = rt->backup_gw.s_addr;
+        snprintf(rec.iface, sizeof(rec.iface), "%s", rt->interface);
+        snprintf(rec.backup_iface, sizeof(rec.backup_iface), "%s", rt->backup_interface);
+        dirty += sr_snap_put(&to[i], &rec, sizeof(rec));
+    }
+    pthread_rwlock_unlock(&sr->rt_lock);
+
+    for (i = 0; i < SR_ARPCACHE_SZ; i++)
+    { dirty += sr_snap_put(&sr_snap_arp(snap)[i], &snap->arp[i], sizeof(snap->arp[i])); }
+
+    sum = sr_snap_sum((const uint8_t*)sr_snap_arp(snap),
+                      n_arp * sizeof(struct sr_snap_arp), 0);
+    sum = sr_snap_sum((const uint8_t*)to, n_rt * sizeof(struct sr_snap_rt), sum);
+
+    hdr->magic = SR_SNAP_MAGIC;
+    hdr->version = SR_SNAP_VERSION;
+    hdr->ifname_len = sr_IFACE_NAMELEN;
+    hdr->n_arp = n_arp;
+    hdr->n_rt = n_rt;
+    hdr->sum = sum;
+    hdr->saved = (uint64_t)time(0);
+    __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
+
+    if (msync(snap->map, snap->size, sync ? MS_SYNC : MS_ASYNC) != 0)
+    {
+        snap->save_errors++;
+        perror("snapshot msync");
+        return -1;
+    }
+
+    snap->saves++;
+    snap->last_saved = (time_t)hdr->saved;
+    snap->last_save_ms = sr_snap_now_ms() - start;
+    snap->changed = dirty;
+    return 0;
+} /* -- sr_snap_save -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_check(..)
+ * Scope: Local
+ *
+ * Is what the file holds a whole snapshot, and recent? Returns 0 if so,
+ * otherwise why not.
+ *
+ *---------------------------------------------------------------------*/
+
+static const char* sr_snap_check(struct sr_snap* snap, size_t file_size)
+{
+    struct sr_snap_hdr* hdr = sr_snap_hdr(snap);
+    uint32_t sum;
+
+    if (file_size < sr_snap_size(0))
+    { return "no snapshot"; }
+    if (hdr->magic != SR_SNAP_MAGIC || hdr->version != SR_SNAP_VERSION ||
+        hdr->ifname_len != sr_IFACE_NAMELEN)
+    { return "not a snapshot this router can read"; }
+    if (hdr->seq & 1)
+    { return "snapshot was being written"; }
+    if (hdr->n_arp > SR_ARPCACHE_SZ || hdr->n_rt > snap->cap)
+    { return "snapshot is cut short"; }
+    sum = sr_snap_sum((const uint8_t*)sr_snap_arp(snap),
+                      hdr->n_arp * sizeof(struct sr_snap_arp), 0);
+    sum = sr_snap_sum((const uint8_t*)sr_snap_rt(snap),
+                      hdr->n_rt * sizeof(struct sr_snap_rt), sum);
+    if (sum != hdr->sum)
+    { return "snapshot checksum is wrong"; }
+    if (difftime(time(0), (time_t)hdr->saved) > SR_SNAP_MAX_AGE_S)
+    { return "snapshot is too old"; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_restore(..)
+ * Scope: Local
+ *
+ * Put back the ARP entries and routes of a good snapshot, tentative,
+ * leaving out anything on an interface this router doesn't have.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_snap_restore(struct sr_snap* snap)
+{
+    struct sr_instance* sr = snap->sr;
+    struct sr_snap_hdr* hdr = sr_snap_hdr(snap);
+    struct sr_snap_arp* a = sr_snap_arp(snap);
+    struct sr_snap_rt* r = sr_snap_rt(snap);
+    struct sr_rt rt;
+    char iface[sr_IFACE_NAMELEN];
+    unsigned int i;
+
+    for (i = 0; i < hdr->n_arp; i++)
+    {
+        memcpy(iface, a[i].iface, sr_IFACE_NAMELEN);
+        iface[sr_IFACE_NAMELEN - 1] = 0;
+        if (sr_get_interface(sr, iface) &&
+            sr_arpcache_restore(&sr->cache, a[i].mac, a[i].ip, iface) == 0)
+        { snap->restored_arp++; }
+    }
+
+    for (i = 0; i < hdr->n_rt; i++)
+    {
+        memset(&rt, 0, sizeof(rt));
+        rt.dest.s_addr = r[i].dest;
+        rt.mask.s_addr = r[i].mask;
+        rt.gw.s_addr = r[i].gw;
+        memcpy(rt.interface, r[i].iface, sr_IFACE_NAMELEN);
+        rt.interface[sr_IFACE_NAMELEN - 1] = 0;
+        if (!sr_get_interface(sr, rt.interface))
+        { continue; }
+        memcpy(rt.backup_interface, r[i].backup_iface, sr_IFACE_NAMELEN);
+        rt.backup_interface[sr_IFACE_NAMELEN - 1] = 0;
+        if (rt.backup_interface[0] && sr_get_interface(sr, rt.backup_interface))
+        { rt.backup_gw.s_addr = r[i].backup_gw; }
+        else
+        { rt.backup_interface[0] = 0; }
+        if (sr_rt_restore(sr, &rt) == 0)
+        { snap->restored_rt++; }
+    }
+
+    snap->hold = snap->restored_rt > 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_writer(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_snap_writer(void* arg)
+{
+    struct sr_snap* snap = (struct sr_snap*)arg;
+    struct timespec ts, hold_end, next;
+
+    clock_gettime(CLOCK_MONOTONIC, &hold_end);
+    hold_end.tv_sec += SR_SNAP_HOLD_S;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    next.tv_sec += SR_SNAP_PERIOD_S;
+
+    pthread_mutex_lock(&snap->lock);
+    while (!snap->stop)
+    {
+        ts = snap->hold && hold_end.tv_sec < next.tv_sec ? hold_end : next;
+        pthread_cond_timedwait(&snap->wake, &snap->lock, &ts);
+        if (snap->stop)
+        { break; }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        if (snap->hold && ts.tv_sec >= hold_end.tv_sec)
+        {
+            snap->hold = 0;
+            snap->expired_rt = sr_rt_expire_tentative(snap->sr);
+            SR_LOG(SR_LOG_INFO, "snapshot: %u of %u restored routes confirmed, the rest withdrawn",
+                   snap->restored_rt - snap->expired_rt, snap->restored_rt);
+        }
+        if (ts.tv_sec >= next.tv_sec)
+        {
+            sr_snap_save(snap, 0);
+            next = ts;
+            next.tv_sec += SR_SNAP_PERIOD_S;
+        }
+    }
+    pthread_mutex_unlock(&snap->lock);
+
+    return 0;
+} /* -- sr_snap_writer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snap_open(struct sr_instance* sr, const char* fname)
+{
+    struct sr_snap* snap;
+    struct stat st;
+    pthread_condattr_t attr;
+    unsigned int cap = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(fname);
+
+    if (!(snap = (struct sr_snap*)calloc(1, sizeof(struct sr_snap))) ||
+        !(snap->fname = strdup(fname)))
+    {
+        fprintf(stderr, "snapshot: out of memory\n");
+        free(snap);
+        return -1;
+    }
+    snap->sr = sr;
+
+    if ((snap->fd = open(fname, O_RDWR | O_CREAT, 0644)) < 0 ||
+        fstat(snap->fd, &st) != 0)
+    {
+        perror(fname);
+        if (snap->fd >= 0)
+        { close(snap->fd); }
+        free(snap->fname);
+        free(snap);
+        return -1;
+    }
+
+    /* -- map what is there, whole routes only -- */
+    if ((size_t)st.st_size > sr_snap_size(0))
+    { cap = (st.st_size - sr_snap_size(0)) / sizeof(struct sr_snap_rt); }
+    if (sr_snap_map(snap, cap) != 0)
+    {
+        perror(fname);
+        close(snap->fd);
+        free(snap->fname);
+        free(snap);
+        return -1;
+    }
+
+    if ((snap->cold_why = sr_snap_check(snap, st.st_size)) == 0)
+    {
+        sr_snap_restore(snap);
+        SR_LOG(SR_LOG_INFO, "snapshot: restored %u ARP entries and %u routes, tentative",
+               snap->restored_arp, snap->restored_rt);
+    }
+    else
+    {
+        SR_LOG(SR_LOG_INFO, "snapshot: starting cold");
+        memset(snap->map, 0, snap->size);
+    }
+
+    pthread_mutex_init(&snap->lock, 0);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&snap->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&snap->thread, 0, sr_snap_writer, snap) != 0)
+    {
+        perror("pthread_create");
+        munmap(snap->map, snap->size);
+        close(snap->fd);
+        free(snap->fname);
+        free(snap);
+        return -1;
+    }
+    sr->snap = snap;
+
+    return 0;
+} /* -- sr_snap_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_close(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_snap_close(struct sr_instance* sr)
+{
+    struct sr_snap* snap = sr->snap;
+
+    if (!snap)
+    { return; }
+
+    sr->snap = 0;
+    pthread_mutex_lock(&snap->lock);
+    snap->stop = 1;
+    pthread_cond_signal(&snap->wake);
+    pthread_mutex_unlock(&snap->lock);
+    pthread_join(snap->thread, 0);
+
+    sr_snap_save(snap, 1);
+
+    munmap(snap->map, snap->size);
+    close(snap->fd);
+    pthread_mutex_destroy(&snap->lock);
+    pthread_cond_destroy(&snap->wake);
+    free(snap->fname);
+    free(snap);
+} /* -- sr_snap_close -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snap_ctl(..)
+ * Scope: Global
+ *
+ * "snapshot" shows what the last start restored and how saving goes;
+ * "snapshot save" saves now.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snap_ctl(void* arg, int argc, char** argv, FILE* out)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_snap* snap = sr->snap;
+    unsigned int i, tentative = 0;
+    int ret = 0;
+
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "save") != 0))
+    { return -1; }
+    if (!snap)
+    {
+        fprintf(out, "snapshots are off\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&snap->lock);
+    if (argc == 2 && (ret = sr_snap_save(snap, 1)) != 0)
+    { fprintf(out, "save failed\n"); }
+
+    fprintf(out, "file %s, room for %u routes\n", snap->fname, snap->cap);
+    if (snap->cold_why)
+    { fprintf(out, "started cold: %s\n", snap->cold_why); }
+    else
+    {
+        fprintf(out, "started warm: %u ARP entries, %u routes restored",
+                snap->restored_arp, snap->restored_rt);
+        if (snap->hold)
+        { fprintf(out, ", routes on hold\n"); }
+        else
+        { fprintf(out, ", %u routes not confirmed\n", snap->expired_rt); }
+    }
+
+    pthread_mutex_lock(&sr->cache.lock);
+    for (i = 0; i < SR_ARPCACHE_SZ; i++)
+    {
+        if (sr->cache.entries[i].valid && sr->cache.entries[i].tentative)
+        { tentative++; }
+    }
+    pthread_mutex_unlock(&sr->cache.lock);
+    fprintf(out, "%u ARP entries still tentative\n", tentative);
+
+    fprintf(out, "%lu saves, %lu failed", snap->saves, snap->save_errors);
+    if (snap->saves)
+    {
+        fprintf(out, "; last %ld s ago, %u ARP entries and %u routes,"
+                " %.1f ms, %lu records changed",
+                (long)difftime(time(0), snap->last_saved),
+                sr_snap_hdr(snap)->n_arp, sr_snap_hdr(snap)->n_rt,
+                snap->last_save_ms, snap->changed);
+    }
+    fprintf(out, "\n");
+    pthread_mutex_unlock(&snap->lock);
+
+    return ret;
+} /* -- sr_snap_ctl -- */
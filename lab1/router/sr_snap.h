@@ -0,0 +1,63 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snap.h
+ *
+ * Description:
+ *
+ * Warm restart. A router that starts cold forwards nothing until it has
+ * ARPed for its next hops and, with link-state routing or zebra, until
+ * its routes have come back; every packet meanwhile waits on ARP or is
+ * dropped for want of a route.
+ *
+ * With a snapshot file (-W), the ARP cache and the routing table are
+ * copied into it every SR_SNAP_PERIOD_S and when the router stops, and
+ * put back when it starts, before the first packet. The file is mapped
+ * into memory and a save only touches the records that changed, so the
+ * pages that go to disk are the ones that differ.
+ *
+ * What comes back is tentative. An ARP entry is used at once, while the
+ * ARP cleanup thread asks for the address again out of the interface it
+ * was learned on, and goes if no reply confirms it (sr_arpcache.h). A route is used at once too, but goes
+ * after SR_SNAP_HOLD_S unless a replace confirms it first, as link-state
+ * routing and zebra do for every route they still want; routes the
+ * rtable has keep its version. A snapshot is a cache of what the router
+ * learned, not configuration.
+ *
+ * A snapshot that is being written has an odd sequence number, and one
+ * whose records don't add up to its checksum, or is older than
+ * SR_SNAP_MAX_AGE_S, is ignored: the router starts cold.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SNAP_H
+#define SR_SNAP_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_snap;
+
+#define SR_SNAP_PERIOD_S   10
+#define SR_SNAP_HOLD_S     30      /* restored routes wait this for a replace */
+#define SR_SNAP_MAX_AGE_S  3600
+#define SR_SNAP_RT_CHUNK   4096    /* the file grows this many routes at a time */
+
+/* Restore what the snapshot in fname holds, if it is good, and keep it up
+   to date from now on. Call after sr_init(), once the rtable is loaded,
+   and before the first packet. Returns 0 on success and sets sr->snap. */
+int  sr_snap_open(struct sr_instance* sr, const char* fname);
+
+/* Save one last time and stop. */
+void sr_snap_close(struct sr_instance* sr);
+
+/* control socket "snapshot" command */
+int  sr_snap_ctl(void* sr, int argc, char** argv, FILE* out);
+
+#endif /* -- SR_SNAP_H -- */
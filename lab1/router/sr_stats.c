@@ -0,0 +1,313 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Per-thread router counters and histograms. See sr_stats.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_protocol.h"
+#include "sr_stats.h"
+
+/* the last slot is shared by every thread past SR_STATS_THREADS */
+static struct sr_stats_slot sr_stats_slots[SR_STATS_THREADS + 1];
+static unsigned int sr_stats_n_slots;
+
+static char sr_stats_names[SR_STATS_IFACES][sr_IFACE_NAMELEN];
+static unsigned int sr_stats_n_ifaces;
+static pthread_mutex_t sr_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread struct sr_stats_slot* sr_stats_mine;
+
+static const char* sr_stats_hist_names[sr_hist_max] = {
+    "sr_service_seconds",
+    "sr_arp_resolve_seconds"};
+
+static const char* sr_stats_hist_help[sr_hist_max] = {
+    "Time to handle one received frame.",
+    "Time from queueing a frame for ARP to the reply."};
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_attach(..)
+ * Scope: Global
+ *
+ * Give the calling thread its slot. Slots are not handed back when a
+ * thread exits; the router's threads live as long as it does.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_stats_slot* sr_stats_attach(void)
+{
+    unsigned int i = __atomic_fetch_add(&sr_stats_n_slots, 1, __ATOMIC_RELAXED);
+
+    if (i >= SR_STATS_THREADS)
+    {
+        i = SR_STATS_THREADS;
+        sr_stats_slots[i].shared = 1;
+    }
+    sr_stats_mine = &sr_stats_slots[i];
+    return sr_stats_mine;
+} /* -- sr_stats_attach -- */
+
+/* number of slots anyone has written to */
+static unsigned int sr_stats_slots_used(void)
+{
+    unsigned int n = __atomic_load_n(&sr_stats_n_slots, __ATOMIC_RELAXED);
+    return n > SR_STATS_THREADS ? SR_STATS_THREADS + 1 : n;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_drop_name(enum sr_drop_reason why)
+ * Scope:  Global
+ *
+ * Short printable name of a drop reason.
+ *
+ *---------------------------------------------------------------------*/
+
+const char* sr_drop_name(enum sr_drop_reason why)
+{
+    static const char* names[sr_drop_max] = {
+        "short_eth",
+        "ethertype",
+        "short_ip",
+        "cksum",
+        "port_unreach",
+        "icmp",
+        "ttl",
+        "no_route",
+        "arp_timeout",
+        "arp",
+        "nat",
+        "broadcast",
+        "queue",
+        "codel",
+        "acl",
+        "flood",
+        "nobuf"};
+
+    if ((int)why < 0 || why >= sr_drop_max)
+    { return "unknown"; }
+    return names[why];
+} /* -- sr_drop_name -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_iface(..)
+ * Scope: Global
+ *
+ * Names are only ever appended, so the scan needs no lock; the count
+ * is published after the name is in place.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_stats_iface(const char* name)
+{
+    unsigned int i, n = __atomic_load_n(&sr_stats_n_ifaces, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n; i++)
+    {
+        if (strncmp(sr_stats_names[i], name, sr_IFACE_NAMELEN) == 0)
+        { return i; }
+    }
+
+    pthread_mutex_lock(&sr_stats_lock);
+    for (n = sr_stats_n_ifaces; i < n; i++)
+    {
+        if (strncmp(sr_stats_names[i], name, sr_IFACE_NAMELEN) == 0)
+        { break; }
+    }
+    if (i == n)
+    {
+        if (n == SR_STATS_IFACES)
+        {
+            pthread_mutex_unlock(&sr_stats_lock);
+            return -1;
+        }
+        strncpy(sr_stats_names[n], name, sr_IFACE_NAMELEN - 1);
+        __atomic_store_n(&sr_stats_n_ifaces, n + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sr_stats_lock);
+
+    return i;
+} /* -- sr_stats_iface -- */
+
+void sr_stats_rx(int i, unsigned int len)
+{
+    if (i >= 0)
+    {
+        SR_STATS_ADD(ifaces[i].rx_packets, 1);
+        SR_STATS_ADD(ifaces[i].rx_bytes, len);
+    }
+}
+
+void sr_stats_tx(int i, unsigned int len)
+{
+    if (i >= 0)
+    {
+        SR_STATS_ADD(ifaces[i].tx_packets, 1);
+        SR_STATS_ADD(ifaces[i].tx_bytes, len);
+    }
+}
+
+void sr_stats_forwarded(int i)
+{
+    if (i >= 0)
+    { SR_STATS_ADD(ifaces[i].forwarded, 1); }
+}
+
+void sr_stats_arp_queued(int i)
+{
+    if (i >= 0)
+    { SR_STATS_ADD(ifaces[i].arp_queued, 1); }
+}
+
+uint64_t sr_stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_hist_add(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_hist_add(enum sr_stats_hist h, uint64_t ns, unsigned long n)
+{
+    unsigned int b = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+
+    if (b >= SR_STATS_BUCKETS)
+    { b = SR_STATS_BUCKETS - 1; }
+
+    SR_STATS_ADD(hists[h].buckets[b], n);
+    SR_STATS_ADD(hists[h].sum_ns, ns * n);
+} /* -- sr_stats_hist_add -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_drops(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_drops(unsigned long drops[sr_drop_max])
+{
+    unsigned int i, s, n = sr_stats_slots_used();
+
+    for (i = 0; i < sr_drop_max; i++)
+    {
+        drops[i] = 0;
+        for (s = 0; s < n; s++)
+        { drops[i] += __atomic_load_n(&sr_stats_slots[s].drops[i], __ATOMIC_RELAXED); }
+    }
+} /* -- sr_stats_drops -- */
+
+/* one interface counter summed over the slots */
+static unsigned long sr_stats_iface_sum(unsigned int i, size_t off)
+{
+    unsigned int s, n = sr_stats_slots_used();
+    unsigned long sum = 0;
+
+    for (s = 0; s < n; s++)
+    {
+        sum += __atomic_load_n((unsigned long*)((char*)&sr_stats_slots[s].ifaces[i] + off),
+                               __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+static void sr_stats_write_iface(FILE* out, const char* name, const char* help,
+                                 size_t off, unsigned int n_ifaces)
+{
+    unsigned int i;
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (i = 0; i < n_ifaces; i++)
+    {
+        fprintf(out, "%s{iface=\"%s\"} %lu\n", name, sr_stats_names[i],
+                sr_stats_iface_sum(i, off));
+    }
+}
+
+static void sr_stats_write_hist(FILE* out, enum sr_stats_hist h)
+{
+    struct sr_stats_histogram sum;
+    unsigned int b, s, n = sr_stats_slots_used();
+    unsigned long cum = 0;
+    const char* name = sr_stats_hist_names[h];
+
+    memset(&sum, 0, sizeof(sum));
+    for (s = 0; s < n; s++)
+    {
+        for (b = 0; b < SR_STATS_BUCKETS; b++)
+        {
+            sum.buckets[b] += __atomic_load_n(&sr_stats_slots[s].hists[h].buckets[b],
+                                              __ATOMIC_RELAXED);
+        }
+        sum.sum_ns += __atomic_load_n(&sr_stats_slots[s].hists[h].sum_ns, __ATOMIC_RELAXED);
+    }
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n",
+            name, sr_stats_hist_help[h], name);
+    /* the last bucket also holds everything too big for it, so it only
+       shows up under +Inf */
+    for (b = 0; b + 1 < SR_STATS_BUCKETS; b++)
+    {
+        cum += sum.buckets[b];
+        fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name,
+                (double)((uint64_t)2 << b) / 1e9, cum);
+    }
+    cum += sum.buckets[b];
+    /* the count is the buckets' total, so it agrees with +Inf even while
+       other threads are adding samples */
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, cum);
+    fprintf(out, "%s_sum %.9f\n", name, (double)sum.sum_ns / 1e9);
+    fprintf(out, "%s_count %lu\n", name, cum);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_write(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_write(FILE* out)
+{
+    unsigned long drops[sr_drop_max];
+    unsigned int i, n_ifaces = __atomic_load_n(&sr_stats_n_ifaces, __ATOMIC_ACQUIRE);
+
+    sr_stats_drops(drops);
+    fprintf(out, "# HELP sr_drops_total Frames dropped, by reason.\n");
+    fprintf(out, "# TYPE sr_drops_total counter\n");
+    for (i = 0; i < sr_drop_max; i++)
+    {
+        fprintf(out, "sr_drops_total{reason=\"%s\"} %lu\n",
+                sr_drop_name((enum sr_drop_reason)i), drops[i]);
+    }
+
+    sr_stats_write_iface(out, "sr_rx_packets_total", "Frames received.",
+                         offsetof(struct sr_stats_iface, rx_packets), n_ifaces);
+    sr_stats_write_iface(out, "sr_rx_bytes_total", "Bytes received.",
+                         offsetof(struct sr_stats_iface, rx_bytes), n_ifaces);
+    sr_stats_write_iface(out, "sr_tx_packets_total", "Frames sent.",
+                         offsetof(struct sr_stats_iface, tx_packets), n_ifaces);
+    sr_stats_write_iface(out, "sr_tx_bytes_total", "Bytes sent.",
+                         offsetof(struct sr_stats_iface, tx_bytes), n_ifaces);
+    sr_stats_write_iface(out, "sr_forwarded_total",
+                         "Transit frames sent out of the interface without waiting for ARP.",
+                         offsetof(struct sr_stats_iface, forwarded), n_ifaces);
+    sr_stats_write_iface(out, "sr_arp_queued_total",
+                         "Transit frames for the interface held for ARP.",
+                         offsetof(struct sr_stats_iface, arp_queued), n_ifaces);
+
+    for (i = 0; i < sr_hist_max; i++)
+    { sr_stats_write_hist(out, (enum sr_stats_hist)i); }
+} /* -- sr_stats_write -- */
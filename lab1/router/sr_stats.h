@@ -0,0 +1,138 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Router counters and latency histograms.
+ *
+ * Each thread that counts something gets a slot of its own, aligned to a
+ * cache line, and updates it with plain adds: no lock, no atomic, and no
+ * line bouncing between cores. Readers add the slots up; a total may be
+ * a packet or two behind but is never torn. Threads beyond
+ * SR_STATS_THREADS share one last slot and update it atomically.
+ *
+ * Histograms are log2 bucketed in nanoseconds: bucket i counts samples
+ * below 2^(i+1) ns that don't fit in bucket i-1.
+ *
+ *   SR_DROP(sr, sr_drop_ttl);
+ *   sr_stats_rx(in_if->stats, len);
+ *   sr_stats_hist_add(sr_hist_service, sr_stats_now_ns() - start, 1);
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_STATS_THREADS 32     /* threads with a slot of their own */
+#define SR_STATS_IFACES  16     /* interfaces counted separately */
+#define SR_STATS_BUCKETS 32     /* histogram buckets, up to ~4 s */
+
+/* ----------------------------------------------------------------------------
+ * enum sr_drop_reason
+ *
+ * Why a received frame was not forwarded or answered.
+ *
+ * -------------------------------------------------------------------------- */
+
+enum sr_drop_reason
+{
+    sr_drop_short_eth = 0,  /* too short for an ethernet header */
+    sr_drop_ethertype,      /* neither IP nor ARP */
+    sr_drop_short_ip,       /* too short for an IP header */
+    sr_drop_cksum,          /* bad IP header checksum */
+    sr_drop_port_unreach,   /* non-ICMP traffic addressed to us */
+    sr_drop_icmp,           /* ICMP to us other than a valid echo request */
+    sr_drop_ttl,            /* TTL expired in transit */
+    sr_drop_no_route,       /* no matching routing table entry */
+    sr_drop_arp_timeout,    /* next hop never answered our ARP requests */
+    sr_drop_arp,            /* short or unknown ARP frame */
+    sr_drop_nat,            /* can't be translated, or unsolicited from outside */
+    sr_drop_broadcast,      /* limited broadcast we have no use for */
+    sr_drop_queue,          /* egress queue full */
+    sr_drop_codel,          /* queued too long, and not ECN capable */
+    sr_drop_acl,            /* denied by the ingress ACL */
+    sr_drop_flood,          /* from or to a flood offender */
+    sr_drop_nobuf,          /* no packet buffer to queue it in */
+    sr_drop_max
+};
+
+enum sr_stats_hist
+{
+    sr_hist_service = 0,    /* sr_handlepacket, per frame */
+    sr_hist_arp,            /* first frame queued to ARP reply */
+    sr_hist_max
+};
+
+struct sr_stats_iface
+{
+    unsigned long rx_packets;
+    unsigned long rx_bytes;
+    unsigned long tx_packets;
+    unsigned long tx_bytes;
+    unsigned long forwarded;    /* transit frames sent without waiting */
+    unsigned long arp_queued;   /* transit frames held for ARP */
+};
+
+struct sr_stats_histogram
+{
+    unsigned long buckets[SR_STATS_BUCKETS];
+    unsigned long sum_ns;
+};
+
+struct sr_stats_slot
+{
+    unsigned long drops[sr_drop_max];
+    struct sr_stats_iface ifaces[SR_STATS_IFACES];
+    struct sr_stats_histogram hists[sr_hist_max];
+    int shared;                 /* more than one thread writes it */
+} __attribute__ ((aligned (64)));
+
+extern __thread struct sr_stats_slot* sr_stats_mine;
+struct sr_stats_slot* sr_stats_attach(void);
+
+#define SR_STATS_SLOT() (sr_stats_mine ? sr_stats_mine : sr_stats_attach())
+
+#define SR_STATS_ADD(field, n) \
+    do { \
+        struct sr_stats_slot* s_ = SR_STATS_SLOT(); \
+        if (s_->shared) \
+        { __atomic_fetch_add(&s_->field, (n), __ATOMIC_RELAXED); } \
+        else \
+        { s_->field += (n); } \
+    } while (0)
+
+const char* sr_drop_name(enum sr_drop_reason);
+
+/* The counter index of an interface, registering the name the first
+   time it is seen. -1 once SR_STATS_IFACES names are taken. Looked up
+   once, when the interface is added, and kept in struct sr_if. */
+int sr_stats_iface(const char* name);
+
+/* Per-interface counts, by counter index; a negative index is ignored. */
+void sr_stats_rx(int iface, unsigned int len);
+void sr_stats_tx(int iface, unsigned int len);
+void sr_stats_forwarded(int iface);
+void sr_stats_arp_queued(int iface);
+
+uint64_t sr_stats_now_ns(void);
+
+/* Add n samples of ns nanoseconds each. */
+void sr_stats_hist_add(enum sr_stats_hist h, uint64_t ns, unsigned long n);
+
+/* Totals over all threads. */
+void sr_stats_drops(unsigned long drops[sr_drop_max]);
+
+/* Everything, in the Prometheus text exposition format. */
+void sr_stats_write(FILE* out);
+
+#endif /* -- SR_STATS_H -- */
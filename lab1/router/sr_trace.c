@@ -0,0 +1,184 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace.c
+ *
+ * Description:
+ *
+ * Per-thread stage trace rings and the dump. See sr_trace.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sr_trace.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_stage_name(enum sr_trace_stage s)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+const char* sr_trace_stage_name(enum sr_trace_stage s)
+{
+    static const char* names[sr_trace_max] = {
+        "read",
+        "parse",
+        "cksum",
+        "fib",
+        "nat",
+        "arp",
+        "rewrite",
+        "send"};
+
+    if ((int)s < 0 || s >= sr_trace_max)
+    { return "unknown"; }
+    return names[s];
+} /* -- sr_trace_stage_name -- */
+
+#ifdef SR_TRACE
+
+static struct sr_trace_ring* sr_trace_rings[SR_TRACE_THREADS];
+static unsigned int sr_trace_n_rings;
+static pthread_mutex_t sr_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the clock at the first attach, to work out the tick rate at dump time */
+static uint64_t sr_trace_base_ticks;
+static uint64_t sr_trace_base_ns;
+
+__thread struct sr_trace_ring* sr_trace_mine;
+
+static uint64_t sr_trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_attach(..)
+ * Scope: Global
+ *
+ * Give the calling thread a ring. A thread past SR_TRACE_THREADS goes
+ * untraced. Rings are never freed.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_trace_ring* sr_trace_attach(void)
+{
+    struct sr_trace_ring* r = 0;
+
+    pthread_mutex_lock(&sr_trace_lock);
+    if (sr_trace_n_rings < SR_TRACE_THREADS &&
+        (r = (struct sr_trace_ring*)calloc(1, sizeof(struct sr_trace_ring))))
+    {
+        if (sr_trace_n_rings == 0)
+        {
+            sr_trace_base_ns = sr_trace_now_ns();
+            sr_trace_base_ticks = sr_trace_ticks();
+        }
+        r->thread = sr_trace_n_rings;
+        sr_trace_rings[sr_trace_n_rings] = r;
+        __atomic_store_n(&sr_trace_n_rings, sr_trace_n_rings + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sr_trace_lock);
+
+    sr_trace_mine = r;
+    return r;
+} /* -- sr_trace_attach -- */
+
+/* ticks per second, measured against CLOCK_MONOTONIC since the first
+   attach */
+static uint64_t sr_trace_rate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns, ticks;
+
+    if (__atomic_load_n(&sr_trace_n_rings, __ATOMIC_ACQUIRE) == 0)
+    { return 0; }
+    if (sr_trace_now_ns() - sr_trace_base_ns < 10000000)
+    { usleep(10000); }
+    ns = sr_trace_now_ns() - sr_trace_base_ns;
+    ticks = sr_trace_ticks() - sr_trace_base_ticks;
+    return (uint64_t)((double)ticks * 1e9 / ns);
+#else
+    return 1000000000;
+#endif
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_trace_dump(..)
+ * Scope: Global
+ *
+ * The rings are copied while their threads keep recording. A record the
+ * writer may have started overwriting during the copy is left out.
+ *
+ *---------------------------------------------------------------------*/
+
+long sr_trace_dump(const char* path)
+{
+    struct sr_trace_file_hdr hdr;
+    struct sr_trace_rec* buf;
+    unsigned int i, n = __atomic_load_n(&sr_trace_n_rings, __ATOMIC_ACQUIRE);
+    uint64_t head, first, lo, idx, count = 0;
+    FILE* f;
+
+    buf = (struct sr_trace_rec*)malloc(SR_TRACE_RECS * sizeof(struct sr_trace_rec));
+    if (!buf)
+    { return -1; }
+    if (!(f = fopen(path, "wb")))
+    {
+        perror(path);
+        free(buf);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.stages = sr_trace_max;
+    hdr.rec_size = sizeof(struct sr_trace_rec);
+    hdr.ticks_per_sec = sr_trace_rate();
+    /* the count is filled in at the end */
+    fwrite(&hdr, sizeof(hdr), 1, f);
+
+    for (i = 0; i < n; i++)
+    {
+        struct sr_trace_ring* r = sr_trace_rings[i];
+
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        first = head > SR_TRACE_RECS ? head - SR_TRACE_RECS : 0;
+        for (idx = first; idx < head; idx++)
+        { buf[idx - first] = r->recs[idx & (SR_TRACE_RECS - 1)]; }
+
+        /* meanwhile the writer may have gone on into the slots of every
+           record up to and including the new head - SR_TRACE_RECS */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        lo = __atomic_load_n(&r->head, __ATOMIC_RELAXED) + 1;
+        lo = lo > SR_TRACE_RECS ? lo - SR_TRACE_RECS : 0;
+        if (lo < first)
+        { lo = first; }
+        if (lo < head)
+        {
+            fwrite(buf + (lo - first), sizeof(struct sr_trace_rec), head - lo, f);
+            count += head - lo;
+        }
+    }
+
+    hdr.count = count;
+    rewind(f);
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    free(buf);
+    if (fclose(f) != 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    return (long)count;
+} /* -- sr_trace_dump -- */
+
+#endif /* SR_TRACE */
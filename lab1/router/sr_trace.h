@@ -0,0 +1,193 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace.h
+ *
+ * Description:
+ *
+ * Per-packet stage tracing. Built with SR_TRACE defined (make
+ * OPT=-DSR_TRACE) every frame the router handles leaves a record of the
+ * moments it got through each stage of the packet path; without it the
+ * macros below compile to nothing.
+ *
+ *   SR_TRACE_OPEN(len);                 start a record unless one is open
+ *   SR_TRACE_STAMP(sr_trace_fib);       the frame got through a stage
+ *   SR_TRACE_CLOSE();                   publish the record
+ *
+ * The VNS client opens the record as soon as a message starts arriving
+ * and cancels it (SR_TRACE_CANCEL) if the message is not a frame for
+ * sr_handlepacket, which then carries on with the open record.
+ *
+ * Records go into a ring of SR_TRACE_RECS per thread, so recording takes
+ * no lock; the oldest records are overwritten. Stamps are TSC ticks where
+ * the CPU has one and nanoseconds elsewhere, and are kept relative to the
+ * start of the record. A burst (sr_handlepacket_burst) makes one record
+ * for the whole vector, stamped with SR_TRACE_STAMP_BURST at the end of
+ * each of its stages; per-frame stamps inside it are ignored.
+ *
+ * sr_trace_dump() writes what the rings hold in the binary format below;
+ * sr_trace_summary turns a dump into per-stage percentiles. The format is
+ * host byte order, for reading on the machine that wrote it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TRACE_H
+#define SR_TRACE_H
+
+#include <time.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#ifndef SR_TRACE_RECS
+#define SR_TRACE_RECS (1 << 16)  /* records kept per thread, power of 2 */
+#endif
+#define SR_TRACE_THREADS 64      /* threads that can record */
+
+#define SR_TRACE_MAGIC   "SRTRACE1"
+
+/* Stages in the order a forwarded frame goes through them. A frame stamps
+   the stages it reaches; a stage's time runs from the previous stamp (or
+   the start of the record) to its own. */
+enum sr_trace_stage
+{
+    sr_trace_read = 0,      /* VNS message body read and checked */
+    sr_trace_parse,         /* ethernet header classified */
+    sr_trace_cksum,         /* IP header validated */
+    sr_trace_fib,           /* route looked up */
+    sr_trace_nat,           /* translated on the way through the NAT */
+    sr_trace_arp,           /* next hop looked up in the ARP cache */
+    sr_trace_rewrite,       /* ethernet header rewritten */
+    sr_trace_send,          /* handed to the transmit path */
+    sr_trace_max
+};
+
+struct sr_trace_rec
+{
+    uint64_t start;                 /* ticks */
+    uint32_t at[sr_trace_max];      /* ticks after start */
+    uint16_t mask;                  /* stages stamped */
+    uint16_t frames;                /* 1, or the length of a burst */
+    uint16_t len;                   /* frame length, 0 for a burst */
+    uint16_t thread;
+};
+
+/* a dump is this header followed by count records */
+struct sr_trace_file_hdr
+{
+    char     magic[8];
+    uint32_t stages;                /* sr_trace_max */
+    uint32_t rec_size;              /* sizeof(struct sr_trace_rec) */
+    uint64_t ticks_per_sec;
+    uint64_t count;
+};
+
+const char* sr_trace_stage_name(enum sr_trace_stage);
+
+#ifdef SR_TRACE
+
+struct sr_trace_ring
+{
+    uint64_t head;                  /* records ever written */
+    int open;                       /* recs[head] is being filled in */
+    int burst;                      /* ... for a whole burst */
+    uint16_t thread;
+    struct sr_trace_rec recs[SR_TRACE_RECS];
+};
+
+extern __thread struct sr_trace_ring* sr_trace_mine;
+struct sr_trace_ring* sr_trace_attach(void);
+
+static __inline__ uint64_t sr_trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static __inline__ void sr_trace_open(uint64_t start, uint16_t frames, uint16_t len,
+                                     int burst)
+{
+    struct sr_trace_ring* r = sr_trace_mine ? sr_trace_mine : sr_trace_attach();
+    struct sr_trace_rec* rec;
+
+    if (!r)
+    { return; }
+    if (r->open)
+    {
+        /* sr_handlepacket() filling in a record the VNS client opened */
+        if (len && !r->burst)
+        { r->recs[r->head & (SR_TRACE_RECS - 1)].len = len; }
+        return;
+    }
+    rec = &r->recs[r->head & (SR_TRACE_RECS - 1)];
+    rec->start = start;
+    rec->mask = 0;
+    rec->frames = frames;
+    rec->len = len;
+    rec->thread = r->thread;
+    r->open = 1;
+    r->burst = burst;
+}
+
+static __inline__ void sr_trace_stamp(enum sr_trace_stage s, int burst)
+{
+    struct sr_trace_ring* r = sr_trace_mine;
+    struct sr_trace_rec* rec;
+
+    if (!r || !r->open || r->burst != burst)
+    { return; }
+    rec = &r->recs[r->head & (SR_TRACE_RECS - 1)];
+    rec->at[s] = (uint32_t)(sr_trace_ticks() - rec->start);
+    rec->mask |= 1 << s;
+}
+
+static __inline__ void sr_trace_close(void)
+{
+    struct sr_trace_ring* r = sr_trace_mine;
+
+    if (!r || !r->open)
+    { return; }
+    r->open = 0;
+    /* the dumper reads records below head */
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+static __inline__ void sr_trace_cancel(void)
+{
+    if (sr_trace_mine)
+    { sr_trace_mine->open = 0; }
+}
+
+/* Write every record the rings hold to path. Returns the number written
+   or -1. */
+long sr_trace_dump(const char* path);
+
+#define SR_TRACE_OPEN(len)               sr_trace_open(sr_trace_ticks(), 1, (len), 0)
+#define SR_TRACE_OPEN_BURST(n)           sr_trace_open(sr_trace_ticks(), (n), 0, 1)
+#define SR_TRACE_STAMP(s)                sr_trace_stamp((s), 0)
+#define SR_TRACE_STAMP_BURST(s)          sr_trace_stamp((s), 1)
+#define SR_TRACE_CLOSE()                 sr_trace_close()
+#define SR_TRACE_CANCEL()                sr_trace_cancel()
+
+#else /* SR_TRACE */
+
+#define SR_TRACE_OPEN(len)               do {} while (0)
+#define SR_TRACE_OPEN_BURST(n)           do {} while (0)
+#define SR_TRACE_STAMP(s)                do {} while (0)
+#define SR_TRACE_STAMP_BURST(s)          do {} while (0)
+#define SR_TRACE_CLOSE()                 do {} while (0)
+#define SR_TRACE_CANCEL()                do {} while (0)
+
+#endif /* SR_TRACE */
+
+#endif /* -- SR_TRACE_H -- */
@@ -0,0 +1,190 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_trace_summary.c
+ *
+ * Description:
+ *
+ * Offline summary of a stage trace written by sr_trace_dump() (the router's
+ * "trace" control command or sr_loadgen -T). For each stage of the packet
+ * path prints how many records reached it and percentiles of the time they
+ * spent in it, then the same for the whole trip. Frames handled one at a
+ * time and bursts are summarized apart; a burst's times are divided by
+ * its length, so they read as each frame's share.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sr_trace.h"
+
+static void usage(char* );
+static int cmp_u32(const void* , const void* );
+static void sr_trace_summary(FILE* , const char* , struct sr_trace_rec* ,
+                             uint64_t , int , double );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    struct sr_trace_file_hdr hdr;
+    struct sr_trace_rec* recs;
+    uint64_t i, bursts = 0;
+    double ns_per_tick;
+    FILE* f;
+
+    if (argc != 2 || argv[1][0] == '-')
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (!(f = fopen(argv[1], "rb")))
+    {
+        perror(argv[1]);
+        exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, SR_TRACE_MAGIC, sizeof(hdr.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+        exit(1);
+    }
+    if (hdr.stages != sr_trace_max || hdr.rec_size != sizeof(struct sr_trace_rec))
+    {
+        fprintf(stderr, "%s: written by a router with a different trace layout\n",
+                argv[1]);
+        exit(1);
+    }
+    if (hdr.ticks_per_sec == 0 || hdr.count == 0)
+    {
+        printf("%s: no records\n", argv[1]);
+        return 0;
+    }
+
+    recs = (struct sr_trace_rec*)malloc(hdr.count * sizeof(struct sr_trace_rec));
+    if (!recs)
+    {
+        fprintf(stderr, "out of memory for %lu records\n", (unsigned long)hdr.count);
+        exit(1);
+    }
+    if (fread(recs, sizeof(struct sr_trace_rec), hdr.count, f) != hdr.count)
+    {
+        fprintf(stderr, "%s: truncated\n", argv[1]);
+        exit(1);
+    }
+    fclose(f);
+
+    for (i = 0; i < hdr.count; i++)
+    {
+        if (recs[i].frames > 1)
+        { bursts++; }
+    }
+    ns_per_tick = 1e9 / hdr.ticks_per_sec;
+
+    printf("%lu records, %lu of them bursts, %.3f GHz clock\n",
+           (unsigned long)hdr.count, (unsigned long)bursts, hdr.ticks_per_sec / 1e9);
+    if (bursts < hdr.count)
+    { sr_trace_summary(stdout, "single frames", recs, hdr.count, 0, ns_per_tick); }
+    if (bursts)
+    { sr_trace_summary(stdout, "bursts, per frame", recs, hdr.count, 1, ns_per_tick); }
+
+    free(recs);
+    return 0;
+}/* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_trace_summary(..)
+ * Scope: local
+ *
+ * Percentiles over the records that are (burst) or are not bursts.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_trace_summary(FILE* out, const char* title,
+                             struct sr_trace_rec* recs, uint64_t count,
+                             int burst, double ns_per_tick)
+{
+    uint32_t* ns[sr_trace_max + 1];
+    uint64_t n[sr_trace_max + 1];
+    uint64_t i;
+    int s;
+
+    for (s = 0; s <= sr_trace_max; s++)
+    {
+        ns[s] = (uint32_t*)malloc(count * sizeof(uint32_t));
+        if (!ns[s])
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        n[s] = 0;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        struct sr_trace_rec* r = &recs[i];
+        uint32_t prev = 0;
+        double share;
+
+        if ((r->frames > 1) != burst || r->mask == 0)
+        { continue; }
+        share = ns_per_tick / (r->frames ? r->frames : 1);
+
+        for (s = 0; s < sr_trace_max; s++)
+        {
+            if (!(r->mask & (1 << s)))
+            { continue; }
+            ns[s][n[s]++] = (uint32_t)((r->at[s] - prev) * share + 0.5);
+            prev = r->at[s];
+        }
+        /* the trip ends at the last stage reached */
+        ns[sr_trace_max][n[sr_trace_max]++] = (uint32_t)(prev * share + 0.5);
+    }
+
+    fprintf(out, "\n%s (ns):\n", title);
+    fprintf(out, "  %-8s %10s %8s %8s %8s %8s %10s\n",
+            "stage", "records", "p50", "p90", "p99", "p99.9", "max");
+    for (s = 0; s <= sr_trace_max; s++)
+    {
+        const char* name = s == sr_trace_max ? "total" :
+                           sr_trace_stage_name((enum sr_trace_stage)s);
+        uint64_t c = n[s];
+
+        if (c == 0)
+        {
+            fprintf(out, "  %-8s %10s\n", name, "-");
+            free(ns[s]);
+            continue;
+        }
+        qsort(ns[s], c, sizeof(uint32_t), cmp_u32);
+        fprintf(out, "  %-8s %10lu %8u %8u %8u %8u %10u\n", name,
+                (unsigned long)c,
+                ns[s][c / 2],
+                ns[s][(uint64_t)(c * 0.90)],
+                ns[s][(uint64_t)(c * 0.99)],
+                ns[s][(uint64_t)(c * 0.999)],
+                ns[s][c - 1]);
+        free(ns[s]);
+    }
+} /* -- sr_trace_summary -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Simple Router stage trace summary\n");
+    printf("Format: %s <trace dump>\n", argv0);
+    printf("   dumps come from the router's trace control command or\n");
+    printf("   sr_loadgen -T, in a build made with OPT=-DSR_TRACE\n");
+} /* -- usage -- */
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
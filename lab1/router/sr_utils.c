@@ -19,6 +19,23 @@ uint16_t cksum (const void *_data, int len) {
   return sum ? sum : 0xffff;
 }
 
+/* HC' = ~(~HC + ~m + m'). One's complement sums come out the same in
+   either byte order, so everything can stay in network order. Like
+   cksum() we never return 0: 0xffff is the same value. */
+uint16_t cksum_update16(uint16_t sum, uint16_t from, uint16_t to) {
+  uint32_t s = (uint16_t)~sum + (uint16_t)~from + to;
+
+  s = (s >> 16) + (s & 0xffff);
+  s += s >> 16;
+  s = (uint16_t)~s;
+  return s ? s : 0xffff;
+}
+
+uint16_t cksum_update32(uint16_t sum, uint32_t from, uint32_t to) {
+  sum = cksum_update16(sum, from >> 16, to >> 16);
+  return cksum_update16(sum, from & 0xffff, to & 0xffff);
+}
+
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
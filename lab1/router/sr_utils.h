@@ -30,6 +30,11 @@
 
 uint16_t cksum(const void *_data, int len);
 
+/* Patch a checksum after a 16 or 32 bit field changed from one value to
+   another (RFC 1624). All values in network byte order. */
+uint16_t cksum_update16(uint16_t sum, uint16_t from, uint16_t to);
+uint16_t cksum_update32(uint16_t sum, uint32_t from, uint32_t to);
+
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
 
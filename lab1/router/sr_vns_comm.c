@@ -35,16 +35,21 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
+#include "sr_pbuf.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_trace.h"
+#include "sr_qos.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
+static void sr_log_packet(struct sr_instance* , uint8_t* , int ,
+                          const char* );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
@@ -201,6 +206,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWSPEED:
                 /* Debug("Speed: %d\n",
                         ntohl(*((unsigned int*)hwinfo->mHWInfo[i].value))); */
+                sr_set_ether_speed(sr,
+                        ntohl(*((unsigned int*)hwinfo->mHWInfo[i].value)));
                 break;
             case HWSUBNET:
                 /* Debug("Subnet: %s\n",inet_ntoa(
@@ -367,6 +374,12 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }
 
+    /* the time spent reading and checking the message body counts as
+       the frame's read stage; an earlier message that bailed out part
+       way may have left its record open */
+    SR_TRACE_CANCEL();
+    SR_TRACE_OPEN(0);
+
     len = ntohl(len);
 
     if ( len > 10000 || len < 0 )
@@ -436,7 +449,10 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
             /* -- log packet -- */
             sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header),
+                    (char*)(buf + sizeof(c_base)));
+
+            SR_TRACE_STAMP(sr_trace_read);
 
             /* -- pass to router, student's code should take over here -- */
             sr_handlepacket(sr,
@@ -501,6 +517,9 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
+    /* anything but a frame sr_handlepacket() took leaves no record */
+    SR_TRACE_CANCEL();
+
     if(buf)
     { free(buf); }
     return ret;
@@ -511,10 +530,11 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
  * Scope: Local
  *
  * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Returns the interface, or 0 if they aren't.
  *
  *----------------------------------------------------------------------------*/
 
-static int
+static struct sr_if*
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
                                 const char* name /* borrowed */ )
@@ -546,7 +566,7 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
      * Note: This check should really be done server side ...
      */
 
-    return 1;
+    return iface;
 
 } /* -- sr_ether_addrs_match_interface -- */
 
@@ -564,7 +584,9 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
+    c_packet_header sr_pkt;
+    struct sr_if* ifp;
+    struct iovec iov[2];
     unsigned int total_len =  len + (sizeof(c_packet_header));
 
     /* REQUIRES */
@@ -578,61 +600,144 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    /* -- a shaped interface queues its own copy -- */
+    if ( sr->qos && sr_qos_shaped(sr->qos, iface) ){
+        struct sr_pbuf* pbuf = sr_pbuf_alloc(len);
+        if ( ! pbuf ){
+            SR_DROP(sr, sr_drop_nobuf);
+            return -1;
+        }
+        memcpy(pbuf->data, buf, len);
+        return sr_qos_enqueue(sr->qos, pbuf, iface);
+    }
+
+    /* Create header; the frame goes out straight from the caller's buffer */
+    memset(&sr_pkt, 0, sizeof(sr_pkt));
+    sr_pkt.mLen  = htonl(total_len);
+    sr_pkt.mType = htonl(VNSPACKET);
+    strncpy(sr_pkt.mInterfaceName,iface,16);
+
+    iov[0].iov_base = &sr_pkt;
+    iov[0].iov_len  = sizeof(c_packet_header);
+    iov[1].iov_base = buf;
+    iov[1].iov_len  = len;
 
     /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    sr_log_packet(sr,buf,len,iface);
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
+    if ( ! (ifp = sr_ether_addrs_match_interface( sr, buf, iface)) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
+    if( writev(sr->sockfd, iov, 2) < total_len ){
         fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
         return -1;
     }
-
-    free(sr_pkt);
+    sr_stats_tx(ifp->stats, len);
 
     return 0;
 } /* -- sr_send_packet -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
- * Scope: Local
+ * Method: sr_send_pbuf(..)
+ * Scope: Global
+ *
+ * As sr_send_packet(..) for a frame in a pool buffer. The VNS header is
+ * written into the buffer's headroom so the frame is never copied. Takes
+ * ownership of the buffer: it is back in the pool when this returns,
+ * or, for a shaped interface, once sr_qos has sent it.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_pbuf(struct sr_instance* sr /* borrowed */,
+                 struct sr_pbuf* pbuf /* given */,
+                 const char* iface /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(pbuf);
+    assert(iface);
+
+    if ( sr->qos && sr_qos_shaped(sr->qos, iface) ){
+        return sr_qos_enqueue(sr->qos, pbuf, iface);
+    }
+    return sr_send_pbuf_now(sr, pbuf, iface);
+} /* -- sr_send_pbuf -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_pbuf_now(..)
+ * Scope: Global
+ *
+ * As sr_send_pbuf(..), bypassing any egress queue; what sr_qos sends
+ * with.
  *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+int sr_send_pbuf_now(struct sr_instance* sr /* borrowed */,
+                     struct sr_pbuf* pbuf /* given */,
+                     const char* iface /* borrowed */)
 {
-    struct pcap_pkthdr h;
-    int size;
+    c_packet_header *sr_pkt;
+    struct sr_if* ifp;
+    unsigned int total_len;
+    int ret = 0;
 
     /* REQUIRES */
     assert(sr);
+    assert(pbuf);
+    assert(iface);
+    assert(SR_PBUF_HEADROOM >= sizeof(c_packet_header));
 
-    if(!sr->logfile)
-    {return; }
+    if ( pbuf->len < sizeof(struct sr_ethernet_hdr) ){
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        sr_pbuf_free(pbuf);
+        return -1;
+    }
+
+    total_len = pbuf->len + sizeof(c_packet_header);
+    sr_pkt = (c_packet_header *)(pbuf->data - sizeof(c_packet_header));
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    memset(sr_pkt->mInterfaceName, 0, sizeof(sr_pkt->mInterfaceName));
+    strncpy(sr_pkt->mInterfaceName,iface,16);
 
-    size = min(PACKET_DUMP_SIZE, len);
+    /* -- log packet -- */
+    sr_log_packet(sr,pbuf->data,pbuf->len,iface);
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    if ( ! (ifp = sr_ether_addrs_match_interface( sr, pbuf->data, iface)) ){
+        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+        ret = -1;
+    }
+    else if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
+        fprintf(stderr, "Error writing packet\n");
+        ret = -1;
+    }
+    else
+    { sr_stats_tx(ifp->stats, pbuf->len); }
+
+    sr_pbuf_free(pbuf);
+
+    return ret;
+} /* -- sr_send_pbuf_now -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   const char* iface )
+{
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->capture)
+    {return; }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- snapshot only, the capture thread does the writing -- */
+    sr_capture_packet(sr->capture, buf, len, iface);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------